@@ -7,6 +7,7 @@
 #include "request-handle.h"
 
 class Change;
+class RemoteStorage;
 
 class BaseStorage {
 public:
@@ -18,6 +19,10 @@ public:
     virtual void setupDeleteHandle(const std::unique_ptr<RequestHandle>& handle, const std::unique_ptr<FileDeletedDTO>& dto) const = 0;
     virtual void setupMoveHandle(const std::unique_ptr<RequestHandle>& handle, const std::unique_ptr<FileMovedDTO>& dto) const = 0;
 
+    // Heavy per-file work done before procces*() without holding the database lock.
+    virtual void prepareUpload(std::unique_ptr<FileRecordDTO>&) const {}
+    virtual void prepareUpdate(std::unique_ptr<FileUpdatedDTO>&) const {}
+
     virtual void proccesUpload(std::unique_ptr<FileRecordDTO>& dto, const std::string& response) const = 0;
     virtual void proccesUpdate(std::unique_ptr<FileUpdatedDTO>& dto, const std::string& response) const = 0;
     virtual void proccesDownload(std::unique_ptr<FileUpdatedDTO>& dto, const std::string& response) const = 0;
@@ -30,6 +35,9 @@ public:
     virtual std::string getRefreshToken(const std::string& code, const int local_port) = 0;
     virtual void refreshAccessToken() = 0;
     virtual void proccessAuth(const std::string& responce) = 0;
+    virtual std::string authorizationHeader() const { return ""; }
+    virtual std::time_t accessTokenExpires() const { return 0; }
+    virtual std::uint64_t tokenGeneration() const { return 0; }
 
     virtual std::string getDeltaToken() = 0;
 
@@ -44,9 +52,15 @@ public:
 
     virtual bool hasChanges() const = 0;
 
+    // True when getChanges() stopped early to bound the pending batches and should be called again.
+    virtual bool hasMoreChanges() const { return false; }
+
     virtual void setOnChange(std::function<void()> cb) = 0;
 
     virtual std::vector<std::shared_ptr<Change>> proccessChanges() = 0;
 
     virtual void ensureRootExists() = 0;
+
+    // Batching, upload sessions and ranged downloads; null for storages that are not a cloud provider.
+    virtual const RemoteStorage* remote() const { return nullptr; }
 };
\ No newline at end of file
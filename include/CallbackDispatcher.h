@@ -3,7 +3,11 @@
 #include "BaseStorage.h"
 #include "active-count.h"
 #include "thread-safe-queue.h"
+#include <chrono>
+#include <functional>
+#include <future>
 #include <thread>
+#include <vector>
 
 class ICommand;
 
@@ -12,20 +16,40 @@ public:
     static CallbackDispatcher& get();
     void submit(std::unique_ptr<ICommand> command);
     void setDB(const std::string& db_file_name);
+    // Shares db's connection and index. While the dispatcher runs, writes through db outside a
+    // callback race its open batch, so they must go through submitDbWrite() instead.
     void setDB(const std::shared_ptr<Database>& db);
     void setClouds(const std::unordered_map<int, std::shared_ptr<BaseStorage>>& clouds);
 
     bool isIdle() const noexcept;
     void waitUntilIdle() const;
 
+    void setWorkerCount(std::size_t count);
+    std::size_t workerCount() const noexcept;
+
+    // Group commit: callbacks waiting for the database share one transaction of at most
+    // max_batch_size callbacks, kept open no longer than max_latency. A callback's writes are
+    // durable only once its batch commits and a crash before that drops the whole batch, while
+    // the work it handed on (chained commands, dependent changes) may already be running.
+    // A callback that throws has its writes undone from the batch and its command abandoned.
+    // A batch size of 1 (the default) commits every write on its own.
+    void setGroupCommit(std::size_t max_batch_size, std::chrono::milliseconds max_latency);
+
+    // Ordered write: runs after the callbacks already submitted under key (see ICommand::entryKey)
+    // and resolves once committed, without waiting for the rest of the pipeline. Runs in place when
+    // the dispatcher is stopped or when called from a callback, which already holds the database lock.
+    std::future<void> submitDbWrite(const std::string& key, std::function<void(const std::unique_ptr<Database>&)> write);
+
+    // Blocking forms of submitDbWrite(), ordered on the (first) DTO's entry.
     void syncDbWrite(const std::unique_ptr<FileRecordDTO>& dto);
     void syncDbWrite(const std::unique_ptr<FileUpdatedDTO>& dto);
-    void syncDbWrite(const std::vector<std::unique_ptr<FileRecordDTO>>& vec_dto);
+    void syncDbWrite(const std::vector<std::unique_ptr<FileRecordDTO>>& vec_dto, const bool defer_indexes = false);
 
     void finish();
     void start();
 private:
     friend class HttpClient;
+    friend class DbWriteCommand;
 
     CallbackDispatcher();
     ~CallbackDispatcher() = default;
@@ -37,13 +61,19 @@ private:
     CallbackDispatcher(CallbackDispatcher&&) noexcept = delete;
     CallbackDispatcher& operator=(CallbackDispatcher&&) noexcept = delete;
 
-    void worker();
+    void worker(std::size_t shard);
+    void createQueues(std::size_t count);
+    std::size_t shardOf(const ICommand& command) const;
+    void commitBatchIfDue();
+    void abortBatch();
+    void resolveAfterCommit(std::promise<void> done);
 
     std::unordered_map<int, std::shared_ptr<BaseStorage>> _clouds;
 
-    ThreadSafeQueue<std::unique_ptr<ICommand>> _queue;
+    // One queue per worker, callbacks for the same target always land on the same one.
+    std::vector<std::unique_ptr<ThreadSafeQueue<std::unique_ptr<ICommand>>>> _queues;
 
-    std::unique_ptr<std::thread> _worker;
+    std::vector<std::thread> _workers;
 
     std::unique_ptr<Database> _db;
 
@@ -53,4 +83,12 @@ private:
     ActiveCount _active_count;
 
     std::mutex _db_mutex;
+
+    std::size_t _max_batch_size{ 1 };
+    std::chrono::milliseconds _max_batch_latency{ 0 };
+    std::size_t _batch_callbacks{ 0 };
+    std::chrono::steady_clock::time_point _batch_opened;
+    // Results of queued writes in the open batch, resolved when it commits or rolls back.
+    std::vector<std::promise<void>> _batch_writes;
+    std::atomic<std::size_t> _db_waiters{ 0 };
 };
\ No newline at end of file
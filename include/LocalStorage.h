@@ -5,6 +5,7 @@
 #include "wtr/watcher.hpp" 
 #include <unordered_set>
 #include <atomic>
+#include <future>
 
 #define XXH_INLINE_ALL
 #include <xxhash.h>
@@ -35,6 +36,9 @@ public:
 
     CloudProviderType getType() const override { return CloudProviderType::LocalStorage; }
 
+    void prepareUpload(std::unique_ptr<FileRecordDTO>& dto) const override;
+    void prepareUpdate(std::unique_ptr<FileUpdatedDTO>& dto) const override;
+
     void proccesUpload(std::unique_ptr<FileRecordDTO>& dto, const std::string& response = "") const override;
 
     void proccesUpdate(std::unique_ptr<FileUpdatedDTO>& dto, const std::string& response = "") const override;
@@ -95,6 +99,7 @@ private:
     FRIEND_TEST(LocalStorageUnitTest, HandleMovedIgnoredTmpThenUpdate);
     FRIEND_TEST(LocalStorageUnitTest, HandleMovedUnknownFileIdCreatesNew);
     FRIEND_TEST(LocalStorageUnitTest, HandleMovedTrueMoved);
+    FRIEND_TEST(LocalStorageUnitTest, HandleMovedWaitsForPendingUpdate);
 
     FRIEND_TEST(LocalStorageIntegrationTest, DetectModifyFile);
     FRIEND_TEST(LocalStorageIntegrationTest, DetectMoveFile);
@@ -121,6 +126,9 @@ private:
 
     bool thatFileTmpExists(const std::filesystem::path& path) const;
 
+    void awaitPendingWrite(const std::filesystem::path& rel);
+    void awaitPendingWrite(int global_id);
+
     ThreadSafeQueue<std::shared_ptr<Change>> _changes_queue;
     ThreadSafeQueue<FileEvent> _events_buff;
     mutable ThreadSafeEventsRegistry _expected_events;
@@ -129,6 +137,9 @@ private:
 
     std::shared_ptr<Database> _db;
 
+    // Local updates still queued on the callback dispatcher by global_id, only touched by proccessChanges().
+    std::unordered_map<int, std::future<void>> _pending_writes;
+
     std::function<void()> _onChange;
 
     std::filesystem::path _local_home_dir;
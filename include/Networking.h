@@ -1,13 +1,32 @@
 #pragma once
 
 #include <thread>
+#include <mutex>
+#include <array>
+#include <map>
+#include <optional>
 #include "request-handle.h"
-#include "BaseStorage.h"
+#include "RemoteStorage.h"
 #include "thread-safe-queue.h"
 #include "active-count.h"
+#include "cloud-governor.h"
+#include "bandwidth-scheduler.h"
+#include "pending-queue.h"
 
 class ICommand;
 
+enum class ShardAssignment {
+    ByCloud,
+    ByLoad
+};
+
+struct ConnectionLimits {
+    bool multiplex = true;
+    long max_host_connections = 0;
+    long max_total_connections = 0;
+    long max_concurrent_streams = 100;
+};
+
 class HttpClient {
 public:
     static HttpClient& get();
@@ -17,12 +36,46 @@ public:
     void shutdown();
     void start();
 
+    void setShardCount(int count);
+    int shardCount() const;
+    void setShardAssignment(ShardAssignment assignment);
+
+    void setConnectionLimits(const ConnectionLimits& limits);
+    ConnectionLimits connectionLimits() const;
+
+    void setBatchWindow(std::chrono::milliseconds window);
+
+    void setRangedDownloads(std::uint64_t threshold, std::size_t max_ranges);
+    std::size_t downloadRanges(int cloud_id, std::uint64_t size) const;
+    std::uint64_t streamThroughput(int cloud_id) const;
+
     void syncRequest(const std::unique_ptr<RequestHandle>& handle);
 
     bool isIdle() const noexcept;
 
     void waitUntilIdle() const;
 
+    CURL* acquireEasyHandle();
+    void releaseEasyHandle(CURL* curl);
+
+    void setCloudQuota(CloudProviderType type, const CloudQuota& quota);
+    CloudGovernorStats cloudStats(int cloud_id);
+
+    BandwidthScheduler& bandwidth() noexcept;
+    void setBandwidthLimit(TrafficDirection direction, std::uint64_t bytes_per_second);
+    void setTrafficWeight(TrafficClass traffic_class, unsigned weight);
+    void setInitialSync(bool initial_sync) noexcept;
+
+    void tokensRefreshed(int cloud_id);
+
+    std::size_t deadLettersCount() const;
+    std::vector<std::unique_ptr<ICommand>> takeDeadLetters();
+
+    std::uint64_t transfersCount() const noexcept;
+    std::uint64_t reusedConnectionsCount() const noexcept;
+    std::uint64_t openedConnectionsCount() const noexcept;
+    std::uint64_t batchedCommandsCount() const noexcept;
+
 private:
     HttpClient();
     ~HttpClient();
@@ -34,24 +87,128 @@ private:
     HttpClient(HttpClient&&) noexcept = delete;
     HttpClient& operator=(HttpClient&&) noexcept = delete;
 
-    void largeRequestsWorker();
-
-    void checkDelayedRequests();
+    struct PendingBatch {
+        std::vector<std::unique_ptr<ICommand>> commands;
+        std::vector<BatchPart> parts;
+        std::chrono::steady_clock::time_point deadline;
+    };
+
+    struct Shard {
+        int index = 0;
+        ThreadSafeQueue<std::unique_ptr<ICommand>> queue;
+        std::unordered_map<int, PendingQueue<std::unique_ptr<ICommand>>> pending;
+        std::unordered_map<CURL*, std::unique_ptr<ICommand>> active_handles;
+        std::vector<std::unique_ptr<ICommand>> delayed_requests;
+        std::vector<std::unique_ptr<ICommand>> awaiting_token;
+        std::mutex batch_mtx;
+        std::map<std::pair<int, std::string>, PendingBatch> batches;
+        std::unique_ptr<std::thread> worker;
+        CURLM* multi_handle = nullptr;
+#ifdef __linux__
+        int epoll_fd = -1;
+        int wakeup_fd = -1;
+#endif
+        int still_running = 0;
+        bool curl_timer_armed = false;
+        std::chrono::steady_clock::time_point curl_timer;
+        std::atomic<int> load{ 0 };
+        std::uint64_t limits_version = 0;
+    };
+
+    void largeRequestsWorker(Shard& shard);
+    // Waits for socket activity, a timer or a wakeup and lets curl make progress; false on an unrecoverable error.
+    bool waitForActivity(Shard& shard);
+
+    void checkDelayedRequests(Shard& shard);
+
+    void addDeadLetter(std::unique_ptr<ICommand> command);
+
+    struct DelayedLater {
+        bool operator()(const std::unique_ptr<ICommand>& lhs, const std::unique_ptr<ICommand>& rhs) const;
+    };
+
+    void createShards();
+    void applyConnectionLimits(Shard& shard, const ConnectionLimits& limits) const;
+    void destroyShards();
+    Shard& pickShard(int cloud_id);
+    std::size_t shardConcurrencyLimit() const;
+    std::size_t shardReservedSlots() const;
+
+    TrafficClass classify(const ICommand& command) const;
+    void resumePausedTransfers(Shard& shard);
+    std::optional<std::chrono::steady_clock::time_point> nextResumeTime(Shard& shard);
+
+    std::uint64_t tokenGeneration(int cloud_id) const;
+    bool waitsForMultiplex(int cloud_id) const;
+    void refreshAuthorization(int cloud_id, RequestHandle& handle);
+    bool canAwaitTokenRefresh(int cloud_id, const RequestHandle& handle);
+    void checkAwaitingToken(Shard& shard);
+
+    std::size_t maxBatchParts(int cloud_id) const;
+    void flushBatches(Shard& shard);
+    void dispatchBatch(Shard& shard, int cloud_id, PendingBatch batch);
+    bool hasPendingBatches(Shard& shard);
+
+    void enqueuePending(Shard& shard, std::unique_ptr<ICommand> command);
+    void addPendingHandles(Shard& shard);
+    void processCompletedTransfers(Shard& shard);
+    bool hasPendingCommands(const Shard& shard) const;
+    int nextWaitTimeout(Shard& shard);
+    void wakeWorker(Shard& shard);
+    void wakeAllWorkers();
+
+#ifdef __linux__
+    static int socketCallback(CURL* easy, curl_socket_t socket, int what, void* userp, void* socketp);
+    static int timerCallback(CURLM* multi, long timeout_ms, void* userp);
+#endif
+
+    void recordConnectionReuse(CURL* curl);
+    void recordStreamThroughput(int cloud_id, CURL* curl);
+    static std::chrono::microseconds serverLatency(CURL* curl);
+    void clearEasyHandlePool();
+
+    static void shareLock(CURL* curl, curl_lock_data data, curl_lock_access access, void* userptr);
+    static void shareUnlock(CURL* curl, curl_lock_data data, void* userptr);
 
     std::atomic<bool> _should_stop{ false };
     std::atomic<bool> _running{ false };
-    std::unordered_map<CURL*, std::unique_ptr<ICommand>> _active_handles;
-    std::vector<std::unique_ptr<ICommand>> _delayed_requests;
+
+    mutable std::mutex _dead_letters_mtx;
+    std::vector<std::unique_ptr<ICommand>> _dead_letters;
 
     std::unordered_map<int, std::shared_ptr<BaseStorage>> _clouds;
 
-    ThreadSafeQueue<std::unique_ptr<ICommand>> _large_queue;
+    CloudGovernor _governor;
 
-    std::unique_ptr<std::thread> _large_worker;
+    BandwidthScheduler _bandwidth;
+    std::atomic<bool> _initial_sync{ false };
+    std::uint64_t _SMALL_FILE_SIZE = 4 * 1024 * 1024;
 
-    CURLM* _large_multi_handle;
+    mutable std::mutex _shards_mtx;
+    std::vector<std::unique_ptr<Shard>> _shards;
+    int _shard_count;
+    ShardAssignment _shard_assignment = ShardAssignment::ByLoad;
+    ConnectionLimits _connection_limits;
+    std::atomic<std::uint64_t> _limits_version{ 0 };
+    std::chrono::milliseconds _batch_window;
+
+    std::atomic<std::uint64_t> _ranged_download_threshold;
+    std::atomic<std::size_t> _max_download_ranges;
+    mutable std::mutex _throughput_mtx;
+    std::unordered_map<int, double> _stream_throughput;
 
     int _MAX_CONCURRENT = 120;
 
     ActiveCount _large_active_count;
+
+    CURLSH* _share = nullptr;
+    std::array<std::mutex, CURL_LOCK_DATA_LAST> _share_mutexes;
+
+    std::mutex _pool_mtx;
+    std::vector<CURL*> _easy_pool;
+
+    std::atomic<std::uint64_t> _transfers_count{ 0 };
+    std::atomic<std::uint64_t> _reused_connections_count{ 0 };
+    std::atomic<std::uint64_t> _opened_connections_count{ 0 };
+    std::atomic<std::uint64_t> _batched_commands_count{ 0 };
 };
\ No newline at end of file
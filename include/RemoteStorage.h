@@ -0,0 +1,38 @@
+#pragma once
+
+#include "BaseStorage.h"
+#include "batch-request.h"
+
+// Capabilities only a cloud provider has; the defaults describe a provider that supports none of them.
+class RemoteStorage : public BaseStorage {
+public:
+    const RemoteStorage* remote() const final { return this; }
+
+    virtual std::optional<HashKind> contentHashKind() const { return std::nullopt; }
+
+    virtual bool supportsMultiplexing() const { return false; }
+
+    virtual bool supportsRangeDownloads() const { return false; }
+
+    virtual std::size_t maxBatchParts() const { return 0; }
+    virtual std::optional<BatchPart> deleteBatchPart(const std::unique_ptr<FileDeletedDTO>&) const { return std::nullopt; }
+    virtual std::optional<BatchPart> moveBatchPart(const std::unique_ptr<FileMovedDTO>&) const { return std::nullopt; }
+    virtual std::optional<BatchPart> uploadCommitPart(const std::unique_ptr<FileRecordDTO>&, const RequestHandle&) const { return std::nullopt; }
+    virtual void setupCommitHandle(const std::unique_ptr<RequestHandle>&, const BatchPart&) const {}
+    virtual void setupBatchHandle(const std::unique_ptr<RequestHandle>&, const std::vector<BatchPart>&) const {}
+    virtual void setupBatchCheckHandle(const std::unique_ptr<RequestHandle>&, const std::vector<BatchPart>&, const std::string&) const {}
+    virtual BatchResult proccesBatch(const RequestHandle& handle, std::size_t parts_count) const { return BatchResult{ {}, false, MultipartBatch::decode(handle.responseHeader("content-type"), handle._response, parts_count) }; }
+
+    virtual std::unique_ptr<UploadSessionDTO> openUploadSession(const std::unique_ptr<FileRecordDTO>&) const { return nullptr; }
+    virtual std::unique_ptr<UploadSessionDTO> openUploadSession(const std::unique_ptr<FileUpdatedDTO>&) const { return nullptr; }
+    virtual void setupUploadSessionHandle(const std::unique_ptr<RequestHandle>&, const std::unique_ptr<FileRecordDTO>&, const UploadSessionDTO&) const {}
+    virtual void setupUploadSessionHandle(const std::unique_ptr<RequestHandle>&, const std::unique_ptr<FileUpdatedDTO>&, const UploadSessionDTO&) const {}
+    virtual bool proccesUploadSession(const RequestHandle&, UploadSessionDTO&) const { return true; }
+    virtual std::size_t concurrentUploadAppends() const { return 0; }
+    virtual std::uint64_t uploadAppendSize() const { return 0; }
+    virtual void setupUploadAppendHandle(const std::unique_ptr<RequestHandle>&, const UploadSessionDTO&, std::uint64_t) const {}
+    virtual bool proccesUploadAppend(const RequestHandle&, const UploadSessionDTO&) const { return true; }
+
+    virtual std::unique_ptr<DownloadProgressDTO> openDownload(const std::unique_ptr<FileRecordDTO>&) const { return nullptr; }
+    virtual std::unique_ptr<DownloadProgressDTO> openDownload(const std::unique_ptr<FileUpdatedDTO>&) const { return nullptr; }
+};
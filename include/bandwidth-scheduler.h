@@ -0,0 +1,77 @@
+#pragma once
+
+#include <mutex>
+#include <array>
+#include <chrono>
+#include <cstdint>
+
+enum class TrafficClass : uint8_t {
+    Metadata = 0,
+    SmallFile = 1,
+    Bulk = 2,
+    InitialSync = 3
+};
+
+enum class TrafficDirection : uint8_t {
+    Upload = 0,
+    Download = 1
+};
+
+const char* to_cstr(TrafficClass traffic_class);
+
+class BandwidthScheduler {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    BandwidthScheduler();
+    ~BandwidthScheduler() = default;
+
+    BandwidthScheduler(const BandwidthScheduler&) = delete;
+    BandwidthScheduler& operator=(const BandwidthScheduler&) = delete;
+
+    BandwidthScheduler(BandwidthScheduler&&) noexcept = delete;
+    BandwidthScheduler& operator=(BandwidthScheduler&&) noexcept = delete;
+
+    void setLimit(TrafficDirection direction, uint64_t bytes_per_second);
+    uint64_t getLimit(TrafficDirection direction) const;
+    bool isLimited() const;
+
+    void setWeight(TrafficClass traffic_class, unsigned weight);
+    unsigned getWeight(TrafficClass traffic_class) const;
+
+    void transferStarted(TrafficClass traffic_class);
+    void transferFinished(TrafficClass traffic_class);
+
+    Clock::duration consume(
+        TrafficClass traffic_class,
+        TrafficDirection direction,
+        uint64_t bytes,
+        Clock::time_point now = Clock::now()
+    );
+
+    Clock::duration waitTime(
+        TrafficClass traffic_class,
+        TrafficDirection direction,
+        Clock::time_point now = Clock::now()
+    );
+
+    double classRate(TrafficClass traffic_class, TrafficDirection direction) const;
+
+    static constexpr std::size_t CLASSES_COUNT = 4;
+    static constexpr std::size_t DIRECTIONS_COUNT = 2;
+
+private:
+    struct Bucket {
+        double tokens = 0.0;
+        Clock::time_point last_refill;
+    };
+
+    double classRateLocked(std::size_t cls, std::size_t dir) const;
+    void refill(std::size_t cls, std::size_t dir, Clock::time_point now);
+
+    mutable std::mutex _mutex;
+    std::array<uint64_t, DIRECTIONS_COUNT> _limits{};
+    std::array<unsigned, CLASSES_COUNT> _weights;
+    std::array<int, CLASSES_COUNT> _active{};
+    std::array<std::array<Bucket, CLASSES_COUNT>, DIRECTIONS_COUNT> _buckets;
+};
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <optional>
+
+struct BatchPart {
+    std::string method;
+    std::string path;
+    std::string content_type;
+    std::string body;
+    std::string group;
+};
+
+struct BatchPartResponse {
+    long status = 0;
+    std::string body;
+};
+
+struct BatchResult {
+    std::string async_job_id;
+    bool in_progress = false;
+    std::vector<std::optional<BatchPartResponse>> responses;
+};
+
+class MultipartBatch {
+public:
+    MultipartBatch();
+    explicit MultipartBatch(std::string boundary);
+
+    const std::string& boundary() const noexcept;
+    std::string contentType() const;
+
+    std::string encode(const std::vector<BatchPart>& parts) const;
+
+    static std::vector<std::optional<BatchPartResponse>> decode(
+        const std::string& content_type,
+        const std::string& body,
+        std::size_t parts_count);
+
+private:
+    std::string _boundary;
+};
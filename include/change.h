@@ -4,7 +4,7 @@
 
 class Change {
 public:
-    enum class Status { Pending, Completed, Cancelled };
+    enum class Status { Pending, Completed, Cancelled, Failed };
 
     Change(
         ChangeType t,
@@ -41,6 +41,8 @@ public:
     void setOnComplete(std::function<void(std::vector<std::shared_ptr<Change>>&& dependents)> cb);
     void onCommandCreated() noexcept;
     void onCommandFinished() noexcept;
+    // A command gave up: the change ends now and the commands still pending in it no longer count.
+    void onCommandFailed() noexcept;
     void onCancel() noexcept;
     void addDependent(std::shared_ptr<Change> change);
     std::time_t getTime() const;
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <mutex>
+#include <deque>
+#include <chrono>
+#include <optional>
+#include <unordered_map>
+
+enum class CloudProviderType;
+
+struct CloudQuota {
+    int requests_per_minute;
+    int max_concurrent;
+    int min_concurrent;
+};
+
+struct CloudGovernorStats {
+    double concurrency_limit;
+    int in_flight;
+    int requests_last_minute;
+    int requests_per_minute_quota;
+};
+
+class CloudGovernor {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    CloudGovernor() = default;
+    ~CloudGovernor() = default;
+
+    CloudGovernor(const CloudGovernor&) = delete;
+    CloudGovernor& operator=(const CloudGovernor&) = delete;
+
+    CloudGovernor(CloudGovernor&&) noexcept = delete;
+    CloudGovernor& operator=(CloudGovernor&&) noexcept = delete;
+
+    void setQuota(CloudProviderType type, const CloudQuota& quota);
+    void registerCloud(int cloud_id, CloudProviderType type);
+
+    bool tryAcquire(int cloud_id, Clock::time_point now = Clock::now(), bool high_priority = true);
+    void release(
+        int cloud_id,
+        long http_code,
+        std::chrono::microseconds latency,
+        Clock::time_point now = Clock::now()
+    );
+
+    std::optional<Clock::time_point> nextTokenTime(
+        int cloud_id,
+        Clock::time_point now = Clock::now(),
+        bool high_priority = true
+    );
+
+    CloudGovernorStats stats(int cloud_id, Clock::time_point now = Clock::now());
+
+    static CloudQuota defaultQuota(CloudProviderType type);
+
+    static bool isCongestionCode(long http_code);
+
+    static int reservedSlots(int limit);
+
+private:
+    struct CloudState {
+        CloudQuota quota;
+        double limit;
+        int in_flight = 0;
+        double tokens;
+        Clock::time_point last_refill;
+        Clock::time_point last_decrease;
+        std::chrono::microseconds latency_baseline{ 0 };
+        std::deque<Clock::time_point> started;
+    };
+
+    CloudState& state(int cloud_id, Clock::time_point now);
+    void resetState(CloudState& st, const CloudQuota& quota, Clock::time_point now);
+    void refill(CloudState& st, Clock::time_point now);
+    void decrease(CloudState& st, double factor, Clock::time_point now);
+    void pruneStarted(CloudState& st, Clock::time_point now);
+
+    std::mutex _mutex;
+    std::unordered_map<CloudProviderType, CloudQuota> _quotas;
+    std::unordered_map<int, CloudProviderType> _types;
+    std::unordered_map<int, CloudState> _clouds;
+};
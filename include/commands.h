@@ -1,15 +1,23 @@
 #pragma once
 
-#include "BaseStorage.h"
+#include "RemoteStorage.h"
 #include "Networking.h"
 #include "CallbackDispatcher.h"
 #include "logger.h"
 
+#include <functional>
+#include <future>
+
+struct ConcurrentUpload;
+struct RangedDownload;
+
 class ICommand {
 public:
     virtual ~ICommand() = default;
     virtual void execute(const std::shared_ptr<BaseStorage>& cloud) = 0;
     virtual void completionCallback(const std::unique_ptr<Database>& db, const std::shared_ptr<BaseStorage>& cloud) = 0;
+    // Runs on a callback worker right before completionCallback, outside the database lock.
+    virtual void prepareCallback(const std::shared_ptr<BaseStorage>& cloud);
     virtual void continueChain() = 0;
     virtual void setDTO(std::unique_ptr<FileRecordDTO> dto);
     virtual void setDTO(std::unique_ptr<FileUpdatedDTO> dto);
@@ -18,16 +26,35 @@ public:
     virtual void addNext(std::unique_ptr<ICommand> next_command) = 0;
     virtual RequestHandle& getHandle();
     virtual std::string getTarget() const = 0;
+    // Callbacks with the same key run in submission order; getTarget() is only a log label.
+    virtual std::string orderingKey() const = 0;
     virtual EntryType getTargetType() const;
+    virtual std::uint64_t getTransferSize() const;
     virtual int getId() const = 0;
     virtual bool needRepeat() const;
+    // Set by completionCallback when the command waits for the streams of a parallel transfer;
+    // the dispatcher then hands its ownership to park() instead of dropping or resubmitting it.
+    virtual bool needPark() const;
+    virtual void park(std::unique_ptr<ICommand> self);
+    // One stream of a parallel transfer; it only adds bandwidth on a TCP connection of its own.
+    virtual bool ownConnection() const;
+    virtual std::optional<BatchPart> batchPart(const std::shared_ptr<BaseStorage>& cloud) const;
+    void setBatchable(bool batchable) noexcept;
+    bool batchable() const noexcept;
     void setOwner(std::weak_ptr<Change> ow) noexcept;
+    // Fails the owning change when the command is given up without its completion callback.
+    virtual void abandon() noexcept;
+    // HttpClient dropped the request with this HTTP code, 0 when curl failed; nothing by default.
+    virtual void dropped(long status);
+    // The ordering key of an entry: its global id once known, else its normalized path.
+    static std::string entryKey(int global_id, const std::filesystem::path& rel_path);
 
 protected:
     std::shared_ptr<Change> owner() const noexcept;
 
 private:
     std::weak_ptr<Change> _owner;
+    bool _batchable = true;
 };
 
 class ChainedCommand : public ICommand {
@@ -62,12 +89,16 @@ public:
 
     void execute(const std::shared_ptr<BaseStorage>& cloud) override {}
 
+    void prepareCallback(const std::shared_ptr<BaseStorage>& cloud) override;
+
     void completionCallback(const std::unique_ptr<Database>& db, const std::shared_ptr<BaseStorage>& cloud) override;
 
     void setDTO(std::unique_ptr<FileRecordDTO> dto) override;
 
     std::string getTarget() const override;
 
+    std::string orderingKey() const override;
+
     EntryType getTargetType() const override;
 
 private:
@@ -87,12 +118,16 @@ public:
 
     void execute(const std::shared_ptr<BaseStorage>& cloud) override {}
 
+    void prepareCallback(const std::shared_ptr<BaseStorage>& cloud) override;
+
     void completionCallback(const std::unique_ptr<Database>& db, const std::shared_ptr<BaseStorage>& cloud) override;
     
     void setDTO(std::unique_ptr<FileUpdatedDTO> dto) override;
 
     std::string getTarget() const override;
 
+    std::string orderingKey() const override;
+
     EntryType getTargetType() const override;
 
 private:
@@ -118,6 +153,8 @@ public:
 
     std::string getTarget() const override;
 
+    std::string orderingKey() const override;
+
     EntryType getTargetType() const override;
 
 private:
@@ -143,6 +180,8 @@ public:
 
     std::string getTarget() const override;
 
+    std::string orderingKey() const override;
+
 private:
     std::unique_ptr<FileDeletedDTO> _dto;
 };
@@ -168,11 +207,27 @@ public:
 
     std::string getTarget() const override;
 
+    std::string orderingKey() const override;
+
     EntryType getTargetType() const override;
 
+    std::uint64_t getTransferSize() const override;
+
+    std::optional<BatchPart> batchPart(const std::shared_ptr<BaseStorage>& cloud) const override;
+
+    bool needRepeat() const override;
+
+    bool needPark() const override;
+
+    void park(std::unique_ptr<ICommand> self) override;
+
 private:
     std::unique_ptr<RequestHandle> _handle;
     std::unique_ptr<FileRecordDTO> _dto;
+    std::unique_ptr<UploadSessionDTO> _session;
+    std::optional<BatchPart> _commit;
+    std::shared_ptr<ConcurrentUpload> _upload;
+    bool _repeat = false;
 };
 
 class CloudUpdateCommand : public CloudCommand {
@@ -196,11 +251,24 @@ public:
 
     std::string getTarget() const override;
 
+    std::string orderingKey() const override;
+
     EntryType getTargetType() const override;
 
+    std::uint64_t getTransferSize() const override;
+
+    bool needRepeat() const override;
+
+    bool needPark() const override;
+
+    void park(std::unique_ptr<ICommand> self) override;
+
 private:
     std::unique_ptr<RequestHandle> _handle;
     std::unique_ptr<FileUpdatedDTO> _dto;
+    std::unique_ptr<UploadSessionDTO> _session;
+    std::shared_ptr<ConcurrentUpload> _upload;
+    bool _repeat = false;
 };
 
 class CloudMoveCommand : public CloudCommand {
@@ -224,8 +292,12 @@ public:
 
     std::string getTarget() const override;
 
+    std::string orderingKey() const override;
+
     EntryType getTargetType() const override;
 
+    std::optional<BatchPart> batchPart(const std::shared_ptr<BaseStorage>& cloud) const override;
+
 private:
     std::unique_ptr<RequestHandle> _handle;
     std::unique_ptr<FileMovedDTO> _dto;
@@ -235,7 +307,7 @@ class CloudDownloadNewCommand : public CloudCommand {
 public:
     CloudDownloadNewCommand(const int cloud_id);
 
-    ~CloudDownloadNewCommand() = default;
+    ~CloudDownloadNewCommand();
     CloudDownloadNewCommand(const CloudDownloadNewCommand&) = delete;
     CloudDownloadNewCommand& operator=(const CloudDownloadNewCommand&) = delete;
 
@@ -244,6 +316,8 @@ public:
 
     void execute(const std::shared_ptr<BaseStorage>& cloud) override;
 
+    void prepareCallback(const std::shared_ptr<BaseStorage>& cloud) override;
+
     void completionCallback(const std::unique_ptr<Database>& db, const std::shared_ptr<BaseStorage>& cloud) override;
 
     RequestHandle& getHandle() override;
@@ -252,18 +326,34 @@ public:
 
     std::string getTarget() const override;
 
+    std::string orderingKey() const override;
+
     EntryType getTargetType() const override;
 
+    std::uint64_t getTransferSize() const override;
+
+    bool needRepeat() const override;
+
+    bool needPark() const override;
+
+    void park(std::unique_ptr<ICommand> self) override;
+
 private:
     std::unique_ptr<RequestHandle> _handle;
     std::unique_ptr<FileRecordDTO> _dto;
+    std::unique_ptr<DownloadProgressDTO> _progress;
+    std::shared_ptr<RangedDownload> _ranges;
+    int _verify_attempts = 0;
+    bool _range_pending = false;
+    bool _hash_failed = false;
+    bool _repeat = false;
 };
 
 class CloudDownloadUpdateCommand : public CloudCommand {
 public:
     CloudDownloadUpdateCommand(const int cloud_id);
 
-    ~CloudDownloadUpdateCommand() = default;
+    ~CloudDownloadUpdateCommand();
     CloudDownloadUpdateCommand(const CloudDownloadUpdateCommand&) = delete;
     CloudDownloadUpdateCommand& operator=(const CloudDownloadUpdateCommand&) = delete;
 
@@ -272,6 +362,8 @@ public:
 
     void execute(const std::shared_ptr<BaseStorage>& cloud) override;
 
+    void prepareCallback(const std::shared_ptr<BaseStorage>& cloud) override;
+
     void completionCallback(const std::unique_ptr<Database>& db, const std::shared_ptr<BaseStorage>& cloud) override;
 
     RequestHandle& getHandle() override;
@@ -280,11 +372,27 @@ public:
 
     std::string getTarget() const override;
 
+    std::string orderingKey() const override;
+
     EntryType getTargetType() const override;
 
+    std::uint64_t getTransferSize() const override;
+
+    bool needRepeat() const override;
+
+    bool needPark() const override;
+
+    void park(std::unique_ptr<ICommand> self) override;
+
 private:
     std::unique_ptr<RequestHandle> _handle;
     std::unique_ptr<FileUpdatedDTO> _dto;
+    std::unique_ptr<DownloadProgressDTO> _progress;
+    std::shared_ptr<RangedDownload> _ranges;
+    int _verify_attempts = 0;
+    bool _range_pending = false;
+    bool _hash_failed = false;
+    bool _repeat = false;
 };
 
 class CloudDeleteCommand : public CloudCommand {
@@ -308,7 +416,165 @@ public:
 
     std::string getTarget() const override;
 
+    std::string orderingKey() const override;
+
+    std::optional<BatchPart> batchPart(const std::shared_ptr<BaseStorage>& cloud) const override;
+
 private:
     std::unique_ptr<RequestHandle> _handle;
     std::unique_ptr<FileDeletedDTO> _dto;
 };
+
+class CloudBatchCommand : public CloudCommand {
+public:
+    CloudBatchCommand(const int cloud_id, std::vector<std::unique_ptr<ICommand>> commands, std::vector<BatchPart> parts);
+
+    ~CloudBatchCommand() = default;
+    CloudBatchCommand(const CloudBatchCommand&) = delete;
+    CloudBatchCommand& operator=(const CloudBatchCommand&) = delete;
+
+    CloudBatchCommand(CloudBatchCommand&&) noexcept = default;
+    CloudBatchCommand& operator=(CloudBatchCommand&&) noexcept = default;
+
+    void execute(const std::shared_ptr<BaseStorage>& cloud) override;
+
+    void completionCallback(const std::unique_ptr<Database>& db, const std::shared_ptr<BaseStorage>& cloud) override;
+
+    RequestHandle& getHandle() override;
+
+    std::string getTarget() const override;
+
+    std::string orderingKey() const override;
+
+    std::size_t size() const noexcept;
+
+    bool needRepeat() const override;
+
+    // Abandons every request of the batch.
+    void abandon() noexcept override;
+
+    // Sends the requests separately when the status is retryable, abandons them otherwise.
+    void dropped(long status) override;
+
+private:
+    void failParts(bool retryable);
+
+    std::unique_ptr<RequestHandle> _handle;
+    std::vector<std::unique_ptr<ICommand>> _commands;
+    std::vector<BatchPart> _parts;
+    std::string _job_id;
+    int _checks = 0;
+    bool _repeat = false;
+};
+
+class CloudUploadAppendCommand : public CloudCommand {
+public:
+    CloudUploadAppendCommand(const int cloud_id, std::shared_ptr<ConcurrentUpload> upload, std::uint64_t offset);
+
+    ~CloudUploadAppendCommand();
+    CloudUploadAppendCommand(const CloudUploadAppendCommand&) = delete;
+    CloudUploadAppendCommand& operator=(const CloudUploadAppendCommand&) = delete;
+
+    CloudUploadAppendCommand(CloudUploadAppendCommand&&) noexcept = default;
+    CloudUploadAppendCommand& operator=(CloudUploadAppendCommand&&) noexcept = default;
+
+    void execute(const std::shared_ptr<BaseStorage>& cloud) override;
+
+    void completionCallback(const std::unique_ptr<Database>& db, const std::shared_ptr<BaseStorage>& cloud) override;
+
+    RequestHandle& getHandle() override;
+
+    std::string getTarget() const override;
+
+    std::string orderingKey() const override;
+
+    std::uint64_t getTransferSize() const override;
+
+    bool needRepeat() const override;
+
+    bool ownConnection() const override;
+
+private:
+    std::unique_ptr<RequestHandle> _handle;
+    std::shared_ptr<ConcurrentUpload> _upload;
+    std::uint64_t _offset;
+    bool _stored = false;
+    bool _repeat = false;
+};
+
+class CloudRangeDownloadCommand : public CloudCommand {
+public:
+    using Setup = std::function<void(const std::shared_ptr<BaseStorage>&, const std::unique_ptr<RequestHandle>&)>;
+
+    CloudRangeDownloadCommand(const int cloud_id, std::shared_ptr<RangedDownload> download, std::uint64_t offset, std::uint64_t length, std::string target, Setup setup);
+
+    ~CloudRangeDownloadCommand();
+    CloudRangeDownloadCommand(const CloudRangeDownloadCommand&) = delete;
+    CloudRangeDownloadCommand& operator=(const CloudRangeDownloadCommand&) = delete;
+
+    CloudRangeDownloadCommand(CloudRangeDownloadCommand&&) noexcept = default;
+    CloudRangeDownloadCommand& operator=(CloudRangeDownloadCommand&&) noexcept = default;
+
+    void execute(const std::shared_ptr<BaseStorage>& cloud) override;
+
+    void completionCallback(const std::unique_ptr<Database>& db, const std::shared_ptr<BaseStorage>& cloud) override;
+
+    RequestHandle& getHandle() override;
+
+    std::string getTarget() const override;
+
+    std::string orderingKey() const override;
+
+    std::uint64_t getTransferSize() const override;
+
+    bool ownConnection() const override;
+
+private:
+    std::unique_ptr<RequestHandle> _handle;
+    std::shared_ptr<RangedDownload> _download;
+    std::uint64_t _offset;
+    std::uint64_t _length;
+    std::string _target;
+    Setup _setup;
+    bool _landed = false;
+};
+
+// Database write queued on the callback worker of its key, after the callbacks already
+// submitted under that key. The key doubles as its log label.
+class DbWriteCommand : public ICommand {
+public:
+    using Write = std::function<void(const std::unique_ptr<Database>&)>;
+
+    DbWriteCommand(std::string target, Write write);
+
+    DbWriteCommand(const DbWriteCommand&) = delete;
+    DbWriteCommand& operator=(const DbWriteCommand&) = delete;
+
+    DbWriteCommand(DbWriteCommand&&) noexcept = default;
+    DbWriteCommand& operator=(DbWriteCommand&&) noexcept = default;
+
+    std::future<void> result();
+
+    // Resolves the result only once the group-commit batch holding the write commits.
+    void resolveAfterCommit() noexcept;
+
+    void execute(const std::shared_ptr<BaseStorage>& cloud) override;
+
+    void completionCallback(const std::unique_ptr<Database>& db, const std::shared_ptr<BaseStorage>& cloud) override;
+
+    void continueChain() override;
+
+    void addNext(std::unique_ptr<ICommand> next_command) override;
+
+    std::string getTarget() const override;
+
+    std::string orderingKey() const override;
+
+    int getId() const override;
+
+private:
+    std::string _target;
+    Write _write;
+    std::promise<void> _done;
+    bool _after_commit = false;
+};
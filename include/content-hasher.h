@@ -0,0 +1,56 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include <vector>
+#include <optional>
+#include <utility>
+#include <cstdint>
+
+enum class HashKind : uint8_t {
+    Xxh64,
+    Md5,
+    DropboxContentHash
+};
+
+class IContentHasher {
+public:
+    virtual ~IContentHasher() = default;
+
+    virtual HashKind kind() const noexcept = 0;
+    virtual void update(const char* data, std::size_t size) = 0;
+    virtual void reset() = 0;
+    virtual std::string hexDigest() = 0;
+
+    static std::unique_ptr<IContentHasher> create(HashKind kind);
+};
+
+class HasherChain {
+public:
+    HasherChain() = default;
+    ~HasherChain() = default;
+
+    HasherChain(const HasherChain&) = delete;
+    HasherChain& operator=(const HasherChain&) = delete;
+
+    HasherChain(HasherChain&&) noexcept = default;
+    HasherChain& operator=(HasherChain&&) noexcept = default;
+
+    void add(HashKind kind);
+
+    bool contains(HashKind kind) const noexcept;
+    bool empty() const noexcept;
+
+    void update(const char* data, std::size_t size);
+    void reset();
+
+    std::optional<std::string> hexDigest(HashKind kind);
+    std::optional<uint64_t> xxh64();
+
+    uint64_t bytesHashed() const noexcept;
+
+private:
+    std::vector<std::unique_ptr<IContentHasher>> _hashers;
+    std::vector<std::pair<HashKind, std::string>> _digests;
+    uint64_t _bytes = 0;
+};
@@ -1,8 +1,16 @@
 #pragma once
 
 #include <sqlite3.h>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 #include "utils.h"
+#include "statement-cache.h"
+#include "metadata-index.h"
 #include <nlohmann/json.hpp>
 
 class Database {
@@ -26,6 +34,10 @@ public:
     
     int add_file(const FileRecordDTO& dto);
     void add_file_link(const FileRecordDTO& dto);
+    // Bulk form of add_file/add_file_link (by cloud_id), thousands of rows per transaction through the
+    // same two statements. Returns global_ids in input order, links report the one they carry. With
+    // defer_indexes the lookup indexes are dropped for the load and built once at the end.
+    std::vector<int> ingest(std::span<const std::unique_ptr<FileRecordDTO>> records, const bool defer_indexes = false);
 
     void update_file_link(const FileUpdatedDTO& dto);
     void update_file(const FileUpdatedDTO& dto);
@@ -52,12 +64,54 @@ public:
     void addLocalDir(const std::string& local_dir);
     std::string getLocalDir();
 
+    void saveUploadSession(const UploadSessionDTO& dto);
+    std::unique_ptr<UploadSessionDTO> getUploadSession(const int cloud_id, const std::filesystem::path& rel_path);
+    void deleteUploadSession(const int cloud_id, const std::filesystem::path& rel_path);
+
+    void saveDownloadProgress(const DownloadProgressDTO& dto);
+    std::unique_ptr<DownloadProgressDTO> getDownloadProgress(const int cloud_id, const std::filesystem::path& rel_path);
+    void deleteDownloadProgress(const int cloud_id, const std::filesystem::path& rel_path);
+
+    // Group commit: writes made between beginBatch() and commitBatch() through this object or any
+    // copy of it (copies share the connection and its statement cache) become savepoints of one transaction.
+    void beginBatch();
+    void commitBatch();
+    void rollbackBatch();
+    bool inBatch() const noexcept;
+    // One callback's writes inside the batch, so a failed callback is undone without the rest of it.
+    void beginBatchItem();
+    void commitBatchItem();
+    void rollbackBatchItem();
+
+    // Loads the in-memory index shared by all copies; until then lookups go to SQLite.
+    void loadIndex();
+    bool indexLoaded() const noexcept;
 
 private:
+    std::shared_ptr<StatementCache> _statements;
+    std::shared_ptr<MetadataIndex> _index;
     sqlite3* _db;
     void check_rc(int rc, const std::string& context);
     void create_tables();
     void execute(const std::string& sql);
+    void reloadIndex();
+    void migrateToTree();
+
+    // Where a path hangs in the tree: the deepest recorded ancestor and the rest of the path.
+    struct Placement {
+        int parent_global_id = 0;
+        std::string name;
+    };
+
+    std::optional<int> childId(const int parent_global_id, const std::string& name);
+    std::pair<int, std::size_t> locate(const std::vector<std::string>& segments, const std::size_t count);
+    std::optional<int> resolvePath(const std::filesystem::path& path);
+    Placement placementOf(const std::filesystem::path& path);
+    std::filesystem::path pathOf(const int global_id);
+    int linkCount(const int global_id);
+    bool adoptChildren(const int global_id, const Placement& place);
+    void ingestChunk(std::span<const std::unique_ptr<FileRecordDTO>> records,
+        std::unordered_map<std::string, int>& dirs, std::vector<int>& global_ids);
 
 #ifdef ENABLE_GTEST_FRIENDS
 #include <gtest/gtest_prod.h>
@@ -80,6 +134,7 @@ private:
     FRIEND_TEST(DatabaseUnitTest, UpdateCloudDataPrepareError);
     FRIEND_TEST(DatabaseUnitTest, UpdateFileLinkAndFilePrepareError);
     FRIEND_TEST(DatabaseUnitTest, UpdateFileMovedDTOPrepareError);
+    FRIEND_TEST(DatabaseUnitTest, CachedLookupFailsAfterDropTable);
 #endif
 
 
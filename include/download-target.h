@@ -0,0 +1,31 @@
+#pragma once
+
+#include <filesystem>
+#include <mutex>
+#include <cstdint>
+
+class DownloadTarget {
+public:
+    explicit DownloadTarget(std::uint64_t size, bool keep_existing = false);
+    ~DownloadTarget();
+
+    DownloadTarget(const DownloadTarget&) = delete;
+    DownloadTarget& operator=(const DownloadTarget&) = delete;
+
+    DownloadTarget(DownloadTarget&&) noexcept = delete;
+    DownloadTarget& operator=(DownloadTarget&&) noexcept = delete;
+
+    void open(const std::filesystem::path& path);
+
+    bool write(std::uint64_t offset, const char* data, std::size_t size);
+
+    std::uint64_t size() const noexcept;
+    std::filesystem::path path() const;
+
+private:
+    mutable std::mutex _mtx;
+    int _fd;
+    std::uint64_t _size;
+    bool _keep_existing;
+    std::filesystem::path _path;
+};
@@ -4,7 +4,7 @@
 #include "event-registry.h"
 #include <unordered_set>
 
-class Dropbox : public BaseStorage {
+class Dropbox : public RemoteStorage {
 public:
     Dropbox(
         const std::string& client_id,
@@ -42,6 +42,28 @@ public:
     void setupDeleteHandle(const std::unique_ptr<RequestHandle>& handle, const std::unique_ptr<FileDeletedDTO>& dto) const override;
     void setupMoveHandle(const std::unique_ptr<RequestHandle>& handle, const std::unique_ptr<FileMovedDTO>& dto) const override;
 
+    std::size_t maxBatchParts() const override;
+    std::optional<BatchPart> deleteBatchPart(const std::unique_ptr<FileDeletedDTO>& dto) const override;
+    std::optional<BatchPart> moveBatchPart(const std::unique_ptr<FileMovedDTO>& dto) const override;
+    std::optional<BatchPart> uploadCommitPart(const std::unique_ptr<FileRecordDTO>& dto, const RequestHandle& handle) const override;
+    void setupCommitHandle(const std::unique_ptr<RequestHandle>& handle, const BatchPart& part) const override;
+    void setupBatchHandle(const std::unique_ptr<RequestHandle>& handle, const std::vector<BatchPart>& parts) const override;
+    void setupBatchCheckHandle(const std::unique_ptr<RequestHandle>& handle, const std::vector<BatchPart>& parts, const std::string& async_job_id) const override;
+    BatchResult proccesBatch(const RequestHandle& handle, std::size_t parts_count) const override;
+
+    std::unique_ptr<UploadSessionDTO> openUploadSession(const std::unique_ptr<FileRecordDTO>& dto) const override;
+    std::unique_ptr<UploadSessionDTO> openUploadSession(const std::unique_ptr<FileUpdatedDTO>& dto) const override;
+    void setupUploadSessionHandle(const std::unique_ptr<RequestHandle>& handle, const std::unique_ptr<FileRecordDTO>& dto, const UploadSessionDTO& session) const override;
+    void setupUploadSessionHandle(const std::unique_ptr<RequestHandle>& handle, const std::unique_ptr<FileUpdatedDTO>& dto, const UploadSessionDTO& session) const override;
+    bool proccesUploadSession(const RequestHandle& handle, UploadSessionDTO& session) const override;
+
+    std::unique_ptr<DownloadProgressDTO> openDownload(const std::unique_ptr<FileRecordDTO>& dto) const override;
+    std::unique_ptr<DownloadProgressDTO> openDownload(const std::unique_ptr<FileUpdatedDTO>& dto) const override;
+    std::size_t concurrentUploadAppends() const override;
+    std::uint64_t uploadAppendSize() const override;
+    void setupUploadAppendHandle(const std::unique_ptr<RequestHandle>& handle, const UploadSessionDTO& session, std::uint64_t offset) const override;
+    bool proccesUploadAppend(const RequestHandle& handle, const UploadSessionDTO& session) const override;
+
     void getChanges() override;
     std::vector<std::shared_ptr<Change>> proccessChanges() override;
 
@@ -73,9 +95,22 @@ public:
     CloudProviderType getType() const override { return CloudProviderType::Dropbox; };
 
     bool hasChanges() const override;
+    bool hasMoreChanges() const override;
 
     void proccessAuth(const std::string& responce) override;
 
+    std::string authorizationHeader() const override;
+
+    std::time_t accessTokenExpires() const override;
+
+    std::uint64_t tokenGeneration() const override;
+
+    std::optional<HashKind> contentHashKind() const override;
+
+    bool supportsMultiplexing() const override;
+
+    bool supportsRangeDownloads() const override;
+
     std::string buildAuthURL(int local_port) const override;
 
     std::string getRefreshToken(const std::string& code, const int local_port) override;
@@ -87,9 +122,21 @@ public:
     ~Dropbox() = default;
 
     void setOnChange(std::function<void()> cb) override;
+
+    void setTestApiBaseUrl(const std::string& url);
+
+    void setUploadChunking(std::uint64_t session_threshold, std::uint64_t chunk_size, std::size_t concurrent_appends);
+
+    void setChangeBatching(std::size_t batch_size, std::size_t max_pending_batches);
 private:
 
     bool isDropboxShortcutJsonFile(const std::filesystem::path& path) const;
+    bool commitsInBatch(const std::unique_ptr<FileRecordDTO>& dto) const;
+    std::string remotePath(const std::filesystem::path& rel_path) const;
+    nlohmann::json createFolderBatch(const std::vector<std::string>& paths);
+    std::unique_ptr<UploadSessionDTO> resumeUploadSession(const std::filesystem::path& rel_path) const;
+    std::unique_ptr<DownloadProgressDTO> resumeDownload(const std::filesystem::path& rel_path, int global_id, const std::string& revision, std::uint64_t size) const;
+    void setupSessionRequest(const std::unique_ptr<RequestHandle>& handle, const UploadSessionDTO& session) const;
 
     std::filesystem::path _home_path;
     std::filesystem::path _local_home_path;
@@ -99,14 +146,29 @@ private:
     std::string _access_token;
     std::string _page_token;
 
-    ThreadSafeQueue<std::vector<std::string>> _events_buff;
+    std::string _api_base_url = "https://api.dropboxapi.com";
+    std::string _content_base_url = "https://content.dropboxapi.com";
+
+    std::uint64_t _session_threshold = 150ULL * 1024 * 1024;
+    std::uint64_t _upload_chunk_size = 16ULL * 1024 * 1024;
+    std::size_t _concurrent_appends = 4;
+
+    std::size_t _change_batch_size = 500;
+    std::size_t _max_pending_batches = 8;
+    bool _more_changes = false;
+
+    ThreadSafeQueue<std::vector<nlohmann::json>> _events_buff;
     mutable ThreadSafeEventsRegistry _expected_events;
 
+    std::unordered_map<std::string, std::shared_ptr<Change>> _pending_deletes;
+
     std::shared_ptr<Database> _db;
 
     std::function<void()> _onChange;
 
-    std::time_t _access_token_expires;
+    std::time_t _access_token_expires = 0;
+    std::atomic<std::uint64_t> _token_generation{ 0 };
+    mutable std::mutex _token_mtx;
 
     int _id;
 };
@@ -8,7 +8,7 @@ struct GoogleDocMimeInfo {
     std::string export_mime_type;
 };
 
-class GoogleDrive : public BaseStorage {
+class GoogleDrive : public RemoteStorage {
 public:
     GoogleDrive(
         const std::string& client_id,
@@ -59,6 +59,20 @@ public:
     void setupDownloadHandle(const std::unique_ptr<RequestHandle>& handle, const std::unique_ptr<FileUpdatedDTO>& dto) const override;
     void setupDeleteHandle(const std::unique_ptr<RequestHandle>& handle, const std::unique_ptr<FileDeletedDTO>& dto) const override;
     void setupMoveHandle(const std::unique_ptr<RequestHandle>& handle, const std::unique_ptr<FileMovedDTO>& dto) const override;
+    void setupBatchHandle(const std::unique_ptr<RequestHandle>& handle, const std::vector<BatchPart>& parts) const override;
+
+    std::size_t maxBatchParts() const override;
+    std::optional<BatchPart> deleteBatchPart(const std::unique_ptr<FileDeletedDTO>& dto) const override;
+    std::optional<BatchPart> moveBatchPart(const std::unique_ptr<FileMovedDTO>& dto) const override;
+
+    std::unique_ptr<UploadSessionDTO> openUploadSession(const std::unique_ptr<FileRecordDTO>& dto) const override;
+    std::unique_ptr<UploadSessionDTO> openUploadSession(const std::unique_ptr<FileUpdatedDTO>& dto) const override;
+    void setupUploadSessionHandle(const std::unique_ptr<RequestHandle>& handle, const std::unique_ptr<FileRecordDTO>& dto, const UploadSessionDTO& session) const override;
+    void setupUploadSessionHandle(const std::unique_ptr<RequestHandle>& handle, const std::unique_ptr<FileUpdatedDTO>& dto, const UploadSessionDTO& session) const override;
+    bool proccesUploadSession(const RequestHandle& handle, UploadSessionDTO& session) const override;
+
+    std::unique_ptr<DownloadProgressDTO> openDownload(const std::unique_ptr<FileRecordDTO>& dto) const override;
+    std::unique_ptr<DownloadProgressDTO> openDownload(const std::unique_ptr<FileUpdatedDTO>& dto) const override;
 
     void getChanges() override;
 
@@ -87,12 +101,26 @@ public:
 
     bool hasChanges() const override;
 
+    bool hasMoreChanges() const override;
+
     std::string buildAuthURL(int local_port) const override;
 
     std::string getRefreshToken(const std::string& code, const int local_port) override;
 
     void proccessAuth(const std::string& responce) override;
 
+    std::string authorizationHeader() const override;
+
+    std::time_t accessTokenExpires() const override;
+
+    std::uint64_t tokenGeneration() const override;
+
+    std::optional<HashKind> contentHashKind() const override;
+
+    bool supportsMultiplexing() const override;
+
+    bool supportsRangeDownloads() const override;
+
     std::string getDeltaToken() override;
 
     void ensureRootExists() override;
@@ -100,11 +128,23 @@ public:
     void setOnChange(std::function<void()> cb) override;
 
     void setTestApiBaseUrl(const std::string& url);
+
+    void setUploadChunking(std::uint64_t resumable_threshold, std::uint64_t chunk_size);
+
+    void setChangeBatching(std::size_t batch_size, std::size_t max_pending_batches);
 private:
     std::optional<GoogleDocMimeInfo> getGoogleDocMimeByExtension(const std::filesystem::path& path) const;
 
     bool ignoreTmp(const std::string& name);
 
+    std::vector<std::unique_ptr<FileRecordDTO>> createFolders(const std::string& parent_id, const std::vector<std::filesystem::path>& paths);
+
+    std::string uploadParentId(const std::unique_ptr<FileRecordDTO>& dto) const;
+
+    std::unique_ptr<UploadSessionDTO> resumeUploadSession(const std::filesystem::path& rel_path) const;
+    std::unique_ptr<DownloadProgressDTO> resumeDownload(const std::filesystem::path& rel_path, int global_id, const std::string& revision, std::uint64_t size) const;
+    void setupSessionTransfer(const std::unique_ptr<RequestHandle>& handle, const UploadSessionDTO& session) const;
+
     std::unordered_map<std::string, std::string> _dir_id_map;
 
     std::filesystem::path _local_home_path;
@@ -121,16 +161,27 @@ private:
     std::string _auth_base_url = "https://oauth2.googleapis.com";
     std::string _acc_base_url = "https://accounts.google.com";
 
+    std::uint64_t _resumable_threshold = 8ULL * 1024 * 1024;
+    std::uint64_t _upload_chunk_size = 8ULL * 1024 * 1024;
+
+    std::size_t _change_batch_size = 500;
+    std::size_t _max_pending_batches = 8;
+    bool _more_changes = false;
+
     ThreadSafeQueue<std::vector<nlohmann::json>> _events_buff;
     mutable ThreadSafeEventsRegistry _expected_events;
 
+    std::unordered_map<std::string, std::filesystem::path> _pending_paths;
+
     std::unordered_map<std::string, std::unique_ptr<FileDeletedDTO>> _pending_deletes;
 
     std::shared_ptr<Database> _db;
 
     std::function<void()> _onChange;
 
-    std::time_t _access_token_expires;
+    std::time_t _access_token_expires = 0;
+    std::atomic<std::uint64_t> _token_generation{ 0 };
+    mutable std::mutex _token_mtx;
 
     int _id;
 };
\ No newline at end of file
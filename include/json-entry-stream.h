@@ -0,0 +1,53 @@
+#pragma once
+
+#include <nlohmann/json.hpp>
+#include <exception>
+#include <functional>
+#include <string>
+
+// Push parser for listing pages: elements of the top-level array under one key are
+// handed out one at a time as bytes arrive, all other top-level members are kept.
+class JsonEntryStream {
+public:
+    JsonEntryStream(std::string array_key, std::function<void(nlohmann::json&&)> on_entry);
+
+    JsonEntryStream(const JsonEntryStream&) = delete;
+    JsonEntryStream& operator=(const JsonEntryStream&) = delete;
+
+    JsonEntryStream(JsonEntryStream&&) noexcept = default;
+    JsonEntryStream& operator=(JsonEntryStream&&) noexcept = default;
+
+    bool feed(const char* data, std::size_t size);
+
+    void reset();
+
+    bool complete() const noexcept;
+
+    // Throws when the page was cut short, malformed, or an entry handler threw.
+    void finish() const;
+
+    std::size_t entries() const noexcept;
+    const nlohmann::json& fields() const noexcept;
+
+private:
+    enum class State { Start, Key, Colon, Value, Entries, Entry, Done, Failed };
+
+    bool consume(char c);
+    bool capture(char c);
+    bool finishValue();
+    bool finishEntry();
+
+    std::string _array_key;
+    std::function<void(nlohmann::json&&)> _on_entry;
+
+    State _state;
+    std::string _key;
+    std::string _buffer;
+    int _nesting;
+    bool _in_string;
+    bool _escaped;
+    bool _scalar;
+    std::size_t _entries;
+    nlohmann::json _fields;
+    std::exception_ptr _error;
+};
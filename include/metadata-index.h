@@ -0,0 +1,141 @@
+#pragma once
+
+#include <sqlite3.h>
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <optional>
+#include <set>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "utils.h"
+
+// In-memory copy of the files and file_links tables, keyed by (parent_global_id, name), file_id,
+// global_id and (cloud_id, cloud_file_id). Loaded once from the connection, then kept current by the
+// Database mutators after each successful write; writers that bypass Database leave it stale.
+class MetadataIndex {
+public:
+    MetadataIndex() = default;
+    ~MetadataIndex() = default;
+
+    MetadataIndex(const MetadataIndex&) = delete;
+    MetadataIndex& operator=(const MetadataIndex&) = delete;
+
+    MetadataIndex(MetadataIndex&&) noexcept = delete;
+    MetadataIndex& operator=(MetadataIndex&&) noexcept = delete;
+
+    // Replaces the contents with the current tables, throws on SQL errors and leaves the index unloaded.
+    void load(sqlite3* db);
+    bool loaded() const noexcept;
+
+    std::size_t files() const;
+    std::size_t links() const;
+
+    // Lookups return nullopt/nullptr when nothing matches; callers fall back to SQL only while unloaded.
+    std::optional<int> childId(const int parent_global_id, const std::string& name) const;
+    std::optional<int> globalIdByFileId(const uint64_t file_id) const;
+    std::optional<std::string> pathByGlobalId(const int global_id) const;
+    std::optional<std::string> cloudFileId(const int cloud_id, const int global_id) const;
+    std::size_t linkCount(const int global_id) const;
+
+    std::unique_ptr<FileRecordDTO> fileByGlobalId(const int global_id) const;
+    std::unique_ptr<FileRecordDTO> fileByFileId(const uint64_t file_id) const;
+    std::unique_ptr<FileRecordDTO> linkByGlobalId(const int cloud_id, const int global_id) const;
+    std::unique_ptr<FileRecordDTO> linkByCloudFileId(const int cloud_id, const std::string& cloud_file_id) const;
+
+    // Write-through, mirroring the row changes of the matching Database mutator. Adds keep an
+    // existing entry like INSERT OR IGNORE does, the rest skip entries that are not indexed.
+    void addFile(const int global_id, const EntryType type, const int parent_global_id, const std::string& name,
+        const uint64_t size, const uint64_t local_hash, const std::time_t local_modified_time, const uint64_t file_id);
+    void updateFile(const int global_id, const uint64_t size, const uint64_t local_hash,
+        const std::time_t local_modified_time, const uint64_t file_id);
+    void moveFile(const int global_id, const int parent_global_id, const std::string& name, const std::time_t local_modified_time);
+    // Siblings named "<name>/..." were waiting for this directory and move under it.
+    void adoptChildren(const int global_id);
+    void addLink(const int global_id, const int cloud_id, const std::string& cloud_file_id, const std::string& cloud_parent_id,
+        const std::time_t cloud_modified_time, const std::string& cloud_hash, const uint64_t cloud_size);
+    void updateLink(const int global_id, const int cloud_id, const std::string& cloud_hash,
+        const std::time_t cloud_modified_time, const uint64_t cloud_size);
+    void moveLink(const int global_id, const int cloud_id, const std::string& cloud_file_id,
+        const std::string& cloud_parent_id, const std::time_t cloud_modified_time);
+    // Children are kept under the parent with the directory name prepended, as Database does.
+    void eraseFile(const int global_id);
+
+private:
+    struct File {
+        std::string name;
+        int parent_global_id;
+        uint64_t size;
+        uint64_t local_hash;
+        uint64_t file_id;
+        std::time_t local_modified_time;
+        EntryType type;
+    };
+
+    // cloud_file_id, cloud_parent_id and cloud_hash share one allocation.
+    struct Link {
+        std::string text;
+        uint32_t parent_offset = 0;
+        uint32_t hash_offset = 0;
+        uint64_t cloud_size;
+        std::time_t cloud_modified_time;
+
+        void assign(std::string_view cloud_file_id, std::string_view cloud_parent_id, std::string_view cloud_hash);
+        std::string_view cloudFileId() const noexcept;
+        std::string_view cloudParentId() const noexcept;
+        std::string_view cloudHash() const noexcept;
+    };
+
+    struct Child {
+        int parent_global_id;
+        std::string_view name;
+        int global_id;
+
+        auto operator<=>(const Child&) const = default;
+    };
+
+    struct CloudFileKey {
+        int cloud_id;
+        std::string_view cloud_file_id;
+
+        bool operator==(const CloudFileKey&) const = default;
+    };
+
+    struct CloudFileKeyHash {
+        std::size_t operator()(const CloudFileKey& key) const noexcept;
+    };
+
+    static uint64_t linkKey(const int global_id, const int cloud_id) noexcept;
+
+    // Secondary maps may hold several rows per key (the columns are not unique), the lowest
+    // global_id wins like the rowid order SQLite returns them in.
+    template <typename Map, typename Key>
+    static std::optional<int> lowest(const Map& map, const Key& key);
+
+    template <typename Map, typename Key>
+    static void eraseEntry(Map& map, const Key& key, const int global_id);
+
+    std::string pathOf(const int global_id) const;
+    void setFileName(const int global_id, File& file, const int parent_global_id, std::string name);
+    std::unique_ptr<FileRecordDTO> fileRecord(const int global_id) const;
+    std::unique_ptr<FileRecordDTO> linkRecord(const int global_id, const int cloud_id) const;
+    void assignLink(const int global_id, const int cloud_id, Link& link, std::string_view cloud_file_id,
+        std::string_view cloud_parent_id, std::string_view cloud_hash);
+    void eraseLink(const int global_id, const int cloud_id);
+    void clear();
+
+    // Views in the secondary maps point into the strings of the node-stable primary maps. Children
+    // are ordered by parent and name, so a directory's entries and a name prefix are ranges.
+    std::unordered_map<int, File> _files;
+    std::unordered_map<uint64_t, Link> _links;
+    std::set<Child> _children;
+    std::unordered_multimap<uint64_t, int> _by_file_id;
+    std::unordered_multimap<CloudFileKey, int, CloudFileKeyHash> _by_cloud_file_id;
+    std::vector<int> _cloud_ids;
+
+    bool _loaded = false;
+    mutable std::shared_mutex _mtx;
+};
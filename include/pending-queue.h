@@ -0,0 +1,91 @@
+#pragma once
+
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include <algorithm>
+#include "bandwidth-scheduler.h"
+
+template<typename T>
+class PendingQueue {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    PendingQueue() = default;
+    ~PendingQueue() = default;
+
+    PendingQueue(const PendingQueue&) = delete;
+    PendingQueue& operator=(const PendingQueue&) = delete;
+
+    PendingQueue(PendingQueue&&) noexcept = default;
+    PendingQueue& operator=(PendingQueue&&) noexcept = default;
+
+    void push(T item, TrafficClass traffic_class, std::uint64_t size, Clock::time_point now = Clock::now()) {
+        _heap.push_back({ std::move(item), traffic_class, deadline(traffic_class, size, now), _next_seq++ });
+        std::push_heap(_heap.begin(), _heap.end(), Later{});
+    }
+
+    T pop() {
+        std::pop_heap(_heap.begin(), _heap.end(), Later{});
+        T item = std::move(_heap.back().item);
+        _heap.pop_back();
+        return item;
+    }
+
+    const T& top() const {
+        return _heap.front().item;
+    }
+
+    TrafficClass topClass() const {
+        return _heap.front().traffic_class;
+    }
+
+    bool empty() const noexcept {
+        return _heap.empty();
+    }
+
+    std::size_t size() const noexcept {
+        return _heap.size();
+    }
+
+    // Shortest job first inside a class, but nothing waits longer than MAX_AGING
+    // behind requests that were queued after it.
+    static Clock::time_point deadline(TrafficClass traffic_class, std::uint64_t size, Clock::time_point enqueued) {
+        constexpr std::chrono::milliseconds CLASS_DELAY[] = {
+            std::chrono::milliseconds(0),
+            std::chrono::milliseconds(1000),
+            std::chrono::milliseconds(5000),
+            std::chrono::milliseconds(10000)
+        };
+
+        auto size_delay = std::chrono::milliseconds(size / BYTES_PER_MILLISECOND);
+        auto delay = std::min<std::chrono::milliseconds>(
+            CLASS_DELAY[static_cast<std::size_t>(traffic_class)] + size_delay,
+            MAX_AGING
+        );
+        return enqueued + delay;
+    }
+
+    static constexpr std::chrono::milliseconds MAX_AGING = std::chrono::seconds(120);
+    static constexpr std::uint64_t BYTES_PER_MILLISECOND = 8 * 1024;
+
+private:
+    struct Entry {
+        T item;
+        TrafficClass traffic_class;
+        Clock::time_point deadline;
+        std::uint64_t seq;
+    };
+
+    struct Later {
+        bool operator()(const Entry& lhs, const Entry& rhs) const {
+            if (lhs.deadline != rhs.deadline) {
+                return lhs.deadline > rhs.deadline;
+            }
+            return lhs.seq > rhs.seq;
+        }
+    };
+
+    std::vector<Entry> _heap;
+    std::uint64_t _next_seq = 0;
+};
@@ -5,6 +5,14 @@
 #include <chrono>
 #include <filesystem>
 #include <fstream>
+#include <functional>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+#include "bandwidth-scheduler.h"
+#include "upload-source.h"
+#include "download-target.h"
+#include "content-hasher.h"
 
 class RequestHandle {
 public:
@@ -18,14 +26,39 @@ public:
 
     ~RequestHandle();
 
-    void scheduleRetry();
+    bool scheduleRetry();
+
+    void rewind();
+
+    std::optional<std::chrono::milliseconds> retryAfter() const;
+
+    std::string responseHeader(const std::string& name) const;
 
     void setFileStream(const std::filesystem::path& file_path, std::ios::openmode mode);
 
+    void setUploadSource(const std::filesystem::path& file_path);
+    void setUploadSource(const std::filesystem::path& file_path, std::uint64_t offset, std::uint64_t length);
+
+    void setDownloadRange(std::shared_ptr<DownloadTarget> target, std::uint64_t offset, std::uint64_t length);
+
+    void resumeDownloadAt(std::uint64_t offset);
+
+    void setResponseSink(std::function<bool(const char*, std::size_t)> sink);
+
+    bool resumable() const noexcept;
+
+    bool accepts(long http_code) const;
+
+    void addMimeUploadPart(curl_mimepart* part, const std::filesystem::path& file_path);
+
+    void addHasher(HashKind kind);
+
     void addHeaders(const std::string& header);
 
     void clearHeaders();
 
+    bool replaceHeader(const std::string& name, const std::string& header);
+
     void setCommonCURLOpt();
 
     static void addGlobalResolve(
@@ -36,10 +69,25 @@ public:
 
     static size_t writeCallback(void* contents, size_t size, size_t nmemb, std::string* output);
 
+    static size_t headerCallback(char* buffer, size_t size, size_t nitems, void* userdata);
+
+    static int xferInfoCallback(
+        void* clientp,
+        curl_off_t dltotal,
+        curl_off_t dlnow,
+        curl_off_t ultotal,
+        curl_off_t ulnow);
+
     static size_t readData(void* ptr, size_t size, size_t nmemb, void* stream);
 
     static size_t writeData(void* ptr, size_t size, size_t nmemb, void* stream);
 
+    static size_t writeHashedData(void* ptr, size_t size, size_t nmemb, void* userdata);
+
+    static size_t writeRangeData(void* ptr, size_t size, size_t nmemb, void* userdata);
+
+    static size_t writeSinkData(void* ptr, size_t size, size_t nmemb, void* userdata);
+
     CURL* _curl;
     curl_mime* _mime;
     curl_slist* _headers;
@@ -48,6 +96,30 @@ public:
 
     std::chrono::steady_clock::time_point _timer;
     std::fstream _iofd;
+    std::unique_ptr<UploadSource> _upload;
+    std::shared_ptr<DownloadTarget> _download;
+    std::uint64_t _range_offset;
+    std::uint64_t _range_length;
+    std::uint64_t _range_written;
+    std::filesystem::path _download_path;
+    std::uint64_t _resume_offset;
+    HasherChain _hashers;
+    std::function<bool(const char*, std::size_t)> _sink;
     std::string _response;
+    std::unordered_map<std::string, std::string> _response_headers;
+    std::vector<long> _accepted_codes;
     int _retry_count;
+
+    TrafficClass _traffic_class;
+    bool _in_multi;
+    bool _paused;
+    curl_off_t _uploaded;
+    curl_off_t _downloaded;
+
+    std::uint64_t _auth_generation;
+    int _auth_retries;
+
+    static constexpr int MAX_RETRIES = 6;
+    static constexpr auto MAX_RETRY_AFTER = std::chrono::hours(1);
+    static constexpr long UPLOAD_BUFFER_SIZE = 1024 * 1024;
 };
\ No newline at end of file
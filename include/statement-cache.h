@@ -0,0 +1,62 @@
+#pragma once
+
+#include <sqlite3.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Prepared statements of one connection, kept across calls. Each statement is leased to one
+// caller at a time, so copies of a Database sharing the connection can use it from any thread.
+class StatementCache {
+public:
+    // Lease on a cached statement: reset, bindings cleared and handed back on reset() or scope exit.
+    class Statement {
+    public:
+        Statement() = default;
+        ~Statement();
+
+        Statement(const Statement&) = delete;
+        Statement& operator=(const Statement&) = delete;
+
+        Statement(Statement&& other) noexcept;
+        Statement& operator=(Statement&& other) noexcept;
+
+        operator sqlite3_stmt*() const noexcept;
+
+        void reset() noexcept;
+
+    private:
+        friend class StatementCache;
+        Statement(StatementCache* cache, sqlite3_stmt* stmt) noexcept;
+
+        StatementCache* _cache = nullptr;
+        sqlite3_stmt* _stmt = nullptr;
+    };
+
+    explicit StatementCache(std::shared_ptr<sqlite3> conn);
+    ~StatementCache();
+
+    StatementCache(const StatementCache&) = delete;
+    StatementCache& operator=(const StatementCache&) = delete;
+
+    StatementCache(StatementCache&&) noexcept = delete;
+    StatementCache& operator=(StatementCache&&) noexcept = delete;
+
+    // Hands out an idle statement for sql or prepares a new one, returns the sqlite result code.
+    int prepare(const std::string& sql, Statement& out);
+
+    // Finalizes idle statements, leased ones are kept until they come back.
+    void clear();
+
+    std::size_t idle() const;
+
+private:
+    void giveBack(sqlite3_stmt* stmt) noexcept;
+
+    std::shared_ptr<sqlite3> _conn;
+
+    mutable std::mutex _mtx;
+    std::unordered_map<std::string, std::vector<sqlite3_stmt*>> _idle;
+};
@@ -3,6 +3,7 @@
 #include "LocalStorage.h"
 #include "http-server.h"
 #include "cloud-factory.h"
+#include "token-manager.h"
 #include <atomic>
 
 class SyncManager {
@@ -60,6 +61,8 @@ private:
 
     void pollingLoop();
 
+    void drainDeadLetters();
+
     void handleChange(std::shared_ptr<Change> change);
 
     void ensureRootsExist();
@@ -97,8 +100,6 @@ private:
 
     std::atomic<bool> _should_exit;
 
-    std::time_t _next_token_refresh;
-
     int _num_clouds;
 
     Mode _mode;
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <optional>
+#include <condition_variable>
+#include <unordered_map>
+#include <unordered_set>
+#include "BaseStorage.h"
+
+class TokenManager {
+public:
+    static TokenManager& get();
+
+    void start(const std::unordered_map<int, std::shared_ptr<BaseStorage>>& clouds);
+    void stop();
+
+    bool requestRefresh(int cloud_id);
+
+    bool isRunning() const;
+
+    void setRefreshMargin(std::chrono::seconds margin);
+
+private:
+    using Clock = std::chrono::system_clock;
+
+    TokenManager() = default;
+    ~TokenManager();
+
+    TokenManager(const TokenManager&) = delete;
+    TokenManager& operator=(const TokenManager&) = delete;
+
+    TokenManager(TokenManager&&) noexcept = delete;
+    TokenManager& operator=(TokenManager&&) noexcept = delete;
+
+    void worker();
+
+    std::optional<Clock::time_point> nextRefreshTime(int cloud_id, const std::shared_ptr<BaseStorage>& cloud) const;
+
+    void refresh(int cloud_id, const std::shared_ptr<BaseStorage>& cloud);
+
+    mutable std::mutex _mutex;
+    std::condition_variable _cv;
+    std::unique_ptr<std::thread> _worker;
+
+    std::unordered_map<int, std::shared_ptr<BaseStorage>> _clouds;
+    std::unordered_set<int> _forced;
+    std::unordered_map<int, Clock::time_point> _retry_at;
+    std::unordered_map<int, Clock::time_point> _refreshed_at;
+
+    std::chrono::seconds _refresh_margin{ 300 };
+    bool _should_stop = false;
+    bool _running = false;
+};
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <curl/curl.h>
+#include <filesystem>
+#include <vector>
+#include <cstdint>
+
+class UploadSource {
+public:
+    // Reads with pread rather than a mapping: a file truncated mid-upload then ends in a short read that
+    // aborts the transfer instead of a SIGBUS.
+    explicit UploadSource(const std::filesystem::path& path);
+    ~UploadSource();
+
+    UploadSource(const UploadSource&) = delete;
+    UploadSource& operator=(const UploadSource&) = delete;
+
+    UploadSource(UploadSource&&) noexcept = delete;
+    UploadSource& operator=(UploadSource&&) noexcept = delete;
+
+    std::size_t read(char* buffer, std::size_t size);
+
+    bool seek(curl_off_t offset, int origin);
+
+    void rewind();
+
+    void setWindow(std::uint64_t offset, std::uint64_t length);
+
+    std::uint64_t size() const noexcept;
+    std::uint64_t length() const noexcept;
+    std::uint64_t position() const noexcept;
+
+    static size_t readCallback(char* buffer, size_t size, size_t nitems, void* userdata);
+    static int seekCallback(void* userdata, curl_off_t offset, int origin);
+
+    static constexpr std::size_t PREAD_BUFFER_SIZE = 4 * 1024 * 1024;
+    // Reads at least this large skip the buffer and land straight in the caller's memory.
+    static constexpr std::size_t DIRECT_READ_SIZE = 64 * 1024;
+
+private:
+    std::size_t readBuffered(char* buffer, std::size_t size);
+
+    int _fd;
+    std::uint64_t _size;
+    std::uint64_t _position;
+    std::uint64_t _window_begin;
+    std::uint64_t _window_end;
+
+    std::vector<char> _buffer;
+    std::uint64_t _buffer_offset;
+    std::size_t _buffer_length;
+};
@@ -5,6 +5,7 @@
 #include <unordered_map>
 #include <chrono>
 #include <variant>
+#include <optional>
 
 std::filesystem::path normalizePath(const std::filesystem::path& p);
 
@@ -160,6 +161,8 @@ public:
     std::string cloud_parent_id;
     std::string cloud_file_id;
     std::variant<std::string, uint64_t> cloud_hash_check_sum;
+    std::optional<uint64_t> streamed_hash;
+    std::string streamed_cloud_hash;
     uint64_t size;
     uint64_t file_id;
     std::time_t cloud_file_modified_time;
@@ -281,6 +284,8 @@ public:
     std::filesystem::path rel_path;
     std::string cloud_file_id;
     std::variant<std::string, uint64_t> cloud_hash_check_sum;
+    std::optional<uint64_t> streamed_hash;
+    std::string streamed_cloud_hash;
     std::string cloud_parent_id;
     uint64_t size;
     std::time_t cloud_file_modified_time;
@@ -394,4 +399,92 @@ public:
     std::time_t when;
     int global_id;
     int cloud_id;
-};
\ No newline at end of file
+};
+class UploadSessionDTO {
+public:
+    UploadSessionDTO(                       // New session
+        const int cid,
+        const std::filesystem::path& rp,
+        const uint64_t s,
+        const std::time_t lmt
+    ) :
+        rel_path(rp),
+        offset(0),
+        size(s),
+        local_modified_time(lmt),
+        cloud_id(cid),
+        confirmed(false)
+    {
+    }
+
+    UploadSessionDTO(                       // Persisted session
+        const int cid,
+        const std::filesystem::path& rp,
+        const std::string& sid,
+        const uint64_t o,
+        const uint64_t s,
+        const std::time_t lmt
+    ) :
+        rel_path(rp),
+        session_id(sid),
+        offset(o),
+        size(s),
+        local_modified_time(lmt),
+        cloud_id(cid),
+        confirmed(false)
+    {
+    }
+
+    UploadSessionDTO() = default;
+    ~UploadSessionDTO() = default;
+
+    UploadSessionDTO(const UploadSessionDTO& other) = default;
+    UploadSessionDTO(UploadSessionDTO&& other) noexcept = default;
+
+    UploadSessionDTO& operator=(const UploadSessionDTO& other) = default;
+    UploadSessionDTO& operator=(UploadSessionDTO&& other) noexcept = default;
+
+    std::filesystem::path rel_path;
+    std::string session_id;
+    uint64_t offset;
+    uint64_t size;
+    std::time_t local_modified_time;
+    int cloud_id;
+    bool confirmed;     // offset was acknowledged by the server in this run, not only loaded from the database
+};
+
+class DownloadProgressDTO {
+public:
+    DownloadProgressDTO(
+        const int cid,
+        const std::filesystem::path& rp,
+        const std::filesystem::path& tp,
+        const std::string& rev,
+        const uint64_t o,
+        const uint64_t s
+    ) :
+        rel_path(rp),
+        tmp_path(tp),
+        revision(rev),
+        offset(o),
+        size(s),
+        cloud_id(cid)
+    {
+    }
+
+    DownloadProgressDTO() = default;
+    ~DownloadProgressDTO() = default;
+
+    DownloadProgressDTO(const DownloadProgressDTO& other) = default;
+    DownloadProgressDTO(DownloadProgressDTO&& other) noexcept = default;
+
+    DownloadProgressDTO& operator=(const DownloadProgressDTO& other) = default;
+    DownloadProgressDTO& operator=(DownloadProgressDTO&& other) noexcept = default;
+
+    std::filesystem::path rel_path;
+    std::filesystem::path tmp_path;
+    std::string revision;   // remote content hash the partial file was downloaded from
+    uint64_t offset;        // bytes at the start of the tmp file known to be downloaded
+    uint64_t size;
+    int cloud_id;
+};
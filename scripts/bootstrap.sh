@@ -7,11 +7,11 @@ case "${unameOut}" in
         sudo apt-get update
         sudo apt-get install -y \
             build-essential cmake ninja-build curl libcurl4-openssl-dev \
-            libsqlite3-dev pkg-config git
+            libsqlite3-dev libssl-dev pkg-config git
         ;;
     Darwin*)
         brew update
-        brew install cmake ninja curl sqlite3
+        brew install cmake ninja curl sqlite3 openssl
         ;;
     MINGW*|MSYS*|CYGWIN*)
         echo "On Windows we recommend using vcpkg:"
@@ -21,7 +21,7 @@ case "${unameOut}" in
           ./bootstrap-vcpkg.sh
           popd
         fi
-        third_party/vcpkg/vcpkg install curl sqlite3
+        third_party/vcpkg/vcpkg install curl sqlite3 openssl
         ;;
     *)
         echo "Unknown OS: ${unameOut}"
@@ -64,6 +64,63 @@ ctest `
   -C $Config `
   -R "^UtilsUnitTest\."
 
+Write-Host "Running CloudGovernorUnitTests in parallel..."
+ctest `
+  --output-on-failure `
+  --parallel 4 `
+  -C $Config `
+  -R "^CloudGovernorUnitTest\."
+
+Write-Host "Running BandwidthSchedulerUnitTests in parallel..."
+ctest `
+  --output-on-failure `
+  --parallel 4 `
+  -C $Config `
+  -R "^BandwidthSchedulerUnitTest\."
+
+Write-Host "Running PendingQueueUnitTests in parallel..."
+ctest `
+  --output-on-failure `
+  --parallel 4 `
+  -C $Config `
+  -R "^PendingQueueUnitTest\."
+
+Write-Host "Running TokenManagerUnitTests sequentially..."
+ctest `
+  --output-on-failure `
+  -C $Config `
+  -R "^TokenManagerUnitTest\."
+
+Write-Host "Running UploadSourceUnitTests sequentially..."
+ctest `
+  --output-on-failure `
+  -C $Config `
+  -R "^UploadSourceUnitTest\."
+
+Write-Host "Running ContentHasherUnitTests sequentially..."
+ctest `
+  --output-on-failure `
+  -C $Config `
+  -R "^ContentHasherUnitTest\."
+
+Write-Host "Running BatchRequestUnitTests sequentially..."
+ctest `
+  --output-on-failure `
+  -C $Config `
+  -R "^BatchRequestUnitTest\."
+
+Write-Host "Running DownloadTargetUnitTests sequentially..."
+ctest `
+  --output-on-failure `
+  -C $Config `
+  -R "^DownloadTargetUnitTest\."
+
+Write-Host "Running JsonEntryStreamUnitTests sequentially..."
+ctest `
+  --output-on-failure `
+  -C $Config `
+  -R "^JsonEntryStreamUnitTest\."
+
 Write-Host "Running SyncManagerUnitTests sequentially..."
 ctest `
   --output-on-failure `
@@ -76,6 +133,12 @@ ctest `
   -C $Config `
   -R "^HttpClientIntegrationTest\."
 
+Write-Host "Running HttpClientShardedIntegrationTests sequentially..."
+ctest `
+  --output-on-failure `
+  -C $Config `
+  -R "^HttpClientShardedIntegrationTest\."
+
 Write-Host "Running LocalStorageIntegrationTests sequentially..."
 ctest `
     --output-on-failure `
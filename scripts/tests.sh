@@ -54,6 +54,54 @@ ctest -C "$cfg" \
   --parallel "$PARALLEL" \
   -R "^UtilsUnitTest\."
 
+echo "Running CloudGovernorUnitTests in parallel..."
+ctest -C "$cfg" \
+  --output-on-failure \
+  --parallel "$PARALLEL" \
+  -R "^CloudGovernorUnitTest\."
+
+echo "Running BandwidthSchedulerUnitTests in parallel..."
+ctest -C "$cfg" \
+  --output-on-failure \
+  --parallel "$PARALLEL" \
+  -R "^BandwidthSchedulerUnitTest\."
+
+echo "Running PendingQueueUnitTests in parallel..."
+ctest -C "$cfg" \
+  --output-on-failure \
+  --parallel "$PARALLEL" \
+  -R "^PendingQueueUnitTest\."
+
+echo "Running TokenManagerUnitTests sequentially..."
+ctest -C "$cfg" \
+  --output-on-failure \
+  -R "^TokenManagerUnitTest\."
+
+echo "Running UploadSourceUnitTests sequentially..."
+ctest -C "$cfg" \
+  --output-on-failure \
+  -R "^UploadSourceUnitTest\."
+
+echo "Running ContentHasherUnitTests sequentially..."
+ctest -C "$cfg" \
+  --output-on-failure \
+  -R "^ContentHasherUnitTest\."
+
+echo "Running BatchRequestUnitTests sequentially..."
+ctest -C "$cfg" \
+  --output-on-failure \
+  -R "^BatchRequestUnitTest\."
+
+echo "Running DownloadTargetUnitTests sequentially..."
+ctest -C "$cfg" \
+  --output-on-failure \
+  -R "^DownloadTargetUnitTest\."
+
+echo "Running JsonEntryStreamUnitTests sequentially..."
+ctest -C "$cfg" \
+  --output-on-failure \
+  -R "^JsonEntryStreamUnitTest\."
+
 echo "Running SyncManagerUnitTests sequentially..."
 ctest -C "$cfg" \
   --output-on-failure \
@@ -64,6 +112,11 @@ ctest -C "$cfg" \
   --output-on-failure \
   -R "^HttpClientIntegrationTest\."
 
+echo "Running HttpClientShardedIntegrationTests sequentially..."
+ctest -C "$cfg" \
+  --output-on-failure \
+  -R "^HttpClientShardedIntegrationTest\."
+
 echo "Running LocalStorageIntegrationTests sequentially..."
 ctest -C "$cfg" \
   --output-on-failure \
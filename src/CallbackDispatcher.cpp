@@ -2,13 +2,103 @@
 #include "commands.h"
 #include "logger.h"
 
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+namespace {
+    constexpr std::size_t MIN_CALLBACK_WORKERS = 2;
+    constexpr std::size_t MAX_CALLBACK_WORKERS = 8;
+
+    // Set on a callback worker while it runs a callback under the database lock.
+    thread_local bool t_holds_db_lock = false;
+}
 
 CallbackDispatcher& CallbackDispatcher::get() {
     static CallbackDispatcher instance;
     return instance;
 }
 
-CallbackDispatcher::CallbackDispatcher() {}
+CallbackDispatcher::CallbackDispatcher() {
+    createQueues(std::clamp<std::size_t>(std::thread::hardware_concurrency(), MIN_CALLBACK_WORKERS, MAX_CALLBACK_WORKERS));
+}
+
+void CallbackDispatcher::createQueues(std::size_t count) {
+    _queues.clear();
+    for (std::size_t i = 0; i < count; ++i) {
+        _queues.push_back(std::make_unique<ThreadSafeQueue<std::unique_ptr<ICommand>>>());
+    }
+}
+
+std::size_t CallbackDispatcher::shardOf(const ICommand& command) const {
+    return std::hash<std::string>{}(command.orderingKey()) % _queues.size();
+}
+
+void CallbackDispatcher::setWorkerCount(std::size_t count) {
+    if (_running.load() || !isIdle()) {
+        LOG_WARNING("CallbackDispatcher", "setWorkerCount() ignored while callbacks are running or pending");
+        return;
+    }
+    createQueues(std::max<std::size_t>(count, 1));
+}
+
+std::size_t CallbackDispatcher::workerCount() const noexcept {
+    return _queues.size();
+}
+
+void CallbackDispatcher::setGroupCommit(std::size_t max_batch_size, std::chrono::milliseconds max_latency) {
+    if (_running.load() || !isIdle()) {
+        LOG_WARNING("CallbackDispatcher", "setGroupCommit() ignored while callbacks are running or pending");
+        return;
+    }
+    _max_batch_size = std::max<std::size_t>(max_batch_size, 1);
+    _max_batch_latency = max_latency;
+}
+
+// Called under _db_mutex. A batch is only left open for a callback already waiting on the
+// lock, so the last callback before the dispatcher goes idle always commits.
+void CallbackDispatcher::commitBatchIfDue() {
+    if (_batch_callbacks == 0) {
+        return;
+    }
+    bool full = _batch_callbacks >= _max_batch_size;
+    bool late = std::chrono::steady_clock::now() - _batch_opened >= _max_batch_latency;
+    if (full || late || _db_waiters.load(std::memory_order_acquire) == 0) {
+        LOG_DEBUG("CallbackDispatcher", "Committing %zu callbacks in one transaction", _batch_callbacks);
+        _batch_callbacks = 0;
+        _db->commitBatch();
+        for (auto& done : std::exchange(_batch_writes, {})) {
+            done.set_value();
+        }
+    }
+}
+
+// Called under _db_mutex after a failed callback or batch statement; the rest of the batch goes with it.
+void CallbackDispatcher::abortBatch() {
+    if (!_db) {
+        return;
+    }
+    if (_batch_callbacks > 0 || _db->inBatch()) {
+        LOG_ERROR("CallbackDispatcher", "Rolling back a batch of %zu callbacks", _batch_callbacks);
+    }
+    _batch_callbacks = 0;
+    if (_db->inBatch()) {
+        _db->rollbackBatch();
+    }
+    for (auto& done : std::exchange(_batch_writes, {})) {
+        done.set_exception(std::make_exception_ptr(std::runtime_error("Database batch was rolled back")));
+    }
+}
+
+// Called under _db_mutex. A queued write only reports success once it is durable, not when it joins a batch.
+void CallbackDispatcher::resolveAfterCommit(std::promise<void> done) {
+    if (_max_batch_size > 1 && _db) {
+        _batch_writes.push_back(std::move(done));
+    }
+    else {
+        done.set_value();
+    }
+}
 
 void CallbackDispatcher::finish() {
     bool was_running = _running.exchange(false);
@@ -19,10 +109,15 @@ void CallbackDispatcher::finish() {
     
     LOG_INFO("CallbackDispatcher", "Shutting down dispatcher...");
     _should_stop.store(true, std::memory_order_release);
-    _queue.close();
-    if (_worker && _worker->joinable()) {
-        _worker->join();
+    for (auto& queue : _queues) {
+        queue->close();
     }
+    for (auto& worker : _workers) {
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+    _workers.clear();
 }
 
 void CallbackDispatcher::start() {
@@ -32,9 +127,22 @@ void CallbackDispatcher::start() {
         return;
     }
 
-    _should_stop.store(false, std::memory_order_release);
-    LOG_INFO("HttpClient", "Starting large worker...");
-    _worker = std::make_unique<std::thread>(&CallbackDispatcher::worker, this);
+    if (_should_stop.exchange(false)) {
+        // finish() closed the queues, callbacks submitted since then move to fresh ones.
+        auto closed = std::move(_queues);
+        createQueues(closed.size());
+        std::unique_ptr<ICommand> command;
+        for (auto& queue : closed) {
+            while (queue->try_pop(command)) {
+                _queues[shardOf(*command)]->push(std::move(command));
+            }
+        }
+    }
+
+    LOG_INFO("CallbackDispatcher", "Starting %zu callback workers...", _queues.size());
+    for (std::size_t shard = 0; shard < _queues.size(); ++shard) {
+        _workers.emplace_back(&CallbackDispatcher::worker, this, shard);
+    }
 }
 
 void CallbackDispatcher::setDB(const std::string& db_file_name) {
@@ -57,13 +165,14 @@ void CallbackDispatcher::submit(std::unique_ptr<ICommand> command) {
         CloudResolver::getName(command->getId())
     );
     _active_count.increment();
-    _queue.push(std::move(command));
+    _queues[shardOf(*command)]->push(std::move(command));
 }
 
-void CallbackDispatcher::worker() {
-    ThreadNamer::setThreadName("CallbackWorker");
+void CallbackDispatcher::worker(std::size_t shard) {
+    ThreadNamer::setThreadName("CallbackWorker " + std::to_string(shard));
+    auto& queue = *_queues[shard];
     std::unique_ptr<ICommand> command;
-    while (_queue.pop(command)) {
+    while (queue.pop(command)) {
         int cloud_id = command->getId();
         LOG_DEBUG(
             "CallbackDispatcher",
@@ -71,10 +180,65 @@ void CallbackDispatcher::worker() {
             command->getTarget(),
             CloudResolver::getName(command->getId())
         );
-        std::lock_guard lock(_db_mutex);
-        command->completionCallback(_db, _clouds[cloud_id]);
-        if (command->needRepeat()) {
-            HttpClient::get().submit(std::move(command));
+        auto it = _clouds.find(cloud_id);
+        std::shared_ptr<BaseStorage> cloud = it != _clouds.end() ? it->second : nullptr;
+
+        // Hashing and other file work overlaps across workers, only the database part is serialized.
+        command->prepareCallback(cloud);
+        auto target = command->getTarget();
+        _db_waiters.fetch_add(1, std::memory_order_acq_rel);
+        {
+            std::lock_guard lock(_db_mutex);
+            _db_waiters.fetch_sub(1, std::memory_order_acq_rel);
+            bool grouped = _max_batch_size > 1 && _db;
+            try {
+                if (grouped && _batch_callbacks == 0) {
+                    _db->beginBatch();
+                    _batch_opened = std::chrono::steady_clock::now();
+                }
+                if (grouped) {
+                    _db->beginBatchItem();
+                }
+                t_holds_db_lock = true;
+                bool failed = false;
+                try {
+                    command->completionCallback(_db, cloud);
+                    if (command->needPark()) {
+                        ICommand* parked = command.get();
+                        parked->park(std::move(command));
+                    }
+                    // A resubmitted command executes here, its database writes still run in place.
+                    else if (command->needRepeat()) {
+                        HttpClient::get().submit(std::move(command));
+                    }
+                }
+                catch (const std::exception& e) {
+                    LOG_ERROR("CallbackDispatcher", "Callback for: %s failed: %s", target, e.what());
+                    failed = true;
+                }
+                t_holds_db_lock = false;
+                if (failed) {
+                    // Its writes are undone and its change fails, as if the command was given up.
+                    if (grouped) {
+                        _db->rollbackBatchItem();
+                    }
+                    if (command) {
+                        command->abandon();
+                    }
+                }
+                else if (grouped) {
+                    _db->commitBatchItem();
+                }
+                if (grouped) {
+                    ++_batch_callbacks;
+                    commitBatchIfDue();
+                }
+            }
+            catch (const std::exception& e) {
+                t_holds_db_lock = false;
+                LOG_ERROR("CallbackDispatcher", "Database batch failed after callback for: %s: %s", target, e.what());
+                abortBatch();
+            }
         }
         _active_count.decrement();
     }
@@ -88,42 +252,53 @@ void CallbackDispatcher::waitUntilIdle() const {
     _active_count.waitUntilIdle();
 }
 
-void CallbackDispatcher::syncDbWrite(const std::unique_ptr<FileRecordDTO>& dto) {
-    CallbackDispatcher::get().waitUntilIdle();
-    std::lock_guard lock(_db_mutex);
-
-    if (dto->cloud_id == 0) {
-        int global_id = _db->add_file(*dto);
-        dto->global_id = global_id;
-    }
-    else {
-        _db->add_file_link(*dto);
+std::future<void> CallbackDispatcher::submitDbWrite(const std::string& key, std::function<void(const std::unique_ptr<Database>&)> write) {
+    auto command = std::make_unique<DbWriteCommand>(key, std::move(write));
+    auto result = command->result();
+    if (t_holds_db_lock) {
+        command->completionCallback(_db, nullptr);
     }
-}
-
-void CallbackDispatcher::syncDbWrite(const std::unique_ptr<FileUpdatedDTO>& dto) {
-    CallbackDispatcher::get().waitUntilIdle();
-    std::lock_guard lock(_db_mutex);
-
-    if (dto->cloud_id == 0) {
-        _db->update_file(*dto);
+    else if (!_running.load()) {
+        std::lock_guard lock(_db_mutex);
+        command->completionCallback(_db, nullptr);
     }
     else {
-        _db->update_file_link(*dto);
+        command->resolveAfterCommit();
+        submit(std::move(command));
     }
+    return result;
 }
 
-void CallbackDispatcher::syncDbWrite(const std::vector<std::unique_ptr<FileRecordDTO>>& vec_dto) {
-    CallbackDispatcher::get().waitUntilIdle();
-    std::lock_guard lock(_db_mutex);
+void CallbackDispatcher::syncDbWrite(const std::unique_ptr<FileRecordDTO>& dto) {
+    submitDbWrite(ICommand::entryKey(dto->global_id, dto->rel_path), [&dto](const std::unique_ptr<Database>& db) {
+        if (dto->cloud_id == 0) {
+            dto->global_id = db->add_file(*dto);
+        }
+        else {
+            db->add_file_link(*dto);
+        }
+        }).get();
+}
 
-    for (auto& dto : vec_dto) {
+void CallbackDispatcher::syncDbWrite(const std::unique_ptr<FileUpdatedDTO>& dto) {
+    submitDbWrite(ICommand::entryKey(dto->global_id, dto->rel_path), [&dto](const std::unique_ptr<Database>& db) {
         if (dto->cloud_id == 0) {
-            int global_id = _db->add_file(*dto);
-            dto->global_id = global_id;
+            db->update_file(*dto);
         }
         else {
-            _db->add_file_link(*dto);
+            db->update_file_link(*dto);
         }
+        }).get();
+}
+
+void CallbackDispatcher::syncDbWrite(const std::vector<std::unique_ptr<FileRecordDTO>>& vec_dto, const bool defer_indexes) {
+    if (vec_dto.empty()) {
+        return;
     }
-}
\ No newline at end of file
+    submitDbWrite(ICommand::entryKey(vec_dto.front()->global_id, vec_dto.front()->rel_path), [&vec_dto, defer_indexes](const std::unique_ptr<Database>& db) {
+        auto global_ids = db->ingest(vec_dto, defer_indexes);
+        for (std::size_t i = 0; i < vec_dto.size(); ++i) {
+            vec_dto[i]->global_id = global_ids[i];
+        }
+        }).get();
+}
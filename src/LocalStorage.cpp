@@ -41,6 +41,28 @@ LocalStorage::~LocalStorage() noexcept {
     stopWatching();
 }
 
+void LocalStorage::prepareUpload(std::unique_ptr<FileRecordDTO>& dto) const {
+    if (dto->type == EntryType::Directory || dto->streamed_hash) {
+        return;
+    }
+    auto full = dto->cloud_id != 0
+        ? _local_home_dir / dto->rel_path.parent_path() / (".-tmp-SyncHarbor-" + dto->rel_path.filename().string())
+        : _local_home_dir / dto->rel_path;
+    if (std::filesystem::is_regular_file(full)) {
+        dto->streamed_hash = this->computeFileHash(full);
+    }
+}
+
+void LocalStorage::prepareUpdate(std::unique_ptr<FileUpdatedDTO>& dto) const {
+    if (dto->cloud_id == 0 || dto->type == EntryType::Directory || dto->streamed_hash) {
+        return;
+    }
+    auto full = _local_home_dir / dto->rel_path.parent_path() / (".-tmp-SyncHarbor-" + dto->rel_path.filename().string());
+    if (std::filesystem::is_regular_file(full)) {
+        dto->streamed_hash = this->computeFileHash(full);
+    }
+}
+
 void LocalStorage::proccesUpdate(std::unique_ptr<FileUpdatedDTO>& dto, const std::string& response) const {
     if (dto->cloud_id != 0) {
         LOG_DEBUG(
@@ -68,7 +90,7 @@ void LocalStorage::proccesUpdate(std::unique_ptr<FileUpdatedDTO>& dto, const std
         std::filesystem::path full = _local_home_dir / dto->rel_path;
         dto->file_id = this->getFileId(full);
         dto->size = std::filesystem::file_size(full);
-        dto->cloud_hash_check_sum = this->computeFileHash(full);
+        dto->cloud_hash_check_sum = dto->streamed_hash ? *dto->streamed_hash : this->computeFileHash(full);
         dto->cloud_file_modified_time = convertSystemTime(full);
         dto->cloud_id = _id;
     }
@@ -99,27 +121,8 @@ void LocalStorage::proccesMove(std::unique_ptr<FileMovedDTO>& dto, const std::st
     dto->cloud_file_modified_time = convertSystemTime(full);
     dto->cloud_id = _id;
 
+    // Descendants are stored relative to this entry and move with it.
     _db->update_file(*dto);
-
-    if (std::filesystem::is_directory(full)) {
-        for (auto& entry : std::filesystem::recursive_directory_iterator(full)) {
-            full = entry.path();
-            auto new_rel_path = full.lexically_relative(_local_home_dir);
-            auto file_id = this->getFileId(full);
-            auto rec = _db->getFileByFileId(file_id);
-            if (rec) {
-                rec->rel_path = full.lexically_relative(_local_home_dir);
-                auto dto = std::make_unique<FileMovedDTO>(
-                    rec->type,
-                    rec->global_id,
-                    convertSystemTime(full),
-                    rec->rel_path,
-                    new_rel_path
-                );
-                _db->update_file(*dto);
-            }
-        }
-    }
 }
 
 void LocalStorage::proccesDelete(std::unique_ptr<FileDeletedDTO>& dto, const std::string& response) const {
@@ -484,6 +487,7 @@ void LocalStorage::handleDeleted(const FileEvent& evt) {
 
     auto full = evt.path;
     auto rel = full.lexically_relative(_local_home_dir);
+    awaitPendingWrite(rel);
 
     int global_id = 0;
     auto rec = _db->getFileByPath(rel);
@@ -566,6 +570,8 @@ void LocalStorage::handleMoved(const FileEvent& evt) {
     auto old_rel = full_old.lexically_relative(_local_home_dir);
 
     uint64_t file_id = this->getFileId(full_new);
+    // An update still in flight may be the one that recorded this file_id.
+    awaitPendingWrite(old_rel);
 
     auto rec = _db->getFileByFileId(file_id);
     if (!rec) {
@@ -605,7 +611,7 @@ void LocalStorage::proccesUpload(std::unique_ptr<FileRecordDTO>& dto, const std:
         std::filesystem::path full = _local_home_dir / dto->rel_path;
         dto->file_id = this->getFileId(full);
         dto->size = std::filesystem::file_size(full);
-        dto->cloud_hash_check_sum = this->computeFileHash(full);
+        dto->cloud_hash_check_sum = dto->streamed_hash ? *dto->streamed_hash : this->computeFileHash(full);
         dto->cloud_file_modified_time = convertSystemTime(full);
         dto->cloud_id = _id;
 
@@ -616,7 +622,7 @@ void LocalStorage::proccesUpload(std::unique_ptr<FileRecordDTO>& dto, const std:
     }
     else {
         dto->file_id = this->getFileId(_local_home_dir / dto->rel_path);
-        dto->cloud_hash_check_sum = this->computeFileHash(_local_home_dir / dto->rel_path);
+        dto->cloud_hash_check_sum = dto->streamed_hash ? *dto->streamed_hash : this->computeFileHash(_local_home_dir / dto->rel_path);
         dto->cloud_file_modified_time = convertSystemTime(_local_home_dir / dto->rel_path);
 
         int global_id = _db->add_file(*dto);
@@ -665,6 +671,7 @@ void LocalStorage::handleUpdated(const FileEvent& evt) {
     auto full = evt.path;
     auto rel = full.lexically_relative(_local_home_dir);
     uint64_t file_id = this->getFileId(full);
+    awaitPendingWrite(rel);
 
     auto rec = _db->getFileByFileId(file_id);
     if (!rec) {
@@ -696,12 +703,35 @@ void LocalStorage::handleUpdated(const FileEvent& evt) {
         file_id
     );
 
-    CallbackDispatcher::get().syncDbWrite(dto);
+    _pending_writes[rec->global_id] = CallbackDispatcher::get().submitDbWrite(ICommand::entryKey(rec->global_id, rel), [update = *dto](const std::unique_ptr<Database>& db) {
+        db->update_file(update);
+        });
 
     auto ch = ChangeFactory::makeLocalUpdate(std::move(dto));
     _changes_queue.push(std::move(ch));
 }
 
+// Local updates never change an entry's path, so the path still finds the global_id they are keyed by.
+void LocalStorage::awaitPendingWrite(const std::filesystem::path& rel) {
+    if (_pending_writes.empty()) {
+        return;
+    }
+    if (auto rec = _db->getFileByPath(rel)) {
+        awaitPendingWrite(rec->global_id);
+    }
+}
+
+// Read-your-writes for one entry: waits for its earlier update only, finished ones are dropped.
+void LocalStorage::awaitPendingWrite(int global_id) {
+    std::erase_if(_pending_writes, [global_id](auto& entry) {
+        if (entry.first == global_id) {
+            entry.second.wait();
+            return true;
+        }
+        return entry.second.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+        });
+}
+
 bool LocalStorage::hasChanges() const {
     return !_events_buff.empty();
 }
\ No newline at end of file
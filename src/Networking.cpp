@@ -1,12 +1,46 @@
 #include "Networking.h"
 #include "commands.h"
 #include "logger.h"
+#include "token-manager.h"
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
+#include <cstring>
+#include <optional>
+#include <algorithm>
+#include <cmath>
+
+namespace {
+    constexpr int MAX_AUTH_RETRIES = 1;
+    constexpr auto TOKEN_REFRESH_WAIT = std::chrono::seconds(30);
+    constexpr auto DEFAULT_BATCH_WINDOW = std::chrono::milliseconds(20);
+    constexpr std::uint64_t DEFAULT_RANGED_DOWNLOAD_THRESHOLD = 64ULL * 1024 * 1024;
+    constexpr std::size_t DEFAULT_MAX_DOWNLOAD_RANGES = 8;
+    constexpr std::uint64_t MIN_DOWNLOAD_RANGE = 4ULL * 1024 * 1024;
+    constexpr std::uint64_t MIN_THROUGHPUT_SAMPLE = 1024 * 1024;
+    constexpr double THROUGHPUT_SMOOTHING = 0.3;
+    constexpr double TARGET_RANGE_SECONDS = 4.0;
+#ifndef __linux__
+    // curl_multi_poll() takes no infinite timeout, an idle worker wakes up this often.
+    constexpr int IDLE_POLL_TIMEOUT_MS = 1000;
+#endif
+
+    // Transfers cut off mid-body; a download resumes after the bytes it already wrote.
+    bool interruptedTransfer(CURLcode result) {
+        return result == CURLE_PARTIAL_FILE || result == CURLE_RECV_ERROR || result == CURLE_GOT_NOTHING || result == CURLE_OPERATION_TIMEDOUT;
+    }
+}
 
 HttpClient::HttpClient()
+    : _shard_count(static_cast<int>(std::clamp(std::thread::hardware_concurrency() / 2, 1u, 4u))),
+    _batch_window(DEFAULT_BATCH_WINDOW),
+    _ranged_download_threshold(DEFAULT_RANGED_DOWNLOAD_THRESHOLD),
+    _max_download_ranges(DEFAULT_MAX_DOWNLOAD_RANGES)
 {
     curl_global_init(CURL_GLOBAL_DEFAULT);
-
-    _large_multi_handle = curl_multi_init();
 }
 
 void HttpClient::syncRequest(const std::unique_ptr<RequestHandle>& handle) {
@@ -15,23 +49,29 @@ void HttpClient::syncRequest(const std::unique_ptr<RequestHandle>& handle) {
         return;
     }
 
+    _bandwidth.transferStarted(handle->_traffic_class);
     while (true) {
         CURLcode res = curl_easy_perform(handle->_curl);
         if (res != CURLE_OK) {
             LOG_ERROR("HttpClient", "curl_easy_perform() failed with code: %i and err msg: %s", res, curl_easy_strerror(res));
             break;
         }
+        recordConnectionReuse(handle->_curl);
+
         long http_code = 0;
         curl_easy_getinfo(handle->_curl, CURLINFO_RESPONSE_CODE, &http_code);
 
-        if (http_code == 403 || http_code == 429 || http_code == 408 || http_code >= 500 && http_code < 600) {
+        if (CloudGovernor::isCongestionCode(http_code)) {
             LOG_WARNING("HttpClient", "HTTP code %i, scheduling retry", http_code);
 
-            handle->scheduleRetry();
+            if (!handle->scheduleRetry()) {
+                LOG_ERROR("HttpClient", "Retries exhausted, HTTP code %i with response: %s", http_code, handle->_response);
+                break;
+            }
             std::this_thread::sleep_until(handle->_timer);
             continue;
         }
-        else if (http_code != 200) {
+        else if (!handle->accepts(http_code)) {
             LOG_ERROR("HttpClient", "Unexpected HTTP code %i with response: %s", http_code, handle->_response);
             break;
         }
@@ -44,7 +84,7 @@ void HttpClient::syncRequest(const std::unique_ptr<RequestHandle>& handle) {
             break;
         }
     }
-
+    _bandwidth.transferFinished(handle->_traffic_class);
 }
 
 void HttpClient::shutdown() {
@@ -57,18 +97,34 @@ void HttpClient::shutdown() {
     LOG_INFO("HttpClient", "Shutting down...");
 
     _should_stop.store(true, std::memory_order_release);
-    _large_queue.close();
+    {
+        std::lock_guard<std::mutex> lock(_shards_mtx);
+        for (auto& shard : _shards) {
+            shard->queue.close();
+            wakeWorker(*shard);
+        }
+    }
 
-    if (_large_worker && _large_worker->joinable()) {
-        _large_worker->join();
+    for (auto& shard : _shards) {
+        if (shard->worker && shard->worker->joinable()) {
+            shard->worker->join();
+        }
     }
 
-    LOG_INFO("HttpClient", "Worker thread joined, cleaning up CURL");
+    LOG_INFO("HttpClient", "Worker threads joined, cleaning up CURL");
+    LOG_INFO(
+        "HttpClient",
+        "Connections reused for %llu of %llu transfers, %llu connections opened",
+        static_cast<unsigned long long>(reusedConnectionsCount()),
+        static_cast<unsigned long long>(transfersCount()),
+        static_cast<unsigned long long>(openedConnectionsCount())
+    );
 
     curl_slist_free_all(RequestHandle::_global_resolve);
     RequestHandle::_global_resolve = nullptr;
 
-    curl_multi_cleanup(_large_multi_handle);
+    destroyShards();
+    clearEasyHandlePool();
     curl_global_cleanup();
 
     CallbackDispatcher::get().finish();
@@ -84,12 +140,175 @@ void HttpClient::start() {
     }
 
     _should_stop.store(false, std::memory_order_release);
-    LOG_INFO("HttpClient", "Starting large worker...");
-    _large_worker = std::make_unique<std::thread>(&HttpClient::largeRequestsWorker, this);
+
+    std::lock_guard<std::mutex> lock(_shards_mtx);
+    if (_shards.empty()) {
+        createShards();
+    }
+    LOG_INFO("HttpClient", "Starting %i large workers...", static_cast<int>(_shards.size()));
+    for (auto& shard : _shards) {
+        shard->worker = std::make_unique<std::thread>(&HttpClient::largeRequestsWorker, this, std::ref(*shard));
+    }
+}
+
+void HttpClient::setShardCount(int count) {
+    std::lock_guard<std::mutex> lock(_shards_mtx);
+    if (!_shards.empty()) {
+        LOG_WARNING("HttpClient", "setShardCount() called while shards are active, ignoring");
+        return;
+    }
+    _shard_count = std::max(count, 1);
+}
+
+int HttpClient::shardCount() const {
+    std::lock_guard<std::mutex> lock(_shards_mtx);
+    return _shards.empty() ? _shard_count : static_cast<int>(_shards.size());
+}
+
+void HttpClient::setShardAssignment(ShardAssignment assignment) {
+    std::lock_guard<std::mutex> lock(_shards_mtx);
+    _shard_assignment = assignment;
+}
+
+void HttpClient::setConnectionLimits(const ConnectionLimits& limits) {
+    {
+        std::lock_guard<std::mutex> lock(_shards_mtx);
+        _connection_limits = limits;
+        _limits_version.fetch_add(1, std::memory_order_release);
+    }
+    wakeAllWorkers();
+}
+
+ConnectionLimits HttpClient::connectionLimits() const {
+    std::lock_guard<std::mutex> lock(_shards_mtx);
+    return _connection_limits;
+}
+
+void HttpClient::setBatchWindow(std::chrono::milliseconds window) {
+    std::lock_guard<std::mutex> lock(_shards_mtx);
+    _batch_window = window;
+}
+
+void HttpClient::setRangedDownloads(std::uint64_t threshold, std::size_t max_ranges) {
+    _ranged_download_threshold = threshold;
+    _max_download_ranges = std::max<std::size_t>(max_ranges, 1);
+}
+
+// Splits large downloads into ranges of at least MIN_DOWNLOAD_RANGE, but no further than
+// the measured per-stream throughput needs to keep each range busy for a few seconds.
+std::size_t HttpClient::downloadRanges(int cloud_id, std::uint64_t size) const {
+    if (size < _ranged_download_threshold) {
+        return 1;
+    }
+    std::uint64_t ranges = std::min<std::uint64_t>(_max_download_ranges, size / MIN_DOWNLOAD_RANGE);
+    if (std::uint64_t throughput = streamThroughput(cloud_id)) {
+        auto by_throughput = static_cast<std::uint64_t>(std::ceil(size / (throughput * TARGET_RANGE_SECONDS)));
+        ranges = std::min(ranges, by_throughput);
+    }
+    return static_cast<std::size_t>(std::max<std::uint64_t>(ranges, 1));
+}
+
+std::uint64_t HttpClient::streamThroughput(int cloud_id) const {
+    std::lock_guard<std::mutex> lock(_throughput_mtx);
+    auto it = _stream_throughput.find(cloud_id);
+    return it != _stream_throughput.end() ? static_cast<std::uint64_t>(it->second) : 0;
+}
+
+void HttpClient::recordStreamThroughput(int cloud_id, CURL* curl) {
+    curl_off_t downloaded = 0;
+    curl_off_t speed = 0;
+    if (curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &downloaded) != CURLE_OK ||
+        curl_easy_getinfo(curl, CURLINFO_SPEED_DOWNLOAD_T, &speed) != CURLE_OK ||
+        downloaded < static_cast<curl_off_t>(MIN_THROUGHPUT_SAMPLE) || speed <= 0) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(_throughput_mtx);
+    auto [it, inserted] = _stream_throughput.try_emplace(cloud_id, static_cast<double>(speed));
+    if (!inserted) {
+        it->second += THROUGHPUT_SMOOTHING * (static_cast<double>(speed) - it->second);
+    }
+}
+
+void HttpClient::applyConnectionLimits(Shard& shard, const ConnectionLimits& limits) const {
+    const long shards = std::max(_shard_count, 1);
+    auto perShard = [shards](long limit) {
+        return limit > 0 ? std::max((limit + shards - 1) / shards, 1L) : 0L;
+    };
+
+    curl_multi_setopt(shard.multi_handle, CURLMOPT_PIPELINING, limits.multiplex ? CURLPIPE_MULTIPLEX : CURLPIPE_NOTHING);
+    curl_multi_setopt(shard.multi_handle, CURLMOPT_MAX_HOST_CONNECTIONS, perShard(limits.max_host_connections));
+    curl_multi_setopt(shard.multi_handle, CURLMOPT_MAX_TOTAL_CONNECTIONS, perShard(limits.max_total_connections));
+    curl_multi_setopt(shard.multi_handle, CURLMOPT_MAX_CONCURRENT_STREAMS, limits.max_concurrent_streams);
+}
+
+void HttpClient::createShards() {
+    for (int i = 0; i < _shard_count; ++i) {
+        auto shard = std::make_unique<Shard>();
+        shard->index = i;
+
+        shard->multi_handle = curl_multi_init();
+        applyConnectionLimits(*shard, _connection_limits);
+        shard->limits_version = _limits_version.load(std::memory_order_acquire);
+
+#ifdef __linux__
+        curl_multi_setopt(shard->multi_handle, CURLMOPT_SOCKETFUNCTION, HttpClient::socketCallback);
+        curl_multi_setopt(shard->multi_handle, CURLMOPT_SOCKETDATA, shard.get());
+        curl_multi_setopt(shard->multi_handle, CURLMOPT_TIMERFUNCTION, HttpClient::timerCallback);
+        curl_multi_setopt(shard->multi_handle, CURLMOPT_TIMERDATA, shard.get());
+
+        shard->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        shard->wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (shard->epoll_fd < 0 || shard->wakeup_fd < 0) {
+            throw std::runtime_error("Failed to create HttpClient event loop descriptors");
+        }
+
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.fd = shard->wakeup_fd;
+        epoll_ctl(shard->epoll_fd, EPOLL_CTL_ADD, shard->wakeup_fd, &ev);
+#endif
+
+        _shards.push_back(std::move(shard));
+    }
+}
+
+void HttpClient::destroyShards() {
+    std::lock_guard<std::mutex> lock(_shards_mtx);
+    for (auto& shard : _shards) {
+        curl_multi_cleanup(shard->multi_handle);
+#ifdef __linux__
+        close(shard->wakeup_fd);
+        close(shard->epoll_fd);
+#endif
+    }
+    _shards.clear();
+}
+
+HttpClient::Shard& HttpClient::pickShard(int cloud_id) {
+    if (_shard_assignment == ShardAssignment::ByCloud) {
+        return *_shards[std::hash<int>{}(cloud_id) % _shards.size()];
+    }
+
+    Shard* least_loaded = _shards.front().get();
+    for (auto& shard : _shards) {
+        if (shard->load.load(std::memory_order_relaxed) < least_loaded->load.load(std::memory_order_relaxed)) {
+            least_loaded = shard.get();
+        }
+    }
+    return *least_loaded;
+}
+
+std::size_t HttpClient::shardConcurrencyLimit() const {
+    return std::max<std::size_t>(_MAX_CONCURRENT / std::max<std::size_t>(_shards.size(), 1), 1);
+}
+
+std::size_t HttpClient::shardReservedSlots() const {
+    return static_cast<std::size_t>(CloudGovernor::reservedSlots(static_cast<int>(shardConcurrencyLimit())));
 }
 
 HttpClient::~HttpClient() {
     this->shutdown();
+    clearEasyHandlePool();
 }
 
 bool HttpClient::isIdle() const noexcept {
@@ -108,13 +327,77 @@ void HttpClient::submit(std::unique_ptr<ICommand> command) {
         command->getTarget(),
         CloudResolver::getName(command->getId())
     );
-    command->execute(_clouds[cloud_id]);
+    std::uint64_t auth_generation = tokenGeneration(cloud_id);
+    const auto& cloud = _clouds[cloud_id];
+    command->execute(cloud);
     if (!command->getHandle()._curl) {
         LOG_ERROR("HttpClient", "No CURL handle in multi_perform: for target:", command->getTarget());
         return;
     }
+    command->getHandle()._traffic_class = classify(*command);
+    command->getHandle()._auth_generation = auth_generation;
+
+    std::optional<BatchPart> batch_part;
+    if (cloud && cloud->remote() && command->batchable() && cloud->remote()->maxBatchParts() > 1) {
+        batch_part = command->batchPart(cloud);
+    }
+
+    std::lock_guard<std::mutex> lock(_shards_mtx);
+    // Only metadata waits to share a multiplexed connection; HTTP/1.1 keeps parallel streams on separate ones.
+    if (command->ownConnection()) {
+        curl_easy_setopt(command->getHandle()._curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_1_1);
+    }
+    else if (command->getHandle()._traffic_class == TrafficClass::Metadata && waitsForMultiplex(cloud_id)) {
+        curl_easy_setopt(command->getHandle()._curl, CURLOPT_PIPEWAIT, 1L);
+    }
+    if (_shards.empty()) {
+        createShards();
+    }
+
+    if (batch_part) {
+        // Batchable requests of one cloud always meet on the same shard so they can share a request.
+        Shard& shard = *_shards[std::hash<int>{}(cloud_id) % _shards.size()];
+        shard.load.fetch_add(1, std::memory_order_relaxed);
+        _large_active_count.increment();
+        {
+            std::lock_guard<std::mutex> batch_lock(shard.batch_mtx);
+            auto& batch = shard.batches[{ cloud_id, batch_part->group }];
+            if (batch.commands.empty()) {
+                batch.deadline = std::chrono::steady_clock::now() + _batch_window;
+            }
+            batch.commands.push_back(std::move(command));
+            batch.parts.push_back(std::move(*batch_part));
+        }
+        wakeWorker(shard);
+        return;
+    }
+
+    Shard& shard = pickShard(cloud_id);
+    shard.load.fetch_add(1, std::memory_order_relaxed);
     _large_active_count.increment();
-    _large_queue.push(std::move(command));
+    shard.queue.push(std::move(command));
+    wakeWorker(shard);
+}
+
+void HttpClient::wakeWorker(Shard& shard) {
+#ifdef __linux__
+    uint64_t one = 1;
+    if (write(shard.wakeup_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        LOG_ERROR("HttpClient", "Failed to wake worker %i: %s", shard.index, std::strerror(errno));
+    }
+#else
+    CURLMcode mc = curl_multi_wakeup(shard.multi_handle);
+    if (mc != CURLM_OK) {
+        LOG_ERROR("HttpClient", "Failed to wake worker %i, code: %i", shard.index, mc);
+    }
+#endif
+}
+
+void HttpClient::wakeAllWorkers() {
+    std::lock_guard<std::mutex> lock(_shards_mtx);
+    for (auto& shard : _shards) {
+        wakeWorker(*shard);
+    }
 }
 
 HttpClient& HttpClient::get() {
@@ -124,107 +407,697 @@ HttpClient& HttpClient::get() {
 
 void HttpClient::setClouds(const std::unordered_map<int, std::shared_ptr<BaseStorage>>& clouds) {
     _clouds = clouds;
+    for (const auto& [cloud_id, cloud] : _clouds) {
+        _governor.registerCloud(cloud_id, cloud->getType());
+    }
 }
 
-void HttpClient::largeRequestsWorker() {
-    ThreadNamer::setThreadName("HttpClient Worker");
-    LOG_INFO("HttpClient", "Started");
-    int still_running = 0;
+void HttpClient::setCloudQuota(CloudProviderType type, const CloudQuota& quota) {
+    _governor.setQuota(type, quota);
+    wakeAllWorkers();
+}
 
-    while (!_should_stop.load(std::memory_order_acquire) || !_large_queue.empty() || still_running > 0 || !_delayed_requests.empty()) {
-        std::unique_ptr<ICommand> request_command;
-        if (_large_active_count.isIdle()) {
-            if (_large_queue.pop(request_command)) {
-                LOG_DEBUG("HttpClient", "Adding CURL handle for file: %s and cloud: %s", request_command->getTarget(), CloudResolver::getName(request_command->getId()));
-                curl_multi_add_handle(_large_multi_handle, request_command->getHandle()._curl);
-                _active_handles.emplace(request_command->getHandle()._curl, std::move(request_command));
-            }
+CloudGovernorStats HttpClient::cloudStats(int cloud_id) {
+    return _governor.stats(cloud_id);
+}
+
+BandwidthScheduler& HttpClient::bandwidth() noexcept {
+    return _bandwidth;
+}
+
+void HttpClient::setBandwidthLimit(TrafficDirection direction, std::uint64_t bytes_per_second) {
+    _bandwidth.setLimit(direction, bytes_per_second);
+    wakeAllWorkers();
+}
+
+void HttpClient::setTrafficWeight(TrafficClass traffic_class, unsigned weight) {
+    _bandwidth.setWeight(traffic_class, weight);
+    wakeAllWorkers();
+}
+
+void HttpClient::setInitialSync(bool initial_sync) noexcept {
+    _initial_sync.store(initial_sync, std::memory_order_relaxed);
+}
+
+void HttpClient::tokensRefreshed([[maybe_unused]] int cloud_id) {
+    LOG_DEBUG("HttpClient", "Access token refreshed for cloud: %s", CloudResolver::getName(cloud_id));
+    wakeAllWorkers();
+}
+
+std::uint64_t HttpClient::tokenGeneration(int cloud_id) const {
+    auto it = _clouds.find(cloud_id);
+    return it != _clouds.end() && it->second ? it->second->tokenGeneration() : 0;
+}
+
+bool HttpClient::waitsForMultiplex(int cloud_id) const {
+    auto it = _clouds.find(cloud_id);
+    return _connection_limits.multiplex && it != _clouds.end() && it->second && it->second->remote() && it->second->remote()->supportsMultiplexing();
+}
+
+void HttpClient::refreshAuthorization(int cloud_id, RequestHandle& handle) {
+    auto it = _clouds.find(cloud_id);
+    if (it == _clouds.end() || !it->second) {
+        return;
+    }
+
+    std::uint64_t generation = it->second->tokenGeneration();
+    if (handle._auth_generation >= generation) {
+        return;
+    }
+    handle.replaceHeader("Authorization", it->second->authorizationHeader());
+    handle._auth_generation = generation;
+}
+
+bool HttpClient::canAwaitTokenRefresh(int cloud_id, const RequestHandle& handle) {
+    if (handle._auth_retries >= MAX_AUTH_RETRIES) {
+        return false;
+    }
+    return handle._auth_generation < tokenGeneration(cloud_id) || TokenManager::get().requestRefresh(cloud_id);
+}
+
+TrafficClass HttpClient::classify(const ICommand& command) const {
+    std::uint64_t size = command.getTransferSize();
+    if (size == 0) {
+        return TrafficClass::Metadata;
+    }
+    if (_initial_sync.load(std::memory_order_relaxed)) {
+        return TrafficClass::InitialSync;
+    }
+    return size <= _SMALL_FILE_SIZE ? TrafficClass::SmallFile : TrafficClass::Bulk;
+}
+
+void HttpClient::largeRequestsWorker(Shard& shard) {
+    ThreadNamer::setThreadName("HttpClient Worker " + std::to_string(shard.index));
+    LOG_INFO("HttpClient", "Worker %i started", shard.index);
+
+    while (!_should_stop.load(std::memory_order_acquire) || !shard.queue.empty() || !shard.active_handles.empty() || !shard.delayed_requests.empty() || !shard.awaiting_token.empty() || hasPendingCommands(shard) || hasPendingBatches(shard)) {
+        std::uint64_t limits_version = _limits_version.load(std::memory_order_acquire);
+        if (shard.limits_version != limits_version) {
+            applyConnectionLimits(shard, connectionLimits());
+            shard.limits_version = limits_version;
         }
-        else {
-            while (_large_queue.try_pop(request_command) && _large_active_count.get() < _MAX_CONCURRENT) {
-                LOG_DEBUG("HttpClient", "Adding CURL handle for file: %s and cloud: %s", request_command->getTarget(), CloudResolver::getName(request_command->getId()));
-                curl_multi_add_handle(_large_multi_handle, request_command->getHandle()._curl);
-                _active_handles.emplace(request_command->getHandle()._curl, std::move(request_command));
-            }
+        flushBatches(shard);
+        addPendingHandles(shard);
+
+        if (!waitForActivity(shard)) {
+            break;
+        }
+
+        resumePausedTransfers(shard);
+        processCompletedTransfers(shard);
+        checkDelayedRequests(shard);
+        checkAwaitingToken(shard);
+    }
+}
+
+#ifdef __linux__
+bool HttpClient::waitForActivity(Shard& shard) {
+    constexpr int MAX_EVENTS = 64;
+    epoll_event events[MAX_EVENTS];
+
+    int nfds = epoll_wait(shard.epoll_fd, events, MAX_EVENTS, nextWaitTimeout(shard));
+    if (nfds < 0) {
+        if (errno == EINTR) {
+            return true;
+        }
+        LOG_ERROR("HttpClient", "epoll_wait() failed: %s", std::strerror(errno));
+        return false;
+    }
+
+    for (int i = 0; i < nfds; ++i) {
+        int fd = events[i].data.fd;
+        if (fd == shard.wakeup_fd) {
+            uint64_t value;
+            while (read(shard.wakeup_fd, &value, sizeof(value)) > 0) {}
+            continue;
         }
 
-        CURLMcode mc = curl_multi_perform(_large_multi_handle, &still_running);
+        int flags = 0;
+        if (events[i].events & EPOLLIN) {
+            flags |= CURL_CSELECT_IN;
+        }
+        if (events[i].events & EPOLLOUT) {
+            flags |= CURL_CSELECT_OUT;
+        }
+        if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+            flags |= CURL_CSELECT_ERR;
+        }
+
+        CURLMcode mc = curl_multi_socket_action(shard.multi_handle, fd, flags, &shard.still_running);
         if (mc != CURLM_OK) {
-            LOG_ERROR("HttpClient", "curl_muli_perform() failed, code: %i", mc);
-            break;
+            LOG_ERROR("HttpClient", "curl_multi_socket_action() failed, code: %i", mc);
         }
+    }
 
-        int numfds = 0;
-        mc = curl_multi_wait(_large_multi_handle, nullptr, 0, 1000, &numfds);
+    if (shard.curl_timer_armed && std::chrono::steady_clock::now() >= shard.curl_timer) {
+        shard.curl_timer_armed = false;
+        CURLMcode mc = curl_multi_socket_action(shard.multi_handle, CURL_SOCKET_TIMEOUT, 0, &shard.still_running);
         if (mc != CURLM_OK) {
-            LOG_ERROR("HttpClient", "curl_muli_wait() failed, code: %i", mc);
-            break;
+            LOG_ERROR("HttpClient", "curl_multi_socket_action() timeout failed, code: %i", mc);
         }
-        CURLMsg* msg;
-        int msgs_left;
-        while ((msg = curl_multi_info_read(_large_multi_handle, &msgs_left))) {
-            if (msg->msg == CURLMSG_DONE) {
-                CURL* easy = msg->easy_handle;
-                curl_multi_remove_handle(_large_multi_handle, easy);
-
-                if (_active_handles[easy]->getTarget() != "CONFIG") {
-                    LOG_INFO("HttpClient",
-                        "Request completed for file: %s and cloud: %s",
-                        _active_handles[easy]->getTarget(),
-                        CloudResolver::getName(_active_handles[easy]->getId())
+    }
+    return true;
+}
+#else
+// Without epoll curl polls its own sockets, wakeWorker() interrupts the wait through curl_multi_wakeup().
+bool HttpClient::waitForActivity(Shard& shard) {
+    int timeout = nextWaitTimeout(shard);
+    CURLMcode mc = curl_multi_poll(shard.multi_handle, nullptr, 0, timeout < 0 ? IDLE_POLL_TIMEOUT_MS : timeout, nullptr);
+    if (mc != CURLM_OK) {
+        LOG_ERROR("HttpClient", "curl_multi_poll() failed, code: %i", mc);
+        return false;
+    }
+    mc = curl_multi_perform(shard.multi_handle, &shard.still_running);
+    if (mc != CURLM_OK) {
+        LOG_ERROR("HttpClient", "curl_multi_perform() failed, code: %i", mc);
+    }
+    return true;
+}
+#endif
+
+std::size_t HttpClient::maxBatchParts(int cloud_id) const {
+    auto it = _clouds.find(cloud_id);
+    return it != _clouds.end() && it->second && it->second->remote() ? it->second->remote()->maxBatchParts() : 0;
+}
+
+void HttpClient::flushBatches(Shard& shard) {
+    std::vector<std::pair<int, PendingBatch>> ready;
+    const bool force = _should_stop.load(std::memory_order_acquire);
+    const auto now = std::chrono::steady_clock::now();
+    {
+        std::lock_guard<std::mutex> lock(shard.batch_mtx);
+        for (auto it = shard.batches.begin(); it != shard.batches.end();) {
+            auto& [key, batch] = *it;
+            const int cloud_id = key.first;
+            const std::size_t max_parts = std::max<std::size_t>(maxBatchParts(cloud_id), 1);
+
+            while (batch.commands.size() >= max_parts || (!batch.commands.empty() && (force || now >= batch.deadline))) {
+                std::size_t count = std::min(batch.commands.size(), max_parts);
+                PendingBatch part;
+                part.commands.assign(std::make_move_iterator(batch.commands.begin()), std::make_move_iterator(batch.commands.begin() + count));
+                part.parts.assign(std::make_move_iterator(batch.parts.begin()), std::make_move_iterator(batch.parts.begin() + count));
+                batch.commands.erase(batch.commands.begin(), batch.commands.begin() + count);
+                batch.parts.erase(batch.parts.begin(), batch.parts.begin() + count);
+                ready.emplace_back(cloud_id, std::move(part));
+            }
+
+            it = batch.commands.empty() ? shard.batches.erase(it) : std::next(it);
+        }
+    }
+
+    for (auto& [cloud_id, batch] : ready) {
+        dispatchBatch(shard, cloud_id, std::move(batch));
+    }
+}
+
+void HttpClient::dispatchBatch(Shard& shard, int cloud_id, PendingBatch batch) {
+    const std::size_t count = batch.commands.size();
+    auto cloud = _clouds.find(cloud_id);
+    if (count == 1 || cloud == _clouds.end() || !cloud->second) {
+        for (auto& command : batch.commands) {
+            enqueuePending(shard, std::move(command));
+        }
+        return;
+    }
+
+    auto command = std::make_unique<CloudBatchCommand>(cloud_id, std::move(batch.commands), std::move(batch.parts));
+    std::uint64_t auth_generation = tokenGeneration(cloud_id);
+    command->execute(cloud->second);
+    command->getHandle()._traffic_class = TrafficClass::Metadata;
+    command->getHandle()._auth_generation = auth_generation;
+    if (connectionLimits().multiplex && cloud->second->remote()->supportsMultiplexing()) {
+        curl_easy_setopt(command->getHandle()._curl, CURLOPT_PIPEWAIT, 1L);
+    }
+
+    // The batch replaces its parts in the load and idle accounting as a single request.
+    shard.load.fetch_sub(static_cast<int>(count - 1), std::memory_order_relaxed);
+    for (std::size_t i = 1; i < count; ++i) {
+        _large_active_count.decrement();
+    }
+    _batched_commands_count.fetch_add(count, std::memory_order_relaxed);
+
+    LOG_DEBUG("HttpClient", "Batching %zu requests for cloud: %s", count, CloudResolver::getName(cloud_id));
+    enqueuePending(shard, std::move(command));
+}
+
+bool HttpClient::hasPendingBatches(Shard& shard) {
+    std::lock_guard<std::mutex> lock(shard.batch_mtx);
+    return !shard.batches.empty();
+}
+
+void HttpClient::enqueuePending(Shard& shard, std::unique_ptr<ICommand> command) {
+    int cloud_id = command->getId();
+    TrafficClass traffic_class = command->getHandle()._traffic_class;
+    std::uint64_t size = command->getTransferSize();
+    shard.pending[cloud_id].push(std::move(command), traffic_class, size);
+}
+
+void HttpClient::addPendingHandles(Shard& shard) {
+    std::unique_ptr<ICommand> request_command;
+    auto now = std::chrono::steady_clock::now();
+    while (shard.queue.try_pop(request_command)) {
+        if (request_command->getHandle()._timer > now) {
+            shard.delayed_requests.push_back(std::move(request_command));
+            std::push_heap(shard.delayed_requests.begin(), shard.delayed_requests.end(), DelayedLater{});
+            continue;
+        }
+        enqueuePending(shard, std::move(request_command));
+    }
+
+    const std::size_t limit = shardConcurrencyLimit();
+    const std::size_t low_priority_limit = limit - shardReservedSlots();
+
+    bool progress = true;
+    while (progress && shard.active_handles.size() < limit) {
+        progress = false;
+        for (auto& [cloud_id, pending] : shard.pending) {
+            if (pending.empty() || shard.active_handles.size() >= limit) {
+                continue;
+            }
+            bool high_priority = pending.topClass() == TrafficClass::Metadata;
+            if (!high_priority && shard.active_handles.size() >= low_priority_limit) {
+                continue;
+            }
+            if (!_governor.tryAcquire(cloud_id, CloudGovernor::Clock::now(), high_priority)) {
+                continue;
+            }
+
+            request_command = pending.pop();
+            progress = true;
+
+            LOG_DEBUG("HttpClient", "Adding CURL handle for file: %s and cloud: %s", request_command->getTarget(), CloudResolver::getName(cloud_id));
+            RequestHandle& handle = request_command->getHandle();
+            refreshAuthorization(cloud_id, handle);
+            handle._in_multi = true;
+            _bandwidth.transferStarted(handle._traffic_class);
+            CURL* easy = handle._curl;
+            shard.active_handles.emplace(easy, std::move(request_command));
+            curl_multi_add_handle(shard.multi_handle, easy);
+        }
+    }
+}
+
+bool HttpClient::hasPendingCommands(const Shard& shard) const {
+    for (const auto& [cloud_id, pending] : shard.pending) {
+        if (!pending.empty()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int HttpClient::nextWaitTimeout(Shard& shard) {
+    std::optional<std::chrono::steady_clock::time_point> deadline;
+    if (shard.curl_timer_armed) {
+        deadline = shard.curl_timer;
+    }
+    const std::size_t limit = shardConcurrencyLimit();
+    const std::size_t low_priority_limit = limit - shardReservedSlots();
+    for (const auto& [cloud_id, pending] : shard.pending) {
+        if (pending.empty()) {
+            continue;
+        }
+        // Blocked on a shard slot rather than a token: a completion or the curl timer wakes us.
+        bool high_priority = pending.topClass() == TrafficClass::Metadata;
+        if (shard.active_handles.size() >= (high_priority ? limit : low_priority_limit)) {
+            continue;
+        }
+        auto token_time = _governor.nextTokenTime(cloud_id, CloudGovernor::Clock::now(), high_priority);
+        if (token_time && (!deadline || *token_time < *deadline)) {
+            deadline = token_time;
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(shard.batch_mtx);
+        for (const auto& [key, batch] : shard.batches) {
+            if (!deadline || batch.deadline < *deadline) {
+                deadline = batch.deadline;
+            }
+        }
+    }
+    if (auto resume_time = nextResumeTime(shard)) {
+        if (!deadline || *resume_time < *deadline) {
+            deadline = resume_time;
+        }
+    }
+    if (!shard.delayed_requests.empty()) {
+        auto retry_time = shard.delayed_requests.front()->getHandle()._timer;
+        if (!deadline || retry_time < *deadline) {
+            deadline = retry_time;
+        }
+    }
+    for (const auto& command : shard.awaiting_token) {
+        auto wait_until = command->getHandle()._timer;
+        if (!deadline || wait_until < *deadline) {
+            deadline = wait_until;
+        }
+    }
+    if (!deadline) {
+        return -1;
+    }
+
+    auto remaining = std::chrono::ceil<std::chrono::milliseconds>(*deadline - std::chrono::steady_clock::now());
+    return static_cast<int>(std::max<std::chrono::milliseconds::rep>(remaining.count(), 0));
+}
+
+void HttpClient::processCompletedTransfers(Shard& shard) {
+    CURLMsg* msg;
+    int msgs_left;
+    while ((msg = curl_multi_info_read(shard.multi_handle, &msgs_left))) {
+        if (msg->msg == CURLMSG_DONE) {
+            CURL* easy = msg->easy_handle;
+            CURLcode result = msg->data.result;
+            curl_multi_remove_handle(shard.multi_handle, easy);
+
+            RequestHandle& handle = shard.active_handles[easy]->getHandle();
+            _bandwidth.transferFinished(handle._traffic_class);
+            handle._in_multi = false;
+            handle._paused = false;
+
+            if (shard.active_handles[easy]->getTarget() != "CONFIG") {
+                LOG_INFO("HttpClient",
+                    "Request completed for file: %s and cloud: %s",
+                    shard.active_handles[easy]->getTarget(),
+                    CloudResolver::getName(shard.active_handles[easy]->getId())
+                );
+            }
+            else {
+                LOG_INFO("HttpClient",
+                    "Configuration request completed for: %s",
+                    CloudResolver::getName(shard.active_handles[easy]->getId())
+                );
+            }
+
+            long http_code = 0;
+            curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, &http_code);
+
+            if (result == CURLE_OK) {
+                recordConnectionReuse(easy);
+                recordStreamThroughput(shard.active_handles[easy]->getId(), easy);
+            }
+            _governor.release(shard.active_handles[easy]->getId(), result == CURLE_OK ? http_code : 0, serverLatency(easy));
+
+            if (result != CURLE_OK && interruptedTransfer(result) && handle.resumable()) {
+                if (handle.scheduleRetry()) {
+                    LOG_WARNING(
+                        "HttpClient",
+                        "Download of file: %s was interrupted with msg: %s, resuming",
+                        shard.active_handles[easy]->getTarget(),
+                        curl_easy_strerror(result)
                     );
+                    shard.delayed_requests.push_back(std::move(shard.active_handles[easy]));
+                    std::push_heap(shard.delayed_requests.begin(), shard.delayed_requests.end(), DelayedLater{});
                 }
                 else {
-                    LOG_INFO("HttpClient",
-                        "Configuration request completed for: %s",
-                        CloudResolver::getName(_active_handles[easy]->getId())
+                    LOG_ERROR(
+                        "HttpClient",
+                        "Resume attempts exhausted for file: %s and cloud: %s, moving to dead letters",
+                        shard.active_handles[easy]->getTarget(),
+                        CloudResolver::getName(shard.active_handles[easy]->getId())
                     );
-                }
-
-                long http_code = 0;
-                curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, &http_code);
-
-                if (msg->data.result != CURLE_OK) {
-                    LOG_ERROR("HttpClient", "curl failed with code: %i and msg: %s", mc, curl_easy_strerror(msg->data.result));
+                    addDeadLetter(std::move(shard.active_handles[easy]));
+                    shard.load.fetch_sub(1, std::memory_order_relaxed);
                     _large_active_count.decrement();
                 }
-                else if (http_code == 403 || http_code == 429 || http_code == 408 || http_code >= 500 && http_code < 600) {
-                    LOG_WARNING("HttpClient", "Scheduling retry for reponcse: %s", _active_handles[easy]->getHandle()._response);
+            }
+            else if (result != CURLE_OK) {
+                LOG_ERROR("HttpClient", "curl failed with code: %i and msg: %s", result, curl_easy_strerror(result));
+                shard.load.fetch_sub(1, std::memory_order_relaxed);
+                _large_active_count.decrement();
+                shard.active_handles[easy]->dropped(0);
+            }
+            else if (CloudGovernor::isCongestionCode(http_code)) {
+                LOG_WARNING("HttpClient", "Scheduling retry for reponcse: %s", shard.active_handles[easy]->getHandle()._response);
 
-                    _active_handles[easy]->getHandle().scheduleRetry();
-                    _delayed_requests.emplace_back(std::move(_active_handles[easy]));
-                }
-                else if (http_code != 200) {
-                    LOG_ERROR("HttpClient", "Unexpected HTTP code %i with response: %s", http_code, _active_handles[easy]->getHandle()._response);
-                    _large_active_count.decrement();
+                if (shard.active_handles[easy]->getHandle().scheduleRetry()) {
+                    shard.delayed_requests.push_back(std::move(shard.active_handles[easy]));
+                    std::push_heap(shard.delayed_requests.begin(), shard.delayed_requests.end(), DelayedLater{});
                 }
                 else {
-                    LOG_DEBUG(
+                    LOG_ERROR(
                         "HttpClient",
-                        "Request succeeded with response: %s",
-                        _active_handles[easy]->getHandle()._response
+                        "Retries exhausted for file: %s and cloud: %s, moving to dead letters",
+                        shard.active_handles[easy]->getTarget(),
+                        CloudResolver::getName(shard.active_handles[easy]->getId())
                     );
-                    CallbackDispatcher::get().submit(std::move(_active_handles[easy]));
+                    addDeadLetter(std::move(shard.active_handles[easy]));
+                    shard.load.fetch_sub(1, std::memory_order_relaxed);
                     _large_active_count.decrement();
                 }
-                _active_handles.erase(easy);
             }
+            else if (http_code == 401 && canAwaitTokenRefresh(shard.active_handles[easy]->getId(), handle)) {
+                LOG_WARNING(
+                    "HttpClient",
+                    "Access token rejected for file: %s and cloud: %s, waiting for refresh",
+                    shard.active_handles[easy]->getTarget(),
+                    CloudResolver::getName(shard.active_handles[easy]->getId())
+                );
+                handle.rewind();
+                handle._auth_retries++;
+                handle._timer = std::chrono::steady_clock::now() + TOKEN_REFRESH_WAIT;
+                shard.awaiting_token.push_back(std::move(shard.active_handles[easy]));
+            }
+            else if (!handle.accepts(http_code)) {
+                LOG_ERROR("HttpClient", "Unexpected HTTP code %i with response: %s", http_code, shard.active_handles[easy]->getHandle()._response);
+                shard.load.fetch_sub(1, std::memory_order_relaxed);
+                _large_active_count.decrement();
+                shard.active_handles[easy]->dropped(http_code);
+            }
+            else {
+                LOG_DEBUG(
+                    "HttpClient",
+                    "Request succeeded with response: %s",
+                    shard.active_handles[easy]->getHandle()._response
+                );
+                CallbackDispatcher::get().submit(std::move(shard.active_handles[easy]));
+                shard.load.fetch_sub(1, std::memory_order_relaxed);
+                _large_active_count.decrement();
+            }
+            shard.active_handles.erase(easy);
         }
-        checkDelayedRequests();
     }
 }
 
-void HttpClient::checkDelayedRequests() {
-    auto now = std::chrono::steady_clock::now();
+void HttpClient::resumePausedTransfers(Shard& shard) {
+    auto now = BandwidthScheduler::Clock::now();
+    for (auto& [easy, command] : shard.active_handles) {
+        RequestHandle& handle = command->getHandle();
+        if (!handle._paused) {
+            continue;
+        }
+        auto wait = std::max(
+            _bandwidth.waitTime(handle._traffic_class, TrafficDirection::Upload, now),
+            _bandwidth.waitTime(handle._traffic_class, TrafficDirection::Download, now)
+        );
+        if (wait == BandwidthScheduler::Clock::duration::zero()) {
+            handle._paused = false;
+            curl_easy_pause(easy, CURLPAUSE_CONT);
+        }
+    }
+}
 
-    auto it = _delayed_requests.begin();
-    while (it != _delayed_requests.end()) {
-        if (it->get()->getHandle()._timer <= now) {
-            _large_queue.push(std::move(*it));
-            it = _delayed_requests.erase(it);
+std::optional<std::chrono::steady_clock::time_point> HttpClient::nextResumeTime(Shard& shard) {
+    std::optional<std::chrono::steady_clock::time_point> resume_time;
+    auto now = BandwidthScheduler::Clock::now();
+    for (auto& [easy, command] : shard.active_handles) {
+        RequestHandle& handle = command->getHandle();
+        if (!handle._paused) {
+            continue;
         }
-        else {
-            ++it;
+        auto at = now + std::max(
+            _bandwidth.waitTime(handle._traffic_class, TrafficDirection::Upload, now),
+            _bandwidth.waitTime(handle._traffic_class, TrafficDirection::Download, now)
+        );
+        if (!resume_time || at < *resume_time) {
+            resume_time = at;
         }
     }
+    return resume_time;
+}
+
+void HttpClient::checkDelayedRequests(Shard& shard) {
+    auto now = std::chrono::steady_clock::now();
+
+    while (!shard.delayed_requests.empty() && shard.delayed_requests.front()->getHandle()._timer <= now) {
+        std::pop_heap(shard.delayed_requests.begin(), shard.delayed_requests.end(), DelayedLater{});
+        enqueuePending(shard, std::move(shard.delayed_requests.back()));
+        shard.delayed_requests.pop_back();
+    }
+}
+
+void HttpClient::checkAwaitingToken(Shard& shard) {
+    auto now = std::chrono::steady_clock::now();
+
+    auto ready = std::partition(shard.awaiting_token.begin(), shard.awaiting_token.end(), [&](const std::unique_ptr<ICommand>& command) {
+        const RequestHandle& handle = command->getHandle();
+        return handle._timer > now && handle._auth_generation >= tokenGeneration(command->getId());
+    });
+    for (auto it = ready; it != shard.awaiting_token.end(); ++it) {
+        enqueuePending(shard, std::move(*it));
+    }
+    shard.awaiting_token.erase(ready, shard.awaiting_token.end());
+}
+
+bool HttpClient::DelayedLater::operator()(const std::unique_ptr<ICommand>& lhs, const std::unique_ptr<ICommand>& rhs) const {
+    return lhs->getHandle()._timer > rhs->getHandle()._timer;
+}
+
+void HttpClient::addDeadLetter(std::unique_ptr<ICommand> command) {
+    std::lock_guard<std::mutex> lock(_dead_letters_mtx);
+    _dead_letters.push_back(std::move(command));
+}
+
+std::size_t HttpClient::deadLettersCount() const {
+    std::lock_guard<std::mutex> lock(_dead_letters_mtx);
+    return _dead_letters.size();
+}
+
+std::vector<std::unique_ptr<ICommand>> HttpClient::takeDeadLetters() {
+    std::lock_guard<std::mutex> lock(_dead_letters_mtx);
+    return std::exchange(_dead_letters, {});
+}
+
+CURL* HttpClient::acquireEasyHandle() {
+    std::lock_guard<std::mutex> lock(_pool_mtx);
+    if (!_share) {
+        _share = curl_share_init();
+        curl_share_setopt(_share, CURLSHOPT_LOCKFUNC, HttpClient::shareLock);
+        curl_share_setopt(_share, CURLSHOPT_UNLOCKFUNC, HttpClient::shareUnlock);
+        curl_share_setopt(_share, CURLSHOPT_USERDATA, this);
+        curl_share_setopt(_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+        curl_share_setopt(_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    }
+
+    CURL* curl = nullptr;
+    if (!_easy_pool.empty()) {
+        curl = _easy_pool.back();
+        _easy_pool.pop_back();
+    }
+    else {
+        curl = curl_easy_init();
+    }
+
+    if (curl) {
+        curl_easy_setopt(curl, CURLOPT_SHARE, _share);
+    }
+    return curl;
+}
+
+void HttpClient::releaseEasyHandle(CURL* curl) {
+    if (!curl) {
+        return;
+    }
+
+    curl_easy_reset(curl);
+
+    std::lock_guard<std::mutex> lock(_pool_mtx);
+    if (_easy_pool.size() < static_cast<size_t>(_MAX_CONCURRENT)) {
+        _easy_pool.push_back(curl);
+    }
+    else {
+        curl_easy_cleanup(curl);
+    }
+}
+
+void HttpClient::clearEasyHandlePool() {
+    std::lock_guard<std::mutex> lock(_pool_mtx);
+    for (CURL* curl : _easy_pool) {
+        curl_easy_cleanup(curl);
+    }
+    _easy_pool.clear();
+
+    if (_share && curl_share_cleanup(_share) == CURLSHE_OK) {
+        _share = nullptr;
+    }
+}
+
+std::chrono::microseconds HttpClient::serverLatency(CURL* curl) {
+    const curl_off_t SMALL_UPLOAD = 64 * 1024;
+
+    curl_off_t uploaded = 0;
+    curl_off_t pretransfer = 0;
+    curl_off_t starttransfer = 0;
+    curl_easy_getinfo(curl, CURLINFO_SIZE_UPLOAD_T, &uploaded);
+    if (uploaded > SMALL_UPLOAD) {
+        return std::chrono::microseconds(0);
+    }
+    curl_easy_getinfo(curl, CURLINFO_PRETRANSFER_TIME_T, &pretransfer);
+    curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME_T, &starttransfer);
+    return std::chrono::microseconds(std::max<curl_off_t>(starttransfer - pretransfer, 0));
+}
+
+void HttpClient::recordConnectionReuse(CURL* curl) {
+    long new_connects = 0;
+    if (curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &new_connects) != CURLE_OK) {
+        return;
+    }
+    _transfers_count.fetch_add(1, std::memory_order_relaxed);
+    _opened_connections_count.fetch_add(static_cast<std::uint64_t>(new_connects), std::memory_order_relaxed);
+    if (new_connects == 0) {
+        _reused_connections_count.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+std::uint64_t HttpClient::transfersCount() const noexcept {
+    return _transfers_count.load(std::memory_order_relaxed);
+}
+
+std::uint64_t HttpClient::reusedConnectionsCount() const noexcept {
+    return _reused_connections_count.load(std::memory_order_relaxed);
+}
+
+std::uint64_t HttpClient::openedConnectionsCount() const noexcept {
+    return _opened_connections_count.load(std::memory_order_relaxed);
+}
+
+std::uint64_t HttpClient::batchedCommandsCount() const noexcept {
+    return _batched_commands_count.load(std::memory_order_relaxed);
+}
+
+#ifdef __linux__
+int HttpClient::socketCallback(CURL*, curl_socket_t socket, int what, void* userp, void*) {
+    auto* shard = static_cast<Shard*>(userp);
+
+    if (what == CURL_POLL_REMOVE) {
+        epoll_ctl(shard->epoll_fd, EPOLL_CTL_DEL, socket, nullptr);
+        return 0;
+    }
+
+    epoll_event ev{};
+    ev.data.fd = socket;
+    if (what & CURL_POLL_IN) {
+        ev.events |= EPOLLIN;
+    }
+    if (what & CURL_POLL_OUT) {
+        ev.events |= EPOLLOUT;
+    }
+
+    if (epoll_ctl(shard->epoll_fd, EPOLL_CTL_MOD, socket, &ev) != 0) {
+        if (errno != ENOENT || epoll_ctl(shard->epoll_fd, EPOLL_CTL_ADD, socket, &ev) != 0) {
+            LOG_ERROR("HttpClient", "epoll_ctl() failed for socket %i: %s", socket, std::strerror(errno));
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int HttpClient::timerCallback(CURLM*, long timeout_ms, void* userp) {
+    auto* shard = static_cast<Shard*>(userp);
+    if (timeout_ms < 0) {
+        shard->curl_timer_armed = false;
+    }
+    else {
+        shard->curl_timer_armed = true;
+        shard->curl_timer = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    }
+    return 0;
+}
+#endif
+
+void HttpClient::shareLock(CURL*, curl_lock_data data, curl_lock_access, void* userptr) {
+    static_cast<HttpClient*>(userptr)->_share_mutexes[data].lock();
+}
+
+void HttpClient::shareUnlock(CURL*, curl_lock_data data, void* userptr) {
+    static_cast<HttpClient*>(userptr)->_share_mutexes[data].unlock();
 }
\ No newline at end of file
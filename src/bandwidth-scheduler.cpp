@@ -0,0 +1,140 @@
+#include "bandwidth-scheduler.h"
+
+#include <algorithm>
+
+namespace {
+    constexpr double BURST_SECONDS = 0.1;
+    constexpr double MIN_BURST_BYTES = 16.0 * 1024;
+}
+
+const char* to_cstr(TrafficClass traffic_class) {
+    switch (traffic_class) {
+    case TrafficClass::Metadata:    return "metadata";
+    case TrafficClass::SmallFile:   return "small-file";
+    case TrafficClass::Bulk:        return "bulk";
+    case TrafficClass::InitialSync: return "initial-sync";
+    }
+    return "unknown";
+}
+
+BandwidthScheduler::BandwidthScheduler()
+    : _weights{ 8, 4, 2, 1 }
+{
+}
+
+void BandwidthScheduler::setLimit(TrafficDirection direction, uint64_t bytes_per_second) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto dir = static_cast<std::size_t>(direction);
+    _limits[dir] = bytes_per_second;
+
+    auto now = Clock::now();
+    for (auto& bucket : _buckets[dir]) {
+        bucket.tokens = std::min(bucket.tokens, 0.0);
+        bucket.last_refill = now;
+    }
+}
+
+uint64_t BandwidthScheduler::getLimit(TrafficDirection direction) const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _limits[static_cast<std::size_t>(direction)];
+}
+
+bool BandwidthScheduler::isLimited() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return std::any_of(_limits.begin(), _limits.end(), [](uint64_t limit) { return limit > 0; });
+}
+
+void BandwidthScheduler::setWeight(TrafficClass traffic_class, unsigned weight) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _weights[static_cast<std::size_t>(traffic_class)] = std::max(weight, 1u);
+}
+
+unsigned BandwidthScheduler::getWeight(TrafficClass traffic_class) const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _weights[static_cast<std::size_t>(traffic_class)];
+}
+
+void BandwidthScheduler::transferStarted(TrafficClass traffic_class) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _active[static_cast<std::size_t>(traffic_class)]++;
+}
+
+void BandwidthScheduler::transferFinished(TrafficClass traffic_class) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto& active = _active[static_cast<std::size_t>(traffic_class)];
+    active = std::max(active - 1, 0);
+}
+
+BandwidthScheduler::Clock::duration BandwidthScheduler::consume(
+    TrafficClass traffic_class,
+    TrafficDirection direction,
+    uint64_t bytes,
+    Clock::time_point now)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto cls = static_cast<std::size_t>(traffic_class);
+    auto dir = static_cast<std::size_t>(direction);
+    if (_limits[dir] == 0) {
+        return Clock::duration::zero();
+    }
+
+    refill(cls, dir, now);
+    auto& bucket = _buckets[dir][cls];
+    bucket.tokens -= static_cast<double>(bytes);
+    if (bucket.tokens >= 0.0) {
+        return Clock::duration::zero();
+    }
+    return std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(-bucket.tokens / classRateLocked(cls, dir))
+    );
+}
+
+BandwidthScheduler::Clock::duration BandwidthScheduler::waitTime(
+    TrafficClass traffic_class,
+    TrafficDirection direction,
+    Clock::time_point now)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto cls = static_cast<std::size_t>(traffic_class);
+    auto dir = static_cast<std::size_t>(direction);
+    if (_limits[dir] == 0) {
+        return Clock::duration::zero();
+    }
+
+    refill(cls, dir, now);
+    const auto& bucket = _buckets[dir][cls];
+    if (bucket.tokens >= 0.0) {
+        return Clock::duration::zero();
+    }
+    return std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(-bucket.tokens / classRateLocked(cls, dir))
+    );
+}
+
+double BandwidthScheduler::classRate(TrafficClass traffic_class, TrafficDirection direction) const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return classRateLocked(static_cast<std::size_t>(traffic_class), static_cast<std::size_t>(direction));
+}
+
+double BandwidthScheduler::classRateLocked(std::size_t cls, std::size_t dir) const {
+    unsigned total_weight = _weights[cls];
+    for (std::size_t i = 0; i < CLASSES_COUNT; ++i) {
+        if (i != cls && _active[i] > 0) {
+            total_weight += _weights[i];
+        }
+    }
+    return static_cast<double>(_limits[dir]) * _weights[cls] / total_weight;
+}
+
+void BandwidthScheduler::refill(std::size_t cls, std::size_t dir, Clock::time_point now) {
+    auto& bucket = _buckets[dir][cls];
+    std::chrono::duration<double> elapsed = now - bucket.last_refill;
+    if (elapsed.count() <= 0.0) {
+        return;
+    }
+
+    double rate = classRateLocked(cls, dir);
+    double burst = std::max(rate * BURST_SECONDS, MIN_BURST_BYTES);
+    bucket.tokens = std::min(burst, bucket.tokens + elapsed.count() * rate);
+    bucket.last_refill = now;
+}
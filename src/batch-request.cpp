@@ -0,0 +1,185 @@
+#include "batch-request.h"
+#include "logger.h"
+
+#include <random>
+#include <charconv>
+#include <algorithm>
+#include <cctype>
+
+namespace {
+    constexpr const char* CONTENT_ID_PREFIX = "item";
+
+    std::string randomBoundary() {
+        static constexpr char digits[] = "0123456789abcdef";
+        thread_local std::mt19937_64 rng{ std::random_device{}() };
+        std::uniform_int_distribution<int> dist(0, 15);
+
+        std::string boundary = "batch_";
+        for (int i = 0; i < 24; ++i) {
+            boundary += digits[dist(rng)];
+        }
+        return boundary;
+    }
+
+    std::string toLower(std::string value) {
+        std::transform(value.begin(), value.end(), value.begin(), [](unsigned char c) { return std::tolower(c); });
+        return value;
+    }
+
+    std::string trim(const std::string& value) {
+        auto begin = value.find_first_not_of(" \t\r\n");
+        if (begin == std::string::npos) {
+            return {};
+        }
+        auto end = value.find_last_not_of(" \t\r\n");
+        return value.substr(begin, end - begin + 1);
+    }
+
+    // Splits a MIME entity at the first empty line, accepting both CRLF and bare LF.
+    bool splitHeaders(const std::string& entity, std::string& headers, std::string& body) {
+        auto crlf = entity.find("\r\n\r\n");
+        auto lf = entity.find("\n\n");
+        if (crlf == std::string::npos && lf == std::string::npos) {
+            return false;
+        }
+        if (lf == std::string::npos || (crlf != std::string::npos && crlf < lf)) {
+            headers = entity.substr(0, crlf);
+            body = entity.substr(crlf + 4);
+        }
+        else {
+            headers = entity.substr(0, lf);
+            body = entity.substr(lf + 2);
+        }
+        return true;
+    }
+
+    std::string headerValue(const std::string& headers, const std::string& name) {
+        std::size_t pos = 0;
+        while (pos < headers.size()) {
+            auto eol = headers.find('\n', pos);
+            std::string line = headers.substr(pos, eol == std::string::npos ? std::string::npos : eol - pos);
+            auto colon = line.find(':');
+            if (colon != std::string::npos && toLower(trim(line.substr(0, colon))) == name) {
+                return trim(line.substr(colon + 1));
+            }
+            if (eol == std::string::npos) {
+                break;
+            }
+            pos = eol + 1;
+        }
+        return {};
+    }
+
+    std::optional<std::size_t> partIndex(const std::string& content_id) {
+        auto end = content_id.find_last_of("0123456789");
+        if (end == std::string::npos) {
+            return std::nullopt;
+        }
+        auto begin = content_id.find_last_not_of("0123456789", end);
+        begin = begin == std::string::npos ? 0 : begin + 1;
+        std::size_t index = 0;
+        auto [ptr, ec] = std::from_chars(content_id.data() + begin, content_id.data() + end + 1, index);
+        if (ec != std::errc{}) {
+            return std::nullopt;
+        }
+        return index;
+    }
+}
+
+MultipartBatch::MultipartBatch() : _boundary(randomBoundary()) {}
+
+MultipartBatch::MultipartBatch(std::string boundary) : _boundary(std::move(boundary)) {}
+
+const std::string& MultipartBatch::boundary() const noexcept {
+    return _boundary;
+}
+
+std::string MultipartBatch::contentType() const {
+    return "multipart/mixed; boundary=" + _boundary;
+}
+
+std::string MultipartBatch::encode(const std::vector<BatchPart>& parts) const {
+    std::string out;
+    for (std::size_t i = 0; i < parts.size(); ++i) {
+        const auto& part = parts[i];
+        out += "--" + _boundary + "\r\n";
+        out += "Content-Type: application/http\r\n";
+        out += "Content-ID: <" + std::string(CONTENT_ID_PREFIX) + std::to_string(i) + ">\r\n\r\n";
+        out += part.method + " " + part.path + " HTTP/1.1\r\n";
+        if (!part.body.empty()) {
+            out += "Content-Type: " + (part.content_type.empty() ? std::string("application/json") : part.content_type) + "\r\n";
+            out += "Content-Length: " + std::to_string(part.body.size()) + "\r\n";
+        }
+        out += "\r\n";
+        out += part.body;
+        out += "\r\n";
+    }
+    out += "--" + _boundary + "--\r\n";
+    return out;
+}
+
+std::vector<std::optional<BatchPartResponse>> MultipartBatch::decode(
+    const std::string& content_type,
+    const std::string& body,
+    std::size_t parts_count)
+{
+    std::vector<std::optional<BatchPartResponse>> responses(parts_count);
+
+    auto boundary_pos = toLower(content_type).find("boundary=");
+    if (boundary_pos == std::string::npos) {
+        LOG_ERROR("MultipartBatch", "No boundary in batch response content type: %s", content_type);
+        return responses;
+    }
+    std::string boundary = content_type.substr(boundary_pos + 9);
+    boundary = boundary.substr(0, boundary.find(';'));
+    boundary = trim(boundary);
+    if (boundary.size() >= 2 && boundary.front() == '"' && boundary.back() == '"') {
+        boundary = boundary.substr(1, boundary.size() - 2);
+    }
+
+    const std::string delimiter = "--" + boundary;
+    std::size_t sequence = 0;
+
+    auto pos = body.find(delimiter);
+    while (pos != std::string::npos) {
+        pos += delimiter.size();
+        if (body.compare(pos, 2, "--") == 0) {
+            break;
+        }
+        auto next = body.find(delimiter, pos);
+        std::string entity = body.substr(pos, next == std::string::npos ? std::string::npos : next - pos);
+        pos = next;
+
+        std::string mime_headers, http_message;
+        if (!splitHeaders(entity, mime_headers, http_message)) {
+            ++sequence;
+            continue;
+        }
+
+        std::string status_and_headers, part_body;
+        if (!splitHeaders(http_message, status_and_headers, part_body)) {
+            status_and_headers = http_message;
+        }
+
+        BatchPartResponse response;
+        std::string status_line = trim(status_and_headers.substr(0, status_and_headers.find('\n')));
+        auto space = status_line.find(' ');
+        if (status_line.starts_with("HTTP/") && space != std::string::npos) {
+            response.status = std::strtol(status_line.c_str() + space + 1, nullptr, 10);
+        }
+        if (part_body.ends_with("\r\n")) {
+            part_body.resize(part_body.size() - 2);
+        }
+        else if (part_body.ends_with("\n")) {
+            part_body.pop_back();
+        }
+        response.body = std::move(part_body);
+
+        std::size_t position = partIndex(headerValue(mime_headers, "content-id")).value_or(sequence);
+        ++sequence;
+        if (position < parts_count) {
+            responses[position] = std::move(response);
+        }
+    }
+    return responses;
+}
@@ -103,6 +103,15 @@ void Change::onCommandFinished() noexcept {
     }
 }
 
+void Change::onCommandFailed() noexcept {
+    if (_pending_cmds.exchange(0, std::memory_order_acq_rel) > 0) {
+        std::lock_guard lk(_mtx);
+
+        _status = Status::Failed;
+        _on_complete(std::move(_dependents));
+    }
+}
+
 void Change::addDependent(std::shared_ptr<Change> change) {
     std::lock_guard lk(_mtx);
     _dependents.emplace_back(std::move(change));
@@ -0,0 +1,192 @@
+#include "cloud-governor.h"
+#include "utils.h"
+
+#include <algorithm>
+
+namespace {
+    constexpr double INCREASE_STEP = 1.0;
+    constexpr double ERROR_DECREASE_FACTOR = 0.5;
+    constexpr double LATENCY_DECREASE_FACTOR = 0.9;
+    constexpr int LATENCY_INFLATION = 4;
+    constexpr auto MIN_LATENCY_SIGNAL = std::chrono::milliseconds(200);
+    constexpr auto DECREASE_COOLDOWN = std::chrono::seconds(1);
+    constexpr auto RATE_WINDOW = std::chrono::minutes(1);
+}
+
+CloudQuota CloudGovernor::defaultQuota(CloudProviderType type) {
+    switch (type) {
+    case CloudProviderType::GoogleDrive:
+        return { 12000, 64, 2 };
+    case CloudProviderType::Dropbox:
+        return { 6000, 32, 2 };
+    default:
+        return { 0, 120, 1 };
+    }
+}
+
+bool CloudGovernor::isCongestionCode(long http_code) {
+    return http_code == 0 || http_code == 403 || http_code == 429 || http_code == 408 || (http_code >= 500 && http_code < 600);
+}
+
+void CloudGovernor::setQuota(CloudProviderType type, const CloudQuota& quota) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _quotas[type] = quota;
+
+    auto now = Clock::now();
+    for (auto& [cloud_id, st] : _clouds) {
+        auto it = _types.find(cloud_id);
+        if (it != _types.end() && it->second == type) {
+            resetState(st, quota, now);
+        }
+    }
+}
+
+void CloudGovernor::registerCloud(int cloud_id, CloudProviderType type) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _types[cloud_id] = type;
+    _clouds.erase(cloud_id);
+}
+
+int CloudGovernor::reservedSlots(int limit) {
+    return limit >= 2 ? std::max(1, limit / 8) : 0;
+}
+
+bool CloudGovernor::tryAcquire(int cloud_id, Clock::time_point now, bool high_priority) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto& st = state(cloud_id, now);
+
+    int limit = static_cast<int>(st.limit);
+    if (!high_priority) {
+        limit -= reservedSlots(limit);
+    }
+    if (st.in_flight >= limit) {
+        return false;
+    }
+
+    if (st.quota.requests_per_minute > 0) {
+        refill(st, now);
+        if (st.tokens < 1.0) {
+            return false;
+        }
+        st.tokens -= 1.0;
+    }
+
+    st.in_flight++;
+    st.started.push_back(now);
+    pruneStarted(st, now);
+    return true;
+}
+
+void CloudGovernor::release(
+    int cloud_id,
+    long http_code,
+    std::chrono::microseconds latency,
+    Clock::time_point now)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto& st = state(cloud_id, now);
+    st.in_flight = std::max(0, st.in_flight - 1);
+
+    if (isCongestionCode(http_code)) {
+        decrease(st, ERROR_DECREASE_FACTOR, now);
+        if (http_code == 429 || http_code == 403) {
+            st.tokens = 0.0;
+        }
+        return;
+    }
+
+    if (latency.count() > 0) {
+        if (st.latency_baseline.count() == 0 || latency < st.latency_baseline) {
+            st.latency_baseline = latency;
+        }
+        if (latency > st.latency_baseline * LATENCY_INFLATION && latency > MIN_LATENCY_SIGNAL) {
+            decrease(st, LATENCY_DECREASE_FACTOR, now);
+            return;
+        }
+    }
+
+    st.limit = std::min<double>(st.quota.max_concurrent, st.limit + INCREASE_STEP / st.limit);
+}
+
+std::optional<CloudGovernor::Clock::time_point> CloudGovernor::nextTokenTime(int cloud_id, Clock::time_point now, bool high_priority) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto& st = state(cloud_id, now);
+    int limit = static_cast<int>(st.limit);
+    if (!high_priority) {
+        limit -= reservedSlots(limit);
+    }
+    if (st.quota.requests_per_minute <= 0 || st.in_flight >= limit) {
+        return std::nullopt;
+    }
+
+    refill(st, now);
+    if (st.tokens >= 1.0) {
+        return now;
+    }
+
+    double per_second = st.quota.requests_per_minute / 60.0;
+    auto wait = std::chrono::duration<double>((1.0 - st.tokens) / per_second);
+    return now + std::chrono::ceil<std::chrono::milliseconds>(wait);
+}
+
+CloudGovernorStats CloudGovernor::stats(int cloud_id, Clock::time_point now) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto& st = state(cloud_id, now);
+    pruneStarted(st, now);
+    return {
+        st.limit,
+        st.in_flight,
+        static_cast<int>(st.started.size()),
+        st.quota.requests_per_minute
+    };
+}
+
+CloudGovernor::CloudState& CloudGovernor::state(int cloud_id, Clock::time_point now) {
+    auto it = _clouds.find(cloud_id);
+    if (it != _clouds.end()) {
+        return it->second;
+    }
+
+    CloudQuota quota = defaultQuota(CloudProviderType::FakeTest);
+    auto type_it = _types.find(cloud_id);
+    if (type_it != _types.end()) {
+        auto quota_it = _quotas.find(type_it->second);
+        quota = quota_it != _quotas.end() ? quota_it->second : defaultQuota(type_it->second);
+    }
+
+    auto& st = _clouds[cloud_id];
+    resetState(st, quota, now);
+    return st;
+}
+
+void CloudGovernor::resetState(CloudState& st, const CloudQuota& quota, Clock::time_point now) {
+    st.quota = quota;
+    st.limit = std::clamp<double>(quota.max_concurrent / 4.0, std::max(quota.min_concurrent, 1), std::max(quota.max_concurrent, 1));
+    st.tokens = std::max(1.0, quota.requests_per_minute / 60.0);
+    st.last_refill = now;
+    st.last_decrease = Clock::time_point{};
+}
+
+void CloudGovernor::refill(CloudState& st, Clock::time_point now) {
+    double per_second = st.quota.requests_per_minute / 60.0;
+    double burst = std::max(1.0, per_second);
+    std::chrono::duration<double> elapsed = now - st.last_refill;
+    if (elapsed.count() > 0) {
+        st.tokens = std::min(burst, st.tokens + elapsed.count() * per_second);
+        st.last_refill = now;
+    }
+}
+
+void CloudGovernor::decrease(CloudState& st, double factor, Clock::time_point now) {
+    if (now - st.last_decrease < DECREASE_COOLDOWN) {
+        return;
+    }
+    st.limit = std::max<double>(std::max(st.quota.min_concurrent, 1), st.limit * factor);
+    st.last_decrease = now;
+}
+
+void CloudGovernor::pruneStarted(CloudState& st, Clock::time_point now) {
+    while (!st.started.empty() && now - st.started.front() >= RATE_WINDOW) {
+        st.started.pop_front();
+    }
+}
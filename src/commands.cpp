@@ -2,6 +2,308 @@
 #include "logger.h"
 #include "change.h"
 
+#include <set>
+#include <map>
+#include <vector>
+
+namespace {
+    constexpr int MAX_DOWNLOAD_VERIFY_ATTEMPTS = 3;
+    constexpr int MAX_BATCH_CHECKS = 60;
+    constexpr auto BATCH_CHECK_INITIAL_DELAY = std::chrono::milliseconds(200);
+    constexpr auto BATCH_CHECK_MAX_DELAY = std::chrono::milliseconds(5000);
+
+    // Cloud commands only ever run against a provider; anything else is a wiring bug.
+    const RemoteStorage& remoteOf(const std::shared_ptr<BaseStorage>& cloud) {
+        const RemoteStorage* remote = cloud ? cloud->remote() : nullptr;
+        if (!remote) {
+            throw std::logic_error("Cloud command dispatched to a storage without remote capabilities");
+        }
+        return *remote;
+    }
+
+    void addStreamHashers(RequestHandle& handle, EntryType type, const RemoteStorage& cloud) {
+        if (type == EntryType::Directory) {
+            return;
+        }
+        handle.addHasher(HashKind::Xxh64);
+        if (auto kind = cloud.contentHashKind()) {
+            handle.addHasher(*kind);
+        }
+    }
+
+    template<typename DTO>
+    bool applyStreamedHashes(RequestHandle& handle, DTO& dto, const RemoteStorage& cloud) {
+        if (handle._hashers.empty()) {
+            return true;
+        }
+        dto.streamed_hash = handle._hashers.xxh64();
+        if (auto kind = cloud.contentHashKind()) {
+            dto.streamed_cloud_hash = handle._hashers.hexDigest(*kind).value_or("");
+        }
+
+        const auto* expected = std::get_if<std::string>(&dto.cloud_hash_check_sum);
+        if (!expected || expected->empty() || dto.streamed_cloud_hash.empty()) {
+            return true;
+        }
+        return *expected == dto.streamed_cloud_hash;
+    }
+
+    // Persists the confirmed offset so an interrupted upload resumes from it; true once the upload is complete.
+    bool advanceUploadSession(const std::unique_ptr<Database>& db, const RemoteStorage& cloud, const RequestHandle& handle, UploadSessionDTO& session) {
+        if (cloud.proccesUploadSession(handle, session)) {
+            db->deleteUploadSession(session.cloud_id, session.rel_path);
+            return true;
+        }
+        if (session.session_id.empty()) {
+            db->deleteUploadSession(session.cloud_id, session.rel_path);
+        }
+        else {
+            db->saveUploadSession(session);
+        }
+        LOG_DEBUG(
+            "UPLOAD SESSION",
+            "Uploaded %llu of %llu bytes for entry: %s",
+            static_cast<unsigned long long>(session.offset),
+            static_cast<unsigned long long>(session.size),
+            session.rel_path.string()
+        );
+        return false;
+    }
+
+    // Congestion, or an expired token the standalone request will refresh.
+    bool batchPartRetryable(long status) {
+        return status == 401 || CloudGovernor::isCongestionCode(status);
+    }
+}
+
+// Shared by the append workers of one upload session; the command that opened the session waits here until they finish.
+struct ConcurrentUpload {
+    ConcurrentUpload(const UploadSessionDTO& s, std::uint64_t chunk) :
+        session(s),
+        chunk_size(chunk),
+        next_offset(s.offset)
+    {
+    }
+
+    std::mutex mtx;
+    std::string key;
+    UploadSessionDTO session;
+    std::uint64_t chunk_size;
+    std::uint64_t next_offset;
+    std::set<std::uint64_t> stored;
+    std::size_t workers = 0;
+    bool failed = false;
+    std::unique_ptr<ICommand> parent;
+    UploadSessionDTO* parent_session = nullptr;
+};
+
+// Byte ranges of one download in flight; the command that planned them waits here for the last one to land.
+struct RangedDownload {
+    RangedDownload(std::uint64_t size, std::unique_ptr<DownloadProgressDTO> p) :
+        target(std::make_shared<DownloadTarget>(size, p && p->offset > 0)),
+        progress(std::move(p))
+    {
+    }
+
+    std::mutex mtx;
+    std::string key;
+    std::shared_ptr<DownloadTarget> target;
+    std::unique_ptr<DownloadProgressDTO> progress;
+    std::map<std::uint64_t, std::uint64_t> landed;
+    std::size_t pending = 0;
+    bool failed = false;
+    std::unique_ptr<ICommand> parent;
+};
+
+namespace {
+    // Plans appending the rest of the command's session in parallel; null if the provider appends sequentially.
+    std::shared_ptr<ConcurrentUpload> planConcurrentAppends(const ICommand& command, UploadSessionDTO& session, const RemoteStorage& cloud) {
+        std::size_t workers = cloud.concurrentUploadAppends();
+        std::uint64_t chunk = cloud.uploadAppendSize();
+        if (workers == 0 || chunk == 0 || session.session_id.empty() || session.offset >= session.size) {
+            return nullptr;
+        }
+
+        auto upload = std::make_shared<ConcurrentUpload>(session, chunk);
+        upload->key = command.orderingKey();
+        upload->parent_session = &session;
+        upload->workers = static_cast<std::size_t>(std::min<std::uint64_t>(workers, (session.size - session.offset + chunk - 1) / chunk));
+        return upload;
+    }
+
+    // Parks the command that opened the session until its append workers finish, then starts them.
+    void startConcurrentAppends(std::shared_ptr<ConcurrentUpload> upload, std::unique_ptr<ICommand> parent) {
+        std::vector<std::unique_ptr<ICommand>> appends;
+        {
+            std::lock_guard<std::mutex> lock(upload->mtx);
+            upload->parent = std::move(parent);
+            while (appends.size() < upload->workers) {
+                appends.push_back(std::make_unique<CloudUploadAppendCommand>(upload->parent->getId(), upload, upload->next_offset));
+                upload->next_offset += upload->chunk_size;
+            }
+            LOG_INFO(
+                "UPLOAD SESSION",
+                "Appending %llu bytes of entry: %s with %zu parallel requests",
+                static_cast<unsigned long long>(upload->session.size - upload->session.offset),
+                upload->session.rel_path.string(),
+                appends.size()
+            );
+        }
+        for (auto& append : appends) {
+            HttpClient::get().submit(std::move(append));
+        }
+    }
+
+    using ByteRange = std::pair<std::uint64_t, std::uint64_t>;
+
+    // Splits the rest of a download into the ranges fetched in parallel; empty when it goes as a single stream.
+    std::vector<ByteRange> planDownloadRanges(int cloud_id, EntryType type, std::uint64_t start, std::uint64_t size, const RemoteStorage& cloud) {
+        std::vector<ByteRange> ranges;
+        if (type != EntryType::File || !cloud.supportsRangeDownloads() || start >= size) {
+            return ranges;
+        }
+        std::size_t count = HttpClient::get().downloadRanges(cloud_id, size - start);
+        if (count < 2) {
+            return ranges;
+        }
+        std::uint64_t step = (size - start + count - 1) / count;
+        for (std::uint64_t offset = start; offset < size; offset += step) {
+            ranges.emplace_back(offset, std::min(step, size - offset));
+        }
+        return ranges;
+    }
+
+    // The command fetches the first range with its own handle, the rest go out as separate commands.
+    template<typename DTO>
+    void submitDownloadRanges(int cloud_id, const std::shared_ptr<RangedDownload>& download, const std::vector<ByteRange>& ranges, const DTO& dto) {
+        {
+            std::lock_guard<std::mutex> lock(download->mtx);
+            download->key = ICommand::entryKey(dto.global_id, dto.rel_path);
+            download->pending = ranges.size();
+        }
+        LOG_INFO("CLOUD DOWNLOAD", "Downloading entry: %s as %zu parallel ranges", dto.rel_path.string(), ranges.size());
+        for (std::size_t i = 1; i < ranges.size(); ++i) {
+            HttpClient::get().submit(std::make_unique<CloudRangeDownloadCommand>(
+                cloud_id,
+                download,
+                ranges[i].first,
+                ranges[i].second,
+                dto.rel_path.filename().string(),
+                [dto](const std::shared_ptr<BaseStorage>& cloud, const std::unique_ptr<RequestHandle>& handle) {
+                    cloud->setupDownloadHandle(handle, std::make_unique<DTO>(dto));
+                }
+            ));
+        }
+    }
+
+    // Only the contiguous prefix is checkpointed, ranges landed above it are fetched again after a restart.
+    void checkpointRange(const std::unique_ptr<Database>& db, RangedDownload& download, std::uint64_t offset, std::uint64_t length) {
+        std::lock_guard<std::mutex> lock(download.mtx);
+        if (!download.progress) {
+            return;
+        }
+        auto& progress = *download.progress;
+        download.landed[offset] = offset + length;
+        std::uint64_t prefix = progress.offset;
+        for (auto it = download.landed.find(progress.offset); it != download.landed.end(); it = download.landed.find(progress.offset)) {
+            progress.offset = it->second;
+            download.landed.erase(it);
+        }
+        if (progress.offset != prefix) {
+            db->saveDownloadProgress(progress);
+        }
+    }
+
+    // Gives up on a download: the partial tmp file is removed and the owning change fails, releasing its path.
+    void abandonDownload(RequestHandle& handle, ICommand& command) {
+        auto tmp_path = handle._download ? handle._download->path() : handle._download_path;
+        if (handle._iofd.is_open()) {
+            handle._iofd.close();
+        }
+        std::error_code ec;
+        if (!tmp_path.empty() && !std::filesystem::remove(tmp_path, ec) && ec) {
+            LOG_WARNING("CLOUD DOWNLOAD", "Failed to remove tmp file: %s: %s", tmp_path.string(), ec.message());
+        }
+        command.abandon();
+    }
+
+    // Counts a range as done; the last one hands back the waiting command unless some range was lost.
+    std::unique_ptr<ICommand> landRange(RangedDownload& download, bool lost) {
+        std::unique_ptr<ICommand> parent;
+        {
+            std::lock_guard<std::mutex> lock(download.mtx);
+            download.failed = download.failed || lost;
+            if (--download.pending > 0 || !download.parent) {
+                return nullptr;
+            }
+            parent = std::move(download.parent);
+            if (!download.failed) {
+                return parent;
+            }
+        }
+        LOG_ERROR("CLOUD DOWNLOAD", "A range of entry: %s was lost, dropping download", parent->getTarget());
+        abandonDownload(parent->getHandle(), *parent);
+        return nullptr;
+    }
+
+    bool hashFile(RequestHandle& handle, const std::filesystem::path& path, std::uint64_t length) {
+        handle._hashers.reset();
+        if (handle._iofd.is_open()) {
+            handle._iofd.flush();
+        }
+        try {
+            UploadSource source(path);
+            source.setWindow(0, length);
+            std::vector<char> buffer(1 << 20);
+            while (std::size_t read = source.read(buffer.data(), buffer.size())) {
+                handle._hashers.update(buffer.data(), read);
+            }
+        }
+        catch (const std::exception& e) {
+            LOG_ERROR("CLOUD DOWNLOAD", "Failed to hash downloaded file: %s: %s", path.string(), e.what());
+            return false;
+        }
+        return true;
+    }
+
+    // Lands the command's own range and parks it in the shared state until the rest land. The command finishing the
+    // download goes back to the dispatcher, its prepareCallback hashes the assembled file outside the database lock.
+    void landOwnRange(std::shared_ptr<RangedDownload>& ranges, bool& own_range_pending, RequestHandle& handle, std::unique_ptr<ICommand> command) {
+        auto download = ranges;
+        std::unique_lock<std::mutex> lock(download->mtx);
+        own_range_pending = false;
+        if (--download->pending > 0) {
+            download->parent = std::move(command);
+            return;
+        }
+        bool failed = download->failed;
+        lock.unlock();
+
+        if (failed) {
+            ranges.reset();
+            LOG_ERROR("CLOUD DOWNLOAD", "A range of entry: %s was lost, dropping download", download->target->path().string());
+            abandonDownload(handle, *command);
+            return;
+        }
+        CallbackDispatcher::get().submit(std::move(command));
+    }
+
+    // The command planning the ranges fetches the first one itself and is their parent, so when it is dropped
+    // before that range landed no other range can abandon the download for it.
+    void dropOwnRange(RangedDownload& download, RequestHandle& handle, ICommand& command) {
+        landRange(download, true);
+        LOG_ERROR("CLOUD DOWNLOAD", "First range of entry: %s was lost, dropping download", download.target->path().string());
+        abandonDownload(handle, command);
+    }
+
+    // Runs once every range has landed: the stream hashers only saw the command's own range.
+    bool hashLandedRanges(std::shared_ptr<RangedDownload>& ranges, RequestHandle& handle) {
+        bool hashed = hashFile(handle, ranges->target->path(), ranges->target->size());
+        ranges.reset();
+        return hashed;
+    }
+}
+
 void ICommand::setDTO(std::unique_ptr<FileRecordDTO> dto) {}
 void ICommand::setDTO(std::unique_ptr<FileUpdatedDTO> dto) {}
 void ICommand::setDTO(std::unique_ptr<FileDeletedDTO> dto) {}
@@ -16,10 +318,38 @@ EntryType ICommand::getTargetType() const {
     return EntryType::Null;
 }
 
+std::uint64_t ICommand::getTransferSize() const {
+    return 0;
+}
+
+void ICommand::prepareCallback(const std::shared_ptr<BaseStorage>&) {}
+
 bool ICommand::needRepeat() const {
     return false;
 }
 
+bool ICommand::needPark() const {
+    return false;
+}
+
+void ICommand::park(std::unique_ptr<ICommand>) {}
+
+bool ICommand::ownConnection() const {
+    return false;
+}
+
+std::optional<BatchPart> ICommand::batchPart(const std::shared_ptr<BaseStorage>&) const {
+    return std::nullopt;
+}
+
+void ICommand::setBatchable(bool batchable) noexcept {
+    _batchable = batchable;
+}
+
+bool ICommand::batchable() const noexcept {
+    return _batchable;
+}
+
 void ICommand::setOwner(std::weak_ptr<Change> ow) noexcept {
     _owner = std::move(ow);
     if (auto ch = owner()) {
@@ -27,6 +357,21 @@ void ICommand::setOwner(std::weak_ptr<Change> ow) noexcept {
     }
 }
 
+void ICommand::abandon() noexcept {
+    if (auto ch = owner()) {
+        ch->onCommandFailed();
+    }
+}
+
+void ICommand::dropped(long) {}
+
+std::string ICommand::entryKey(int global_id, const std::filesystem::path& rel_path) {
+    if (global_id > 0) {
+        return "#" + std::to_string(global_id);
+    }
+    return rel_path.lexically_normal().generic_string();
+}
+
 std::shared_ptr<Change> ICommand::owner() const noexcept {
     return _owner.lock();
 }
@@ -55,6 +400,12 @@ LocalUploadCommand::LocalUploadCommand(const int cloud_id) {
     _cloud_id = cloud_id;
 }
 
+void LocalUploadCommand::prepareCallback(const std::shared_ptr<BaseStorage>& cloud) {
+    if (cloud) {
+        cloud->prepareUpload(_dto);
+    }
+}
+
 void LocalUploadCommand::completionCallback(const std::unique_ptr<Database>& db, const std::shared_ptr<BaseStorage>& cloud) {
 
     LOG_INFO("LOCAL UPLOAD" "on %s started", this->getTarget());
@@ -80,6 +431,10 @@ std::string LocalUploadCommand::getTarget() const {
     return _dto->rel_path.string();
 }
 
+std::string LocalUploadCommand::orderingKey() const {
+    return entryKey(_dto->global_id, _dto->rel_path);
+}
+
 EntryType LocalUploadCommand::getTargetType() const {
     return _dto->type;
 }
@@ -88,6 +443,12 @@ LocalUpdateCommand::LocalUpdateCommand(const int cloud_id) {
     _cloud_id = cloud_id;
 }
 
+void LocalUpdateCommand::prepareCallback(const std::shared_ptr<BaseStorage>& cloud) {
+    if (cloud) {
+        cloud->prepareUpdate(_dto);
+    }
+}
+
 void LocalUpdateCommand::completionCallback(const std::unique_ptr<Database>& db, const std::shared_ptr<BaseStorage>& cloud) {
     LOG_INFO("LOCAL UPDATE", this->getTarget(), "started");
 
@@ -116,6 +477,10 @@ std::string LocalUpdateCommand::getTarget() const {
     return _dto->rel_path.string();
 }
 
+std::string LocalUpdateCommand::orderingKey() const {
+    return entryKey(_dto->global_id, _dto->rel_path);
+}
+
 EntryType LocalUpdateCommand::getTargetType() const {
     return _dto->type;
 }
@@ -154,6 +519,10 @@ std::string LocalMoveCommand::getTarget() const {
     return _dto->old_rel_path.string();
 }
 
+std::string LocalMoveCommand::orderingKey() const {
+    return entryKey(_dto->global_id, _dto->old_rel_path);
+}
+
 EntryType LocalMoveCommand::getTargetType() const {
     return _dto->type;
 }
@@ -198,19 +567,56 @@ std::string LocalDeleteCommand::getTarget() const {
     return _dto->rel_path.string();
 }
 
+std::string LocalDeleteCommand::orderingKey() const {
+    return entryKey(_dto->global_id, _dto->rel_path);
+}
+
 CloudUploadCommand::CloudUploadCommand(const int cloud_id) {
     _cloud_id = cloud_id;
 }
 
 void CloudUploadCommand::execute(const std::shared_ptr<BaseStorage>& cloud) {
+    const RemoteStorage& remote = remoteOf(cloud);
     _dto->cloud_id = _cloud_id;
+    _repeat = false;
     _handle = std::make_unique<RequestHandle>();
-    cloud->setupUploadHandle(_handle, _dto);
+    if (_commit) {
+        remote.setupCommitHandle(_handle, *_commit);
+        LOG_DEBUG("CLOUD UPLOAD", "Committing entry: %s on: %s", this->getTarget(), CloudResolver::getName(_cloud_id));
+        return;
+    }
+    if (_session) {
+        remote.setupUploadSessionHandle(_handle, _dto, *_session);
+        return;
+    }
+    _session = remote.openUploadSession(_dto);
+    if (_session) {
+        remote.setupUploadSessionHandle(_handle, _dto, *_session);
+    }
+    else {
+        cloud->setupUploadHandle(_handle, _dto);
+    }
 
     LOG_INFO("CLOUD UPLOAD", "Started for entry: %s on: %s", this->getTarget(), CloudResolver::getName(_cloud_id));
 }
 
 void CloudUploadCommand::completionCallback(const std::unique_ptr<Database>& db, const std::shared_ptr<BaseStorage>& cloud) {
+    const RemoteStorage& remote = remoteOf(cloud);
+    if (_session) {
+        if (!advanceUploadSession(db, remote, *_handle, *_session)) {
+            _upload = planConcurrentAppends(*this, *_session, remote);
+            _repeat = !_upload;
+            return;
+        }
+    }
+    else if (!_commit) {
+        // Providers may stage the content first and commit it in a separate, batchable request.
+        _commit = remote.uploadCommitPart(_dto, *_handle);
+        if (_commit) {
+            _repeat = true;
+            return;
+        }
+    }
     cloud->proccesUpload(_dto, _handle->_response);
     db->add_file_link(*_dto);
     LOG_INFO("CLOUD UPLOAD", "Completed for entry: %s on: %s", this->getTarget(), CloudResolver::getName(_cloud_id));
@@ -236,23 +642,68 @@ std::string CloudUploadCommand::getTarget() const {
     return _dto->rel_path.string();
 }
 
+std::string CloudUploadCommand::orderingKey() const {
+    return entryKey(_dto->global_id, _dto->rel_path);
+}
+
 EntryType CloudUploadCommand::getTargetType() const {
     return _dto->type;
 }
 
+std::uint64_t CloudUploadCommand::getTransferSize() const {
+    if (_session) {
+        return _handle && _handle->_upload ? _handle->_upload->length() : 0;
+    }
+    return _dto->type == EntryType::Directory || _commit ? 0 : _dto->size;
+}
+
+std::optional<BatchPart> CloudUploadCommand::batchPart(const std::shared_ptr<BaseStorage>&) const {
+    return _commit;
+}
+
+bool CloudUploadCommand::needRepeat() const {
+    return _repeat;
+}
+
+bool CloudUploadCommand::needPark() const {
+    return _upload != nullptr;
+}
+
+void CloudUploadCommand::park(std::unique_ptr<ICommand> self) {
+    startConcurrentAppends(std::move(_upload), std::move(self));
+}
+
 CloudUpdateCommand::CloudUpdateCommand(const int cloud_id) {
     _cloud_id = cloud_id;
 }
 
 void CloudUpdateCommand::execute(const std::shared_ptr<BaseStorage>& cloud) {
+    const RemoteStorage& remote = remoteOf(cloud);
     _dto->cloud_id = _cloud_id;
+    _repeat = false;
     _handle = std::make_unique<RequestHandle>();
-    cloud->setupUpdateHandle(_handle, _dto);
+    if (_session) {
+        remote.setupUploadSessionHandle(_handle, _dto, *_session);
+        return;
+    }
+    _session = remote.openUploadSession(_dto);
+    if (_session) {
+        remote.setupUploadSessionHandle(_handle, _dto, *_session);
+    }
+    else {
+        cloud->setupUpdateHandle(_handle, _dto);
+    }
 
     LOG_INFO("CLOUD UPDATE", "Started for entry: %s on: %s", this->getTarget(), CloudResolver::getName(_cloud_id));
 }
 
 void CloudUpdateCommand::completionCallback(const std::unique_ptr<Database>& db, const std::shared_ptr<BaseStorage>& cloud) {
+    const RemoteStorage& remote = remoteOf(cloud);
+    if (_session && !advanceUploadSession(db, remote, *_handle, *_session)) {
+        _upload = planConcurrentAppends(*this, *_session, remote);
+        _repeat = !_upload;
+        return;
+    }
     cloud->proccesUpdate(_dto, _handle->_response);
     db->update_file_link(*_dto);
     LOG_INFO("CLOUD UPDATE", "Completed for entry: %s on: %s", this->getTarget(), CloudResolver::getName(_cloud_id));
@@ -278,10 +729,33 @@ std::string CloudUpdateCommand::getTarget() const {
     return _dto->rel_path.filename().string();
 }
 
+std::string CloudUpdateCommand::orderingKey() const {
+    return entryKey(_dto->global_id, _dto->rel_path);
+}
+
 EntryType CloudUpdateCommand::getTargetType() const {
     return _dto->type;
 }
 
+std::uint64_t CloudUpdateCommand::getTransferSize() const {
+    if (_session) {
+        return _handle && _handle->_upload ? _handle->_upload->length() : 0;
+    }
+    return _dto->type == EntryType::Directory ? 0 : _dto->size;
+}
+
+bool CloudUpdateCommand::needRepeat() const {
+    return _repeat;
+}
+
+bool CloudUpdateCommand::needPark() const {
+    return _upload != nullptr;
+}
+
+void CloudUpdateCommand::park(std::unique_ptr<ICommand> self) {
+    startConcurrentAppends(std::move(_upload), std::move(self));
+}
+
 CloudMoveCommand::CloudMoveCommand(const int cloud_id) {
     _cloud_id = cloud_id;
 }
@@ -320,22 +794,85 @@ std::string CloudMoveCommand::getTarget() const {
     return _dto->old_rel_path.filename().string();
 }
 
+std::string CloudMoveCommand::orderingKey() const {
+    return entryKey(_dto->global_id, _dto->old_rel_path);
+}
+
 EntryType CloudMoveCommand::getTargetType() const {
     return _dto->type;
 }
 
+std::optional<BatchPart> CloudMoveCommand::batchPart(const std::shared_ptr<BaseStorage>& cloud) const {
+    return remoteOf(cloud).moveBatchPart(_dto);
+}
+
 CloudDownloadNewCommand::CloudDownloadNewCommand(const int cloud_id) {
     _cloud_id = cloud_id;
 }
 
+CloudDownloadNewCommand::~CloudDownloadNewCommand() {
+    // Dropped by the HTTP client without a response: the whole download is abandoned.
+    if (_ranges && _range_pending) {
+        dropOwnRange(*_ranges, *_handle, *this);
+    }
+}
+
 void CloudDownloadNewCommand::execute(const std::shared_ptr<BaseStorage>& cloud) {
+    const RemoteStorage& remote = remoteOf(cloud);
     LOG_INFO("CLOUD DOWNLOAD", "New file download started: %s", _dto->rel_path.string().c_str());
     _dto->cloud_id = _cloud_id;
     _handle = std::make_unique<RequestHandle>();
+    _repeat = false;
+    _hash_failed = false;
+    _progress = remote.openDownload(_dto);
+    std::uint64_t resume_from = _progress ? _progress->offset : 0;
+    auto ranges = planDownloadRanges(_cloud_id, _dto->type, resume_from, _dto->size, remote);
+    if (!ranges.empty()) {
+        _ranges = std::make_shared<RangedDownload>(_dto->size, _progress ? std::make_unique<DownloadProgressDTO>(*_progress) : nullptr);
+        _range_pending = true;
+        _handle->setDownloadRange(_ranges->target, ranges[0].first, ranges[0].second);
+    }
+    else {
+        _handle->resumeDownloadAt(resume_from);
+    }
     cloud->setupDownloadHandle(_handle, _dto);
+    addStreamHashers(*_handle, _dto->type, remote);
+    if (_ranges) {
+        submitDownloadRanges(_cloud_id, _ranges, ranges, *_dto);
+    }
+}
+
+void CloudDownloadNewCommand::prepareCallback(const std::shared_ptr<BaseStorage>&) {
+    if (_ranges && !_range_pending) {
+        _hash_failed = !hashLandedRanges(_ranges, *_handle);
+    }
+    else if (!_ranges && _progress && _progress->offset > 0) {
+        // The stream hashers never saw the resumed prefix, the finished file is hashed here instead of on the submit path.
+        _hash_failed = !hashFile(*_handle, _progress->tmp_path, _dto->size);
+    }
 }
 
 void CloudDownloadNewCommand::completionCallback(const std::unique_ptr<Database>& db, const std::shared_ptr<BaseStorage>& cloud) {
+    if (_range_pending) {
+        checkpointRange(db, *_ranges, _handle->_range_offset, _handle->_range_length);
+        return;
+    }
+    if (_progress) {
+        // Finished either way, a mismatching file is downloaded again from scratch.
+        db->deleteDownloadProgress(_progress->cloud_id, _progress->rel_path);
+        _progress.reset();
+    }
+    if (_hash_failed || !applyStreamedHashes(*_handle, *_dto, remoteOf(cloud))) {
+        if (++_verify_attempts < MAX_DOWNLOAD_VERIFY_ATTEMPTS) {
+            LOG_WARNING("CLOUD DOWNLOAD", "Checksum mismatch for: %s, downloading again", _dto->rel_path.string());
+            _repeat = true;
+        }
+        else {
+            LOG_ERROR("CLOUD DOWNLOAD", "Checksum mismatch for: %s after %i attempts, dropping download", _dto->rel_path.string(), _verify_attempts);
+            abandonDownload(*_handle, *this);
+        }
+        return;
+    }
     LOG_INFO("CLOUD DOWNLOAD", "New file downloaded: %s", _dto->rel_path.string().c_str());
     for (auto& next_command : _next_commands) {
         next_command->setDTO(std::make_unique<FileRecordDTO>(*_dto));
@@ -359,22 +896,100 @@ std::string CloudDownloadNewCommand::getTarget() const {
     return _dto->rel_path.filename().string();
 }
 
+std::string CloudDownloadNewCommand::orderingKey() const {
+    return entryKey(_dto->global_id, _dto->rel_path);
+}
+
 EntryType CloudDownloadNewCommand::getTargetType() const {
     return _dto->type;
 }
 
+std::uint64_t CloudDownloadNewCommand::getTransferSize() const {
+    if (_ranges) {
+        return _handle->_range_length;
+    }
+    return _dto->type == EntryType::Directory ? 0 : _dto->size;
+}
+
+bool CloudDownloadNewCommand::needRepeat() const {
+    return _repeat;
+}
+
+bool CloudDownloadNewCommand::needPark() const {
+    return _range_pending;
+}
+
+void CloudDownloadNewCommand::park(std::unique_ptr<ICommand> self) {
+    landOwnRange(_ranges, _range_pending, *_handle, std::move(self));
+}
+
 CloudDownloadUpdateCommand::CloudDownloadUpdateCommand(const int cloud_id) {
     _cloud_id = cloud_id;
 }
 
+CloudDownloadUpdateCommand::~CloudDownloadUpdateCommand() {
+    // Dropped by the HTTP client without a response: the whole download is abandoned.
+    if (_ranges && _range_pending) {
+        dropOwnRange(*_ranges, *_handle, *this);
+    }
+}
+
 void CloudDownloadUpdateCommand::execute(const std::shared_ptr<BaseStorage>& cloud) {
+    const RemoteStorage& remote = remoteOf(cloud);
     LOG_INFO("CLOUD DOWNLOAD", "Update file download started: %s", _dto->rel_path.string().c_str());
     _dto->cloud_id = _cloud_id;
     _handle = std::make_unique<RequestHandle>();
+    _repeat = false;
+    _hash_failed = false;
+    _progress = remote.openDownload(_dto);
+    std::uint64_t resume_from = _progress ? _progress->offset : 0;
+    auto ranges = planDownloadRanges(_cloud_id, _dto->type, resume_from, _dto->size, remote);
+    if (!ranges.empty()) {
+        _ranges = std::make_shared<RangedDownload>(_dto->size, _progress ? std::make_unique<DownloadProgressDTO>(*_progress) : nullptr);
+        _range_pending = true;
+        _handle->setDownloadRange(_ranges->target, ranges[0].first, ranges[0].second);
+    }
+    else {
+        _handle->resumeDownloadAt(resume_from);
+    }
     cloud->setupDownloadHandle(_handle, _dto);
+    addStreamHashers(*_handle, _dto->type, remote);
+    if (_ranges) {
+        submitDownloadRanges(_cloud_id, _ranges, ranges, *_dto);
+    }
+}
+
+void CloudDownloadUpdateCommand::prepareCallback(const std::shared_ptr<BaseStorage>&) {
+    if (_ranges && !_range_pending) {
+        _hash_failed = !hashLandedRanges(_ranges, *_handle);
+    }
+    else if (!_ranges && _progress && _progress->offset > 0) {
+        // The stream hashers never saw the resumed prefix, the finished file is hashed here instead of on the submit path.
+        _hash_failed = !hashFile(*_handle, _progress->tmp_path, _dto->size);
+    }
 }
 
 void CloudDownloadUpdateCommand::completionCallback(const std::unique_ptr<Database>& db, const std::shared_ptr<BaseStorage>& cloud) {
+    if (_range_pending) {
+        checkpointRange(db, *_ranges, _handle->_range_offset, _handle->_range_length);
+        return;
+    }
+    if (_progress) {
+        // Finished either way, a mismatching file is downloaded again from scratch.
+        db->deleteDownloadProgress(_progress->cloud_id, _progress->rel_path);
+        _progress.reset();
+    }
+    if (_hash_failed || !applyStreamedHashes(*_handle, *_dto, remoteOf(cloud))) {
+        if (++_verify_attempts < MAX_DOWNLOAD_VERIFY_ATTEMPTS) {
+            LOG_WARNING("CLOUD DOWNLOAD", "Checksum mismatch for: %s, downloading again", _dto->rel_path.string());
+            _repeat = true;
+        }
+        else {
+            LOG_ERROR("CLOUD DOWNLOAD", "Checksum mismatch for: %s after %i attempts, dropping download", _dto->rel_path.string(), _verify_attempts);
+            abandonDownload(*_handle, *this);
+        }
+        return;
+    }
     LOG_INFO("CLOUD DOWNLOAD", "Updated file downloaded (tmp): %s",
         _dto->rel_path.string().c_str());
     for (auto& next_command : _next_commands) {
@@ -399,10 +1014,33 @@ std::string CloudDownloadUpdateCommand::getTarget() const {
     return _dto->rel_path.filename().string();
 }
 
+std::string CloudDownloadUpdateCommand::orderingKey() const {
+    return entryKey(_dto->global_id, _dto->rel_path);
+}
+
 EntryType CloudDownloadUpdateCommand::getTargetType() const {
     return _dto->type;
 }
 
+std::uint64_t CloudDownloadUpdateCommand::getTransferSize() const {
+    if (_ranges) {
+        return _handle->_range_length;
+    }
+    return _dto->type == EntryType::Directory ? 0 : _dto->size;
+}
+
+bool CloudDownloadUpdateCommand::needRepeat() const {
+    return _repeat;
+}
+
+bool CloudDownloadUpdateCommand::needPark() const {
+    return _range_pending;
+}
+
+void CloudDownloadUpdateCommand::park(std::unique_ptr<ICommand> self) {
+    landOwnRange(_ranges, _range_pending, *_handle, std::move(self));
+}
+
 CloudDeleteCommand::CloudDeleteCommand(const int cloud_id) {
     _cloud_id = cloud_id;
 }
@@ -439,3 +1077,354 @@ RequestHandle& CloudDeleteCommand::getHandle() {
 std::string CloudDeleteCommand::getTarget() const {
     return _dto->rel_path.string();
 }
+
+std::string CloudDeleteCommand::orderingKey() const {
+    return entryKey(_dto->global_id, _dto->rel_path);
+}
+
+std::optional<BatchPart> CloudDeleteCommand::batchPart(const std::shared_ptr<BaseStorage>& cloud) const {
+    return remoteOf(cloud).deleteBatchPart(_dto);
+}
+
+CloudBatchCommand::CloudBatchCommand(const int cloud_id, std::vector<std::unique_ptr<ICommand>> commands, std::vector<BatchPart> parts)
+    : _commands(std::move(commands)),
+    _parts(std::move(parts))
+{
+    _cloud_id = cloud_id;
+}
+
+void CloudBatchCommand::execute(const std::shared_ptr<BaseStorage>& cloud) {
+    const RemoteStorage& remote = remoteOf(cloud);
+    _repeat = false;
+    _handle = std::make_unique<RequestHandle>();
+    if (!_job_id.empty()) {
+        remote.setupBatchCheckHandle(_handle, _parts, _job_id);
+        auto delay = std::min(BATCH_CHECK_INITIAL_DELAY * (1 << std::min(_checks - 1, 5)), BATCH_CHECK_MAX_DELAY);
+        _handle->_timer = std::chrono::steady_clock::now() + delay;
+        return;
+    }
+    remote.setupBatchHandle(_handle, _parts);
+
+    LOG_INFO("CLOUD BATCH", "Started batch of %zu requests on: %s", _commands.size(), CloudResolver::getName(_cloud_id));
+}
+
+void CloudBatchCommand::completionCallback(const std::unique_ptr<Database>&, const std::shared_ptr<BaseStorage>& cloud) {
+    auto result = remoteOf(cloud).proccesBatch(*_handle, _commands.size());
+    if (result.in_progress) {
+        if (!result.async_job_id.empty()) {
+            _job_id = result.async_job_id;
+        }
+        if (!_job_id.empty() && _checks < MAX_BATCH_CHECKS) {
+            ++_checks;
+            _repeat = true;
+            LOG_DEBUG("CLOUD BATCH", "Batch job %s on: %s is still running", _job_id, CloudResolver::getName(_cloud_id));
+            return;
+        }
+        // The job may still finish on the server, sending its requests again could apply them twice.
+        LOG_ERROR("CLOUD BATCH", "Gave up waiting for batch job %s on: %s", _job_id, CloudResolver::getName(_cloud_id));
+        abandon();
+        return;
+    }
+    auto& responses = result.responses;
+
+    std::size_t resubmitted = 0;
+    for (std::size_t i = 0; i < _commands.size(); ++i) {
+        auto& command = _commands[i];
+        const auto& response = responses[i];
+
+        if (response && response->status >= 200 && response->status < 300) {
+            command->getHandle()._response = response->body;
+            CallbackDispatcher::get().submit(std::move(command));
+        }
+        else if (!response || batchPartRetryable(response->status)) {
+            LOG_WARNING(
+                "CLOUD BATCH",
+                "Batched request for: %s failed with HTTP code %i, sending it separately",
+                command->getTarget(),
+                response ? static_cast<int>(response->status) : 0
+            );
+            command->setBatchable(false);
+            HttpClient::get().submit(std::move(command));
+            ++resubmitted;
+        }
+        else {
+            LOG_ERROR(
+                "CLOUD BATCH",
+                "Batched request for: %s failed with HTTP code %i and response: %s",
+                command->getTarget(),
+                static_cast<int>(response->status),
+                response->body
+            );
+            command->abandon();
+        }
+    }
+    LOG_INFO("CLOUD BATCH", "Completed batch of %zu requests on: %s, %zu sent separately", _commands.size(), CloudResolver::getName(_cloud_id), resubmitted);
+}
+
+RequestHandle& CloudBatchCommand::getHandle() {
+    return *_handle;
+}
+
+std::string CloudBatchCommand::getTarget() const {
+    return "BATCH";
+}
+
+// Only splits the response, each part goes back to the dispatcher under its own key.
+std::string CloudBatchCommand::orderingKey() const {
+    return getTarget();
+}
+
+std::size_t CloudBatchCommand::size() const noexcept {
+    return _commands.size();
+}
+
+bool CloudBatchCommand::needRepeat() const {
+    return _repeat;
+}
+
+void CloudBatchCommand::abandon() noexcept {
+    failParts(false);
+}
+
+void CloudBatchCommand::dropped(long status) {
+    failParts(status == 0 || batchPartRetryable(status));
+}
+
+// The batch request itself failed, so none of its parts ran: each gets its own fate instead of being lost with it.
+void CloudBatchCommand::failParts(bool retryable) {
+    std::size_t count = 0;
+    for (auto& command : _commands) {
+        if (!command) {
+            continue;
+        }
+        ++count;
+        if (!retryable) {
+            command->abandon();
+            continue;
+        }
+        command->setBatchable(false);
+        HttpClient::get().submit(std::move(command));
+    }
+    _commands.clear();
+    if (count > 0) {
+        LOG_WARNING(
+            "CLOUD BATCH",
+            "Batch of %zu requests on: %s failed, %s",
+            count,
+            CloudResolver::getName(_cloud_id),
+            retryable ? "sending them separately" : "abandoning them"
+        );
+    }
+}
+
+CloudUploadAppendCommand::CloudUploadAppendCommand(const int cloud_id, std::shared_ptr<ConcurrentUpload> upload, std::uint64_t offset)
+    : _upload(std::move(upload)),
+    _offset(offset)
+{
+    _cloud_id = cloud_id;
+}
+
+CloudUploadAppendCommand::~CloudUploadAppendCommand() {
+    if (!_upload || _stored) {
+        return;
+    }
+    // Dropped by the HTTP client without a response: the session stays in the database for the next attempt.
+    std::unique_lock<std::mutex> lock(_upload->mtx);
+    _upload->failed = true;
+    if (--_upload->workers > 0) {
+        return;
+    }
+    LOG_ERROR(
+        "UPLOAD SESSION",
+        "Append failed for entry: %s, upload will resume from byte %llu",
+        _upload->session.rel_path.string(),
+        static_cast<unsigned long long>(_upload->session.offset)
+    );
+    auto parent = std::move(_upload->parent);
+    lock.unlock();
+    if (parent) {
+        parent->abandon();
+    }
+}
+
+void CloudUploadAppendCommand::execute(const std::shared_ptr<BaseStorage>& cloud) {
+    _repeat = false;
+    _stored = false;
+    _handle = std::make_unique<RequestHandle>();
+    UploadSessionDTO session = [this] {
+        std::lock_guard<std::mutex> lock(_upload->mtx);
+        return _upload->session;
+    }();
+    remoteOf(cloud).setupUploadAppendHandle(_handle, session, _offset);
+}
+
+void CloudUploadAppendCommand::completionCallback(const std::unique_ptr<Database>& db, const std::shared_ptr<BaseStorage>& cloud) {
+    std::unique_lock<std::mutex> lock(_upload->mtx);
+    auto& session = _upload->session;
+    _stored = true;
+
+    if (!remoteOf(cloud).proccesUploadAppend(*_handle, session)) {
+        LOG_WARNING("UPLOAD SESSION", "Session for entry: %s is gone, starting over", session.rel_path.string());
+        _upload->failed = true;
+        session.session_id.clear();
+        session.offset = 0;
+        db->deleteUploadSession(session.cloud_id, session.rel_path);
+    }
+    else {
+        // Only the contiguous prefix is persisted, chunks stored out of order above it are sent again after a restart.
+        _upload->stored.insert(_offset);
+        std::uint64_t prefix = session.offset;
+        while (_upload->stored.erase(session.offset)) {
+            session.offset = std::min(session.size, session.offset + _upload->chunk_size);
+        }
+        if (session.offset != prefix) {
+            db->saveUploadSession(session);
+        }
+    }
+
+    if (!_upload->failed && _upload->next_offset < session.size) {
+        _offset = _upload->next_offset;
+        _upload->next_offset += _upload->chunk_size;
+        _repeat = true;
+        return;
+    }
+    if (--_upload->workers > 0) {
+        return;
+    }
+    if (_upload->failed) {
+        LOG_ERROR("UPLOAD SESSION", "Upload of entry: %s was not completed", session.rel_path.string());
+        auto parent = std::move(_upload->parent);
+        lock.unlock();
+        if (parent) {
+            parent->abandon();
+        }
+        return;
+    }
+    *_upload->parent_session = session;
+    _upload->parent_session->confirmed = true;
+    auto parent = std::move(_upload->parent);
+    lock.unlock();
+    HttpClient::get().submit(std::move(parent));
+}
+
+RequestHandle& CloudUploadAppendCommand::getHandle() {
+    return *_handle;
+}
+
+std::string CloudUploadAppendCommand::getTarget() const {
+    return _upload->session.rel_path.string();
+}
+
+std::string CloudUploadAppendCommand::orderingKey() const {
+    return _upload->key;
+}
+
+std::uint64_t CloudUploadAppendCommand::getTransferSize() const {
+    return _handle && _handle->_upload ? _handle->_upload->length() : 0;
+}
+
+bool CloudUploadAppendCommand::needRepeat() const {
+    return _repeat;
+}
+
+bool CloudUploadAppendCommand::ownConnection() const {
+    return true;
+}
+
+CloudRangeDownloadCommand::CloudRangeDownloadCommand(const int cloud_id, std::shared_ptr<RangedDownload> download, std::uint64_t offset, std::uint64_t length, std::string target, Setup setup)
+    : _download(std::move(download)),
+    _offset(offset),
+    _length(length),
+    _target(std::move(target)),
+    _setup(std::move(setup))
+{
+    _cloud_id = cloud_id;
+}
+
+CloudRangeDownloadCommand::~CloudRangeDownloadCommand() {
+    // Dropped by the HTTP client without a response: the whole download is abandoned.
+    if (_download && !_landed) {
+        landRange(*_download, true);
+    }
+}
+
+void CloudRangeDownloadCommand::execute(const std::shared_ptr<BaseStorage>& cloud) {
+    _handle = std::make_unique<RequestHandle>();
+    _handle->setDownloadRange(_download->target, _offset, _length);
+    _setup(cloud, _handle);
+}
+
+void CloudRangeDownloadCommand::completionCallback(const std::unique_ptr<Database>& db, const std::shared_ptr<BaseStorage>&) {
+    checkpointRange(db, *_download, _offset, _length);
+    _landed = true;
+    if (auto parent = landRange(*_download, false)) {
+        CallbackDispatcher::get().submit(std::move(parent));
+    }
+}
+
+RequestHandle& CloudRangeDownloadCommand::getHandle() {
+    return *_handle;
+}
+
+std::string CloudRangeDownloadCommand::getTarget() const {
+    return _target;
+}
+
+std::string CloudRangeDownloadCommand::orderingKey() const {
+    return _download->key;
+}
+
+std::uint64_t CloudRangeDownloadCommand::getTransferSize() const {
+    return _length;
+}
+
+bool CloudRangeDownloadCommand::ownConnection() const {
+    return true;
+}
+
+DbWriteCommand::DbWriteCommand(std::string target, Write write)
+    : _target(std::move(target)),
+    _write(std::move(write))
+{}
+
+std::future<void> DbWriteCommand::result() {
+    return _done.get_future();
+}
+
+void DbWriteCommand::execute(const std::shared_ptr<BaseStorage>&) {}
+
+void DbWriteCommand::resolveAfterCommit() noexcept {
+    _after_commit = true;
+}
+
+void DbWriteCommand::completionCallback(const std::unique_ptr<Database>& db, const std::shared_ptr<BaseStorage>&) {
+    try {
+        _write(db);
+        if (_after_commit) {
+            CallbackDispatcher::get().resolveAfterCommit(std::move(_done));
+        }
+        else {
+            _done.set_value();
+        }
+    }
+    catch (const std::exception& e) {
+        LOG_ERROR("DB WRITE", "Failed for entry: %s: %s", _target, e.what());
+        _done.set_exception(std::current_exception());
+    }
+}
+
+void DbWriteCommand::continueChain() {}
+
+void DbWriteCommand::addNext(std::unique_ptr<ICommand>) {}
+
+std::string DbWriteCommand::getTarget() const {
+    return _target;
+}
+
+std::string DbWriteCommand::orderingKey() const {
+    return _target;
+}
+
+int DbWriteCommand::getId() const {
+    return 0;
+}
@@ -0,0 +1,227 @@
+#include "content-hasher.h"
+
+#define XXH_INLINE_ALL
+#include <xxhash.h>
+#include <openssl/evp.h>
+#include <algorithm>
+#include <stdexcept>
+
+namespace {
+    constexpr std::size_t DROPBOX_BLOCK_SIZE = 4 * 1024 * 1024;
+
+    std::string toHex(const unsigned char* data, std::size_t size) {
+        static constexpr char digits[] = "0123456789abcdef";
+        std::string out(size * 2, '0');
+        for (std::size_t i = 0; i < size; ++i) {
+            out[2 * i] = digits[data[i] >> 4];
+            out[2 * i + 1] = digits[data[i] & 0x0f];
+        }
+        return out;
+    }
+
+    class EvpDigest {
+    public:
+        explicit EvpDigest(const EVP_MD* md) : _md(md), _ctx(EVP_MD_CTX_new()) {
+            if (!_ctx) {
+                throw std::runtime_error("EVP_MD_CTX_new() failed");
+            }
+            reset();
+        }
+        ~EvpDigest() {
+            EVP_MD_CTX_free(_ctx);
+        }
+
+        EvpDigest(const EvpDigest&) = delete;
+        EvpDigest& operator=(const EvpDigest&) = delete;
+
+        void update(const void* data, std::size_t size) {
+            EVP_DigestUpdate(_ctx, data, size);
+        }
+
+        void reset() {
+            EVP_DigestInit_ex(_ctx, _md, nullptr);
+        }
+
+        std::vector<unsigned char> finish() {
+            std::vector<unsigned char> out(EVP_MAX_MD_SIZE);
+            unsigned int length = 0;
+            EVP_DigestFinal_ex(_ctx, out.data(), &length);
+            out.resize(length);
+            reset();
+            return out;
+        }
+
+    private:
+        const EVP_MD* _md;
+        EVP_MD_CTX* _ctx;
+    };
+
+    class Xxh64Hasher : public IContentHasher {
+    public:
+        Xxh64Hasher() : _state(XXH64_createState()) {
+            reset();
+        }
+        ~Xxh64Hasher() override {
+            XXH64_freeState(_state);
+        }
+
+        HashKind kind() const noexcept override { return HashKind::Xxh64; }
+
+        void update(const char* data, std::size_t size) override {
+            XXH64_update(_state, data, size);
+        }
+
+        void reset() override {
+            XXH64_reset(_state, 0);
+        }
+
+        std::string hexDigest() override {
+            XXH64_canonical_t canonical;
+            XXH64_canonicalFromHash(&canonical, XXH64_digest(_state));
+            return toHex(canonical.digest, sizeof(canonical.digest));
+        }
+
+    private:
+        XXH64_state_t* _state;
+    };
+
+    class Md5Hasher : public IContentHasher {
+    public:
+        Md5Hasher() : _digest(EVP_md5()) {}
+
+        HashKind kind() const noexcept override { return HashKind::Md5; }
+
+        void update(const char* data, std::size_t size) override {
+            _digest.update(data, size);
+        }
+
+        void reset() override {
+            _digest.reset();
+        }
+
+        std::string hexDigest() override {
+            auto out = _digest.finish();
+            return toHex(out.data(), out.size());
+        }
+
+    private:
+        EvpDigest _digest;
+    };
+
+    // Dropbox content_hash: SHA-256 over the concatenated SHA-256 digests of 4 MiB blocks.
+    class DropboxContentHasher : public IContentHasher {
+    public:
+        DropboxContentHasher() : _block(EVP_sha256()), _overall(EVP_sha256()) {}
+
+        HashKind kind() const noexcept override { return HashKind::DropboxContentHash; }
+
+        void update(const char* data, std::size_t size) override {
+            while (size > 0) {
+                std::size_t count = std::min(size, DROPBOX_BLOCK_SIZE - _block_filled);
+                _block.update(data, count);
+                _block_filled += count;
+                data += count;
+                size -= count;
+                if (_block_filled == DROPBOX_BLOCK_SIZE) {
+                    flushBlock();
+                }
+            }
+        }
+
+        void reset() override {
+            _block.reset();
+            _overall.reset();
+            _block_filled = 0;
+        }
+
+        std::string hexDigest() override {
+            if (_block_filled > 0) {
+                flushBlock();
+            }
+            auto out = _overall.finish();
+            _block_filled = 0;
+            return toHex(out.data(), out.size());
+        }
+
+    private:
+        void flushBlock() {
+            auto block_digest = _block.finish();
+            _overall.update(block_digest.data(), block_digest.size());
+            _block_filled = 0;
+        }
+
+        EvpDigest _block;
+        EvpDigest _overall;
+        std::size_t _block_filled = 0;
+    };
+}
+
+std::unique_ptr<IContentHasher> IContentHasher::create(HashKind kind) {
+    switch (kind) {
+    case HashKind::Xxh64:
+        return std::make_unique<Xxh64Hasher>();
+    case HashKind::Md5:
+        return std::make_unique<Md5Hasher>();
+    case HashKind::DropboxContentHash:
+        return std::make_unique<DropboxContentHasher>();
+    }
+    throw std::invalid_argument("Unknown hash kind");
+}
+
+void HasherChain::add(HashKind kind) {
+    if (!contains(kind)) {
+        _hashers.push_back(IContentHasher::create(kind));
+        _digests.clear();
+    }
+}
+
+bool HasherChain::contains(HashKind kind) const noexcept {
+    return std::any_of(_hashers.begin(), _hashers.end(), [kind](const auto& hasher) {
+        return hasher->kind() == kind;
+    });
+}
+
+bool HasherChain::empty() const noexcept {
+    return _hashers.empty();
+}
+
+void HasherChain::update(const char* data, std::size_t size) {
+    for (auto& hasher : _hashers) {
+        hasher->update(data, size);
+    }
+    _bytes += size;
+}
+
+void HasherChain::reset() {
+    for (auto& hasher : _hashers) {
+        hasher->reset();
+    }
+    _digests.clear();
+    _bytes = 0;
+}
+
+std::optional<std::string> HasherChain::hexDigest(HashKind kind) {
+    if (_digests.empty()) {
+        for (auto& hasher : _hashers) {
+            _digests.emplace_back(hasher->kind(), hasher->hexDigest());
+        }
+    }
+    for (const auto& [digest_kind, digest] : _digests) {
+        if (digest_kind == kind) {
+            return digest;
+        }
+    }
+    return std::nullopt;
+}
+
+std::optional<uint64_t> HasherChain::xxh64() {
+    auto hex = hexDigest(HashKind::Xxh64);
+    if (!hex) {
+        return std::nullopt;
+    }
+    return std::stoull(*hex, nullptr, 16);
+}
+
+uint64_t HasherChain::bytesHashed() const noexcept {
+    return _bytes;
+}
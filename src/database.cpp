@@ -1,9 +1,75 @@
 #include "database.h"
 #include "logger.h"
 
+#include <algorithm>
+#include <unordered_map>
+
 struct WhereTag {};
 struct SetTag {};
 
+namespace {
+    // Savepoints start their own transaction, or nest inside an open batch on the same connection.
+    constexpr const char* BEGIN_WRITE_SQL = "SAVEPOINT db_write;";
+    constexpr const char* COMMIT_WRITE_SQL = "RELEASE db_write;";
+    constexpr const char* ROLLBACK_WRITE_SQL = "ROLLBACK TO db_write; RELEASE db_write;";
+
+    // Parent of the entries at the top of the sync directory, AUTOINCREMENT ids start at 1.
+    constexpr int ROOT_GLOBAL_ID = 0;
+    // Guards path assembly against a parent cycle in a damaged database.
+    constexpr std::size_t MAX_TREE_DEPTH = 4096;
+
+    // Rows written per transaction by ingest().
+    constexpr std::size_t INGEST_CHUNK_ROWS = 10000;
+
+    constexpr const char* ADD_FILE_SQL = "INSERT OR IGNORE INTO files (type, parent_global_id, name, size, local_hash, local_modified_time, file_id) VALUES (?, ?, ?, ?, ?, ?, ?);";
+    constexpr const char* ADD_FILE_LINK_SQL = "INSERT OR IGNORE INTO file_links (global_id, cloud_id, cloud_file_id, cloud_parent_id, cloud_file_modified_time, cloud_hash_check_sum, cloud_size) VALUES (?, ?, ?, ?, ?, ?, ?);";
+
+    // Lookup indexes nothing reads while a bulk load places rows, ingest() may build them afterwards.
+    constexpr const char* LOOKUP_INDEXES_SQL = R"(
+        CREATE INDEX IF NOT EXISTS idx_files_id ON files(file_id);
+        CREATE INDEX IF NOT EXISTS idx_file_links_cloud_file_id_cloud_id ON file_links(cloud_file_id, cloud_id);
+        CREATE INDEX IF NOT EXISTS idx_file_links_global_cloud ON file_links(global_id, cloud_id);
+    )";
+    constexpr const char* DROP_LOOKUP_INDEXES_SQL = R"(
+        DROP INDEX IF EXISTS idx_files_id;
+        DROP INDEX IF EXISTS idx_file_links_cloud_file_id_cloud_id;
+        DROP INDEX IF EXISTS idx_file_links_global_cloud;
+    )";
+
+    uint64_t localHash(const FileRecordDTO& dto) {
+        const auto& hash = dto.cloud_hash_check_sum;
+        return std::holds_alternative<uint64_t>(hash) ? std::get<uint64_t>(hash) : 0;
+    }
+
+    std::string cloudHash(const FileRecordDTO& dto) {
+        const auto& hash = dto.cloud_hash_check_sum;
+        return std::holds_alternative<std::string>(hash) ? std::get<std::string>(hash) : std::string{};
+    }
+
+    std::vector<std::string> pathSegments(const std::filesystem::path& path) {
+        std::vector<std::string> segments;
+        for (const auto& part : path) {
+            auto segment = part.string();
+            if (segment.empty() || segment == "." || segment == "/") {
+                continue;
+            }
+            segments.push_back(std::move(segment));
+        }
+        return segments;
+    }
+
+    std::string joinSegments(const std::vector<std::string>& segments, const std::size_t from, const std::size_t to) {
+        std::string joined;
+        for (std::size_t i = from; i < to; ++i) {
+            if (!joined.empty()) {
+                joined += '/';
+            }
+            joined += segments[i];
+        }
+        return joined;
+    }
+}
+
 Database::Database(const std::string& db_file) {
     int flags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_FULLMUTEX;
     int rc = sqlite3_open_v2(db_file.c_str(), &_db, flags, nullptr);
@@ -12,6 +78,8 @@ Database::Database(const std::string& db_file) {
         std::string errMsg = _db ? sqlite3_errmsg(_db) : "Unknown error";
         throw std::runtime_error("Error opening db: " + errMsg);
     }
+    _statements = std::make_shared<StatementCache>(std::shared_ptr<sqlite3>(_db, sqlite3_close));
+    _index = std::make_shared<MetadataIndex>();
 
     execute("PRAGMA foreign_keys = ON;");
     execute("PRAGMA journal_mode = WAL;");
@@ -27,6 +95,8 @@ Database::Database(const std::filesystem::path& db_file) {
         std::string errMsg = _db ? sqlite3_errmsg(_db) : "Unknown error";
         throw std::runtime_error("Error opening db: " + errMsg);
     }
+    _statements = std::make_shared<StatementCache>(std::shared_ptr<sqlite3>(_db, sqlite3_close));
+    _index = std::make_shared<MetadataIndex>();
 
     execute("PRAGMA foreign_keys = ON;");
     execute("PRAGMA journal_mode = WAL;");
@@ -34,9 +104,62 @@ Database::Database(const std::filesystem::path& db_file) {
     create_tables();
 }
 
-Database::~Database() {
-    if (_db) {
-        sqlite3_close(_db);
+Database::~Database() = default;
+
+void Database::beginBatch() {
+    sqlite3_busy_timeout(_db, 5000);
+    int rc = sqlite3_exec(_db, "BEGIN IMMEDIATE;", nullptr, nullptr, nullptr);
+    check_rc(rc, "Failed to begin batch");
+}
+
+void Database::commitBatch() {
+    int rc = sqlite3_exec(_db, "COMMIT;", nullptr, nullptr, nullptr);
+    if (rc != SQLITE_OK) {
+        std::string error = sqlite3_errmsg(_db);
+        sqlite3_exec(_db, "ROLLBACK;", nullptr, nullptr, nullptr);
+        reloadIndex();
+        throw std::runtime_error("Error commiting batch: " + error);
+    }
+}
+
+void Database::rollbackBatch() {
+    sqlite3_exec(_db, "ROLLBACK;", nullptr, nullptr, nullptr);
+    reloadIndex();
+}
+
+bool Database::inBatch() const noexcept {
+    return sqlite3_get_autocommit(_db) == 0;
+}
+
+void Database::beginBatchItem() {
+    int rc = sqlite3_exec(_db, "SAVEPOINT batch_item;", nullptr, nullptr, nullptr);
+    check_rc(rc, "Failed to begin batch item");
+}
+
+void Database::commitBatchItem() {
+    int rc = sqlite3_exec(_db, "RELEASE batch_item;", nullptr, nullptr, nullptr);
+    check_rc(rc, "Failed to release batch item");
+}
+
+void Database::rollbackBatchItem() {
+    int rc = sqlite3_exec(_db, "ROLLBACK TO batch_item; RELEASE batch_item;", nullptr, nullptr, nullptr);
+    reloadIndex();
+    check_rc(rc, "Failed to roll back batch item");
+}
+
+void Database::loadIndex() {
+    _index->load(_db);
+}
+
+bool Database::indexLoaded() const noexcept {
+    return _index->loaded();
+}
+
+// A rolled back batch or raw SQL may have changed rows the index mirrors, the tables are read again.
+void Database::reloadIndex() {
+    if (_index->loaded()) {
+        LOG_WARNING("Database", "Reloading metadata index");
+        _index->load(_db);
     }
 }
 
@@ -45,14 +168,13 @@ int Database::add_cloud(
     const CloudProviderType type,
     const nlohmann::json& config_data)
 {
-    sqlite3_stmt* stmt = nullptr;
+    StatementCache::Statement stmt;
     const std::string sql = "INSERT INTO cloud_configs (name, type, config_data) "
         "VALUES (?, ?, ?)";
 
-    int rc = sqlite3_prepare_v2(_db, sql.c_str(), -1, &stmt, nullptr);
+    int rc = _statements->prepare(sql, stmt);
     if (rc != SQLITE_OK) {
         std::string err = sqlite3_errmsg(_db);
-        sqlite3_finalize(stmt);
         throw std::runtime_error("Failed to prepare cloud_configs: " + err);
     }
     sqlite3_bind_text(stmt, 1, name.c_str(), -1, SQLITE_STATIC);
@@ -62,23 +184,22 @@ int Database::add_cloud(
     rc = sqlite3_step(stmt);
     if (rc != SQLITE_DONE) {
         std::string err = sqlite3_errmsg(_db);
-        sqlite3_finalize(stmt);
+        stmt.reset();
         throw std::runtime_error("Failed to insert new cloud: " + name + ", error msg:" + err);
     }
     int cloud_id = sqlite3_last_insert_rowid(_db);
 
-    sqlite3_finalize(stmt);
+    stmt.reset();
     return cloud_id;
 }
 
 nlohmann::json Database::get_cloud_config(const int cloud_id) {
-    sqlite3_stmt* stmt;
+    StatementCache::Statement stmt;
     const std::string sql = "SELECT config_data FROM cloud_configs "
         "WHERE config_id = ?";
 
-    int rc = sqlite3_prepare_v2(_db, sql.c_str(), -1, &stmt, nullptr);
+    int rc = _statements->prepare(sql, stmt);
     if (rc != SQLITE_OK) {
-        sqlite3_finalize(stmt);
         throw std::runtime_error("Failed to prepare SQL statement get_cloud_config");
     }
 
@@ -86,24 +207,23 @@ nlohmann::json Database::get_cloud_config(const int cloud_id) {
 
     rc = sqlite3_step(stmt);
     if (rc != SQLITE_ROW) {
-        sqlite3_finalize(stmt);
+        stmt.reset();
         throw std::runtime_error("Cloud not found");
     }
 
     std::string str = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
 
-    sqlite3_finalize(stmt);
+    stmt.reset();
 
     return nlohmann::json::parse(str);
 }
 
 std::vector<nlohmann::json> Database::get_clouds() {
-    sqlite3_stmt* stmt;
+    StatementCache::Statement stmt;
     const std::string sql = "SELECT config_id, type, config_data FROM cloud_configs;";
 
-    int rc = sqlite3_prepare_v2(_db, sql.c_str(), -1, &stmt, nullptr);
+    int rc = _statements->prepare(sql, stmt);
     if (rc != SQLITE_OK) {
-        sqlite3_finalize(stmt);
         throw std::runtime_error("Failed to prepare SQL statement get_clouds");
     }
 
@@ -120,74 +240,166 @@ std::vector<nlohmann::json> Database::get_clouds() {
         clouds.emplace_back(std::move(json_cloud));
     }
 
-    sqlite3_finalize(stmt);
+    stmt.reset();
 
     return clouds;
 }
-int Database::getGlobalIdByFileId(const uint64_t file_id) {
-    LOG_DEBUG("Database", "Trying to global id for file_id: %i", file_id);
+std::optional<int> Database::childId(const int parent_global_id, const std::string& name) {
+    if (_index->loaded()) {
+        return _index->childId(parent_global_id, name);
+    }
 
-    sqlite3_stmt* stmt = nullptr;
+    StatementCache::Statement stmt;
     int rc = 0;
 
-    std::string sql = "SELECT global_id FROM files WHERE file_id = ? LIMIT 1;";
-    rc = sqlite3_prepare_v2(_db, sql.c_str(), -1, &stmt, nullptr);
+    std::string sql = "SELECT global_id FROM files WHERE parent_global_id = ? AND name = ? ORDER BY global_id LIMIT 1;";
+    rc = _statements->prepare(sql, stmt);
     if (rc != SQLITE_OK) {
-        sqlite3_finalize(stmt);
-        throw std::runtime_error("Failed to prepare statement get_cloud_file_info)");
+        throw std::runtime_error("Failed to prepare statement (childId)");
     }
-
-    sqlite3_bind_int64(stmt, 1, file_id);
+    sqlite3_bind_int64(stmt, 1, parent_global_id);
+    sqlite3_bind_text(stmt, 2, name.c_str(), -1, SQLITE_STATIC);
 
     rc = sqlite3_step(stmt);
     if (rc != SQLITE_ROW) {
-        sqlite3_finalize(stmt);
-        throw std::runtime_error("No file found for given file_id: " + std::to_string(file_id));
-
+        return std::nullopt;
     }
+    return static_cast<int>(sqlite3_column_int64(stmt, 0));
+}
 
-    int global_id = sqlite3_column_int64(stmt, 0);
+// Walks the first count segments down the tree, returns the deepest entry reached and the segments it covers.
+std::pair<int, std::size_t> Database::locate(const std::vector<std::string>& segments, const std::size_t count) {
+    int node = ROOT_GLOBAL_ID;
+    std::size_t done = 0;
+    while (done < count) {
+        std::string name = segments[done];
+        std::size_t end = done + 1;
+        auto next = childId(node, name);
+        // Names span several segments only below directories that were never recorded.
+        while (!next && end < count) {
+            name += '/';
+            name += segments[end++];
+            next = childId(node, name);
+        }
+        if (!next) {
+            break;
+        }
+        node = *next;
+        done = end;
+    }
+    return { node, done };
+}
 
-    sqlite3_finalize(stmt);
+std::optional<int> Database::resolvePath(const std::filesystem::path& path) {
+    auto segments = pathSegments(path);
+    if (segments.empty()) {
+        return std::nullopt;
+    }
+    auto [node, done] = locate(segments, segments.size());
+    if (done != segments.size()) {
+        return std::nullopt;
+    }
+    return node;
+}
 
-    return global_id;
+Database::Placement Database::placementOf(const std::filesystem::path& path) {
+    auto segments = pathSegments(path);
+    if (segments.empty()) {
+        return Placement{ ROOT_GLOBAL_ID, path.string() };
+    }
+    auto [node, done] = locate(segments, segments.size() - 1);
+    return Placement{ node, joinSegments(segments, done, segments.size()) };
 }
 
-int Database::getGlobalIdByPath(const std::filesystem::path& path) {
-    sqlite3_stmt* stmt = nullptr;
+std::filesystem::path Database::pathOf(const int global_id) {
+    if (_index->loaded()) {
+        auto path = _index->pathByGlobalId(global_id);
+        return path ? std::filesystem::path(*path) : std::filesystem::path{};
+    }
+
+    StatementCache::Statement stmt;
     int rc = 0;
 
-    std::string sql = "SELECT global_id FROM files WHERE path = ? LIMIT 1;";
-    rc = sqlite3_prepare_v2(_db, sql.c_str(), -1, &stmt, nullptr);
+    std::string sql = "SELECT parent_global_id, name FROM files WHERE global_id = ?;";
+    rc = _statements->prepare(sql, stmt);
     if (rc != SQLITE_OK) {
-        sqlite3_finalize(stmt);
-        throw std::runtime_error("Failed to prepare statement getGlobalIdByPath)");
+        throw std::runtime_error("Failed to prepare statement (pathOf)");
+    }
+
+    std::vector<std::string> names;
+    int node = global_id;
+    while (node != ROOT_GLOBAL_ID && names.size() < MAX_TREE_DEPTH) {
+        sqlite3_reset(stmt);
+        sqlite3_bind_int64(stmt, 1, node);
+        if (sqlite3_step(stmt) != SQLITE_ROW) {
+            break;
+        }
+        node = sqlite3_column_int(stmt, 0);
+        names.emplace_back(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1)));
     }
 
-    auto path_str = path.string();
-    sqlite3_bind_text(stmt, 1, path_str.c_str(), -1, SQLITE_STATIC);
+    std::filesystem::path path;
+    for (auto it = names.rbegin(); it != names.rend(); ++it) {
+        path /= *it;
+    }
+    return path;
+}
 
-    rc = sqlite3_step(stmt);
-    if (rc != SQLITE_ROW) {
-        sqlite3_finalize(stmt);
-        throw std::runtime_error("No file found for given path: " + path.string());
+int Database::linkCount(const int global_id) {
+    if (_index->loaded()) {
+        return static_cast<int>(_index->linkCount(global_id));
     }
 
-    int global_id = sqlite3_column_int64(stmt, 0);
+    StatementCache::Statement stmt;
+    int rc = 0;
 
-    sqlite3_finalize(stmt);
+    std::string sql = "SELECT COUNT(*) FROM file_links WHERE global_id = ?;";
+    rc = _statements->prepare(sql, stmt);
+    if (rc != SQLITE_OK) {
+        throw std::runtime_error("Failed to prepare statement (linkCount)");
+    }
+    sqlite3_bind_int64(stmt, 1, global_id);
 
-    return global_id;
+    rc = sqlite3_step(stmt);
+    return rc == SQLITE_ROW ? sqlite3_column_int(stmt, 0) : 0;
 }
 
-std::unique_ptr<FileRecordDTO> Database::getFileByFileId(const uint64_t file_id) {
-    sqlite3_stmt* stmt = nullptr;
+// Siblings stored as "<name>/..." were waiting for this directory, they move under it.
+bool Database::adoptChildren(const int global_id, const Placement& place) {
+    StatementCache::Statement stmt;
+
+    std::string sql = "UPDATE files SET parent_global_id = ?1, name = substr(name, length(?2) + 1) "
+        "WHERE parent_global_id = ?3 AND name >= ?2 AND name < ?4 AND global_id != ?1;";
+    if (_statements->prepare(sql, stmt) != SQLITE_OK) {
+        return false;
+    }
+    std::string prefix = place.name + '/';
+    std::string end = place.name + static_cast<char>('/' + 1);
+    sqlite3_bind_int64(stmt, 1, global_id);
+    sqlite3_bind_text(stmt, 2, prefix.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 3, place.parent_global_id);
+    sqlite3_bind_text(stmt, 4, end.c_str(), -1, SQLITE_STATIC);
+
+    return sqlite3_step(stmt) == SQLITE_DONE;
+}
+
+int Database::getGlobalIdByFileId(const uint64_t file_id) {
+    LOG_DEBUG("Database", "Trying to global id for file_id: %i", file_id);
+
+    if (_index->loaded()) {
+        auto global_id = _index->globalIdByFileId(file_id);
+        if (!global_id) {
+            throw std::runtime_error("No file found for given file_id: " + std::to_string(file_id));
+        }
+        return *global_id;
+    }
+
+    StatementCache::Statement stmt;
     int rc = 0;
 
-    std::string sql = "SELECT global_id, type, path, size, local_hash, local_modified_time FROM files WHERE file_id = ?;";
-    rc = sqlite3_prepare_v2(_db, sql.c_str(), -1, &stmt, nullptr);
+    std::string sql = "SELECT global_id FROM files WHERE file_id = ? LIMIT 1;";
+    rc = _statements->prepare(sql, stmt);
     if (rc != SQLITE_OK) {
-        sqlite3_finalize(stmt);
         throw std::runtime_error("Failed to prepare statement get_cloud_file_info)");
     }
 
@@ -195,70 +407,67 @@ std::unique_ptr<FileRecordDTO> Database::getFileByFileId(const uint64_t file_id)
 
     rc = sqlite3_step(stmt);
     if (rc != SQLITE_ROW) {
-        sqlite3_finalize(stmt);
-        LOG_ERROR("Database", "No file found for given file_id: %i", file_id);
-        return nullptr;
+        stmt.reset();
+        throw std::runtime_error("No file found for given file_id: " + std::to_string(file_id));
+
     }
 
     int global_id = sqlite3_column_int64(stmt, 0);
-    EntryType type = entry_type_from_string(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1)));
-    std::string path = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2));
-    sqlite3_int64 raw_size = sqlite3_column_int64(stmt, 3);
-    uint64_t size = static_cast<uint64_t>(raw_size);
-    sqlite3_int64 raw_hash = sqlite3_column_int64(stmt, 4);
-    uint64_t local_hash = static_cast<uint64_t>(raw_hash);
-    uint64_t local_modified_time = sqlite3_column_int64(stmt, 5);
 
-    sqlite3_finalize(stmt);
+    stmt.reset();
 
-    return std::make_unique<FileRecordDTO>(
-        global_id,
-        type,
-        path,
-        size,
-        local_hash,
-        local_modified_time,
-        file_id
-    );
+    return global_id;
 }
 
-std::unique_ptr<FileRecordDTO> Database::getFileByPath(const std::filesystem::path& path) {
-    sqlite3_stmt* stmt = nullptr;
+int Database::getGlobalIdByPath(const std::filesystem::path& path) {
+    auto global_id = resolvePath(path);
+    if (!global_id) {
+        throw std::runtime_error("No file found for given path: " + path.string());
+    }
+    return *global_id;
+}
+
+std::unique_ptr<FileRecordDTO> Database::getFileByFileId(const uint64_t file_id) {
+    if (_index->loaded()) {
+        auto file = _index->fileByFileId(file_id);
+        if (!file) {
+            LOG_ERROR("Database", "No file found for given file_id: %i", file_id);
+        }
+        return file;
+    }
+
+    StatementCache::Statement stmt;
     int rc = 0;
 
-    std::string sql = "SELECT global_id, type, file_id, size, local_hash, local_modified_time FROM files WHERE path = ?;";
-    rc = sqlite3_prepare_v2(_db, sql.c_str(), -1, &stmt, nullptr);
+    std::string sql = "SELECT global_id, type, size, local_hash, local_modified_time FROM files WHERE file_id = ?;";
+    rc = _statements->prepare(sql, stmt);
     if (rc != SQLITE_OK) {
-        sqlite3_finalize(stmt);
-        throw std::runtime_error("Failed to prepare statement getFileByPath)");
+        throw std::runtime_error("Failed to prepare statement get_cloud_file_info)");
     }
 
-    auto path_str = path.string();
-    sqlite3_bind_text(stmt, 1, path_str.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 1, file_id);
 
     rc = sqlite3_step(stmt);
     if (rc != SQLITE_ROW) {
-        sqlite3_finalize(stmt);
-        LOG_ERROR("Database", "No file found for given path: %s", path.c_str());
+        stmt.reset();
+        LOG_ERROR("Database", "No file found for given file_id: %i", file_id);
         return nullptr;
     }
 
     int global_id = sqlite3_column_int64(stmt, 0);
     EntryType type = entry_type_from_string(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1)));
-    sqlite3_int64 raw_file_id = sqlite3_column_int64(stmt, 2);
-    uint64_t file_id = static_cast<uint64_t>(raw_file_id);
-    sqlite3_int64 raw_size = sqlite3_column_int64(stmt, 3);
+    sqlite3_int64 raw_size = sqlite3_column_int64(stmt, 2);
     uint64_t size = static_cast<uint64_t>(raw_size);
-    sqlite3_int64 raw_hash = sqlite3_column_int64(stmt, 4);
+    sqlite3_int64 raw_hash = sqlite3_column_int64(stmt, 3);
     uint64_t local_hash = static_cast<uint64_t>(raw_hash);
-    uint64_t local_modified_time = sqlite3_column_int64(stmt, 5);
+    uint64_t local_modified_time = sqlite3_column_int64(stmt, 4);
 
-    sqlite3_finalize(stmt);
+    stmt.reset();
 
     return std::make_unique<FileRecordDTO>(
         global_id,
         type,
-        path,
+        pathOf(global_id),
         size,
         local_hash,
         local_modified_time,
@@ -266,14 +475,30 @@ std::unique_ptr<FileRecordDTO> Database::getFileByPath(const std::filesystem::pa
     );
 }
 
+std::unique_ptr<FileRecordDTO> Database::getFileByPath(const std::filesystem::path& path) {
+    auto global_id = resolvePath(path);
+    if (!global_id) {
+        LOG_ERROR("Database", "No file found for given path: %s", path.c_str());
+        return nullptr;
+    }
+    return getFileByGlobalId(*global_id);
+}
+
 std::unique_ptr<FileRecordDTO> Database::getFileByGlobalId(const int global_id) {
-    sqlite3_stmt* stmt = nullptr;
+    if (_index->loaded()) {
+        auto file = _index->fileByGlobalId(global_id);
+        if (!file) {
+            LOG_ERROR("Database", "No file found for given global_id: %i", global_id);
+        }
+        return file;
+    }
+
+    StatementCache::Statement stmt;
     int rc = 0;
 
-    std::string sql = "SELECT file_id, type, path, size, local_hash, local_modified_time FROM files WHERE global_id = ?;";
-    rc = sqlite3_prepare_v2(_db, sql.c_str(), -1, &stmt, nullptr);
+    std::string sql = "SELECT file_id, type, size, local_hash, local_modified_time FROM files WHERE global_id = ?;";
+    rc = _statements->prepare(sql, stmt);
     if (rc != SQLITE_OK) {
-        sqlite3_finalize(stmt);
         throw std::runtime_error("Failed to prepare statement get_cloud_file_info)");
     }
 
@@ -281,7 +506,7 @@ std::unique_ptr<FileRecordDTO> Database::getFileByGlobalId(const int global_id)
 
     rc = sqlite3_step(stmt);
     if (rc != SQLITE_ROW) {
-        sqlite3_finalize(stmt);
+        stmt.reset();
         LOG_ERROR("Database", "No file found for given global_id: %i", global_id);
         return nullptr;
     }
@@ -289,19 +514,18 @@ std::unique_ptr<FileRecordDTO> Database::getFileByGlobalId(const int global_id)
     sqlite3_int64 raw_file_id = sqlite3_column_int64(stmt, 0);
     uint64_t file_id = static_cast<uint64_t>(raw_file_id);
     EntryType type = entry_type_from_string(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1)));
-    std::string path = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2));
-    sqlite3_int64 raw_size = sqlite3_column_int64(stmt, 3);
+    sqlite3_int64 raw_size = sqlite3_column_int64(stmt, 2);
     uint64_t size = static_cast<uint64_t>(raw_size);
-    sqlite3_int64 raw_hash = sqlite3_column_int64(stmt, 4);
+    sqlite3_int64 raw_hash = sqlite3_column_int64(stmt, 3);
     uint64_t local_hash = static_cast<uint64_t>(raw_hash);
-    uint64_t local_modified_time = sqlite3_column_int64(stmt, 5);
+    uint64_t local_modified_time = sqlite3_column_int64(stmt, 4);
 
-    sqlite3_finalize(stmt);
+    stmt.reset();
 
     return std::make_unique<FileRecordDTO>(
         global_id,
         type,
-        path,
+        pathOf(global_id),
         size,
         local_hash,
         local_modified_time,
@@ -314,28 +538,15 @@ std::filesystem::path Database::getMissingPathPart(const std::filesystem::path&
 
     LOG_DEBUG("Database", "getMissingPathPart() for path=%s and norm=%s", path.c_str(), norm.c_str());
 
-    sqlite3_stmt* stmt = nullptr;
-    int rc = 0;
-
+    int node = ROOT_GLOBAL_ID;
     std::filesystem::path accum{};
-    for (const auto& seq : norm) {
+    for (const auto& seq : pathSegments(norm)) {
         accum /= seq;
 
         LOG_DEBUG("Database", "Checking existence of: %s", accum.c_str());
 
-        std::string sql = "SELECT global_id FROM files WHERE path = ?;";
-        rc = sqlite3_prepare_v2(_db, sql.c_str(), -1, &stmt, nullptr);
-        if (rc != SQLITE_OK) {
-            sqlite3_finalize(stmt);
-            throw std::runtime_error("Failed to prepare statement (checkExistanceByPath)");
-        }
-
-        auto accum_str = accum.string();
-        sqlite3_bind_text(stmt, 1, accum_str.c_str(), -1, SQLITE_STATIC);
-
-        rc = sqlite3_step(stmt);
-        if (rc != SQLITE_ROW) {
-            sqlite3_finalize(stmt);
+        auto child = childId(node, seq);
+        if (!child || linkCount(*child) != num_clouds) {
             auto parent = accum.parent_path();
             if (parent.empty()) {
                 return norm;
@@ -344,35 +555,7 @@ std::filesystem::path Database::getMissingPathPart(const std::filesystem::path&
             LOG_DEBUG("Database", "Missing path part detected: %s", missing.c_str());
             return missing;
         }
-        else {
-            int global_id = sqlite3_column_int64(stmt, 0);
-            sqlite3_finalize(stmt);
-
-            sql = "SELECT cloud_file_id FROM file_links WHERE global_id = ?;";
-            rc = sqlite3_prepare_v2(_db, sql.c_str(), -1, &stmt, nullptr);
-            if (rc != SQLITE_OK) {
-                sqlite3_finalize(stmt);
-                throw std::runtime_error("Failed to prepare statement (getMissingPathPart)");
-            }
-
-            sqlite3_bind_int64(stmt, 1, global_id);
-
-            int row_count = 0;
-            while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
-                ++row_count;
-            }
-            sqlite3_finalize(stmt);
-
-            if (row_count != num_clouds) {
-                auto parent = accum.parent_path();
-                if (parent.empty()) {
-                    return norm;
-                }
-                auto missing = norm.lexically_relative(parent);
-                LOG_DEBUG("Database", "Missing path part detected: %s", missing.c_str());
-                return missing;
-            }
-        }
+        node = *child;
     }
 
     LOG_DEBUG("Database", "No missing path parts for path=%s", path.string().c_str());
@@ -380,51 +563,43 @@ std::filesystem::path Database::getMissingPathPart(const std::filesystem::path&
 }
 
 std::string Database::getCloudFileIdByPath(const std::filesystem::path& path, const int cloud_id) {
-    sqlite3_stmt* stmt = nullptr;
-    int rc = 0;
-
-    std::string sql = "SELECT global_id FROM files WHERE path = ?;";
-
-    rc = sqlite3_prepare_v2(_db, sql.c_str(), -1, &stmt, nullptr);
-    if (rc != SQLITE_OK) {
-        sqlite3_finalize(stmt);
-        throw std::runtime_error("Failed to prepare statement getCloudFileIdbyPath)");
-    }
-
-    auto path_str = path.string();
-    sqlite3_bind_text(stmt, 1, path_str.c_str(), -1, SQLITE_STATIC);
-
-    rc = sqlite3_step(stmt);
-    if (rc != SQLITE_ROW) {
-        sqlite3_finalize(stmt);
+    auto global_id = resolvePath(path);
+    if (!global_id) {
         LOG_ERROR("Database", "No such global_id getCloudFileIdbyPath for path: %s", path.string());
         return std::string{};
     }
 
-    int global_id = sqlite3_column_int64(stmt, 0);
-    sqlite3_finalize(stmt);
+    if (_index->loaded()) {
+        auto cloud_file_id = _index->cloudFileId(cloud_id, *global_id);
+        if (!cloud_file_id) {
+            LOG_ERROR("Database", "No such global_id getCloudFileIdbyPath for path: %s and cloud: %s", path.string(), CloudResolver::getName(cloud_id));
+            return std::string{};
+        }
+        return *cloud_file_id;
+    }
+
+    StatementCache::Statement stmt;
+    int rc = 0;
 
-    stmt = nullptr;
-    sql = "SELECT cloud_file_id FROM file_links WHERE global_id = ? AND cloud_id = ?;";
+    std::string sql = "SELECT cloud_file_id FROM file_links WHERE global_id = ? AND cloud_id = ?;";
 
-    rc = sqlite3_prepare_v2(_db, sql.c_str(), -1, &stmt, nullptr);
+    rc = _statements->prepare(sql, stmt);
     if (rc != SQLITE_OK) {
-        sqlite3_finalize(stmt);
         throw std::runtime_error("Failed to prepare statement getCloudFileIdbyPath)");
     }
 
-    sqlite3_bind_int64(stmt, 1, global_id);
+    sqlite3_bind_int64(stmt, 1, *global_id);
     sqlite3_bind_int64(stmt, 2, cloud_id);
 
     rc = sqlite3_step(stmt);
     if (rc != SQLITE_ROW) {
-        sqlite3_finalize(stmt);
+        stmt.reset();
         LOG_ERROR("Database", "No such global_id getCloudFileIdbyPath for path: %s and cloud: %s", path.string(), CloudResolver::getName(cloud_id));
         return std::string{};
     }
 
     std::string cloud_file_id = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
-    sqlite3_finalize(stmt);
+    stmt.reset();
 
     return cloud_file_id;
 
@@ -434,90 +609,87 @@ int Database::add_file(const FileRecordDTO& dto) {
     sqlite3_busy_timeout(_db, 5000);
     LOG_DEBUG("Database", "Trying to add file: path: %s, file_id: %i", dto.rel_path.string(), dto.file_id);
     int rc = 0;
-    rc = sqlite3_exec(_db, "BEGIN TRANSACTION;", nullptr, nullptr, nullptr);
+    rc = sqlite3_exec(_db, BEGIN_WRITE_SQL, nullptr, nullptr, nullptr);
     if (rc != SQLITE_OK) {
         throw std::runtime_error("Failed to begin transaction add_file");
     }
-    sqlite3_stmt* stmt = nullptr;
+    Placement place;
+    try {
+        place = placementOf(dto.rel_path);
+    }
+    catch (...) {
+        sqlite3_exec(_db, ROLLBACK_WRITE_SQL, nullptr, nullptr, nullptr);
+        throw;
+    }
+    StatementCache::Statement stmt;
 
-    const std::string sql = "INSERT OR IGNORE INTO files (type, path, size, local_hash, local_modified_time, file_id) VALUES (?, ?, ?, ?, ?, ?);";
-    rc = sqlite3_prepare_v2(_db, sql.c_str(), -1, &stmt, nullptr);
+    rc = _statements->prepare(ADD_FILE_SQL, stmt);
     if (rc != SQLITE_OK) {
-        sqlite3_finalize(stmt);
-        sqlite3_exec(_db, "ROLLBACK;", nullptr, nullptr, nullptr);
+        sqlite3_exec(_db, ROLLBACK_WRITE_SQL, nullptr, nullptr, nullptr);
         throw std::runtime_error("Failed to prepare SQL statement add_file");
     }
     sqlite3_bind_text(stmt, 1, to_cstr(dto.type), -1, SQLITE_STATIC);
-    auto path_str = dto.rel_path.string();
-    sqlite3_bind_text(stmt, 2, path_str.c_str(), -1, SQLITE_STATIC);
-    sqlite3_bind_int64(stmt, 3, dto.size);
+    sqlite3_bind_int64(stmt, 2, place.parent_global_id);
+    sqlite3_bind_text(stmt, 3, place.name.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 4, dto.size);
     const auto& hash = dto.cloud_hash_check_sum;
     uint64_t hash_u;
     if (std::holds_alternative<uint64_t>(hash))
         hash_u = std::get<uint64_t>(hash);
     else
         hash_u = 0;
-    sqlite3_bind_int64(stmt, 4, hash_u);
-    sqlite3_bind_int64(stmt, 5, static_cast<sqlite3_int64>(dto.cloud_file_modified_time));
-    sqlite3_bind_int64(stmt, 6, dto.file_id);
+    sqlite3_bind_int64(stmt, 5, hash_u);
+    sqlite3_bind_int64(stmt, 6, static_cast<sqlite3_int64>(dto.cloud_file_modified_time));
+    sqlite3_bind_int64(stmt, 7, dto.file_id);
 
     rc = sqlite3_step(stmt);
     if (rc != SQLITE_DONE) {
-        sqlite3_finalize(stmt);
-        sqlite3_exec(_db, "ROLLBACK;", nullptr, nullptr, nullptr);
+        stmt.reset();
+        sqlite3_exec(_db, ROLLBACK_WRITE_SQL, nullptr, nullptr, nullptr);
         throw std::runtime_error("Error adding file to files" + dto.rel_path.string());
     }
     int global_id = sqlite3_last_insert_rowid(_db);
-    sqlite3_finalize(stmt);
-    rc = sqlite3_exec(_db, "COMMIT;", nullptr, nullptr, nullptr);
+    stmt.reset();
+
+    bool directory = dto.type == EntryType::Directory;
+    if (directory && !adoptChildren(global_id, place)) {
+        sqlite3_exec(_db, ROLLBACK_WRITE_SQL, nullptr, nullptr, nullptr);
+        throw std::runtime_error("Error adopting children of " + dto.rel_path.string());
+    }
+    rc = sqlite3_exec(_db, COMMIT_WRITE_SQL, nullptr, nullptr, nullptr);
     if (rc != SQLITE_OK) {
-        sqlite3_exec(_db, "ROLLBACK;", nullptr, nullptr, nullptr);
+        sqlite3_exec(_db, ROLLBACK_WRITE_SQL, nullptr, nullptr, nullptr);
         throw std::runtime_error("Error commiting file " + dto.rel_path.string());
     }
+    _index->addFile(global_id, dto.type, place.parent_global_id, place.name, dto.size, hash_u, dto.cloud_file_modified_time, dto.file_id);
+    if (directory) {
+        _index->adoptChildren(global_id);
+    }
     return global_id;
 }
 
 bool Database::quickPathCheck(const std::filesystem::path& path) {
-    sqlite3_stmt* stmt = nullptr;
-    int rc = 0;
-
-    std::string sql = "SELECT global_id FROM files WHERE path = ?;";
-    rc = sqlite3_prepare_v2(_db, sql.c_str(), -1, &stmt, nullptr);
-    if (rc != SQLITE_OK) {
-        sqlite3_finalize(stmt);
-        throw std::runtime_error("Failed to prepare statement (quickPathCheck)");
-    }
-
-    auto path_str = path.string();
-    sqlite3_bind_text(stmt, 1, path_str.c_str(), -1, SQLITE_STATIC);
-
-    rc = sqlite3_step(stmt);
-    if (rc != SQLITE_ROW) {
-        sqlite3_finalize(stmt);
+    if (!resolvePath(path)) {
         LOG_DEBUG("Database", "Missing path detected: %s", path.c_str());
         return false;
     }
-    else {
-        sqlite3_finalize(stmt);
-        LOG_DEBUG("Database", "Path exists: %s", path.c_str());
-        return true;
-    }
+    LOG_DEBUG("Database", "Path exists: %s", path.c_str());
+    return true;
 }
 
 void Database::update_cloud_data(const int cloud_id, const nlohmann::json& data) {
     sqlite3_busy_timeout(_db, 5000);
     int rc = 0;
-    rc = sqlite3_exec(_db, "BEGIN TRANSACTION;", nullptr, nullptr, nullptr);
+    rc = sqlite3_exec(_db, BEGIN_WRITE_SQL, nullptr, nullptr, nullptr);
     if (rc != SQLITE_OK) {
         throw std::runtime_error("Failed to begin transaction update_cloud_data");
     }
-    sqlite3_stmt* stmt = nullptr;
+    StatementCache::Statement stmt;
 
     const std::string sql = "UPDATE cloud_configs SET config_data = ? WHERE config_id = ?;";
-    rc = sqlite3_prepare_v2(_db, sql.c_str(), -1, &stmt, nullptr);
+    rc = _statements->prepare(sql, stmt);
     if (rc != SQLITE_OK) {
-        sqlite3_finalize(stmt);
-        sqlite3_exec(_db, "ROLLBACK;", nullptr, nullptr, nullptr);
+        sqlite3_exec(_db, ROLLBACK_WRITE_SQL, nullptr, nullptr, nullptr);
         throw std::runtime_error("Failed to prepare SQL statement update_cloud_data");
     }
 
@@ -526,51 +698,42 @@ void Database::update_cloud_data(const int cloud_id, const nlohmann::json& data)
 
     rc = sqlite3_step(stmt);
     if (rc != SQLITE_DONE) {
-        sqlite3_finalize(stmt);
-        sqlite3_exec(_db, "ROLLBACK;", nullptr, nullptr, nullptr);
+        stmt.reset();
+        sqlite3_exec(_db, ROLLBACK_WRITE_SQL, nullptr, nullptr, nullptr);
         throw std::runtime_error("Error changing update_cloud_data");
     }
-    sqlite3_finalize(stmt);
+    stmt.reset();
 
-    rc = sqlite3_exec(_db, "COMMIT;", nullptr, nullptr, nullptr);
+    rc = sqlite3_exec(_db, COMMIT_WRITE_SQL, nullptr, nullptr, nullptr);
     if (rc != SQLITE_OK) {
-        sqlite3_exec(_db, "ROLLBACK;", nullptr, nullptr, nullptr);
+        sqlite3_exec(_db, ROLLBACK_WRITE_SQL, nullptr, nullptr, nullptr);
         throw std::runtime_error("Error commiting change update_cloud_data");
     }
 }
 
 std::filesystem::path Database::getPathByGlobalId(const int search_global_id) {
-    sqlite3_stmt* stmt = nullptr;
-    int rc = 0;
-
-    std::string sql = "SELECT path FROM files WHERE global_id = ? LIMIT 1;";
-    rc = sqlite3_prepare_v2(_db, sql.c_str(), -1, &stmt, nullptr);
-    if (rc != SQLITE_OK) {
-        sqlite3_finalize(stmt);
-        throw std::runtime_error("Failed to prepare statement (file_links lookup)");
-    }
-    sqlite3_bind_int64(stmt, 1, search_global_id);
-
-    rc = sqlite3_step(stmt);
-    if (rc != SQLITE_ROW) {
-        sqlite3_finalize(stmt);
+    auto path = pathOf(search_global_id);
+    if (path.empty()) {
         LOG_ERROR("Database", "No path found for given global_id: %i", search_global_id);
-        return std::filesystem::path{};
     }
-    std::string path_text = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
-    sqlite3_finalize(stmt);
-
-    return std::filesystem::path(path_text);
+    return path;
 }
 
 std::unique_ptr<FileRecordDTO> Database::getFileByCloudIdAndCloudFileId(const int cloud_id, const std::string& cloud_file_id) {
-    sqlite3_stmt* stmt = nullptr;
+    if (_index->loaded()) {
+        auto link = _index->linkByCloudFileId(cloud_id, cloud_file_id);
+        if (!link) {
+            LOG_WARNING("DATABASE", "No link found for pair cloud_id: %i and cloud_file_id: %s", cloud_id, cloud_file_id);
+        }
+        return link;
+    }
+
+    StatementCache::Statement stmt;
     int rc = 0;
 
     std::string sql = "SELECT global_id, cloud_parent_id, cloud_hash_check_sum, cloud_file_modified_time, cloud_size FROM file_links WHERE cloud_id = ? AND cloud_file_id = ? LIMIT 1;";
-    rc = sqlite3_prepare_v2(_db, sql.c_str(), -1, &stmt, nullptr);
+    rc = _statements->prepare(sql, stmt);
     if (rc != SQLITE_OK) {
-        sqlite3_finalize(stmt);
         throw std::runtime_error("Failed to prepare statement get_global_id");
     }
     sqlite3_bind_int64(stmt, 1, cloud_id);
@@ -578,7 +741,7 @@ std::unique_ptr<FileRecordDTO> Database::getFileByCloudIdAndCloudFileId(const in
 
     rc = sqlite3_step(stmt);
     if (rc != SQLITE_ROW) {
-        sqlite3_finalize(stmt);
+        stmt.reset();
         LOG_WARNING("DATABASE", "No link found for pair cloud_id: %i and cloud_file_id: %s", cloud_id, cloud_file_id);
         return nullptr;
     }
@@ -589,7 +752,7 @@ std::unique_ptr<FileRecordDTO> Database::getFileByCloudIdAndCloudFileId(const in
     sqlite3_int64 raw_size = sqlite3_column_int64(stmt, 4);
     uint64_t cloud_size = static_cast<uint64_t>(raw_size);
 
-    sqlite3_finalize(stmt);
+    stmt.reset();
 
     return std::make_unique<FileRecordDTO>(
         global_id,
@@ -603,13 +766,20 @@ std::unique_ptr<FileRecordDTO> Database::getFileByCloudIdAndCloudFileId(const in
 }
 
 std::unique_ptr<FileRecordDTO> Database::getFileByCloudIdAndGlobalId(const int cloud_id, const int global_id) {
-    sqlite3_stmt* stmt = nullptr;
+    if (_index->loaded()) {
+        auto link = _index->linkByGlobalId(cloud_id, global_id);
+        if (!link) {
+            LOG_WARNING("DATABASE", "No link found for pair cloud_id: %i and cloud_file_id: %i", cloud_id, global_id);
+        }
+        return link;
+    }
+
+    StatementCache::Statement stmt;
     int rc = 0;
 
     std::string sql = "SELECT cloud_file_id, cloud_parent_id, cloud_hash_check_sum, cloud_file_modified_time, cloud_size FROM file_links WHERE cloud_id = ? AND global_id = ? LIMIT 1;";
-    rc = sqlite3_prepare_v2(_db, sql.c_str(), -1, &stmt, nullptr);
+    rc = _statements->prepare(sql, stmt);
     if (rc != SQLITE_OK) {
-        sqlite3_finalize(stmt);
         throw std::runtime_error("Failed to prepare statement getFileByCloudIdAndGlobalId");
     }
     sqlite3_bind_int64(stmt, 1, cloud_id);
@@ -617,7 +787,7 @@ std::unique_ptr<FileRecordDTO> Database::getFileByCloudIdAndGlobalId(const int c
 
     rc = sqlite3_step(stmt);
     if (rc != SQLITE_ROW) {
-        sqlite3_finalize(stmt);
+        stmt.reset();
         LOG_WARNING("DATABASE", "No link found for pair cloud_id: %i and cloud_file_id: %i", cloud_id, global_id);
         return nullptr;
     }
@@ -628,7 +798,7 @@ std::unique_ptr<FileRecordDTO> Database::getFileByCloudIdAndGlobalId(const int c
     sqlite3_int64 raw_size = sqlite3_column_int64(stmt, 4);
     uint64_t cloud_size = static_cast<uint64_t>(raw_size);
 
-    sqlite3_finalize(stmt);
+    stmt.reset();
 
     return std::make_unique<FileRecordDTO>(
         global_id,
@@ -642,13 +812,20 @@ std::unique_ptr<FileRecordDTO> Database::getFileByCloudIdAndGlobalId(const int c
 }
 
 std::string Database::get_cloud_file_id_by_cloud_id(const int cloud_id, const int global_id) {
-    sqlite3_stmt* stmt = nullptr;
+    if (_index->loaded()) {
+        auto cloud_file_id = _index->cloudFileId(cloud_id, global_id);
+        if (!cloud_file_id) {
+            throw std::runtime_error("ERROR No file_link found for given cloud_id and global id: " + std::to_string(cloud_id));
+        }
+        return *cloud_file_id;
+    }
+
+    StatementCache::Statement stmt;
     int rc = 0;
 
     std::string sql = "SELECT cloud_file_id FROM file_links WHERE cloud_id = ? AND global_id = ? LIMIT 1;";
-    rc = sqlite3_prepare_v2(_db, sql.c_str(), -1, &stmt, nullptr);
+    rc = _statements->prepare(sql, stmt);
     if (rc != SQLITE_OK) {
-        sqlite3_finalize(stmt);
         throw std::runtime_error("Failed to prepare statement (file_links lookup)");
     }
     sqlite3_bind_int64(stmt, 1, cloud_id);
@@ -657,12 +834,12 @@ std::string Database::get_cloud_file_id_by_cloud_id(const int cloud_id, const in
 
     rc = sqlite3_step(stmt);
     if (rc != SQLITE_ROW) {
-        sqlite3_finalize(stmt);
+        stmt.reset();
         throw std::runtime_error("ERROR No file_link found for given cloud_id and global id: " + std::to_string(cloud_id));
     }
     std::string cloud_file_id = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
 
-    sqlite3_finalize(stmt);
+    stmt.reset();
 
     return cloud_file_id;
 }
@@ -671,17 +848,16 @@ void Database::update_file_link(const FileUpdatedDTO& dto) {
     sqlite3_busy_timeout(_db, 5000);
 
     int rc = 0;
-    rc = sqlite3_exec(_db, "BEGIN TRANSACTION;", nullptr, nullptr, nullptr);
+    rc = sqlite3_exec(_db, BEGIN_WRITE_SQL, nullptr, nullptr, nullptr);
     if (rc != SQLITE_OK) {
         throw std::runtime_error("Failed to begin transaction update_file_link");
     }
-    sqlite3_stmt* stmt = nullptr;
+    StatementCache::Statement stmt;
 
     const std::string sql = "UPDATE file_links SET cloud_hash_check_sum = ?, cloud_file_modified_time = ?, cloud_size = ? WHERE cloud_id = ? AND global_id = ?;";
-    rc = sqlite3_prepare_v2(_db, sql.c_str(), -1, &stmt, nullptr);
+    rc = _statements->prepare(sql, stmt);
     if (rc != SQLITE_OK) {
-        sqlite3_finalize(stmt);
-        sqlite3_exec(_db, "ROLLBACK;", nullptr, nullptr, nullptr);
+        sqlite3_exec(_db, ROLLBACK_WRITE_SQL, nullptr, nullptr, nullptr);
         throw std::runtime_error("Failed to prepare SQL statement update_file_link");
     }
 
@@ -701,35 +877,35 @@ void Database::update_file_link(const FileUpdatedDTO& dto) {
     rc = sqlite3_step(stmt);
 
     if (rc != SQLITE_DONE) {
-        sqlite3_finalize(stmt);
-        sqlite3_exec(_db, "ROLLBACK;", nullptr, nullptr, nullptr);
+        stmt.reset();
+        sqlite3_exec(_db, ROLLBACK_WRITE_SQL, nullptr, nullptr, nullptr);
         throw std::runtime_error("Error changing update_file_link");
     }
-    sqlite3_finalize(stmt);
+    stmt.reset();
 
-    rc = sqlite3_exec(_db, "COMMIT;", nullptr, nullptr, nullptr);
+    rc = sqlite3_exec(_db, COMMIT_WRITE_SQL, nullptr, nullptr, nullptr);
 
     if (rc != SQLITE_OK) {
-        sqlite3_exec(_db, "ROLLBACK;", nullptr, nullptr, nullptr);
+        sqlite3_exec(_db, ROLLBACK_WRITE_SQL, nullptr, nullptr, nullptr);
         throw std::runtime_error("Error commiting change update_file_link");
     }
+    _index->updateLink(dto.global_id, dto.cloud_id, hash_str, dto.cloud_file_modified_time, dto.size);
 }
 
 void Database::update_file(const FileUpdatedDTO& dto) {
     sqlite3_busy_timeout(_db, 5000);
 
     int rc = 0;
-    rc = sqlite3_exec(_db, "BEGIN TRANSACTION;", nullptr, nullptr, nullptr);
+    rc = sqlite3_exec(_db, BEGIN_WRITE_SQL, nullptr, nullptr, nullptr);
     if (rc != SQLITE_OK) {
         throw std::runtime_error("Failed to begin transaction update_file_link");
     }
-    sqlite3_stmt* stmt = nullptr;
+    StatementCache::Statement stmt;
 
     const std::string sql = "UPDATE files SET size = ?, local_hash = ?, local_modified_time = ?, file_id = ? WHERE global_id = ?;";
-    rc = sqlite3_prepare_v2(_db, sql.c_str(), -1, &stmt, nullptr);
+    rc = _statements->prepare(sql, stmt);
     if (rc != SQLITE_OK) {
-        sqlite3_finalize(stmt);
-        sqlite3_exec(_db, "ROLLBACK;", nullptr, nullptr, nullptr);
+        sqlite3_exec(_db, ROLLBACK_WRITE_SQL, nullptr, nullptr, nullptr);
         throw std::runtime_error("Failed to prepare SQL statement update_file_link");
     }
 
@@ -748,35 +924,35 @@ void Database::update_file(const FileUpdatedDTO& dto) {
     rc = sqlite3_step(stmt);
 
     if (rc != SQLITE_DONE) {
-        sqlite3_finalize(stmt);
-        sqlite3_exec(_db, "ROLLBACK;", nullptr, nullptr, nullptr);
+        stmt.reset();
+        sqlite3_exec(_db, ROLLBACK_WRITE_SQL, nullptr, nullptr, nullptr);
         throw std::runtime_error("Error changing update_file_link");
     }
-    sqlite3_finalize(stmt);
+    stmt.reset();
 
-    rc = sqlite3_exec(_db, "COMMIT;", nullptr, nullptr, nullptr);
+    rc = sqlite3_exec(_db, COMMIT_WRITE_SQL, nullptr, nullptr, nullptr);
 
     if (rc != SQLITE_OK) {
-        sqlite3_exec(_db, "ROLLBACK;", nullptr, nullptr, nullptr);
+        sqlite3_exec(_db, ROLLBACK_WRITE_SQL, nullptr, nullptr, nullptr);
         throw std::runtime_error("Error commiting change update_file_link");
     }
+    _index->updateFile(dto.global_id, dto.size, hash_u, dto.cloud_file_modified_time, dto.file_id);
 }
 
 void Database::update_file_link(const FileMovedDTO& dto) {
     sqlite3_busy_timeout(_db, 5000);
 
     int rc = 0;
-    rc = sqlite3_exec(_db, "BEGIN TRANSACTION;", nullptr, nullptr, nullptr);
+    rc = sqlite3_exec(_db, BEGIN_WRITE_SQL, nullptr, nullptr, nullptr);
     if (rc != SQLITE_OK) {
         throw std::runtime_error("Failed to begin transaction update_file_link");
     }
-    sqlite3_stmt* stmt = nullptr;
+    StatementCache::Statement stmt;
 
     const std::string sql = "UPDATE file_links SET cloud_file_id = ?, cloud_file_modified_time = ?, cloud_parent_id = ? WHERE cloud_id = ? AND global_id = ?;";
-    rc = sqlite3_prepare_v2(_db, sql.c_str(), -1, &stmt, nullptr);
+    rc = _statements->prepare(sql, stmt);
     if (rc != SQLITE_OK) {
-        sqlite3_finalize(stmt);
-        sqlite3_exec(_db, "ROLLBACK;", nullptr, nullptr, nullptr);
+        sqlite3_exec(_db, ROLLBACK_WRITE_SQL, nullptr, nullptr, nullptr);
         throw std::runtime_error("Failed to prepare SQL statement update_file_link");
     }
 
@@ -789,108 +965,139 @@ void Database::update_file_link(const FileMovedDTO& dto) {
     rc = sqlite3_step(stmt);
 
     if (rc != SQLITE_DONE) {
-        sqlite3_finalize(stmt);
-        sqlite3_exec(_db, "ROLLBACK;", nullptr, nullptr, nullptr);
+        stmt.reset();
+        sqlite3_exec(_db, ROLLBACK_WRITE_SQL, nullptr, nullptr, nullptr);
         throw std::runtime_error("Error changing update_file_link");
     }
-    sqlite3_finalize(stmt);
+    stmt.reset();
 
-    rc = sqlite3_exec(_db, "COMMIT;", nullptr, nullptr, nullptr);
+    rc = sqlite3_exec(_db, COMMIT_WRITE_SQL, nullptr, nullptr, nullptr);
 
     if (rc != SQLITE_OK) {
-        sqlite3_exec(_db, "ROLLBACK;", nullptr, nullptr, nullptr);
+        sqlite3_exec(_db, ROLLBACK_WRITE_SQL, nullptr, nullptr, nullptr);
         throw std::runtime_error("Error commiting change update_file_link");
     }
+    _index->moveLink(dto.global_id, dto.cloud_id, dto.cloud_file_id, dto.new_cloud_parent_id, dto.cloud_file_modified_time);
 }
 
 void Database::update_file(const FileMovedDTO& dto) {
     sqlite3_busy_timeout(_db, 5000);
 
     int rc = 0;
-    rc = sqlite3_exec(_db, "BEGIN TRANSACTION;", nullptr, nullptr, nullptr);
+    rc = sqlite3_exec(_db, BEGIN_WRITE_SQL, nullptr, nullptr, nullptr);
     if (rc != SQLITE_OK) {
         throw std::runtime_error("Failed to begin transaction update_file_link");
     }
-    sqlite3_stmt* stmt = nullptr;
+    Placement place;
+    try {
+        place = placementOf(dto.new_rel_path);
+    }
+    catch (...) {
+        sqlite3_exec(_db, ROLLBACK_WRITE_SQL, nullptr, nullptr, nullptr);
+        throw;
+    }
+    StatementCache::Statement stmt;
 
-    const std::string sql = "UPDATE files SET path = ?, local_modified_time = ? WHERE global_id = ?;";
-    rc = sqlite3_prepare_v2(_db, sql.c_str(), -1, &stmt, nullptr);
+    // Descendants hang off this row, a directory moves with a single update.
+    const std::string sql = "UPDATE files SET parent_global_id = ?, name = ?, local_modified_time = ? WHERE global_id = ?;";
+    rc = _statements->prepare(sql, stmt);
     if (rc != SQLITE_OK) {
-        sqlite3_finalize(stmt);
-        sqlite3_exec(_db, "ROLLBACK;", nullptr, nullptr, nullptr);
+        sqlite3_exec(_db, ROLLBACK_WRITE_SQL, nullptr, nullptr, nullptr);
         throw std::runtime_error("Failed to prepare SQL statement update_file_link");
     }
 
-    auto path_str = dto.new_rel_path.string();
-    sqlite3_bind_text(stmt, 1, path_str.c_str(), -1, SQLITE_STATIC);
-    sqlite3_bind_int64(stmt, 2, static_cast<sqlite3_int64>(dto.cloud_file_modified_time));
-    sqlite3_bind_int(stmt, 3, dto.global_id);
+    sqlite3_bind_int64(stmt, 1, place.parent_global_id);
+    sqlite3_bind_text(stmt, 2, place.name.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 3, static_cast<sqlite3_int64>(dto.cloud_file_modified_time));
+    sqlite3_bind_int(stmt, 4, dto.global_id);
 
     rc = sqlite3_step(stmt);
 
     if (rc != SQLITE_DONE) {
-        sqlite3_finalize(stmt);
-        sqlite3_exec(_db, "ROLLBACK;", nullptr, nullptr, nullptr);
+        stmt.reset();
+        sqlite3_exec(_db, ROLLBACK_WRITE_SQL, nullptr, nullptr, nullptr);
         throw std::runtime_error("Error changing update_file_link");
     }
-    sqlite3_finalize(stmt);
+    stmt.reset();
+
+    if (!adoptChildren(dto.global_id, place)) {
+        sqlite3_exec(_db, ROLLBACK_WRITE_SQL, nullptr, nullptr, nullptr);
+        throw std::runtime_error("Error adopting children of " + dto.new_rel_path.string());
+    }
 
-    rc = sqlite3_exec(_db, "COMMIT;", nullptr, nullptr, nullptr);
+    rc = sqlite3_exec(_db, COMMIT_WRITE_SQL, nullptr, nullptr, nullptr);
 
     if (rc != SQLITE_OK) {
-        sqlite3_exec(_db, "ROLLBACK;", nullptr, nullptr, nullptr);
+        sqlite3_exec(_db, ROLLBACK_WRITE_SQL, nullptr, nullptr, nullptr);
         throw std::runtime_error("Error commiting change update_file_link");
     }
+    _index->moveFile(dto.global_id, place.parent_global_id, place.name, dto.cloud_file_modified_time);
+    _index->adoptChildren(dto.global_id);
 }
 
 void Database::delete_file_and_links(const int global_id) {
     sqlite3_busy_timeout(_db, 5000);
 
     int rc = 0;
-    rc = sqlite3_exec(_db, "BEGIN TRANSACTION;", nullptr, nullptr, nullptr);
+    rc = sqlite3_exec(_db, BEGIN_WRITE_SQL, nullptr, nullptr, nullptr);
     if (rc != SQLITE_OK) {
         throw std::runtime_error("Failed to begin transaction delete_file");
     }
-    sqlite3_stmt* stmt = nullptr;
+    StatementCache::Statement stmt;
 
-    const std::string sql = "DELETE FROM files WHERE global_id = ?;";
+    // Children stay reachable under the same path, hung off the parent with the name prepended.
+    std::string sql = "UPDATE files SET parent_global_id = (SELECT parent_global_id FROM files WHERE global_id = ?1), "
+        "name = (SELECT name FROM files WHERE global_id = ?1) || '/' || name WHERE parent_global_id = ?1;";
 
-    rc = sqlite3_prepare_v2(_db, sql.c_str(), -1, &stmt, nullptr);
+    rc = _statements->prepare(sql, stmt);
     if (rc != SQLITE_OK) {
-        sqlite3_finalize(stmt);
-        sqlite3_exec(_db, "ROLLBACK;", nullptr, nullptr, nullptr);
+        sqlite3_exec(_db, ROLLBACK_WRITE_SQL, nullptr, nullptr, nullptr);
         throw std::runtime_error("Failed to prepare SQL statement delete_file");
     }
     sqlite3_bind_int64(stmt, 1, global_id);
     rc = sqlite3_step(stmt);
+    stmt.reset();
     if (rc != SQLITE_DONE) {
-        sqlite3_finalize(stmt);
-        sqlite3_exec(_db, "ROLLBACK;", nullptr, nullptr, nullptr);
+        sqlite3_exec(_db, ROLLBACK_WRITE_SQL, nullptr, nullptr, nullptr);
+        throw std::runtime_error("Error reparenting children of: " + std::to_string(global_id));
+    }
+
+    sql = "DELETE FROM files WHERE global_id = ?;";
+
+    rc = _statements->prepare(sql, stmt);
+    if (rc != SQLITE_OK) {
+        sqlite3_exec(_db, ROLLBACK_WRITE_SQL, nullptr, nullptr, nullptr);
+        throw std::runtime_error("Failed to prepare SQL statement delete_file");
+    }
+    sqlite3_bind_int64(stmt, 1, global_id);
+    rc = sqlite3_step(stmt);
+    if (rc != SQLITE_DONE) {
+        stmt.reset();
+        sqlite3_exec(_db, ROLLBACK_WRITE_SQL, nullptr, nullptr, nullptr);
         throw std::runtime_error("Error deleting from files: " + std::to_string(global_id));
     }
 
-    sqlite3_finalize(stmt);
-    rc = sqlite3_exec(_db, "COMMIT;", nullptr, nullptr, nullptr);
+    stmt.reset();
+    rc = sqlite3_exec(_db, COMMIT_WRITE_SQL, nullptr, nullptr, nullptr);
     if (rc != SQLITE_OK) {
-        sqlite3_exec(_db, "ROLLBACK;", nullptr, nullptr, nullptr);
+        sqlite3_exec(_db, ROLLBACK_WRITE_SQL, nullptr, nullptr, nullptr);
         throw std::runtime_error("Error commiting deletion: " + std::to_string(global_id));
     }
+    _index->eraseFile(global_id);
 }
 
 void Database::add_file_link(const FileRecordDTO& dto)
 {
     sqlite3_busy_timeout(_db, 5000);
     int rc = 0;
-    rc = sqlite3_exec(_db, "BEGIN TRANSACTION;", nullptr, nullptr, nullptr);
+    rc = sqlite3_exec(_db, BEGIN_WRITE_SQL, nullptr, nullptr, nullptr);
     if (rc != SQLITE_OK) {
         throw std::runtime_error("Failed to begin transaction add_file_links");
     }
-    sqlite3_stmt* stmt = nullptr;
-    const std::string sql = "INSERT OR IGNORE INTO file_links (global_id, cloud_id, cloud_file_id, cloud_parent_id, cloud_file_modified_time, cloud_hash_check_sum, cloud_size) VALUES (?, ?, ?, ?, ?, ?, ?);";
-    rc = sqlite3_prepare_v2(_db, sql.c_str(), -1, &stmt, nullptr);
+    StatementCache::Statement stmt;
+    rc = _statements->prepare(ADD_FILE_LINK_SQL, stmt);
     if (rc != SQLITE_OK) {
-        sqlite3_finalize(stmt);
-        sqlite3_exec(_db, "ROLLBACK;", nullptr, nullptr, nullptr);
+        sqlite3_exec(_db, ROLLBACK_WRITE_SQL, nullptr, nullptr, nullptr);
         throw std::runtime_error("Failed to prepare SQL statement add_file_links");
     }
 
@@ -910,59 +1117,182 @@ void Database::add_file_link(const FileRecordDTO& dto)
 
     rc = sqlite3_step(stmt);
     if (rc != SQLITE_DONE) {
-        sqlite3_finalize(stmt);
-        sqlite3_exec(_db, "ROLLBACK;", nullptr, nullptr, nullptr);
+        stmt.reset();
+        sqlite3_exec(_db, ROLLBACK_WRITE_SQL, nullptr, nullptr, nullptr);
         throw std::runtime_error("Error adding file to file_links " + std::to_string(dto.global_id));
     }
 
-    sqlite3_finalize(stmt);
-    rc = sqlite3_exec(_db, "COMMIT;", nullptr, nullptr, nullptr);
+    stmt.reset();
+    rc = sqlite3_exec(_db, COMMIT_WRITE_SQL, nullptr, nullptr, nullptr);
     if (rc != SQLITE_OK) {
-        sqlite3_exec(_db, "ROLLBACK;", nullptr, nullptr, nullptr);
+        sqlite3_exec(_db, ROLLBACK_WRITE_SQL, nullptr, nullptr, nullptr);
         throw std::runtime_error("Error commiting file_link " + std::to_string(dto.global_id));
     }
+    _index->addLink(dto.global_id, dto.cloud_id, dto.cloud_file_id, dto.cloud_parent_id, dto.cloud_file_modified_time, hash_str, dto.size);
+}
+
+std::vector<int> Database::ingest(std::span<const std::unique_ptr<FileRecordDTO>> records, const bool defer_indexes) {
+    std::vector<int> global_ids;
+    global_ids.reserve(records.size());
+    if (records.empty()) {
+        return global_ids;
+    }
+    sqlite3_busy_timeout(_db, 5000);
+    LOG_INFO("Database", "Ingesting %i records, lookup indexes %s", records.size(), defer_indexes ? "deferred" : "kept");
+
+    if (defer_indexes) {
+        check_rc(sqlite3_exec(_db, DROP_LOOKUP_INDEXES_SQL, nullptr, nullptr, nullptr), "Failed to drop lookup indexes");
+    }
+    try {
+        std::unordered_map<std::string, int> dirs;
+        for (std::size_t begin = 0; begin < records.size(); begin += INGEST_CHUNK_ROWS) {
+            auto count = std::min(INGEST_CHUNK_ROWS, records.size() - begin);
+            ingestChunk(records.subspan(begin, count), dirs, global_ids);
+        }
+    }
+    catch (...) {
+        if (defer_indexes) {
+            sqlite3_exec(_db, LOOKUP_INDEXES_SQL, nullptr, nullptr, nullptr);
+        }
+        throw;
+    }
+    if (defer_indexes) {
+        check_rc(sqlite3_exec(_db, LOOKUP_INDEXES_SQL, nullptr, nullptr, nullptr), "Failed to build lookup indexes");
+    }
+    return global_ids;
+}
+
+// One transaction (or savepoint of an open batch) for the whole chunk, the insert statements are
+// leased once and rebound per row. Directories are remembered by path so their children skip the tree walk.
+void Database::ingestChunk(std::span<const std::unique_ptr<FileRecordDTO>> records,
+    std::unordered_map<std::string, int>& dirs, std::vector<int>& global_ids)
+{
+    int rc = sqlite3_exec(_db, BEGIN_WRITE_SQL, nullptr, nullptr, nullptr);
+    if (rc != SQLITE_OK) {
+        throw std::runtime_error("Failed to begin transaction ingest");
+    }
+    StatementCache::Statement file_stmt;
+    StatementCache::Statement link_stmt;
+    if (_statements->prepare(ADD_FILE_SQL, file_stmt) != SQLITE_OK || _statements->prepare(ADD_FILE_LINK_SQL, link_stmt) != SQLITE_OK) {
+        file_stmt.reset();
+        link_stmt.reset();
+        sqlite3_exec(_db, ROLLBACK_WRITE_SQL, nullptr, nullptr, nullptr);
+        throw std::runtime_error("Failed to prepare SQL statements ingest");
+    }
+
+    try {
+        for (const auto& record : records) {
+            const auto& dto = *record;
+            if (dto.cloud_id != 0) {
+                auto hash_str = cloudHash(dto);
+                sqlite3_reset(link_stmt);
+                sqlite3_bind_int64(link_stmt, 1, dto.global_id);
+                sqlite3_bind_int(link_stmt, 2, dto.cloud_id);
+                sqlite3_bind_text(link_stmt, 3, dto.cloud_file_id.c_str(), -1, SQLITE_STATIC);
+                sqlite3_bind_text(link_stmt, 4, dto.cloud_parent_id.c_str(), -1, SQLITE_STATIC);
+                sqlite3_bind_int64(link_stmt, 5, dto.cloud_file_modified_time);
+                sqlite3_bind_text(link_stmt, 6, hash_str.c_str(), -1, SQLITE_STATIC);
+                sqlite3_bind_int64(link_stmt, 7, dto.size);
+                if (sqlite3_step(link_stmt) != SQLITE_DONE) {
+                    throw std::runtime_error("Error adding file to file_links " + std::to_string(dto.global_id));
+                }
+                _index->addLink(dto.global_id, dto.cloud_id, dto.cloud_file_id, dto.cloud_parent_id, dto.cloud_file_modified_time, hash_str, dto.size);
+                global_ids.push_back(dto.global_id);
+                continue;
+            }
+
+            Placement place;
+            auto parent = dto.rel_path.has_filename() ? dirs.find(dto.rel_path.parent_path().string()) : dirs.end();
+            if (parent != dirs.end()) {
+                place = Placement{ parent->second, dto.rel_path.filename().string() };
+            }
+            else {
+                place = placementOf(dto.rel_path);
+            }
+
+            auto hash_u = localHash(dto);
+            sqlite3_reset(file_stmt);
+            sqlite3_bind_text(file_stmt, 1, to_cstr(dto.type), -1, SQLITE_STATIC);
+            sqlite3_bind_int64(file_stmt, 2, place.parent_global_id);
+            sqlite3_bind_text(file_stmt, 3, place.name.c_str(), -1, SQLITE_STATIC);
+            sqlite3_bind_int64(file_stmt, 4, dto.size);
+            sqlite3_bind_int64(file_stmt, 5, hash_u);
+            sqlite3_bind_int64(file_stmt, 6, static_cast<sqlite3_int64>(dto.cloud_file_modified_time));
+            sqlite3_bind_int64(file_stmt, 7, dto.file_id);
+            if (sqlite3_step(file_stmt) != SQLITE_DONE) {
+                throw std::runtime_error("Error adding file to files" + dto.rel_path.string());
+            }
+            int global_id = sqlite3_last_insert_rowid(_db);
+
+            // The index follows row by row so later placements in this chunk see earlier ones.
+            _index->addFile(global_id, dto.type, place.parent_global_id, place.name, dto.size, hash_u, dto.cloud_file_modified_time, dto.file_id);
+            if (dto.type == EntryType::Directory) {
+                if (!adoptChildren(global_id, place)) {
+                    throw std::runtime_error("Error adopting children of " + dto.rel_path.string());
+                }
+                _index->adoptChildren(global_id);
+                dirs.insert_or_assign(dto.rel_path.string(), global_id);
+            }
+            global_ids.push_back(global_id);
+        }
+    }
+    catch (...) {
+        file_stmt.reset();
+        link_stmt.reset();
+        sqlite3_exec(_db, ROLLBACK_WRITE_SQL, nullptr, nullptr, nullptr);
+        reloadIndex();
+        throw;
+    }
+    file_stmt.reset();
+    link_stmt.reset();
+
+    rc = sqlite3_exec(_db, COMMIT_WRITE_SQL, nullptr, nullptr, nullptr);
+    if (rc != SQLITE_OK) {
+        sqlite3_exec(_db, ROLLBACK_WRITE_SQL, nullptr, nullptr, nullptr);
+        reloadIndex();
+        throw std::runtime_error("Error commiting ingest chunk");
+    }
 }
 
 bool Database::isInitialSyncDone() {
-    sqlite3_stmt* stmt = nullptr;
+    StatementCache::Statement stmt;
     const char* sql = "SELECT value FROM metadata WHERE name = 'initial_sync_done';";
-    sqlite3_prepare_v2(_db, sql, -1, &stmt, nullptr);
+    _statements->prepare(sql, stmt);
     bool done = false;
     if (sqlite3_step(stmt) == SQLITE_ROW) {
         done = std::string(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0))) == "1";
     }
-    sqlite3_finalize(stmt);
+    stmt.reset();
     return done;
 }
 
 void Database::markInitialSyncDone() {
     sqlite3_busy_timeout(_db, 5000);
     int rc = 0;
-    rc = sqlite3_exec(_db, "BEGIN TRANSACTION;", nullptr, nullptr, nullptr);
+    rc = sqlite3_exec(_db, BEGIN_WRITE_SQL, nullptr, nullptr, nullptr);
     if (rc != SQLITE_OK) {
         throw std::runtime_error("Failed to begin transaction markInitialSyncDone");
     }
 
-    sqlite3_stmt* stmt = nullptr;
+    StatementCache::Statement stmt;
     const std::string sql = "INSERT OR REPLACE INTO metadata(name, value) VALUES('initial_sync_done','1');";
-    rc = sqlite3_prepare_v2(_db, sql.c_str(), -1, &stmt, nullptr);
+    rc = _statements->prepare(sql, stmt);
     if (rc != SQLITE_OK) {
-        sqlite3_finalize(stmt);
-        sqlite3_exec(_db, "ROLLBACK;", nullptr, nullptr, nullptr);
+        sqlite3_exec(_db, ROLLBACK_WRITE_SQL, nullptr, nullptr, nullptr);
         throw std::runtime_error("Failed to prepare SQL statement markInitialSyncDone");
     }
 
     rc = sqlite3_step(stmt);
     if (rc != SQLITE_DONE) {
-        sqlite3_finalize(stmt);
-        sqlite3_exec(_db, "ROLLBACK;", nullptr, nullptr, nullptr);
+        stmt.reset();
+        sqlite3_exec(_db, ROLLBACK_WRITE_SQL, nullptr, nullptr, nullptr);
         throw std::runtime_error("Error doing markInitialSyncDone");
     }
 
-    sqlite3_finalize(stmt);
-    rc = sqlite3_exec(_db, "COMMIT;", nullptr, nullptr, nullptr);
+    stmt.reset();
+    rc = sqlite3_exec(_db, COMMIT_WRITE_SQL, nullptr, nullptr, nullptr);
     if (rc != SQLITE_OK) {
-        sqlite3_exec(_db, "ROLLBACK;", nullptr, nullptr, nullptr);
+        sqlite3_exec(_db, ROLLBACK_WRITE_SQL, nullptr, nullptr, nullptr);
         throw std::runtime_error("Error commiting markInitialSyncDone");
     }
 }
@@ -970,17 +1300,16 @@ void Database::markInitialSyncDone() {
 void Database::addLocalDir(const std::string& local_dir) {
     sqlite3_busy_timeout(_db, 5000);
     int rc = 0;
-    rc = sqlite3_exec(_db, "BEGIN TRANSACTION;", nullptr, nullptr, nullptr);
+    rc = sqlite3_exec(_db, BEGIN_WRITE_SQL, nullptr, nullptr, nullptr);
     if (rc != SQLITE_OK) {
         throw std::runtime_error("Failed to begin transaction addLocalDir");
     }
 
-    sqlite3_stmt* stmt = nullptr;
+    StatementCache::Statement stmt;
     const std::string sql = "INSERT OR REPLACE INTO metadata(name, value) VALUES('local_dir', ?);";
-    rc = sqlite3_prepare_v2(_db, sql.c_str(), -1, &stmt, nullptr);
+    rc = _statements->prepare(sql, stmt);
     if (rc != SQLITE_OK) {
-        sqlite3_finalize(stmt);
-        sqlite3_exec(_db, "ROLLBACK;", nullptr, nullptr, nullptr);
+        sqlite3_exec(_db, ROLLBACK_WRITE_SQL, nullptr, nullptr, nullptr);
         throw std::runtime_error("Failed to prepare SQL statement addLocalDir");
     }
 
@@ -988,50 +1317,200 @@ void Database::addLocalDir(const std::string& local_dir) {
 
     rc = sqlite3_step(stmt);
     if (rc != SQLITE_DONE) {
-        sqlite3_finalize(stmt);
-        sqlite3_exec(_db, "ROLLBACK;", nullptr, nullptr, nullptr);
+        stmt.reset();
+        sqlite3_exec(_db, ROLLBACK_WRITE_SQL, nullptr, nullptr, nullptr);
         throw std::runtime_error("Error doing addLocalDir");
     }
 
-    sqlite3_finalize(stmt);
-    rc = sqlite3_exec(_db, "COMMIT;", nullptr, nullptr, nullptr);
+    stmt.reset();
+    rc = sqlite3_exec(_db, COMMIT_WRITE_SQL, nullptr, nullptr, nullptr);
     if (rc != SQLITE_OK) {
-        sqlite3_exec(_db, "ROLLBACK;", nullptr, nullptr, nullptr);
+        sqlite3_exec(_db, ROLLBACK_WRITE_SQL, nullptr, nullptr, nullptr);
         throw std::runtime_error("Error commiting addLocalDir");
     }
 }
 
 std::string Database::getLocalDir() {
-    sqlite3_stmt* stmt = nullptr;
+    StatementCache::Statement stmt;
     int rc = 0;
 
     std::string sql = "SELECT value FROM metadata WHERE name = 'local_dir';";
-    rc = sqlite3_prepare_v2(_db, sql.c_str(), -1, &stmt, nullptr);
+    rc = _statements->prepare(sql, stmt);
     if (rc != SQLITE_OK) {
-        sqlite3_finalize(stmt);
         throw std::runtime_error("Failed to prepare statement (getLocalDir)");
     }
 
     rc = sqlite3_step(stmt);
     if (rc != SQLITE_ROW) {
-        sqlite3_finalize(stmt);
+        stmt.reset();
         throw std::runtime_error("ERROR getting local_dir");
     }
     std::string local_dir = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
 
-    sqlite3_finalize(stmt);
+    stmt.reset();
     return local_dir;
 }
 
 
 
+void Database::saveUploadSession(const UploadSessionDTO& dto) {
+    sqlite3_busy_timeout(_db, 5000);
+    StatementCache::Statement stmt;
+    const std::string sql = "INSERT OR REPLACE INTO upload_sessions (cloud_id, path, session_id, committed_offset, size, local_modified_time) VALUES (?, ?, ?, ?, ?, ?);";
+    int rc = _statements->prepare(sql, stmt);
+    if (rc != SQLITE_OK) {
+        throw std::runtime_error("Failed to prepare SQL statement saveUploadSession");
+    }
+
+    auto path_str = dto.rel_path.string();
+    sqlite3_bind_int(stmt, 1, dto.cloud_id);
+    sqlite3_bind_text(stmt, 2, path_str.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 3, dto.session_id.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 4, static_cast<sqlite3_int64>(dto.offset));
+    sqlite3_bind_int64(stmt, 5, static_cast<sqlite3_int64>(dto.size));
+    sqlite3_bind_int64(stmt, 6, dto.local_modified_time);
+
+    rc = sqlite3_step(stmt);
+    stmt.reset();
+    if (rc != SQLITE_DONE) {
+        throw std::runtime_error("Error saving upload session for: " + path_str);
+    }
+}
+
+std::unique_ptr<UploadSessionDTO> Database::getUploadSession(const int cloud_id, const std::filesystem::path& rel_path) {
+    StatementCache::Statement stmt;
+    const std::string sql = "SELECT session_id, committed_offset, size, local_modified_time FROM upload_sessions WHERE cloud_id = ? AND path = ?;";
+    int rc = _statements->prepare(sql, stmt);
+    if (rc != SQLITE_OK) {
+        throw std::runtime_error("Failed to prepare statement getUploadSession");
+    }
+
+    auto path_str = rel_path.string();
+    sqlite3_bind_int(stmt, 1, cloud_id);
+    sqlite3_bind_text(stmt, 2, path_str.c_str(), -1, SQLITE_STATIC);
+
+    if (sqlite3_step(stmt) != SQLITE_ROW) {
+        stmt.reset();
+        return nullptr;
+    }
+
+    auto dto = std::make_unique<UploadSessionDTO>(
+        cloud_id,
+        rel_path,
+        reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0)),
+        static_cast<uint64_t>(sqlite3_column_int64(stmt, 1)),
+        static_cast<uint64_t>(sqlite3_column_int64(stmt, 2)),
+        static_cast<std::time_t>(sqlite3_column_int64(stmt, 3))
+    );
+    stmt.reset();
+    return dto;
+}
+
+void Database::deleteUploadSession(const int cloud_id, const std::filesystem::path& rel_path) {
+    sqlite3_busy_timeout(_db, 5000);
+    StatementCache::Statement stmt;
+    const std::string sql = "DELETE FROM upload_sessions WHERE cloud_id = ? AND path = ?;";
+    int rc = _statements->prepare(sql, stmt);
+    if (rc != SQLITE_OK) {
+        throw std::runtime_error("Failed to prepare SQL statement deleteUploadSession");
+    }
+
+    auto path_str = rel_path.string();
+    sqlite3_bind_int(stmt, 1, cloud_id);
+    sqlite3_bind_text(stmt, 2, path_str.c_str(), -1, SQLITE_STATIC);
+
+    rc = sqlite3_step(stmt);
+    stmt.reset();
+    if (rc != SQLITE_DONE) {
+        throw std::runtime_error("Error deleting upload session for: " + path_str);
+    }
+}
+
+void Database::saveDownloadProgress(const DownloadProgressDTO& dto) {
+    sqlite3_busy_timeout(_db, 5000);
+    StatementCache::Statement stmt;
+    const std::string sql = "INSERT OR REPLACE INTO download_progress (cloud_id, path, tmp_path, revision, downloaded_offset, size) VALUES (?, ?, ?, ?, ?, ?);";
+    int rc = _statements->prepare(sql, stmt);
+    if (rc != SQLITE_OK) {
+        throw std::runtime_error("Failed to prepare SQL statement saveDownloadProgress");
+    }
+
+    auto path_str = dto.rel_path.string();
+    auto tmp_str = dto.tmp_path.string();
+    sqlite3_bind_int(stmt, 1, dto.cloud_id);
+    sqlite3_bind_text(stmt, 2, path_str.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 3, tmp_str.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 4, dto.revision.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 5, static_cast<sqlite3_int64>(dto.offset));
+    sqlite3_bind_int64(stmt, 6, static_cast<sqlite3_int64>(dto.size));
+
+    rc = sqlite3_step(stmt);
+    stmt.reset();
+    if (rc != SQLITE_DONE) {
+        throw std::runtime_error("Error saving download progress for: " + path_str);
+    }
+}
+
+std::unique_ptr<DownloadProgressDTO> Database::getDownloadProgress(const int cloud_id, const std::filesystem::path& rel_path) {
+    StatementCache::Statement stmt;
+    const std::string sql = "SELECT tmp_path, revision, downloaded_offset, size FROM download_progress WHERE cloud_id = ? AND path = ?;";
+    int rc = _statements->prepare(sql, stmt);
+    if (rc != SQLITE_OK) {
+        throw std::runtime_error("Failed to prepare statement getDownloadProgress");
+    }
+
+    auto path_str = rel_path.string();
+    sqlite3_bind_int(stmt, 1, cloud_id);
+    sqlite3_bind_text(stmt, 2, path_str.c_str(), -1, SQLITE_STATIC);
+
+    if (sqlite3_step(stmt) != SQLITE_ROW) {
+        stmt.reset();
+        return nullptr;
+    }
+
+    auto dto = std::make_unique<DownloadProgressDTO>(
+        cloud_id,
+        rel_path,
+        reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0)),
+        reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1)),
+        static_cast<uint64_t>(sqlite3_column_int64(stmt, 2)),
+        static_cast<uint64_t>(sqlite3_column_int64(stmt, 3))
+    );
+    stmt.reset();
+    return dto;
+}
+
+void Database::deleteDownloadProgress(const int cloud_id, const std::filesystem::path& rel_path) {
+    sqlite3_busy_timeout(_db, 5000);
+    StatementCache::Statement stmt;
+    const std::string sql = "DELETE FROM download_progress WHERE cloud_id = ? AND path = ?;";
+    int rc = _statements->prepare(sql, stmt);
+    if (rc != SQLITE_OK) {
+        throw std::runtime_error("Failed to prepare SQL statement deleteDownloadProgress");
+    }
+
+    auto path_str = rel_path.string();
+    sqlite3_bind_int(stmt, 1, cloud_id);
+    sqlite3_bind_text(stmt, 2, path_str.c_str(), -1, SQLITE_STATIC);
+
+    rc = sqlite3_step(stmt);
+    stmt.reset();
+    if (rc != SQLITE_DONE) {
+        throw std::runtime_error("Error deleting download progress for: " + path_str);
+    }
+}
+
 void Database::execute(const std::string& sql) {
+    // Raw SQL may change the schema, cached statements are prepared again on next use.
+    _statements->clear();
     char* err = nullptr;
     if (sqlite3_exec(_db, sql.c_str(), nullptr, nullptr, &err) != SQLITE_OK) {
         std::string error = "SQL error: " + std::string(err);
         sqlite3_free(err);
+        reloadIndex();
         throw std::runtime_error(error);
     }
+    reloadIndex();
 }
 
 void Database::check_rc(int rc, const std::string& context) {
@@ -1055,7 +1534,8 @@ void Database::create_tables() {
         CREATE TABLE IF NOT EXISTS files (
             global_id           INTEGER PRIMARY KEY AUTOINCREMENT,
             type                TEXT NOT NULL,
-            path                TEXT NOT NULL,
+            parent_global_id    INTEGER NOT NULL DEFAULT 0,
+            name                TEXT NOT NULL,
             size                INTEGER,
             local_hash          INTEGER,
             local_modified_time INTEGER,
@@ -1073,14 +1553,30 @@ void Database::create_tables() {
             FOREIGN KEY(global_id) REFERENCES files(global_id) ON DELETE CASCADE,
             FOREIGN KEY(cloud_id) REFERENCES cloud_configs(config_id) ON DELETE CASCADE
         );
+        CREATE TABLE IF NOT EXISTS upload_sessions (
+            cloud_id            INTEGER NOT NULL,
+            path                TEXT NOT NULL,
+            session_id          TEXT NOT NULL,
+            committed_offset    INTEGER NOT NULL,
+            size                INTEGER NOT NULL,
+            local_modified_time INTEGER NOT NULL,
+            PRIMARY KEY (cloud_id, path),
+            FOREIGN KEY(cloud_id) REFERENCES cloud_configs(config_id) ON DELETE CASCADE
+        );
+        CREATE TABLE IF NOT EXISTS download_progress (
+            cloud_id          INTEGER NOT NULL,
+            path              TEXT NOT NULL,
+            tmp_path          TEXT NOT NULL,
+            revision          TEXT NOT NULL,
+            downloaded_offset INTEGER NOT NULL,
+            size              INTEGER NOT NULL,
+            PRIMARY KEY (cloud_id, path),
+            FOREIGN KEY(cloud_id) REFERENCES cloud_configs(config_id) ON DELETE CASCADE
+        );
     )";
-    const char* indexes_sql = R"(
-        CREATE INDEX IF NOT EXISTS idx_files_path ON files(path);
-        CREATE INDEX IF NOT EXISTS idx_files_id ON files(file_id);
-        CREATE INDEX IF NOT EXISTS idx_file_links_cloud_file_id_cloud_id ON file_links(cloud_file_id, cloud_id);
-        CREATE INDEX IF NOT EXISTS idx_file_links_global_cloud ON file_links(global_id, cloud_id);
-
-    )";
+    const std::string indexes_sql = std::string(R"(
+        CREATE INDEX IF NOT EXISTS idx_files_parent_name ON files(parent_global_id, name);
+    )") + LOOKUP_INDEXES_SQL;
 
     char* err = nullptr;
     int rc = sqlite3_exec(_db, sql, nullptr, nullptr, &err);
@@ -1089,10 +1585,94 @@ void Database::create_tables() {
         sqlite3_free(err);
         throw std::runtime_error(error);
     }
-    rc = sqlite3_exec(_db, indexes_sql, nullptr, nullptr, &err);
+    migrateToTree();
+    rc = sqlite3_exec(_db, indexes_sql.c_str(), nullptr, nullptr, &err);
     if (rc != SQLITE_OK) {
         std::string error = "SQL error: " + std::string(err);
         sqlite3_free(err);
         throw std::runtime_error(error);
     }
-}
\ No newline at end of file
+}
+
+// Databases written before parent pointers keep full paths in files.path, each row is re-hung
+// under its nearest recorded ancestor and the column is dropped, all in one transaction.
+void Database::migrateToTree() {
+    bool has_path = false;
+    {
+        StatementCache::Statement stmt;
+        if (_statements->prepare("PRAGMA table_info(files);", stmt) != SQLITE_OK) {
+            throw std::runtime_error("Failed to read files schema");
+        }
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            if (std::string_view(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1))) == "path") {
+                has_path = true;
+            }
+        }
+    }
+    if (!has_path) {
+        return;
+    }
+
+    LOG_INFO("Database", "Migrating files table from full paths to parent pointers");
+    sqlite3_busy_timeout(_db, 5000);
+    execute("BEGIN IMMEDIATE;");
+    try {
+        execute("ALTER TABLE files ADD COLUMN parent_global_id INTEGER NOT NULL DEFAULT 0;");
+        execute("ALTER TABLE files ADD COLUMN name TEXT NOT NULL DEFAULT '';");
+
+        std::vector<std::pair<int, std::string>> rows;
+        std::unordered_map<std::string, int> by_path;
+        {
+            StatementCache::Statement stmt;
+            if (_statements->prepare("SELECT global_id, path FROM files ORDER BY global_id;", stmt) != SQLITE_OK) {
+                throw std::runtime_error("Failed to prepare statement (migrateToTree)");
+            }
+            while (sqlite3_step(stmt) == SQLITE_ROW) {
+                int global_id = sqlite3_column_int64(stmt, 0);
+                auto segments = pathSegments(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1)));
+                auto path = joinSegments(segments, 0, segments.size());
+                by_path.try_emplace(path, global_id);
+                rows.emplace_back(global_id, std::move(path));
+            }
+        }
+
+        StatementCache::Statement stmt;
+        if (_statements->prepare("UPDATE files SET parent_global_id = ?, name = ? WHERE global_id = ?;", stmt) != SQLITE_OK) {
+            throw std::runtime_error("Failed to prepare statement (migrateToTree)");
+        }
+        int rc = 0;
+        for (const auto& [global_id, path] : rows) {
+            auto segments = pathSegments(path);
+            int parent_global_id = ROOT_GLOBAL_ID;
+            std::size_t parent_segments = 0;
+            for (std::size_t n = segments.empty() ? 0 : segments.size() - 1; n > 0; --n) {
+                auto it = by_path.find(joinSegments(segments, 0, n));
+                if (it != by_path.end() && it->second != global_id) {
+                    parent_global_id = it->second;
+                    parent_segments = n;
+                    break;
+                }
+            }
+            auto name = joinSegments(segments, parent_segments, segments.size());
+            sqlite3_bind_int64(stmt, 1, parent_global_id);
+            sqlite3_bind_text(stmt, 2, name.c_str(), -1, SQLITE_STATIC);
+            sqlite3_bind_int64(stmt, 3, global_id);
+            rc = sqlite3_step(stmt);
+            sqlite3_reset(stmt);
+            sqlite3_clear_bindings(stmt);
+            if (rc != SQLITE_DONE) {
+                throw std::runtime_error("Error migrating file: " + path);
+            }
+        }
+        stmt.reset();
+
+        execute("DROP INDEX IF EXISTS idx_files_path;");
+        execute("ALTER TABLE files DROP COLUMN path;");
+        execute("COMMIT;");
+        LOG_INFO("Database", "Migrated %zu files to parent pointers", rows.size());
+    }
+    catch (...) {
+        sqlite3_exec(_db, "ROLLBACK;", nullptr, nullptr, nullptr);
+        throw;
+    }
+}
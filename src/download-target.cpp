@@ -0,0 +1,159 @@
+#include "download-target.h"
+#include "logger.h"
+
+#include <fcntl.h>
+#include <cerrno>
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <algorithm>
+#include <io.h>
+#include <share.h>
+#include <sys/stat.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+    int openFile(const std::filesystem::path& path, bool keep_existing) {
+#ifdef _WIN32
+        int fd = -1;
+        int flags = _O_WRONLY | _O_CREAT | _O_BINARY | _O_NOINHERIT | (keep_existing ? 0 : _O_TRUNC);
+        return _wsopen_s(&fd, path.c_str(), flags, _SH_DENYNO, _S_IREAD | _S_IWRITE) == 0 ? fd : -1;
+#else
+        int flags = O_WRONLY | O_CREAT | O_CLOEXEC | (keep_existing ? 0 : O_TRUNC);
+        return ::open(path.c_str(), flags, 0644);
+#endif
+    }
+
+    void closeFile(int fd) {
+#ifdef _WIN32
+        _close(fd);
+#else
+        close(fd);
+#endif
+    }
+
+    bool resizeFile(int fd, std::uint64_t size) {
+#ifdef _WIN32
+        return _chsize_s(fd, static_cast<__int64>(size)) == 0;
+#else
+        return ftruncate(fd, static_cast<off_t>(size)) == 0;
+#endif
+    }
+
+    // Reserves the blocks up front so a full disk fails here rather than halfway through; 0 or an errno value.
+    int preallocateFile(int fd, std::uint64_t size) {
+#if defined(__linux__)
+        return posix_fallocate(fd, 0, static_cast<off_t>(size));
+#elif defined(__APPLE__)
+        fstore_t store{};
+        store.fst_flags = F_ALLOCATECONTIG;
+        store.fst_posmode = F_PEOFPOSMODE;
+        store.fst_length = static_cast<off_t>(size);
+        if (fcntl(fd, F_PREALLOCATE, &store) != 0) {
+            store.fst_flags = F_ALLOCATEALL;
+            if (fcntl(fd, F_PREALLOCATE, &store) != 0) {
+                return errno;
+            }
+        }
+        return resizeFile(fd, size) ? 0 : errno;
+#else
+        // No portable way to reserve blocks; setting the size still lets every range write at its own offset.
+        return resizeFile(fd, size) ? 0 : errno;
+#endif
+    }
+
+    // Writes at an absolute offset without moving a shared file position; the bytes written or -1 with errno set.
+    long long writeAt(int fd, const char* data, std::size_t size, std::uint64_t offset) {
+#ifdef _WIN32
+        HANDLE handle = reinterpret_cast<HANDLE>(_get_osfhandle(fd));
+        OVERLAPPED at{};
+        at.Offset = static_cast<DWORD>(offset & 0xFFFFFFFFull);
+        at.OffsetHigh = static_cast<DWORD>(offset >> 32);
+        DWORD written = 0;
+        DWORD chunk = static_cast<DWORD>(std::min<std::size_t>(size, 0x7FFFFFFF));
+        if (handle == INVALID_HANDLE_VALUE || !WriteFile(handle, data, chunk, &written, &at)) {
+            errno = EIO;
+            return -1;
+        }
+        return static_cast<long long>(written);
+#else
+        return static_cast<long long>(pwrite(fd, data, size, static_cast<off_t>(offset)));
+#endif
+    }
+}
+
+DownloadTarget::DownloadTarget(std::uint64_t size, bool keep_existing)
+    : _fd(-1),
+    _size(size),
+    _keep_existing(keep_existing)
+{
+}
+
+DownloadTarget::~DownloadTarget() {
+    if (_fd >= 0) {
+        closeFile(_fd);
+    }
+}
+
+// The first range to start creates the file at its final size; the others write into the same descriptor.
+void DownloadTarget::open(const std::filesystem::path& path) {
+    std::lock_guard<std::mutex> lock(_mtx);
+    if (_fd >= 0) {
+        if (path != _path) {
+            throw std::runtime_error("Download ranges target different files: " + _path.string() + " and " + path.string());
+        }
+        return;
+    }
+
+    // A resumed download keeps the prefix written by an earlier attempt.
+    int fd = openFile(path, _keep_existing);
+    if (fd < 0) {
+        throw std::runtime_error("Error opening file: " + path.string());
+    }
+    int rc = _size > 0 ? preallocateFile(fd, _size) : 0;
+    if (rc == ENOSPC) {
+        closeFile(fd);
+        throw std::runtime_error("Not enough space to download: " + path.string());
+    }
+    if (rc != 0) {
+        LOG_WARNING("DownloadTarget", "Preallocation failed for %s: %s", path.string(), std::strerror(rc));
+        if (!resizeFile(fd, _size)) {
+            closeFile(fd);
+            throw std::runtime_error("Error resizing file: " + path.string());
+        }
+    }
+    _fd = fd;
+    _path = path;
+}
+
+bool DownloadTarget::write(std::uint64_t offset, const char* data, std::size_t size) {
+    if (_fd < 0 || offset + size > _size) {
+        return false;
+    }
+    while (size > 0) {
+        long long written = writeAt(_fd, data, size, offset);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOG_ERROR("DownloadTarget", "Write failed at offset %llu: %s", static_cast<unsigned long long>(offset), std::strerror(errno));
+            return false;
+        }
+        data += written;
+        offset += static_cast<std::uint64_t>(written);
+        size -= static_cast<std::size_t>(written);
+    }
+    return true;
+}
+
+std::uint64_t DownloadTarget::size() const noexcept {
+    return _size;
+}
+
+std::filesystem::path DownloadTarget::path() const {
+    std::lock_guard<std::mutex> lock(_mtx);
+    return _path;
+}
@@ -1,6 +1,77 @@
 #include "dropbox.h"
 #include "logger.h"
 #include "Networking.h"
+#include "CallbackDispatcher.h"
+#include "json-entry-stream.h"
+
+#include <thread>
+#include <algorithm>
+
+namespace {
+    constexpr std::size_t MAX_BATCH_PARTS = 1000;
+    constexpr std::uint64_t SINGLE_UPLOAD_LIMIT = 150ULL * 1024 * 1024;
+    constexpr std::uint64_t APPEND_ALIGNMENT = 4ULL * 1024 * 1024;
+    constexpr std::uint64_t MAX_APPEND_SIZE = 148ULL * 1024 * 1024;
+    constexpr std::uint64_t RESUMABLE_DOWNLOAD_THRESHOLD = 8ULL * 1024 * 1024;
+    constexpr int MAX_FOLDER_BATCH_CHECKS = 60;
+    constexpr auto FOLDER_BATCH_CHECK_DELAY = std::chrono::milliseconds(250);
+
+    constexpr const char* DELETE_BATCH = "/2/files/delete_batch";
+    constexpr const char* MOVE_BATCH = "/2/files/move_batch_v2";
+    constexpr const char* FINISH_BATCH = "/2/files/upload_session/finish_batch_v2";
+
+    std::string batchCheckPath(const std::string& group) {
+        if (group == DELETE_BATCH) {
+            return "/2/files/delete_batch/check";
+        }
+        if (group == MOVE_BATCH) {
+            return "/2/files/move_batch/check_v2";
+        }
+        return "/2/files/upload_session/finish_batch/check";
+    }
+
+    bool isFolderConflict(const nlohmann::json& failure) {
+        const auto path = failure.value("path", nlohmann::json::object());
+        return path.value(".tag", "") == "conflict" && path.value("conflict", nlohmann::json::object()).value(".tag", "") == "folder";
+    }
+
+    // Tag of an upload session lookup error, which finish nests under lookup_failed.
+    std::string sessionErrorTag(const std::string& response) {
+        auto j = nlohmann::json::parse(response, nullptr, false);
+        if (j.is_discarded() || !j.contains("error")) {
+            return {};
+        }
+        const auto& error = j["error"];
+        if (error.value(".tag", "") == "lookup_failed" && error.contains("lookup_failed")) {
+            return error["lookup_failed"].value(".tag", "");
+        }
+        return error.value(".tag", "");
+    }
+
+    long responseCode(const RequestHandle& handle) {
+        long http_code = 0;
+        curl_easy_getinfo(handle._curl, CURLINFO_RESPONSE_CODE, &http_code);
+        return http_code;
+    }
+
+    // Maps one batch entry onto the response the single-entry endpoint would have returned.
+    BatchPartResponse batchEntryResponse(const nlohmann::json& entry) {
+        if (entry.value(".tag", "") == "failure") {
+            const auto& failure = entry.contains("failure") ? entry["failure"] : entry;
+            long status = failure.value(".tag", "") == "too_many_write_operations" ? 429 : 409;
+            return BatchPartResponse{ status, failure.dump() };
+        }
+        if (entry.contains("success")) {
+            return BatchPartResponse{ 200, nlohmann::json{ { "metadata", entry["success"] } }.dump() };
+        }
+        if (entry.contains("metadata")) {
+            return BatchPartResponse{ 200, nlohmann::json{ { "metadata", entry["metadata"] } }.dump() };
+        }
+        nlohmann::json metadata = entry;
+        metadata.erase(".tag");
+        return BatchPartResponse{ 200, metadata.dump() };
+    }
+}
 
 Dropbox::Dropbox(
     const std::string& client_id,
@@ -76,29 +147,50 @@ bool Dropbox::isDropboxShortcutJsonFile(const std::filesystem::path& path) const
     return shortcut_exts.contains(ext);
 }
 
-void Dropbox::setupUploadHandle(const std::unique_ptr<RequestHandle>& handle, const std::unique_ptr<FileRecordDTO>& dto) const {
-
-    nlohmann::json j;
-    j["path"] = _home_path.string() + "/" + dto->rel_path.string();
-    j["mode"] = "overwrite";
-    j["mute"] = true;
-    j["strict_conflict"] = false;
+bool Dropbox::commitsInBatch(const std::unique_ptr<FileRecordDTO>& dto) const {
+    if (dto->type == EntryType::Directory || dto->size > SINGLE_UPLOAD_LIMIT) {
+        return false;
+    }
+    return !(dto->type == EntryType::Document && this->isDropboxShortcutJsonFile(dto->rel_path));
+}
 
-    handle->addHeaders("Authorization: Bearer " + _access_token);
+std::string Dropbox::remotePath(const std::filesystem::path& rel_path) const {
+    auto p = (_home_path / rel_path).generic_string();
+    return !p.empty() && p[0] == '/' ? p : "/" + p;
+}
 
-    std::string dropbox_api_arg = j.dump();
-    handle->addHeaders("Dropbox-API-Arg: " + dropbox_api_arg);
+void Dropbox::setupUploadHandle(const std::unique_ptr<RequestHandle>& handle, const std::unique_ptr<FileRecordDTO>& dto) const {
+    handle->addHeaders(authorizationHeader());
 
-    if (dto->type == EntryType::Document && this->isDropboxShortcutJsonFile(dto->rel_path)) {
-        handle->addHeaders("Content-Type: application/json");
+    std::string url;
+    if (commitsInBatch(dto)) {
+        // The content goes into a closed session, the commit is batched with others by uploadCommitPart.
+        handle->addHeaders("Dropbox-API-Arg: {\"close\": true}");
+        handle->addHeaders("Content-Type: application/octet-stream");
+        url = _content_base_url + "/2/files/upload_session/start";
     }
     else {
-        handle->addHeaders("Content-Type: application/octet-stream");
+        nlohmann::json j;
+        j["path"] = _home_path.string() + "/" + dto->rel_path.string();
+        j["mode"] = "overwrite";
+        j["mute"] = true;
+        j["strict_conflict"] = false;
+
+        std::string dropbox_api_arg = j.dump();
+        handle->addHeaders("Dropbox-API-Arg: " + dropbox_api_arg);
+
+        if (dto->type == EntryType::Document && this->isDropboxShortcutJsonFile(dto->rel_path)) {
+            handle->addHeaders("Content-Type: application/json");
+        }
+        else {
+            handle->addHeaders("Content-Type: application/octet-stream");
+        }
+        url = _content_base_url + "/2/files/upload";
     }
 
-    handle->setFileStream((_local_home_path.string() + "/" + dto->rel_path.string()), std::ios::in);
+    handle->setUploadSource(_local_home_path / dto->rel_path);
 
-    curl_easy_setopt(handle->_curl, CURLOPT_URL, "https://content.dropboxapi.com/2/files/upload");
+    curl_easy_setopt(handle->_curl, CURLOPT_URL, url.c_str());
     curl_easy_setopt(handle->_curl, CURLOPT_POST, 1L);
 
     handle->setCommonCURLOpt();
@@ -106,18 +198,270 @@ void Dropbox::setupUploadHandle(const std::unique_ptr<RequestHandle>& handle, co
     _expected_events.add(dto->rel_path, ChangeType::New);
 }
 
+std::optional<BatchPart> Dropbox::uploadCommitPart(const std::unique_ptr<FileRecordDTO>& dto, const RequestHandle& handle) const {
+    if (!commitsInBatch(dto)) {
+        return std::nullopt;
+    }
+
+    auto session = nlohmann::json::parse(handle._response);
+    std::string session_id = session.value("session_id", std::string{});
+    if (session_id.empty()) {
+        throw std::runtime_error("Dropbox upload_session/start returned no session id for: " + dto->rel_path.string());
+    }
+
+    nlohmann::json entry = {
+        { "cursor", {
+            { "session_id", session_id },
+            { "offset", handle._upload ? handle._upload->size() : dto->size }
+        } },
+        { "commit", {
+            { "path", _home_path.string() + "/" + dto->rel_path.string() },
+            { "mode", "overwrite" },
+            { "mute", true },
+            { "strict_conflict", false }
+        } }
+    };
+    return BatchPart{ "POST", "/2/files/upload_session/finish", "application/json", entry.dump(), FINISH_BATCH };
+}
+
+void Dropbox::setupCommitHandle(const std::unique_ptr<RequestHandle>& handle, const BatchPart& part) const {
+    handle->addHeaders(authorizationHeader());
+    handle->addHeaders("Dropbox-API-Arg: " + part.body);
+    handle->addHeaders("Content-Type: application/octet-stream");
+
+    curl_easy_setopt(handle->_curl, CURLOPT_URL, (_content_base_url + part.path).c_str());
+    curl_easy_setopt(handle->_curl, CURLOPT_POST, 1L);
+    curl_easy_setopt(handle->_curl, CURLOPT_POSTFIELDS, "");
+    curl_easy_setopt(handle->_curl, CURLOPT_POSTFIELDSIZE, 0L);
+
+    handle->setCommonCURLOpt();
+}
+
+std::unique_ptr<UploadSessionDTO> Dropbox::resumeUploadSession(const std::filesystem::path& rel_path) const {
+    auto file_path = _local_home_path / rel_path;
+    std::error_code ec;
+    std::uint64_t size = std::filesystem::file_size(file_path, ec);
+    if (ec || size <= _session_threshold) {
+        return nullptr;
+    }
+    std::time_t modified = convertSystemTime(file_path);
+
+    if (_db) {
+        if (auto saved = _db->getUploadSession(_id, rel_path)) {
+            if (saved->size == size && saved->local_modified_time == modified) {
+                LOG_INFO("Dropbox", "Resuming upload of %s from byte %llu", rel_path.string(), static_cast<unsigned long long>(saved->offset));
+                return saved;
+            }
+            LOG_INFO("Dropbox", "File changed since its upload session started, starting over: %s", rel_path.string());
+        }
+    }
+    return std::make_unique<UploadSessionDTO>(_id, rel_path, size, modified);
+}
+
+std::unique_ptr<UploadSessionDTO> Dropbox::openUploadSession(const std::unique_ptr<FileRecordDTO>& dto) const {
+    if (dto->type != EntryType::File) {
+        return nullptr;
+    }
+    auto session = resumeUploadSession(dto->rel_path);
+    if (session) {
+        _expected_events.add(dto->rel_path, ChangeType::New);
+    }
+    return session;
+}
+
+std::unique_ptr<UploadSessionDTO> Dropbox::openUploadSession(const std::unique_ptr<FileUpdatedDTO>& dto) const {
+    if (dto->type != EntryType::File) {
+        return nullptr;
+    }
+    auto session = resumeUploadSession(dto->rel_path);
+    if (session) {
+        _expected_events.add(dto->cloud_file_id, ChangeType::Update);
+    }
+    return session;
+}
+
+// Picks up the partial file of an interrupted download as long as the remote content did not change since.
+std::unique_ptr<DownloadProgressDTO> Dropbox::resumeDownload(const std::filesystem::path& rel_path, int global_id, const std::string& revision, std::uint64_t size) const {
+    if (!_db || revision.empty() || size < RESUMABLE_DOWNLOAD_THRESHOLD) {
+        return nullptr;
+    }
+    auto tmp_path = _local_home_path / rel_path.parent_path() /
+        (".-tmp-SyncHarbor-" + rel_path.filename().string());
+    auto progress = std::make_unique<DownloadProgressDTO>(_id, rel_path, tmp_path, revision, 0, size);
+
+    if (auto saved = _db->getDownloadProgress(_id, rel_path)) {
+        std::error_code ec;
+        std::uint64_t on_disk = std::filesystem::file_size(tmp_path, ec);
+        if (!ec && saved->revision == revision && saved->size == size && saved->tmp_path == tmp_path) {
+            // A streamed file holds exactly the downloaded bytes, a preallocated one only its checkpointed prefix.
+            std::uint64_t offset = on_disk < size ? on_disk : saved->offset;
+            progress->offset = offset < size ? offset : 0;
+            LOG_INFO("Dropbox", "Resuming download of %s from byte %llu", rel_path.string(), static_cast<unsigned long long>(progress->offset));
+        }
+        else {
+            LOG_INFO("Dropbox", "File changed since its download started, starting over: %s", rel_path.string());
+        }
+    }
+    // Runs on whatever thread submits the download, which must not wait for the callback workers. Queued under
+    // the download's own key, the row lands before any callback of the download can checkpoint or delete it.
+    CallbackDispatcher::get().submitDbWrite(ICommand::entryKey(global_id, rel_path), [saved = *progress](const std::unique_ptr<Database>& db) {
+        db->saveDownloadProgress(saved);
+        });
+    return progress;
+}
+
+std::unique_ptr<DownloadProgressDTO> Dropbox::openDownload(const std::unique_ptr<FileRecordDTO>& dto) const {
+    const auto* revision = std::get_if<std::string>(&dto->cloud_hash_check_sum);
+    if (dto->type != EntryType::File || !revision) {
+        return nullptr;
+    }
+    return resumeDownload(dto->rel_path, dto->global_id, *revision, dto->size);
+}
+
+std::unique_ptr<DownloadProgressDTO> Dropbox::openDownload(const std::unique_ptr<FileUpdatedDTO>& dto) const {
+    const auto* revision = std::get_if<std::string>(&dto->cloud_hash_check_sum);
+    if (dto->type != EntryType::File || !revision) {
+        return nullptr;
+    }
+    return resumeDownload(dto->rel_path, dto->global_id, *revision, dto->size);
+}
+
+void Dropbox::setupUploadSessionHandle(const std::unique_ptr<RequestHandle>& handle, const std::unique_ptr<FileRecordDTO>&, const UploadSessionDTO& session) const {
+    setupSessionRequest(handle, session);
+}
+
+void Dropbox::setupUploadSessionHandle(const std::unique_ptr<RequestHandle>& handle, const std::unique_ptr<FileUpdatedDTO>&, const UploadSessionDTO& session) const {
+    setupSessionRequest(handle, session);
+}
+
+void Dropbox::setupSessionRequest(const std::unique_ptr<RequestHandle>& handle, const UploadSessionDTO& session) const {
+    if (session.session_id.empty()) {
+        handle->addHeaders(authorizationHeader());
+        handle->addHeaders("Dropbox-API-Arg: {\"close\": false, \"session_type\": \"concurrent\"}");
+        handle->addHeaders("Content-Type: application/octet-stream");
+        curl_easy_setopt(handle->_curl, CURLOPT_URL, (_content_base_url + "/2/files/upload_session/start").c_str());
+        curl_easy_setopt(handle->_curl, CURLOPT_POST, 1L);
+        curl_easy_setopt(handle->_curl, CURLOPT_POSTFIELDS, "");
+        curl_easy_setopt(handle->_curl, CURLOPT_POSTFIELDSIZE, 0L);
+        handle->setCommonCURLOpt();
+        return;
+    }
+    if (session.offset < session.size) {
+        // A resumed session is checked with the first missing chunk before the rest is appended in parallel.
+        setupUploadAppendHandle(handle, session, session.offset);
+        return;
+    }
+
+    nlohmann::json arg = {
+        { "cursor", {
+            { "session_id", session.session_id },
+            { "offset", session.size }
+        } },
+        { "commit", {
+            { "path", remotePath(session.rel_path) },
+            { "mode", "overwrite" },
+            { "mute", true },
+            { "strict_conflict", false }
+        } }
+    };
+    handle->_accepted_codes = { 409 };
+    handle->addHeaders(authorizationHeader());
+    handle->addHeaders("Dropbox-API-Arg: " + arg.dump());
+    handle->addHeaders("Content-Type: application/octet-stream");
+    curl_easy_setopt(handle->_curl, CURLOPT_URL, (_content_base_url + "/2/files/upload_session/finish").c_str());
+    curl_easy_setopt(handle->_curl, CURLOPT_POST, 1L);
+    curl_easy_setopt(handle->_curl, CURLOPT_POSTFIELDS, "");
+    curl_easy_setopt(handle->_curl, CURLOPT_POSTFIELDSIZE, 0L);
+    handle->setCommonCURLOpt();
+}
+
+bool Dropbox::proccesUploadSession(const RequestHandle& handle, UploadSessionDTO& session) const {
+    if (session.session_id.empty()) {
+        session.session_id = nlohmann::json::parse(handle._response).value("session_id", std::string{});
+        if (session.session_id.empty()) {
+            throw std::runtime_error("Dropbox upload_session/start returned no session id for: " + session.rel_path.string());
+        }
+        session.offset = 0;
+        session.confirmed = true;
+        return false;
+    }
+
+    bool finishing = session.offset >= session.size;
+    if (responseCode(handle) == 200 && finishing) {
+        return true;
+    }
+    if (finishing || !proccesUploadAppend(handle, session)) {
+        LOG_WARNING("Dropbox", "Upload session for %s failed with: %s, starting over", session.rel_path.string(), handle._response);
+        session.session_id.clear();
+        session.offset = 0;
+        session.confirmed = false;
+        return false;
+    }
+    session.offset = std::min(session.size, session.offset + _upload_chunk_size);
+    session.confirmed = true;
+    return false;
+}
+
+std::size_t Dropbox::concurrentUploadAppends() const {
+    return _concurrent_appends;
+}
+
+std::uint64_t Dropbox::uploadAppendSize() const {
+    return _upload_chunk_size;
+}
+
+void Dropbox::setupUploadAppendHandle(const std::unique_ptr<RequestHandle>& handle, const UploadSessionDTO& session, std::uint64_t offset) const {
+    std::uint64_t length = std::min(_upload_chunk_size, session.size - offset);
+    nlohmann::json arg = {
+        { "cursor", {
+            { "session_id", session.session_id },
+            { "offset", offset }
+        } },
+        { "close", offset + length >= session.size }
+    };
+
+    handle->_accepted_codes = { 409 };
+    handle->addHeaders(authorizationHeader());
+    handle->addHeaders("Dropbox-API-Arg: " + arg.dump());
+    handle->addHeaders("Content-Type: application/octet-stream");
+    handle->addHeaders("Expect:");
+    handle->setUploadSource(_local_home_path / session.rel_path, offset, length);
+    curl_easy_setopt(handle->_curl, CURLOPT_URL, (_content_base_url + "/2/files/upload_session/append_v2").c_str());
+    curl_easy_setopt(handle->_curl, CURLOPT_POST, 1L);
+    handle->setCommonCURLOpt();
+}
+
+bool Dropbox::proccesUploadAppend(const RequestHandle& handle, const UploadSessionDTO&) const {
+    if (responseCode(handle) == 200) {
+        return true;
+    }
+    // The chunk reached the server before, e.g. when a response was lost and the append was resent.
+    return sessionErrorTag(handle._response) == "incorrect_offset";
+}
+
+void Dropbox::setChangeBatching(std::size_t batch_size, std::size_t max_pending_batches) {
+    _change_batch_size = std::max<std::size_t>(batch_size, 1);
+    _max_pending_batches = std::max<std::size_t>(max_pending_batches, 1);
+}
+
+void Dropbox::setUploadChunking(std::uint64_t session_threshold, std::uint64_t chunk_size, std::size_t concurrent_appends) {
+    _session_threshold = session_threshold;
+    _upload_chunk_size = std::clamp((chunk_size + APPEND_ALIGNMENT - 1) / APPEND_ALIGNMENT * APPEND_ALIGNMENT, APPEND_ALIGNMENT, MAX_APPEND_SIZE);
+    _concurrent_appends = concurrent_appends;
+}
+
 void Dropbox::setupDownloadHandle(const std::unique_ptr<RequestHandle>& handle, const std::unique_ptr<FileRecordDTO>& dto) const {
     std::string remote_path = (_home_path / dto->rel_path).string();
     std::string url;
 
     if (dto->type == EntryType::Document && this->isDropboxShortcutJsonFile(dto->rel_path)) {
-        url = "https://content.dropboxapi.com/2/files/export";
+        url = _content_base_url + "/2/files/export";
     }
     else {
-        url = "https://content.dropboxapi.com/2/files/download";
+        url = _content_base_url + "/2/files/download";
     }
 
-    handle->addHeaders("Authorization: Bearer " + _access_token);
+    handle->addHeaders(authorizationHeader());
     handle->addHeaders("Dropbox-API-Arg: {\"path\": \"" + remote_path + "\"}");
 
     auto local_tmp_path = _local_home_path / dto->rel_path.parent_path() /
@@ -133,13 +477,13 @@ void Dropbox::setupDownloadHandle(const std::unique_ptr<RequestHandle>& handle,
     std::string url;
 
     if (dto->type == EntryType::Document && this->isDropboxShortcutJsonFile(dto->rel_path)) {
-        url = "https://content.dropboxapi.com/2/files/export";
+        url = _content_base_url + "/2/files/export";
     }
     else {
-        url = "https://content.dropboxapi.com/2/files/download";
+        url = _content_base_url + "/2/files/download";
     }
 
-    handle->addHeaders("Authorization: Bearer " + _access_token);
+    handle->addHeaders(authorizationHeader());
     handle->addHeaders("Dropbox-API-Arg: {\"path\": \"" + remote_path + "\"}");
 
     auto local_tmp_path = _local_home_path / dto->rel_path.parent_path() /
@@ -153,7 +497,7 @@ void Dropbox::setupDownloadHandle(const std::unique_ptr<RequestHandle>& handle,
 void Dropbox::setupUpdateHandle(const std::unique_ptr<RequestHandle>& handle, const std::unique_ptr<FileUpdatedDTO>& dto) const {
     std::filesystem::path file_path = _local_home_path / dto->rel_path;
 
-    std::string url = "https://content.dropboxapi.com/2/files/upload";
+    std::string url = _content_base_url + "/2/files/upload";
     curl_easy_setopt(handle->_curl, CURLOPT_URL, url.c_str());
     curl_easy_setopt(handle->_curl, CURLOPT_POST, 1L);
 
@@ -172,43 +516,35 @@ void Dropbox::setupUpdateHandle(const std::unique_ptr<RequestHandle>& handle, co
         handle->addHeaders("Content-Type: application/octet-stream");
     }
 
-    handle->addHeaders("Authorization: Bearer " + _access_token);
+    handle->addHeaders(authorizationHeader());
     handle->addHeaders("Dropbox-API-Arg: " + api_arg);
 
-    handle->setFileStream(file_path.string(), std::ios::in);
+    handle->setUploadSource(file_path);
     handle->setCommonCURLOpt();
 
     _expected_events.add(dto->cloud_file_id, ChangeType::Update);
 }
 
-void Dropbox::setupMoveHandle(const std::unique_ptr<RequestHandle>& handle, const std::unique_ptr<FileMovedDTO>& dto) const {
-    auto makeRemote = [this](const std::filesystem::path& rel) {
-        std::filesystem::path p = _home_path / rel;
-        std::string s = p.generic_string();
-        if (s.empty() || s[0] != '/')
-            s = "/" + s;
-        return s;
-        };
-
-    const std::string from_path = makeRemote(dto->old_rel_path);
-    const std::string to_path = makeRemote(dto->new_rel_path);
-
+std::optional<BatchPart> Dropbox::moveBatchPart(const std::unique_ptr<FileMovedDTO>& dto) const {
     nlohmann::json body = {
-        {"from_path", from_path},
-        {"to_path",   to_path},
+        {"from_path", remotePath(dto->old_rel_path)},
+        {"to_path",   remotePath(dto->new_rel_path)},
         {"allow_shared_folder", true},
         {"autorename", false},
         {"allow_ownership_transfer", false}
     };
+    return BatchPart{ "POST", "/2/files/move_v2", "application/json", body.dump(), MOVE_BATCH };
+}
 
-    std::string body_str = body.dump();
+void Dropbox::setupMoveHandle(const std::unique_ptr<RequestHandle>& handle, const std::unique_ptr<FileMovedDTO>& dto) const {
+    auto request = *moveBatchPart(dto);
 
     curl_easy_setopt(handle->_curl, CURLOPT_URL,
-        "https://api.dropboxapi.com/2/files/move_v2");
+        (_api_base_url + request.path).c_str());
     curl_easy_setopt(handle->_curl, CURLOPT_POST, 1L);
-    curl_easy_setopt(handle->_curl, CURLOPT_COPYPOSTFIELDS, body_str.c_str());
+    curl_easy_setopt(handle->_curl, CURLOPT_COPYPOSTFIELDS, request.body.c_str());
 
-    handle->addHeaders("Authorization: Bearer " + _access_token);
+    handle->addHeaders(authorizationHeader());
     handle->addHeaders("Content-Type: application/json");
     handle->setCommonCURLOpt();
 
@@ -231,69 +567,59 @@ std::vector<std::unique_ptr<FileRecordDTO>> Dropbox::createPath(const std::files
         prefix /= segs[i];
     }
 
-    auto handle = std::make_unique<RequestHandle>();
-    handle->addHeaders("Authorization: Bearer " + _access_token);
-    handle->addHeaders("Content-Type: application/json");
-    handle->setCommonCURLOpt();
-
     std::filesystem::path accum = _home_path / prefix;
-
+    std::vector<std::filesystem::path> rel_paths;
+    std::vector<std::string> remote_paths;
     for (auto const& seg : missing) {
         accum /= seg;
-        nlohmann::json cf_req = {
-            { "path",     accum.string() },
-            { "autorename", false }
-        };
-        std::string cf_body = cf_req.dump();
-
-        curl_easy_setopt(handle->_curl, CURLOPT_URL,
-            "https://api.dropboxapi.com/2/files/create_folder_v2");
-        curl_easy_setopt(handle->_curl, CURLOPT_POST, 1L);
-        curl_easy_setopt(handle->_curl, CURLOPT_COPYPOSTFIELDS,
-            cf_body.c_str());
-        handle->_response.clear();
-
-        _expected_events.add(std::filesystem::relative(accum, _home_path), ChangeType::New);
+        rel_paths.push_back(std::filesystem::relative(accum, _home_path));
+        remote_paths.push_back(accum.string());
+        _expected_events.add(rel_paths.back(), ChangeType::New);
+    }
+    if (remote_paths.empty()) {
+        return created;
+    }
 
-        HttpClient::get().syncRequest(handle);
+    auto entries = createFolderBatch(remote_paths);
 
-        nlohmann::json j = nlohmann::json::parse(handle->_response);
+    for (std::size_t i = 0; i < remote_paths.size(); ++i) {
+        const auto& entry = i < entries.size() ? entries[i] : nlohmann::json::object();
 
         std::string folder_id;
-        if (j.contains("error_summary")) {
-            auto summary = j["error_summary"].get<std::string>();
-            if (summary.rfind("path/conflict/folder", 0) == 0) {
-                nlohmann::json md_req = {
-                    { "path", accum.string() }
-                };
-                std::string md_body = md_req.dump();
-
-                curl_easy_setopt(handle->_curl, CURLOPT_POST, 1L);
-                curl_easy_setopt(handle->_curl, CURLOPT_URL,
-                    "https://api.dropboxapi.com/2/files/get_metadata");
-                curl_easy_setopt(handle->_curl, CURLOPT_COPYPOSTFIELDS,
-                    md_body.c_str());
-                handle->_response.clear();
-
-                HttpClient::get().syncRequest(handle);
-                auto md = nlohmann::json::parse(handle->_response);
-                folder_id = md["id"].get<std::string>();
-            }
-            else {
-                throw std::runtime_error(
-                    "Dropbox create_folder_v2 error: " + summary
-                );
-            }
-            _expected_events.check(std::filesystem::relative(accum, _home_path), ChangeType::New);
+        if (entry.value(".tag", "") == "success") {
+            folder_id = entry["metadata"]["id"].get<std::string>();
+        }
+        else if (isFolderConflict(entry.value("failure", nlohmann::json::object()))) {
+            auto handle = std::make_unique<RequestHandle>();
+            handle->addHeaders(authorizationHeader());
+            handle->addHeaders("Content-Type: application/json");
+            handle->setCommonCURLOpt();
+
+            nlohmann::json md_req = {
+                { "path", remote_paths[i] }
+            };
+            std::string md_body = md_req.dump();
+
+            curl_easy_setopt(handle->_curl, CURLOPT_POST, 1L);
+            curl_easy_setopt(handle->_curl, CURLOPT_URL,
+                (_api_base_url + "/2/files/get_metadata").c_str());
+            curl_easy_setopt(handle->_curl, CURLOPT_COPYPOSTFIELDS,
+                md_body.c_str());
+
+            HttpClient::get().syncRequest(handle);
+            auto md = nlohmann::json::parse(handle->_response);
+            folder_id = md["id"].get<std::string>();
+            _expected_events.check(rel_paths[i], ChangeType::New);
         }
         else {
-            auto meta = j["metadata"];
-            folder_id = meta["id"].get<std::string>();
+            throw std::runtime_error(
+                "Dropbox create_folder_batch error for " + remote_paths[i] + ": " + entry.dump()
+            );
         }
 
         auto dto = std::make_unique<FileRecordDTO>(
             EntryType::Directory,
-            std::filesystem::relative(accum, _home_path),
+            rel_paths[i],
             folder_id,
             0ULL,
             0,
@@ -306,43 +632,194 @@ std::vector<std::unique_ptr<FileRecordDTO>> Dropbox::createPath(const std::files
     return created;
 }
 
-void Dropbox::setupDeleteHandle(const std::unique_ptr<RequestHandle>& handle, const std::unique_ptr<FileDeletedDTO>& dto) const {
-    auto rem = [this](const std::filesystem::path& rel) {
-        auto p = (_home_path / rel).generic_string();
-        return p[0] == '/' ? p : "/" + p;
-        }(dto->rel_path);
+nlohmann::json Dropbox::createFolderBatch(const std::vector<std::string>& paths) {
+    auto handle = std::make_unique<RequestHandle>();
+    handle->addHeaders(authorizationHeader());
+    handle->addHeaders("Content-Type: application/json");
+    handle->setCommonCURLOpt();
+
+    nlohmann::json request = {
+        { "paths", paths },
+        { "autorename", false },
+        { "force_async", false }
+    };
+    std::string body = request.dump();
 
-    nlohmann::json j = { {"path", rem} };
-    auto s = j.dump();
+    curl_easy_setopt(handle->_curl, CURLOPT_URL,
+        (_api_base_url + "/2/files/create_folder_batch").c_str());
+    curl_easy_setopt(handle->_curl, CURLOPT_POST, 1L);
+    curl_easy_setopt(handle->_curl, CURLOPT_COPYPOSTFIELDS, body.c_str());
+
+    HttpClient::get().syncRequest(handle);
+    auto j = nlohmann::json::parse(handle->_response);
+
+    for (int checks = 0; j.value(".tag", "") == "async_job_id" || j.value(".tag", "") == "in_progress"; ++checks) {
+        if (checks == 0) {
+            nlohmann::json check = { { "async_job_id", j["async_job_id"] } };
+            body = check.dump();
+            curl_easy_setopt(handle->_curl, CURLOPT_URL,
+                (_api_base_url + "/2/files/create_folder_batch/check").c_str());
+            curl_easy_setopt(handle->_curl, CURLOPT_COPYPOSTFIELDS, body.c_str());
+        }
+        else if (checks >= MAX_FOLDER_BATCH_CHECKS) {
+            throw std::runtime_error("Dropbox create_folder_batch did not complete in time");
+        }
+        std::this_thread::sleep_for(FOLDER_BATCH_CHECK_DELAY);
+
+        handle->_response.clear();
+        HttpClient::get().syncRequest(handle);
+        j = nlohmann::json::parse(handle->_response);
+    }
+
+    if (!j.contains("entries")) {
+        throw std::runtime_error("Dropbox create_folder_batch error: " + j.dump());
+    }
+    return j["entries"];
+}
+
+std::optional<BatchPart> Dropbox::deleteBatchPart(const std::unique_ptr<FileDeletedDTO>& dto) const {
+    nlohmann::json j = { {"path", remotePath(dto->rel_path)} };
+    return BatchPart{ "POST", "/2/files/delete_v2", "application/json", j.dump(), DELETE_BATCH };
+}
+
+void Dropbox::setupDeleteHandle(const std::unique_ptr<RequestHandle>& handle, const std::unique_ptr<FileDeletedDTO>& dto) const {
+    auto request = *deleteBatchPart(dto);
 
     curl_easy_setopt(handle->_curl, CURLOPT_URL,
-        "https://api.dropboxapi.com/2/files/delete_v2");
+        (_api_base_url + request.path).c_str());
     curl_easy_setopt(handle->_curl, CURLOPT_POST, 1L);
-    curl_easy_setopt(handle->_curl, CURLOPT_COPYPOSTFIELDS, s.c_str());
+    curl_easy_setopt(handle->_curl, CURLOPT_COPYPOSTFIELDS, request.body.c_str());
 
-    handle->addHeaders("Authorization: Bearer " + _access_token);
+    handle->addHeaders(authorizationHeader());
     handle->addHeaders("Content-Type: application/json");
     handle->setCommonCURLOpt();
 
     _expected_events.add(dto->rel_path, ChangeType::Delete);
 }
 
+std::size_t Dropbox::maxBatchParts() const {
+    return MAX_BATCH_PARTS;
+}
+
+void Dropbox::setupBatchHandle(const std::unique_ptr<RequestHandle>& handle, const std::vector<BatchPart>& parts) const {
+    const std::string& group = parts.front().group;
+
+    nlohmann::json entries = nlohmann::json::array();
+    for (const auto& part : parts) {
+        auto entry = nlohmann::json::parse(part.body);
+        if (group == MOVE_BATCH) {
+            entries.push_back({ {"from_path", entry["from_path"]}, {"to_path", entry["to_path"]} });
+        }
+        else {
+            entries.push_back(std::move(entry));
+        }
+    }
+
+    nlohmann::json body = { {"entries", std::move(entries)} };
+    if (group == MOVE_BATCH) {
+        body["autorename"] = false;
+        body["allow_ownership_transfer"] = false;
+    }
+    std::string body_str = body.dump();
+
+    curl_easy_setopt(handle->_curl, CURLOPT_URL, (_api_base_url + group).c_str());
+    curl_easy_setopt(handle->_curl, CURLOPT_POST, 1L);
+    curl_easy_setopt(handle->_curl, CURLOPT_COPYPOSTFIELDS, body_str.c_str());
+
+    handle->addHeaders(authorizationHeader());
+    handle->addHeaders("Content-Type: application/json");
+    handle->setCommonCURLOpt();
+}
+
+void Dropbox::setupBatchCheckHandle(const std::unique_ptr<RequestHandle>& handle, const std::vector<BatchPart>& parts, const std::string& async_job_id) const {
+    nlohmann::json body = { {"async_job_id", async_job_id} };
+    std::string body_str = body.dump();
+
+    curl_easy_setopt(handle->_curl, CURLOPT_URL, (_api_base_url + batchCheckPath(parts.front().group)).c_str());
+    curl_easy_setopt(handle->_curl, CURLOPT_POST, 1L);
+    curl_easy_setopt(handle->_curl, CURLOPT_COPYPOSTFIELDS, body_str.c_str());
+
+    handle->addHeaders(authorizationHeader());
+    handle->addHeaders("Content-Type: application/json");
+    handle->setCommonCURLOpt();
+}
+
+BatchResult Dropbox::proccesBatch(const RequestHandle& handle, std::size_t parts_count) const {
+    BatchResult result{ {}, false, std::vector<std::optional<BatchPartResponse>>(parts_count) };
+
+    auto j = nlohmann::json::parse(handle._response, nullptr, false);
+    if (j.is_discarded() || !j.is_object()) {
+        LOG_ERROR("DROPBOX", "Unreadable batch response: %s", handle._response);
+        return result;
+    }
+
+    const std::string tag = j.value(".tag", "");
+    if (tag == "async_job_id" || tag == "in_progress") {
+        result.async_job_id = j.value("async_job_id", std::string{});
+        result.in_progress = true;
+        return result;
+    }
+    if (tag == "failed" || !j.contains("entries")) {
+        LOG_WARNING("DROPBOX", "Batch job failed with response: %s", handle._response);
+        return result;
+    }
+
+    const auto& entries = j["entries"];
+    for (std::size_t i = 0; i < parts_count && i < entries.size(); ++i) {
+        result.responses[i] = batchEntryResponse(entries[i]);
+    }
+    return result;
+}
+
 std::vector<std::unique_ptr<FileRecordDTO>> Dropbox::initialFiles() {
     LOG_INFO("Dropbox", "initialFiles() start for cloud_id=%d", _id);
 
     std::vector<std::unique_ptr<FileRecordDTO>> result;
 
+    JsonEntryStream page("entries", [&](nlohmann::json&& e) {
+        bool is_folder = (e[".tag"] == "folder");
+        bool is_doc = !e.value("is_downloadable", true);
+        std::string id = e["id"].get<std::string>();
+        std::string path_str = e["path_display"].get<std::string>();
+
+        std::filesystem::path rel_path = std::filesystem::relative(path_str, _home_path);
+        if (rel_path.empty() || rel_path == std::filesystem::path(".")) {
+            return;
+        }
+
+        LOG_DEBUG("Dropbox", "  Found %s id=%s path=%s",
+            is_folder ? "DIR" : "FILE",
+            id.c_str(),
+            path_str.c_str());
+
+        std::time_t mtime = is_folder ? 0 : convertCloudTime(e["server_modified"].get<std::string>());
+        std::string hash = is_folder ? "" : e["content_hash"].get<std::string>();
+        uint64_t size = is_folder ? 0ULL : e.value("size", 0ULL);
+
+        auto dto = std::make_unique<FileRecordDTO>(
+            is_folder ? EntryType::Directory : (is_doc ? EntryType::Document : EntryType::File),
+            rel_path,
+            id,
+            size,
+            mtime,
+            hash,
+            _id
+        );
+        result.push_back(std::move(dto));
+        });
+
     auto handle = std::make_unique<RequestHandle>();
     curl_easy_setopt(handle->_curl, CURLOPT_POST, 1L);
 
     curl_easy_setopt(handle->_curl,
         CURLOPT_URL,
-        "https://api.dropboxapi.com/2/files/list_folder");
+        (_api_base_url + "/2/files/list_folder").c_str());
 
-    handle->addHeaders("Authorization: Bearer " + _access_token);
+    handle->addHeaders(authorizationHeader());
     handle->addHeaders("Content-Type: application/json");
 
     handle->setCommonCURLOpt();
+    handle->setResponseSink([&page](const char* data, std::size_t size) { return page.feed(data, size); });
 
     nlohmann::json body = {
         { "path",         _home_path },
@@ -355,64 +832,28 @@ std::vector<std::unique_ptr<FileRecordDTO>> Dropbox::initialFiles() {
     curl_easy_setopt(handle->_curl, CURLOPT_COPYPOSTFIELDS, body_str.c_str());
 
     HttpClient::get().syncRequest(handle);
-    auto rsp = nlohmann::json::parse(handle->_response);
-
-    auto proccess_entries = [&](const nlohmann::json& entries) {
-        for (auto& e : entries) {
-            bool is_folder = (e[".tag"] == "folder");
-            bool is_doc = !e.value("is_downloadable", true);
-            std::string id = e["id"].get<std::string>();
-            std::string path_str = e["path_display"].get<std::string>();
-
-            std::filesystem::path rel_path = std::filesystem::relative(path_str, _home_path);
-            if (rel_path.empty() || rel_path == std::filesystem::path(".")) {
-                continue;
-            }
+    page.finish();
 
-            LOG_DEBUG("Dropbox", "  Found %s id=%s path=%s",
-                is_folder ? "DIR" : "FILE",
-                id.c_str(),
-                path_str.c_str());
-
-            std::time_t mtime = is_folder ? 0 : convertCloudTime(e["server_modified"].get<std::string>());
-            std::string hash = is_folder ? "" : e["content_hash"].get<std::string>();
-            uint64_t size = is_folder ? 0ULL : e.value("size", 0ULL);
-
-            auto dto = std::make_unique<FileRecordDTO>(
-                is_folder ? EntryType::Directory : (is_doc ? EntryType::Document : EntryType::File),
-                rel_path,
-                id,
-                size,
-                mtime,
-                hash,
-                _id
-            );
-            result.push_back(std::move(dto));
-        }
-        };
-
-    proccess_entries(rsp["entries"]);
-
-    bool has_more = rsp.value("has_more", false);
-    std::string cursor = rsp.value("cursor", "");
+    bool has_more = page.fields().value("has_more", false);
+    std::string cursor = page.fields().value("cursor", "");
 
     while (has_more) {
         nlohmann::json cont_body = { { "cursor", cursor } };
         std::string cont_str = cont_body.dump();
 
         curl_easy_setopt(handle->_curl, CURLOPT_URL,
-            "https://api.dropboxapi.com/2/files/list_folder/continue");
+            (_api_base_url + "/2/files/list_folder/continue").c_str());
         curl_easy_setopt(handle->_curl, CURLOPT_COPYPOSTFIELDS, cont_str.c_str());
         handle->_response.clear();
+        page.reset();
 
         HttpClient::get().syncRequest(handle);
-        auto cont_rsp = nlohmann::json::parse(handle->_response);
+        page.finish();
 
-        LOG_DEBUG("Dropbox", "continue response: %s", handle->_response.c_str());
-        proccess_entries(cont_rsp["entries"]);
+        LOG_DEBUG("Dropbox", "continue page with %zu entries", page.entries());
 
-        has_more = cont_rsp.value("has_more", false);
-        cursor = cont_rsp.value("cursor", "");
+        has_more = page.fields().value("has_more", false);
+        cursor = page.fields().value("cursor", "");
     }
 
     LOG_INFO("Dropbox", "initialFiles() done, total entries = %zu", result.size());
@@ -427,10 +868,14 @@ bool Dropbox::hasChanges() const {
     return !_events_buff.empty();
 }
 
+bool Dropbox::hasMoreChanges() const {
+    return _more_changes;
+}
+
 void Dropbox::ensureRootExists() {
     auto handle = std::make_unique<RequestHandle>();
 
-    handle->addHeaders("Authorization: Bearer " + _access_token);
+    handle->addHeaders(authorizationHeader());
     handle->addHeaders("Content-Type: application/json");
     handle->setCommonCURLOpt();
 
@@ -442,7 +887,7 @@ void Dropbox::ensureRootExists() {
     std::string payload = body.dump();
 
     curl_easy_setopt(handle->_curl, CURLOPT_URL,
-        "https://api.dropboxapi.com/2/files/create_folder_v2");
+        (_api_base_url + "/2/files/create_folder_v2").c_str());
     curl_easy_setopt(handle->_curl, CURLOPT_POST, 1L);
     curl_easy_setopt(handle->_curl, CURLOPT_POSTFIELDS, payload.c_str());
 
@@ -533,7 +978,7 @@ std::string Dropbox::getRefreshToken(const std::string& code, const int local_po
         "&client_secret=" + _client_secret +
         "&redirect_uri=http://localhost:" + std::to_string(local_port) + "/oauth2callback";
 
-    curl_easy_setopt(handle->_curl, CURLOPT_URL, "https://api.dropboxapi.com/oauth2/token");
+    curl_easy_setopt(handle->_curl, CURLOPT_URL, (_api_base_url + "/oauth2/token").c_str());
     curl_easy_setopt(handle->_curl, CURLOPT_POSTFIELDS, post_fields.c_str());
     curl_easy_setopt(handle->_curl, CURLOPT_POST, 1L);
     handle->setCommonCURLOpt();
@@ -547,13 +992,19 @@ std::string Dropbox::getRefreshToken(const std::string& code, const int local_po
 void Dropbox::refreshAccessToken() {
     auto handle = std::make_unique<RequestHandle>();
 
+    std::string refresh_token;
+    {
+        std::lock_guard<std::mutex> lock(_token_mtx);
+        refresh_token = _refresh_token;
+    }
+
     std::string post_fields =
         "grant_type=refresh_token"
-        "&refresh_token=" + _refresh_token +
+        "&refresh_token=" + refresh_token +
         "&client_id=" + _client_id +
         "&client_secret=" + _client_secret;
 
-    curl_easy_setopt(handle->_curl, CURLOPT_URL, "https://api.dropboxapi.com/oauth2/token");
+    curl_easy_setopt(handle->_curl, CURLOPT_URL, (_api_base_url + "/oauth2/token").c_str());
     curl_easy_setopt(handle->_curl, CURLOPT_POSTFIELDS, post_fields.c_str());
     curl_easy_setopt(handle->_curl, CURLOPT_POST, 1L);
     handle->setCommonCURLOpt();
@@ -565,18 +1016,50 @@ void Dropbox::refreshAccessToken() {
 void Dropbox::proccessAuth(const std::string& response) {
     auto j = nlohmann::json::parse(response);
 
-    _access_token = j["access_token"].get<std::string>();
+    std::string access_token = j["access_token"].get<std::string>();
+    int expires_in = j["expires_in"].get<int>();
 
-    if (j.contains("refresh_token")) {
-        _refresh_token = j["refresh_token"].get<std::string>();
-    }
+    {
+        std::lock_guard<std::mutex> lock(_token_mtx);
+        _access_token = std::move(access_token);
 
-    int expires_in = j["expires_in"].get<int>();
-    _access_token_expires = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now()) + expires_in;
+        if (j.contains("refresh_token")) {
+            _refresh_token = j["refresh_token"].get<std::string>();
+        }
+
+        _access_token_expires = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now()) + expires_in;
+        _token_generation.fetch_add(1, std::memory_order_release);
+    }
 
     LOG_INFO("AUTH", "DropboxCloud with id: %i tokens updated, expires in %i", _id, expires_in);
 }
 
+std::string Dropbox::authorizationHeader() const {
+    std::lock_guard<std::mutex> lock(_token_mtx);
+    return "Authorization: Bearer " + _access_token;
+}
+
+std::time_t Dropbox::accessTokenExpires() const {
+    std::lock_guard<std::mutex> lock(_token_mtx);
+    return _access_token_expires;
+}
+
+std::uint64_t Dropbox::tokenGeneration() const {
+    return _token_generation.load(std::memory_order_acquire);
+}
+
+std::optional<HashKind> Dropbox::contentHashKind() const {
+    return HashKind::DropboxContentHash;
+}
+
+bool Dropbox::supportsRangeDownloads() const {
+    return true;
+}
+
+bool Dropbox::supportsMultiplexing() const {
+    return true;
+}
+
 std::string Dropbox::getDeltaToken() {
     auto handle = std::make_unique<RequestHandle>();
 
@@ -590,11 +1073,11 @@ std::string Dropbox::getDeltaToken() {
 
     std::string body = j.dump();
 
-    handle->addHeaders("Authorization: Bearer " + _access_token);
+    handle->addHeaders(authorizationHeader());
     handle->addHeaders("Content-Type: application/json");
 
     curl_easy_setopt(handle->_curl, CURLOPT_URL,
-        "https://api.dropboxapi.com/2/files/list_folder/get_latest_cursor");
+        (_api_base_url + "/2/files/list_folder/get_latest_cursor").c_str());
     curl_easy_setopt(handle->_curl, CURLOPT_POSTFIELDS, body.c_str());
     curl_easy_setopt(handle->_curl, CURLOPT_POST, 1L);
 
@@ -618,206 +1101,234 @@ void Dropbox::getChanges() {
     }
 
     auto handle = std::make_unique<RequestHandle>();
-    std::vector<std::string> pages;
     std::string cursor = _page_token;
 
+    std::vector<nlohmann::json> batch;
+    std::vector<std::vector<nlohmann::json>> page_batches;
+
+    JsonEntryStream page("entries", [&](nlohmann::json&& entry) {
+        batch.push_back(std::move(entry));
+        if (batch.size() >= _change_batch_size) {
+            page_batches.push_back(std::exchange(batch, {}));
+        }
+        });
+
     nlohmann::json body_json = { {"cursor", cursor} };
     std::string body = body_json.dump();
 
-    handle->addHeaders("Authorization: Bearer " + _access_token);
+    handle->addHeaders(authorizationHeader());
     handle->addHeaders("Content-Type: application/json");
     curl_easy_setopt(handle->_curl, CURLOPT_POST, 1L);
     curl_easy_setopt(handle->_curl, CURLOPT_URL,
-        "https://api.dropboxapi.com/2/files/list_folder/continue");
+        (_api_base_url + "/2/files/list_folder/continue").c_str());
     handle->setCommonCURLOpt();
+    handle->setResponseSink([&page](const char* data, std::size_t size) { return page.feed(data, size); });
 
+    std::size_t pushed = 0;
     bool has_more = false;
+    _more_changes = false;
     do {
         curl_easy_setopt(handle->_curl, CURLOPT_POSTFIELDS, body.c_str());
 
+        handle->_response.clear();
+        page.reset();
+
         HttpClient::get().syncRequest(handle);
 
-        pages.push_back(handle->_response);
+        page.finish();
+
+        // The cursor only moves past pages whose entries were all handed over.
+        if (!batch.empty()) {
+            page_batches.push_back(std::exchange(batch, {}));
+        }
+        for (auto& ready : page_batches) {
+            _events_buff.push(std::move(ready));
+            ++pushed;
+        }
+        page_batches.clear();
 
-        auto j = nlohmann::json::parse(handle->_response);
-        has_more = j.value("has_more", false);
-        cursor = j.value("cursor", cursor);
+        has_more = page.fields().value("has_more", false);
+        cursor = page.fields().value("cursor", cursor);
+        _page_token = cursor;
 
         if (has_more) {
+            if (_events_buff.size() >= static_cast<int>(_max_pending_batches)) {
+                _more_changes = true;
+                break;
+            }
             body_json["cursor"] = cursor;
             body = body_json.dump();
         }
     } while (has_more);
 
-    _page_token = cursor;
-    LOG_INFO("Dropbox", "All changes received");
-
-    bool any_entries = false;
-    for (const auto& raw : pages) {
-        auto j = nlohmann::json::parse(raw);
-        if (!j.value("entries", nlohmann::json::array()).empty()) {
-            any_entries = true;
-            break;
-        }
+    if (_more_changes) {
+        LOG_INFO("Dropbox", "Change feed paused with %i batches pending", _events_buff.size());
     }
-    if (any_entries) {
-        _events_buff.push(pages);
+    else {
+        LOG_INFO("Dropbox", "All changes received");
+    }
+
+    if (pushed > 0) {
         _onChange();
     }
 }
 
+void Dropbox::setTestApiBaseUrl(const std::string& url) {
+    _api_base_url = url;
+    _content_base_url = url;
+}
+
 void Dropbox::setOnChange(std::function<void()> cb) {
     _onChange = std::move(cb);
 }
 
 std::vector<std::shared_ptr<Change>> Dropbox::proccessChanges() {
     std::vector<std::shared_ptr<Change>> changes;
-    std::vector<std::string> pages;
-
-    std::unordered_map<std::string, std::shared_ptr<Change>> pending_deletes;
+    std::vector<nlohmann::json> batch;
 
-    if (!_events_buff.try_pop(pages))
+    if (!_events_buff.try_pop(batch))
         return changes;
 
     PrevEventsRegistry old_expected(_expected_events.copyMap());
 
-    for (const auto& raw : pages) {
-        auto j = nlohmann::json::parse(raw);
-        for (auto& entry : j.value("entries", nlohmann::json::array())) {
-            std::string tag = entry[".tag"].get<std::string>();
-            bool is_dir = (tag == "folder");
-            bool is_doc = !entry.value("is_downloadable", true);
-            std::string cloud_file_id = entry.value("id", std::string{});
-
-            std::string path_str = entry.value("path_display", std::string{});
-            std::filesystem::path path = path_str;
-            std::filesystem::path rel_path = path.lexically_relative(_home_path);
-
-            if (rel_path.empty() || rel_path == std::filesystem::path(".")) {
-                continue;
-            }
+    for (const auto& entry : batch) {
+        std::string tag = entry[".tag"].get<std::string>();
+        bool is_dir = (tag == "folder");
+        bool is_doc = !entry.value("is_downloadable", true);
+        std::string cloud_file_id = entry.value("id", std::string{});
 
-            if (cloud_file_id == "") {
-                cloud_file_id = _db->getCloudFileIdByPath(rel_path, _id);
-            }
+        std::string path_str = entry.value("path_display", std::string{});
+        std::filesystem::path path = path_str;
+        std::filesystem::path rel_path = path.lexically_relative(_home_path);
 
-            std::time_t mtime = 0;
-            uint64_t size = 0;
-            std::string hash;
+        if (rel_path.empty() || rel_path == std::filesystem::path(".")) {
+            continue;
+        }
 
-            if (tag != "deleted" && !is_dir) {
-                mtime = convertCloudTime(entry.value("server_modified", std::string{}));
-                size = entry.value("size", 0ULL);
-                hash = entry.value("content_hash", std::string{});
-            }
+        if (cloud_file_id == "") {
+            cloud_file_id = _db->getCloudFileIdByPath(rel_path, _id);
+        }
 
-            EntryType type = is_dir ? EntryType::Directory : (is_doc ? EntryType::Document : EntryType::File);
+        std::time_t mtime = 0;
+        uint64_t size = 0;
+        std::string hash;
 
-            auto link = _db->getFileByCloudIdAndCloudFileId(_id, cloud_file_id);
-            int  global_id = link ? link->global_id : 0;
-            auto old_path = link ? _db->getPathByGlobalId(global_id) : std::filesystem::path{};
-            bool existed = (link != nullptr);
+        if (tag != "deleted" && !is_dir) {
+            mtime = convertCloudTime(entry.value("server_modified", std::string{}));
+            size = entry.value("size", 0ULL);
+            hash = entry.value("content_hash", std::string{});
+        }
 
-            bool need_new = !existed && tag != "deleted";
-            bool need_del = existed && tag == "deleted";
-            bool need_move = existed && tag != "deleted" && rel_path != old_path;
-            bool need_update = existed && !is_dir && tag != "deleted"
-                && mtime > link->cloud_file_modified_time
-                && hash != get<std::string>(link->cloud_hash_check_sum);
+        EntryType type = is_dir ? EntryType::Directory : (is_doc ? EntryType::Document : EntryType::File);
+
+        auto link = _db->getFileByCloudIdAndCloudFileId(_id, cloud_file_id);
+        int  global_id = link ? link->global_id : 0;
+        auto old_path = link ? _db->getPathByGlobalId(global_id) : std::filesystem::path{};
+        bool existed = (link != nullptr);
+
+        bool need_new = !existed && tag != "deleted";
+        bool need_del = existed && tag == "deleted";
+        bool need_move = existed && tag != "deleted" && rel_path != old_path;
+        bool need_update = existed && !is_dir && tag != "deleted"
+            && mtime > link->cloud_file_modified_time
+            && hash != get<std::string>(link->cloud_hash_check_sum);
+
+        LOG_DEBUG("Dropbox",
+            "Eval change: old_path=\"%s\", new_path=\"%s\", new=%d, del=%d, move=%d, upd=%d",
+            old_path.string().c_str(),
+            rel_path.string().c_str(),
+            (int)need_new, (int)need_del, (int)need_move, (int)need_update);
+
+        if (need_new && old_expected.check(rel_path, ChangeType::New)) {
+            LOG_DEBUG("Dropbox", "Expected NEW: %s", entry.dump().c_str());
+            continue;
+        }
+        if (need_del && old_expected.check(rel_path, ChangeType::Delete)) {
+            LOG_DEBUG("Dropbox", "Expected DELETE: %s", entry.dump().c_str());
+            continue;
+        }
+        if (need_move && old_expected.check(cloud_file_id, ChangeType::Move)) {
+            LOG_DEBUG("Dropbox", "Expected MOVE: %s", entry.dump().c_str());
+            continue;
+        }
+        if (need_update && old_expected.check(cloud_file_id, ChangeType::Update)) {
+            LOG_DEBUG("Dropbox", "Expected UPDATE: %s", entry.dump().c_str());
+            continue;
+        }
 
-            LOG_DEBUG("Dropbox",
-                "Eval change: old_path=\"%s\", new_path=\"%s\", new=%d, del=%d, move=%d, upd=%d",
+        std::shared_ptr<Change> ch = nullptr;
+        if (need_move && need_update) {
+            LOG_DEBUG("Dropbox", "  -> emit MOVE+UPDATE for: \"%s\" -> \"%s\"",
                 old_path.string().c_str(),
-                rel_path.string().c_str(),
-                (int)need_new, (int)need_del, (int)need_move, (int)need_update);
-
-            if (need_new && old_expected.check(rel_path, ChangeType::New)) {
-                LOG_DEBUG("Dropbox", "Expected NEW: %s", raw.c_str());
-                continue;
-            }
-            if (need_del && old_expected.check(rel_path, ChangeType::Delete)) {
-                LOG_DEBUG("Dropbox", "Expected DELETE: %s", raw.c_str());
-                continue;
-            }
-            if (need_move && old_expected.check(cloud_file_id, ChangeType::Move)) {
-                LOG_DEBUG("Dropbox", "Expected MOVE: %s", raw.c_str());
-                continue;
-            }
-            if (need_update && old_expected.check(cloud_file_id, ChangeType::Update)) {
-                LOG_DEBUG("Dropbox", "Expected UPDATE: %s", raw.c_str());
-                continue;
+                rel_path.string().c_str());
+            // MOVE
+            auto m_dto = std::make_unique<FileMovedDTO>(
+                type, global_id, _id, cloud_file_id,
+                mtime, old_path, rel_path,
+                /*oldParent=*/"", /*newParent=*/""
+            );
+            if (_pending_deletes.contains(rel_path.string())) {
+                _pending_deletes.erase(rel_path.string());
             }
+            ch = ChangeFactory::makeCloudMove(std::move(m_dto));
 
-            std::shared_ptr<Change> ch = nullptr;
-            if (need_move && need_update) {
-                LOG_DEBUG("Dropbox", "  -> emit MOVE+UPDATE for: \"%s\" -> \"%s\"",
-                    old_path.string().c_str(),
-                    rel_path.string().c_str());
-                // MOVE
-                auto m_dto = std::make_unique<FileMovedDTO>(
-                    type, global_id, _id, cloud_file_id,
-                    mtime, old_path, rel_path,
-                    /*oldParent=*/"", /*newParent=*/""
-                );
-                if (pending_deletes.contains(rel_path.string())) {
-                    pending_deletes.erase(rel_path.string());
-                }
-                ch = ChangeFactory::makeCloudMove(std::move(m_dto));
-
-                // UPDATE as dependent
-                auto u_dto = std::make_unique<FileUpdatedDTO>(
-                    type, global_id, _id, cloud_file_id,
-                    hash, mtime, rel_path, /*newParent=*/"", size
-                );
-                auto updCh = ChangeFactory::makeCloudUpdate(std::move(u_dto));
-                ch->addDependent(std::move(updCh));
-            }
-            else if (need_new) {
-                LOG_DEBUG("Dropbox", "  -> emit NEW for: \"%s\"", rel_path.string().c_str());
-                auto dto = std::make_unique<FileRecordDTO>(
-                    type, rel_path,
-                    cloud_file_id, size, mtime, hash, _id
-                );
-                ch = ChangeFactory::makeCloudNew(std::move(dto));
-            }
-            else if (need_del) {
-                LOG_DEBUG("Dropbox", "  -> emit DELETE for: \"%s\"", rel_path.string().c_str());
-                auto dto = std::make_unique<FileDeletedDTO>(
-                    rel_path, global_id, _id, cloud_file_id, mtime
-                );
-                auto mb_del = ChangeFactory::makeDelete(std::move(dto));
-                pending_deletes.emplace(rel_path.string(), std::move(mb_del));
-            }
-            else if (need_move) {
-                LOG_DEBUG("Dropbox", "  -> emit MOVE for: \"%s\" -> \"%s\"",
-                    old_path.string().c_str(),
-                    rel_path.string().c_str());
-                auto dto = std::make_unique<FileMovedDTO>(
-                    type, global_id, _id, cloud_file_id,
-                    mtime, old_path, rel_path,
-                    /*oldParent=*/"", /*newParent=*/""
-                );
-                if (pending_deletes.contains(rel_path.string())) {
-                    pending_deletes.erase(rel_path.string());
-                }
-                ch = ChangeFactory::makeCloudMove(std::move(dto));
-            }
-            else if (need_update) {
-                LOG_DEBUG("GoogleDrive", "  -> emit UPDATE for: \"%s\"", rel_path.string().c_str());
-                auto dto = std::make_unique<FileUpdatedDTO>(
-                    type, global_id, _id, cloud_file_id,
-                    hash, mtime, rel_path, /*newParent=*/"", size
-                );
-                ch = ChangeFactory::makeCloudUpdate(std::move(dto));
+            // UPDATE as dependent
+            auto u_dto = std::make_unique<FileUpdatedDTO>(
+                type, global_id, _id, cloud_file_id,
+                hash, mtime, rel_path, /*newParent=*/"", size
+            );
+            auto updCh = ChangeFactory::makeCloudUpdate(std::move(u_dto));
+            ch->addDependent(std::move(updCh));
+        }
+        else if (need_new) {
+            LOG_DEBUG("Dropbox", "  -> emit NEW for: \"%s\"", rel_path.string().c_str());
+            auto dto = std::make_unique<FileRecordDTO>(
+                type, rel_path,
+                cloud_file_id, size, mtime, hash, _id
+            );
+            ch = ChangeFactory::makeCloudNew(std::move(dto));
+        }
+        else if (need_del) {
+            LOG_DEBUG("Dropbox", "  -> emit DELETE for: \"%s\"", rel_path.string().c_str());
+            auto dto = std::make_unique<FileDeletedDTO>(
+                rel_path, global_id, _id, cloud_file_id, mtime
+            );
+            auto mb_del = ChangeFactory::makeDelete(std::move(dto));
+            _pending_deletes.emplace(rel_path.string(), std::move(mb_del));
+        }
+        else if (need_move) {
+            LOG_DEBUG("Dropbox", "  -> emit MOVE for: \"%s\" -> \"%s\"",
+                old_path.string().c_str(),
+                rel_path.string().c_str());
+            auto dto = std::make_unique<FileMovedDTO>(
+                type, global_id, _id, cloud_file_id,
+                mtime, old_path, rel_path,
+                /*oldParent=*/"", /*newParent=*/""
+            );
+            if (_pending_deletes.contains(rel_path.string())) {
+                _pending_deletes.erase(rel_path.string());
             }
+            ch = ChangeFactory::makeCloudMove(std::move(dto));
+        }
+        else if (need_update) {
+            LOG_DEBUG("GoogleDrive", "  -> emit UPDATE for: \"%s\"", rel_path.string().c_str());
+            auto dto = std::make_unique<FileUpdatedDTO>(
+                type, global_id, _id, cloud_file_id,
+                hash, mtime, rel_path, /*newParent=*/"", size
+            );
+            ch = ChangeFactory::makeCloudUpdate(std::move(dto));
+        }
 
-            if (ch) {
-                changes.emplace_back(std::move(ch));
-            }
+        if (ch) {
+            changes.emplace_back(std::move(ch));
         }
     }
-    for (auto& [path, del] : pending_deletes) {
-        changes.emplace_back(std::move(del));
+    // A delete may still be cancelled by a move in a later batch of the same feed.
+    if (_events_buff.empty() && !_more_changes) {
+        for (auto& [path, del] : _pending_deletes) {
+            changes.emplace_back(std::move(del));
+        }
+        _pending_deletes.clear();
     }
 
     return changes;
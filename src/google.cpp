@@ -1,7 +1,16 @@
 #include "google.h"
 #include "Networking.h"
+#include "CallbackDispatcher.h"
 #include "logger.h"
 #include "change-factory.h"
+#include "json-entry-stream.h"
+
+namespace {
+    constexpr std::size_t MAX_BATCH_PARTS = 100;
+    constexpr const char* FOLDER_MIME_TYPE = "application/vnd.google-apps.folder";
+    constexpr std::uint64_t UPLOAD_CHUNK_GRANULARITY = 256 * 1024;
+    constexpr std::uint64_t RESUMABLE_DOWNLOAD_THRESHOLD = 8ULL * 1024 * 1024;
+}
 
 GoogleDrive::GoogleDrive(
     const std::string& client_id,
@@ -138,11 +147,12 @@ std::vector<std::unique_ptr<FileRecordDTO>> GoogleDrive::createPath(const std::f
     std::string parent_id = prefix.empty() ? _home_dir_id : _db->getCloudFileIdByPath(prefix, _id);
 
     auto handle = std::make_unique<RequestHandle>();
-    handle->addHeaders("Authorization: Bearer " + _access_token);
+    handle->addHeaders(authorizationHeader());
     handle->addHeaders("Accept: application/json");
     handle->setCommonCURLOpt();
 
     std::filesystem::path accum = prefix;
+    std::vector<std::filesystem::path> to_create;
     bool creating = false;
 
     LOG_DEBUG("GoogleDrive", "Normalized prefix=%s, parent_id=%s", prefix.c_str(), parent_id.c_str());
@@ -151,7 +161,7 @@ std::vector<std::unique_ptr<FileRecordDTO>> GoogleDrive::createPath(const std::f
         accum /= seg;
         if (!creating) {
             std::string q = "name='" + seg.string() +
-                "' and mimeType='application/vnd.google-apps.folder'"
+                "' and mimeType='" + FOLDER_MIME_TYPE + "'"
                 " and '" + parent_id + "' in parents and trashed=false";
             char* eq = curl_easy_escape(handle->_curl, q.c_str(), 0);
             std::string url = _api_base_url + "/drive/v3/files"
@@ -201,59 +211,118 @@ std::vector<std::unique_ptr<FileRecordDTO>> GoogleDrive::createPath(const std::f
 
         }
 
-        LOG_INFO("GoogleDrive", "Creating folder: %s", accum.c_str());
+        to_create.push_back(accum);
+    }
 
-        nlohmann::json body = {
-            {"name",      seg.string()},
-            {"mimeType",  "application/vnd.google-apps.folder"},
-            {"parents",   { parent_id }}
-        };
-        std::string payload = body.dump();
+    auto folders = createFolders(parent_id, to_create);
+    created.insert(created.end(), std::make_move_iterator(folders.begin()), std::make_move_iterator(folders.end()));
 
-        handle->clearHeaders();
-        handle->addHeaders("Authorization: Bearer " + _access_token);
-        handle->addHeaders("Content-Type: application/json; charset=UTF-8");
-        handle->addHeaders("Accept: application/json");
+    LOG_INFO("GoogleDrive", "createPath() done, total created = %zu", created.size());
 
-        curl_easy_setopt(handle->_curl, CURLOPT_HTTPGET, 0L);
-        curl_easy_setopt(handle->_curl, CURLOPT_POST, 1L);
+    return created;
+}
 
-        std::string url = _api_base_url + "/drive/v3/files?fields=id,modifiedTime";
-        curl_easy_setopt(handle->_curl, CURLOPT_URL, url.c_str());
-        curl_easy_setopt(handle->_curl, CURLOPT_POSTFIELDS, payload.c_str());
+std::vector<std::unique_ptr<FileRecordDTO>> GoogleDrive::createFolders(const std::string& parent_id, const std::vector<std::filesystem::path>& paths) {
+    std::vector<std::unique_ptr<FileRecordDTO>> created(paths.size());
+    if (paths.empty()) {
+        return {};
+    }
 
+    // Ids are allocated up front so every level knows its parent and the whole chain fits in one batch.
+    std::vector<std::string> ids;
+    if (paths.size() > 1) {
+        auto handle = std::make_unique<RequestHandle>();
+        std::string url = _api_base_url + "/drive/v3/files/generateIds?count=" + std::to_string(paths.size()) + "&space=drive&type=files";
+        curl_easy_setopt(handle->_curl, CURLOPT_HTTPGET, 1L);
+        curl_easy_setopt(handle->_curl, CURLOPT_URL, url.c_str());
+        handle->addHeaders(authorizationHeader());
+        handle->addHeaders("Accept: application/json");
         handle->setCommonCURLOpt();
-        handle->_response.clear();
-
-        _expected_events.add(accum, ChangeType::New);
-
         HttpClient::get().syncRequest(handle);
 
-        LOG_DEBUG("GoogleDrive", "Response for folder '%s': %s", seg.string().c_str(), handle->_response.c_str());
-
-        auto j2 = nlohmann::json::parse(handle->_response);
+        auto j = nlohmann::json::parse(handle->_response);
+        ids = j["ids"].get<std::vector<std::string>>();
+        if (ids.size() < paths.size()) {
+            throw std::runtime_error("Drive generated " + std::to_string(ids.size()) + " ids for " + std::to_string(paths.size()) + " folders");
+        }
+    }
 
-        std::string cloud_file_id = j2["id"].get<std::string>();
+    std::vector<BatchPart> parts;
+    for (std::size_t i = 0; i < paths.size(); ++i) {
+        nlohmann::json body = {
+            {"name",      paths[i].filename().string()},
+            {"mimeType",  FOLDER_MIME_TYPE},
+            {"parents",   { i == 0 ? parent_id : ids[i - 1] }}
+        };
+        if (!ids.empty()) {
+            body["id"] = ids[i];
+        }
+        parts.push_back(BatchPart{ "POST", "/drive/v3/files?fields=id,modifiedTime", "application/json; charset=UTF-8", body.dump(), std::string{} });
+        _expected_events.add(paths[i], ChangeType::New);
+        LOG_INFO("GoogleDrive", "Creating folder: %s", paths[i].c_str());
+    }
 
-        auto dto = std::make_unique<FileRecordDTO>(
+    auto makeDto = [&](std::size_t i, const std::string& response) {
+        auto j = nlohmann::json::parse(response);
+        created[i] = std::make_unique<FileRecordDTO>(
             EntryType::Directory,
-            parent_id,
-            accum,
-            cloud_file_id,
+            i == 0 ? parent_id : ids[i - 1],
+            paths[i],
+            j["id"].get<std::string>(),
             0ULL,
-            convertCloudTime(j2["modifiedTime"].get<std::string>()),
+            convertCloudTime(j["modifiedTime"].get<std::string>()),
             std::string{},
             _id
         );
+        LOG_INFO("GoogleDrive", "Created directory id=%s, path=%s", created[i]->cloud_file_id.c_str(), paths[i].string().c_str());
+    };
 
-        LOG_INFO("GoogleDrive", "Created directory id=%s, path=%s", cloud_file_id.c_str(), accum.string().c_str());
+    if (parts.size() == 1) {
+        auto handle = std::make_unique<RequestHandle>();
+        std::string url = _api_base_url + parts[0].path;
+        curl_easy_setopt(handle->_curl, CURLOPT_POST, 1L);
+        curl_easy_setopt(handle->_curl, CURLOPT_URL, url.c_str());
+        curl_easy_setopt(handle->_curl, CURLOPT_COPYPOSTFIELDS, parts[0].body.c_str());
+        handle->addHeaders(authorizationHeader());
+        handle->addHeaders("Content-Type: " + parts[0].content_type);
+        handle->addHeaders("Accept: application/json");
+        handle->setCommonCURLOpt();
+        HttpClient::get().syncRequest(handle);
 
-        parent_id = cloud_file_id;
+        makeDto(0, handle->_response);
+        return created;
+    }
 
-        created.push_back(std::move(dto));
+    // Parts of a batch may run in any order, so a child can miss its parent; those are sent again next round.
+    std::vector<std::size_t> pending(parts.size());
+    for (std::size_t i = 0; i < pending.size(); ++i) {
+        pending[i] = i;
     }
+    while (!pending.empty()) {
+        std::vector<BatchPart> round;
+        for (auto i : pending) {
+            round.push_back(parts[i]);
+        }
 
-    LOG_INFO("GoogleDrive", "createPath() done, total created = %zu", created.size());
+        auto handle = std::make_unique<RequestHandle>();
+        setupBatchHandle(handle, round);
+        HttpClient::get().syncRequest(handle);
+
+        auto responses = MultipartBatch::decode(handle->responseHeader("content-type"), handle->_response, round.size());
+        std::vector<std::size_t> failed;
+        for (std::size_t k = 0; k < pending.size(); ++k) {
+            if (responses[k] && responses[k]->status >= 200 && responses[k]->status < 300) {
+                makeDto(pending[k], responses[k]->body);
+            }
+            else {
+                failed.push_back(pending[k]);
+            }
+        }
+        if (failed.size() == pending.size()) {
+            throw std::runtime_error("Failed to create folder: " + paths[failed.front()].string());
+        }
+        pending = std::move(failed);
+    }
 
     return created;
 }
@@ -261,10 +330,16 @@ std::vector<std::unique_ptr<FileRecordDTO>> GoogleDrive::createPath(const std::f
 void GoogleDrive::refreshAccessToken() {
     auto handle = std::make_unique<RequestHandle>();
 
+    std::string refresh_token;
+    {
+        std::lock_guard<std::mutex> lock(_token_mtx);
+        refresh_token = _refresh_token;
+    }
+
     std::string post =
         "client_id=" + _client_id +
         "&client_secret=" + _client_secret +
-        "&refresh_token=" + _refresh_token +
+        "&refresh_token=" + refresh_token +
         "&grant_type=refresh_token";
 
     std::string url = _auth_base_url + "/token";
@@ -289,9 +364,9 @@ void GoogleDrive::setupUpdateHandle(const std::unique_ptr<RequestHandle>& handle
 
     curl_easy_setopt(handle->_curl, CURLOPT_UPLOAD, 1L);
 
-    handle->setFileStream(file_path, std::ios::in);
+    handle->setUploadSource(file_path);
 
-    handle->addHeaders("Authorization: Bearer " + _access_token);
+    handle->addHeaders(authorizationHeader());
     handle->addHeaders("Content-Type: application/octet-stream");
 
     handle->setCommonCURLOpt();
@@ -299,60 +374,288 @@ void GoogleDrive::setupUpdateHandle(const std::unique_ptr<RequestHandle>& handle
     _expected_events.add(dto->cloud_file_id, ChangeType::Update);
 }
 
-void GoogleDrive::setupMoveHandle(const std::unique_ptr<RequestHandle>& handle, const std::unique_ptr<FileMovedDTO>& dto) const {
-    std::string url = _api_base_url + "/drive/v3/files/" + dto->cloud_file_id;
+std::unique_ptr<UploadSessionDTO> GoogleDrive::resumeUploadSession(const std::filesystem::path& rel_path) const {
+    auto file_path = _local_home_path / rel_path;
+    std::error_code ec;
+    std::uint64_t size = std::filesystem::file_size(file_path, ec);
+    if (ec || size < _resumable_threshold) {
+        return nullptr;
+    }
+    std::time_t modified = convertSystemTime(file_path);
 
-    bool parent_changed = (!dto->new_cloud_parent_id.empty() &&
-        dto->new_cloud_parent_id != dto->old_cloud_parent_id);
+    if (_db) {
+        if (auto saved = _db->getUploadSession(_id, rel_path)) {
+            if (saved->size == size && saved->local_modified_time == modified) {
+                LOG_INFO("GoogleDrive", "Resuming upload of %s from byte %llu", rel_path.string(), static_cast<unsigned long long>(saved->offset));
+                return saved;
+            }
+            LOG_INFO("GoogleDrive", "File changed since its upload session started, starting over: %s", rel_path.string());
+        }
+    }
+    return std::make_unique<UploadSessionDTO>(_id, rel_path, size, modified);
+}
 
-    if (parent_changed) {
-        url += "?addParents=" + dto->new_cloud_parent_id +
-            "&removeParents=" + dto->old_cloud_parent_id;
+std::unique_ptr<UploadSessionDTO> GoogleDrive::openUploadSession(const std::unique_ptr<FileRecordDTO>& dto) const {
+    if (dto->type != EntryType::File) {
+        return nullptr;
+    }
+    auto session = resumeUploadSession(dto->rel_path);
+    if (session) {
+        _expected_events.add(dto->rel_path, ChangeType::New);
     }
+    return session;
+}
 
-    url += (parent_changed ? "&" : "?");
-    url += "fields=id,name,parents,modifiedTime,md5Checksum,size";
+std::unique_ptr<UploadSessionDTO> GoogleDrive::openUploadSession(const std::unique_ptr<FileUpdatedDTO>& dto) const {
+    if (dto->type != EntryType::File) {
+        return nullptr;
+    }
+    auto session = resumeUploadSession(dto->rel_path);
+    if (session) {
+        _expected_events.add(dto->cloud_file_id, ChangeType::Update);
+    }
+    return session;
+}
 
+// Picks up the partial file of an interrupted download as long as the remote content did not change since.
+std::unique_ptr<DownloadProgressDTO> GoogleDrive::resumeDownload(const std::filesystem::path& rel_path, int global_id, const std::string& revision, std::uint64_t size) const {
+    if (!_db || revision.empty() || size < RESUMABLE_DOWNLOAD_THRESHOLD) {
+        return nullptr;
+    }
+    auto tmp_path = _local_home_path / rel_path.parent_path() /
+        (".-tmp-SyncHarbor-" + rel_path.filename().string());
+    auto progress = std::make_unique<DownloadProgressDTO>(_id, rel_path, tmp_path, revision, 0, size);
+
+    if (auto saved = _db->getDownloadProgress(_id, rel_path)) {
+        std::error_code ec;
+        std::uint64_t on_disk = std::filesystem::file_size(tmp_path, ec);
+        if (!ec && saved->revision == revision && saved->size == size && saved->tmp_path == tmp_path) {
+            // A streamed file holds exactly the downloaded bytes, a preallocated one only its checkpointed prefix.
+            std::uint64_t offset = on_disk < size ? on_disk : saved->offset;
+            progress->offset = offset < size ? offset : 0;
+            LOG_INFO("GoogleDrive", "Resuming download of %s from byte %llu", rel_path.string(), static_cast<unsigned long long>(progress->offset));
+        }
+        else {
+            LOG_INFO("GoogleDrive", "File changed since its download started, starting over: %s", rel_path.string());
+        }
+    }
+    // Runs on whatever thread submits the download, which must not wait for the callback workers. Queued under
+    // the download's own key, the row lands before any callback of the download can checkpoint or delete it.
+    CallbackDispatcher::get().submitDbWrite(ICommand::entryKey(global_id, rel_path), [saved = *progress](const std::unique_ptr<Database>& db) {
+        db->saveDownloadProgress(saved);
+        });
+    return progress;
+}
+
+std::unique_ptr<DownloadProgressDTO> GoogleDrive::openDownload(const std::unique_ptr<FileRecordDTO>& dto) const {
+    const auto* revision = std::get_if<std::string>(&dto->cloud_hash_check_sum);
+    if (dto->type != EntryType::File || !revision) {
+        return nullptr;
+    }
+    return resumeDownload(dto->rel_path, dto->global_id, *revision, dto->size);
+}
+
+std::unique_ptr<DownloadProgressDTO> GoogleDrive::openDownload(const std::unique_ptr<FileUpdatedDTO>& dto) const {
+    const auto* revision = std::get_if<std::string>(&dto->cloud_hash_check_sum);
+    if (dto->type != EntryType::File || !revision) {
+        return nullptr;
+    }
+    return resumeDownload(dto->rel_path, dto->global_id, *revision, dto->size);
+}
+
+void GoogleDrive::setupUploadSessionHandle(const std::unique_ptr<RequestHandle>& handle, const std::unique_ptr<FileRecordDTO>& dto, const UploadSessionDTO& session) const {
+    if (!session.session_id.empty()) {
+        setupSessionTransfer(handle, session);
+        return;
+    }
+
+    nlohmann::json j;
+    j["name"] = dto->rel_path.filename().string();
+    j["parents"] = { uploadParentId(dto) };
+    std::string metadata = j.dump();
+
+    std::string url = _api_base_url + "/upload/drive/v3/files?uploadType=resumable&fields=id,modifiedTime,md5Checksum,parents";
+    curl_easy_setopt(handle->_curl, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(handle->_curl, CURLOPT_POST, 1L);
+    curl_easy_setopt(handle->_curl, CURLOPT_COPYPOSTFIELDS, metadata.c_str());
+
+    handle->addHeaders(authorizationHeader());
+    handle->addHeaders("Content-Type: application/json; charset=UTF-8");
+    handle->addHeaders("X-Upload-Content-Type: application/octet-stream");
+    handle->addHeaders("X-Upload-Content-Length: " + std::to_string(session.size));
+    handle->setCommonCURLOpt();
+}
+
+void GoogleDrive::setupUploadSessionHandle(const std::unique_ptr<RequestHandle>& handle, const std::unique_ptr<FileUpdatedDTO>& dto, const UploadSessionDTO& session) const {
+    if (!session.session_id.empty()) {
+        setupSessionTransfer(handle, session);
+        return;
+    }
+
+    std::string url = _api_base_url + "/upload/drive/v3/files/" + dto->cloud_file_id +
+        "?uploadType=resumable&fields=id,modifiedTime,md5Checksum,parents,size";
     curl_easy_setopt(handle->_curl, CURLOPT_URL, url.c_str());
     curl_easy_setopt(handle->_curl, CURLOPT_CUSTOMREQUEST, "PATCH");
+    curl_easy_setopt(handle->_curl, CURLOPT_COPYPOSTFIELDS, "{}");
 
-    nlohmann::json body;
-    std::string old_name = dto->old_rel_path.filename().string();
-    std::string new_name = dto->new_rel_path.filename().string();
+    handle->addHeaders(authorizationHeader());
+    handle->addHeaders("Content-Type: application/json; charset=UTF-8");
+    handle->addHeaders("X-Upload-Content-Type: application/octet-stream");
+    handle->addHeaders("X-Upload-Content-Length: " + std::to_string(session.size));
+    handle->setCommonCURLOpt();
+}
 
-    if (old_name != new_name) {
-        body["name"] = new_name;
+void GoogleDrive::setupSessionTransfer(const std::unique_ptr<RequestHandle>& handle, const UploadSessionDTO& session) const {
+    handle->_accepted_codes = { 201, 308, 404, 410 };
+    curl_easy_setopt(handle->_curl, CURLOPT_URL, session.session_id.c_str());
+    handle->addHeaders(authorizationHeader());
+
+    if (!session.confirmed || session.offset >= session.size) {
+        // An offset loaded from the database may lag behind the server, so ask before sending data.
+        curl_easy_setopt(handle->_curl, CURLOPT_CUSTOMREQUEST, "PUT");
+        curl_easy_setopt(handle->_curl, CURLOPT_POSTFIELDS, "");
+        curl_easy_setopt(handle->_curl, CURLOPT_POSTFIELDSIZE, 0L);
+        handle->addHeaders("Content-Range: bytes */" + std::to_string(session.size));
+    }
+    else {
+        std::uint64_t length = std::min(_upload_chunk_size, session.size - session.offset);
+        handle->setUploadSource(_local_home_path / session.rel_path, session.offset, length);
+        curl_easy_setopt(handle->_curl, CURLOPT_UPLOAD, 1L);
+        handle->addHeaders("Content-Type: application/octet-stream");
+        // Chunks are small and their offset is already confirmed, so skip the 100-continue round trip.
+        handle->addHeaders("Expect:");
+        handle->addHeaders(
+            "Content-Range: bytes " + std::to_string(session.offset) + "-" +
+            std::to_string(session.offset + length - 1) + "/" + std::to_string(session.size)
+        );
+    }
+    handle->setCommonCURLOpt();
+}
+
+bool GoogleDrive::proccesUploadSession(const RequestHandle& handle, UploadSessionDTO& session) const {
+    if (session.session_id.empty()) {
+        session.session_id = handle.responseHeader("location");
+        if (session.session_id.empty()) {
+            throw std::runtime_error("Drive returned no resumable session URI for: " + session.rel_path.string());
+        }
+        session.offset = 0;
+        session.confirmed = true;
+        return false;
     }
 
-    std::string body_str = body.dump();
-    if (!body.empty()) {
-        curl_easy_setopt(handle->_curl, CURLOPT_COPYPOSTFIELDS, body_str.c_str());
-        handle->addHeaders("Content-Type: application/json");
+    long http_code = 0;
+    curl_easy_getinfo(handle._curl, CURLINFO_RESPONSE_CODE, &http_code);
+    if (http_code == 200 || http_code == 201) {
+        return true;
+    }
+    if (http_code == 404 || http_code == 410) {
+        LOG_WARNING("GoogleDrive", "Upload session expired for %s, starting over", session.rel_path.string());
+        session.session_id.clear();
+        session.offset = 0;
+        session.confirmed = false;
+        return false;
     }
 
-    handle->addHeaders("Authorization: Bearer " + _access_token);
+    // 308 Resume Incomplete: Range holds the last byte the server has stored, if any.
+    std::string range = handle.responseHeader("range");
+    auto dash = range.rfind('-');
+    session.offset = dash == std::string::npos ? 0 : std::stoull(range.substr(dash + 1)) + 1;
+    session.confirmed = true;
+    return false;
+}
+
+void GoogleDrive::setUploadChunking(std::uint64_t resumable_threshold, std::uint64_t chunk_size) {
+    _resumable_threshold = resumable_threshold;
+    _upload_chunk_size = std::max(UPLOAD_CHUNK_GRANULARITY, (chunk_size + UPLOAD_CHUNK_GRANULARITY - 1) / UPLOAD_CHUNK_GRANULARITY * UPLOAD_CHUNK_GRANULARITY);
+}
+
+void GoogleDrive::setChangeBatching(std::size_t batch_size, std::size_t max_pending_batches) {
+    _change_batch_size = std::max<std::size_t>(batch_size, 1);
+    _max_pending_batches = std::max<std::size_t>(max_pending_batches, 1);
+}
+
+void GoogleDrive::setupMoveHandle(const std::unique_ptr<RequestHandle>& handle, const std::unique_ptr<FileMovedDTO>& dto) const {
+    auto request = *moveBatchPart(dto);
+    std::string url = _api_base_url + request.path;
+
+    curl_easy_setopt(handle->_curl, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(handle->_curl, CURLOPT_CUSTOMREQUEST, request.method.c_str());
+
+    if (!request.body.empty()) {
+        curl_easy_setopt(handle->_curl, CURLOPT_COPYPOSTFIELDS, request.body.c_str());
+        handle->addHeaders("Content-Type: " + request.content_type);
+    }
+
+    handle->addHeaders(authorizationHeader());
     handle->setCommonCURLOpt();
 
     _expected_events.add(dto->cloud_file_id, ChangeType::Move);
 }
 
 void GoogleDrive::setupDeleteHandle(const std::unique_ptr<RequestHandle>& handle, const std::unique_ptr<FileDeletedDTO>& dto) const {
-    std::string url = _api_base_url + "/drive/v3/files/" + dto->cloud_file_id;
+    auto request = *deleteBatchPart(dto);
+    std::string url = _api_base_url + request.path;
 
     curl_easy_setopt(handle->_curl, CURLOPT_URL, url.c_str());
-    curl_easy_setopt(handle->_curl, CURLOPT_CUSTOMREQUEST, "PATCH");
+    curl_easy_setopt(handle->_curl, CURLOPT_CUSTOMREQUEST, request.method.c_str());
+    curl_easy_setopt(handle->_curl, CURLOPT_COPYPOSTFIELDS, request.body.c_str());
+
+    handle->addHeaders("Content-Type: " + request.content_type);
+    handle->addHeaders(authorizationHeader());
+    handle->setCommonCURLOpt();
+
+    _expected_events.add(dto->cloud_file_id, ChangeType::Delete);
+}
+
+std::size_t GoogleDrive::maxBatchParts() const {
+    return MAX_BATCH_PARTS;
+}
+
+std::optional<BatchPart> GoogleDrive::moveBatchPart(const std::unique_ptr<FileMovedDTO>& dto) const {
+    std::string path = "/drive/v3/files/" + dto->cloud_file_id;
+
+    bool parent_changed = (!dto->new_cloud_parent_id.empty() &&
+        dto->new_cloud_parent_id != dto->old_cloud_parent_id);
+
+    if (parent_changed) {
+        path += "?addParents=" + dto->new_cloud_parent_id +
+            "&removeParents=" + dto->old_cloud_parent_id;
+    }
+
+    path += (parent_changed ? "&" : "?");
+    path += "fields=id,name,parents,modifiedTime,md5Checksum,size";
 
+    nlohmann::json body;
+    std::string old_name = dto->old_rel_path.filename().string();
+    std::string new_name = dto->new_rel_path.filename().string();
+
+    if (old_name != new_name) {
+        body["name"] = new_name;
+    }
+
+    return BatchPart{ "PATCH", path, "application/json", body.empty() ? std::string{} : body.dump(), std::string{} };
+}
+
+std::optional<BatchPart> GoogleDrive::deleteBatchPart(const std::unique_ptr<FileDeletedDTO>& dto) const {
     nlohmann::json body;
     body["trashed"] = true;
-    auto s = body.dump();
 
-    curl_easy_setopt(handle->_curl, CURLOPT_COPYPOSTFIELDS, s.c_str());
+    return BatchPart{ "PATCH", "/drive/v3/files/" + dto->cloud_file_id, "application/json", body.dump(), std::string{} };
+}
 
-    handle->addHeaders("Content-Type: application/json");
-    handle->addHeaders("Authorization: Bearer " + _access_token);
-    handle->setCommonCURLOpt();
+void GoogleDrive::setupBatchHandle(const std::unique_ptr<RequestHandle>& handle, const std::vector<BatchPart>& parts) const {
+    MultipartBatch batch;
+    std::string body = batch.encode(parts);
+    std::string url = _api_base_url + "/batch/drive/v3";
 
-    _expected_events.add(dto->cloud_file_id, ChangeType::Delete);
+    curl_easy_setopt(handle->_curl, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(handle->_curl, CURLOPT_POST, 1L);
+    curl_easy_setopt(handle->_curl, CURLOPT_POSTFIELDSIZE_LARGE, static_cast<curl_off_t>(body.size()));
+    curl_easy_setopt(handle->_curl, CURLOPT_COPYPOSTFIELDS, body.c_str());
+
+    handle->addHeaders(authorizationHeader());
+    handle->addHeaders("Content-Type: " + batch.contentType());
+    handle->setCommonCURLOpt();
 }
 
 std::vector<std::unique_ptr<FileRecordDTO>> GoogleDrive::initialFiles() {
@@ -364,16 +667,55 @@ std::vector<std::unique_ptr<FileRecordDTO>> GoogleDrive::initialFiles() {
 
     dir_queue.emplace(_home_dir_id, std::filesystem::path{});
 
+    std::string parent_id;
+    std::filesystem::path rel_path;
+
+    JsonEntryStream page("files", [&](nlohmann::json&& f) {
+        bool is_folder = (f["mimeType"] == "application/vnd.google-apps.folder");
+        bool is_doc = f["mimeType"].get<std::string>().rfind("application/vnd.google-apps.", 0) == 0;
+        std::string id = f["id"].get<std::string>();
+        std::string name = f["name"].get<std::string>();
+        auto path = rel_path / name;
+
+        uint64_t file_size = 0;
+        if (!is_folder && f.contains("size")) {
+            file_size = std::stoull(f["size"].get<std::string>());
+        }
+
+        LOG_DEBUG("GoogleDrive",
+            "  Found %s id=%s name=%s",
+            is_folder ? "DIR" : "FILE",
+            id.c_str(),
+            path.c_str());
+
+        auto dto = std::make_unique<FileRecordDTO>(
+            is_folder ? EntryType::Directory : (is_doc ? EntryType::Document : EntryType::File),
+            parent_id,
+            path,
+            id,
+            file_size,
+            convertCloudTime(f["modifiedTime"].get<std::string>()),
+            f.value("md5Checksum", std::string{}),
+            _id
+        );
+
+        if (is_folder) {
+            dir_queue.emplace(id, path);
+        }
+
+        result.push_back(std::move(dto));
+        });
+
     auto handle = std::make_unique<RequestHandle>();
     curl_easy_setopt(handle->_curl, CURLOPT_HTTPGET, 1L);
-    handle->addHeaders("Authorization: Bearer " + _access_token);
+    handle->addHeaders(authorizationHeader());
     handle->addHeaders("Accept: application/json");
 
     handle->setCommonCURLOpt();
-
+    handle->setResponseSink([&page](const char* data, std::size_t size) { return page.feed(data, size); });
 
     while (!dir_queue.empty()) {
-        auto [parent_id, rel_path] = dir_queue.front();
+        std::tie(parent_id, rel_path) = dir_queue.front();
         dir_queue.pop();
 
         LOG_DEBUG("GoogleDrive", "Scanning folder id=%s rel_path=%s",
@@ -397,47 +739,12 @@ std::vector<std::unique_ptr<FileRecordDTO>> GoogleDrive::initialFiles() {
             curl_easy_setopt(handle->_curl, CURLOPT_URL, url.c_str());
 
             handle->_response.clear();
+            page.reset();
 
             HttpClient::get().syncRequest(handle);
 
-            auto rsp = nlohmann::json::parse(handle->_response);
-
-            for (auto& f : rsp["files"]) {
-                bool is_folder = (f["mimeType"] == "application/vnd.google-apps.folder");
-                bool is_doc = f["mimeType"].get<std::string>().rfind("application/vnd.google-apps.", 0) == 0;
-                std::string id = f["id"].get<std::string>();
-                std::string name = f["name"].get<std::string>();
-                auto path = rel_path / name;
-
-                uint64_t file_size = 0;
-                if (!is_folder && f.contains("size")) {
-                    file_size = std::stoull(f["size"].get<std::string>());
-                }
-
-                LOG_DEBUG("GoogleDrive",
-                    "  Found %s id=%s name=%s",
-                    is_folder ? "DIR" : "FILE",
-                    id.c_str(),
-                    path.c_str());
-
-                auto dto = std::make_unique<FileRecordDTO>(
-                    is_folder ? EntryType::Directory : (is_doc ? EntryType::Document : EntryType::File),
-                    parent_id,
-                    path,
-                    id,
-                    file_size,
-                    convertCloudTime(f["modifiedTime"].get<std::string>()),
-                    f.value("md5Checksum", std::string{}),
-                    _id
-                );
-
-                if (is_folder) {
-                    dir_queue.emplace(id, path);
-                }
-
-                result.push_back(std::move(dto));
-            }
-            page_token = rsp.value("nextPageToken", "");
+            page.finish();
+            page_token = page.fields().value("nextPageToken", "");
 
         } while (!page_token.empty());
     }
@@ -449,7 +756,7 @@ std::vector<std::unique_ptr<FileRecordDTO>> GoogleDrive::initialFiles() {
 void GoogleDrive::ensureRootExists() {
     auto handle = std::make_unique<RequestHandle>();
 
-    handle->addHeaders("Authorization: Bearer " + _access_token);
+    handle->addHeaders(authorizationHeader());
     curl_easy_setopt(handle->_curl, CURLOPT_HTTPGET, 1L);
     handle->setCommonCURLOpt();
 
@@ -504,7 +811,7 @@ void GoogleDrive::ensureRootExists() {
             curl_easy_setopt(handle->_curl, CURLOPT_POSTFIELDS, payload.c_str());
             handle->_response.clear();
 
-            handle->addHeaders("Authorization: Bearer " + _access_token);
+            handle->addHeaders(authorizationHeader());
             handle->addHeaders("Content-Type: application/json; charset=UTF-8");
             curl_easy_setopt(handle->_curl, CURLOPT_HTTPHEADER, handle->_headers);
 
@@ -519,23 +826,20 @@ void GoogleDrive::ensureRootExists() {
     _home_dir_id = parent_id;
 }
 
-void GoogleDrive::setupUploadHandle(const std::unique_ptr<RequestHandle>& handle, const std::unique_ptr<FileRecordDTO>& dto) const {
-    std::string parent_id;
-    if (dto->cloud_parent_id.empty()) {
-        if (dto->rel_path.parent_path().empty()) {
-            parent_id = _home_dir_id;
-        }
-        else {
-            parent_id = _db->getCloudFileIdByPath(dto->rel_path.parent_path(), _id);
-        }
+std::string GoogleDrive::uploadParentId(const std::unique_ptr<FileRecordDTO>& dto) const {
+    if (!dto->cloud_parent_id.empty()) {
+        return dto->cloud_parent_id;
     }
-    else {
-        parent_id = dto->cloud_parent_id;
+    if (dto->rel_path.parent_path().empty()) {
+        return _home_dir_id;
     }
+    return _db->getCloudFileIdByPath(dto->rel_path.parent_path(), _id);
+}
 
+void GoogleDrive::setupUploadHandle(const std::unique_ptr<RequestHandle>& handle, const std::unique_ptr<FileRecordDTO>& dto) const {
     nlohmann::json j;
     j["name"] = dto->rel_path.filename().string();
-    j["parents"] = { parent_id };
+    j["parents"] = { uploadParentId(dto) };
 
     std::string cloud_mime, content_mime = "application/octet-stream";
 
@@ -550,7 +854,7 @@ void GoogleDrive::setupUploadHandle(const std::unique_ptr<RequestHandle>& handle
         }
     }
 
-    handle->addHeaders("Authorization: Bearer " + _access_token);
+    handle->addHeaders(authorizationHeader());
 
     const std::string metadata = j.dump();
     handle->_mime = curl_mime_init(handle->_curl);
@@ -562,7 +866,7 @@ void GoogleDrive::setupUploadHandle(const std::unique_ptr<RequestHandle>& handle
 
     part = curl_mime_addpart(handle->_mime);
     curl_mime_name(part, "media");
-    curl_mime_filedata(part, (_local_home_path.string() + "/" + dto->rel_path.string()).c_str());
+    handle->addMimeUploadPart(part, _local_home_path / dto->rel_path);
     curl_mime_type(part, content_mime.c_str());
 
     curl_easy_setopt(handle->_curl, CURLOPT_MIMEPOST, handle->_mime);
@@ -591,7 +895,7 @@ void GoogleDrive::setupDownloadHandle(const std::unique_ptr<RequestHandle>& hand
         url += "/drive/v3/files/" + dto->cloud_file_id + "?alt=media";
     }
 
-    handle->addHeaders("Authorization: Bearer " + _access_token);
+    handle->addHeaders(authorizationHeader());
 
     auto path = _local_home_path / dto->rel_path.parent_path() /
         (".-tmp-SyncHarbor-" + dto->rel_path.filename().string());
@@ -618,7 +922,7 @@ void GoogleDrive::setupDownloadHandle(const std::unique_ptr<RequestHandle>& hand
         url += "/drive/v3/files/" + dto->cloud_file_id + "?alt=media";
     }
 
-    handle->addHeaders("Authorization: Bearer " + _access_token);
+    handle->addHeaders(authorizationHeader());
 
     auto path = _local_home_path / dto->rel_path.parent_path() /
         (".-tmp-SyncHarbor-" + dto->rel_path.filename().string());
@@ -675,22 +979,54 @@ std::string GoogleDrive::getRefreshToken(const std::string& code, const int loca
 void GoogleDrive::proccessAuth(const std::string& responce) {
     auto j = nlohmann::json::parse(responce);
 
-    _access_token = j["access_token"].get<std::string>();
+    std::string access_token = j["access_token"].get<std::string>();
+    int expires_in = j["expires_in"].get<int>();
 
-    if (j.contains("refresh_token")) {
-        std::string new_refresh = j["refresh_token"].get<std::string>();
-        _refresh_token = new_refresh;
-    }
+    {
+        std::lock_guard<std::mutex> lock(_token_mtx);
+        _access_token = std::move(access_token);
 
-    int expires_in = j["expires_in"].get<int>();
-    _access_token_expires = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now()) + expires_in;
+        if (j.contains("refresh_token")) {
+            std::string new_refresh = j["refresh_token"].get<std::string>();
+            _refresh_token = new_refresh;
+        }
+
+        _access_token_expires = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now()) + expires_in;
+        _token_generation.fetch_add(1, std::memory_order_release);
+    }
 
     LOG_INFO("AUTH", "GoogleCloud with id: %i tokens updated, expires in %i", _id, expires_in);
 }
 
+std::string GoogleDrive::authorizationHeader() const {
+    std::lock_guard<std::mutex> lock(_token_mtx);
+    return "Authorization: Bearer " + _access_token;
+}
+
+std::time_t GoogleDrive::accessTokenExpires() const {
+    std::lock_guard<std::mutex> lock(_token_mtx);
+    return _access_token_expires;
+}
+
+std::uint64_t GoogleDrive::tokenGeneration() const {
+    return _token_generation.load(std::memory_order_acquire);
+}
+
+std::optional<HashKind> GoogleDrive::contentHashKind() const {
+    return HashKind::Md5;
+}
+
+bool GoogleDrive::supportsRangeDownloads() const {
+    return true;
+}
+
+bool GoogleDrive::supportsMultiplexing() const {
+    return true;
+}
+
 std::string GoogleDrive::getDeltaToken() {
     auto handle = std::make_unique<RequestHandle>();
-    handle->addHeaders("Authorization: Bearer " + _access_token);
+    handle->addHeaders(authorizationHeader());
     std::string url = _api_base_url + "/drive/v3/changes/startPageToken";
     curl_easy_setopt(handle->_curl, CURLOPT_URL, url.c_str());
     handle->setCommonCURLOpt();
@@ -708,12 +1044,22 @@ void GoogleDrive::getChanges() {
 
     std::string page_token = _page_token;
 
-    std::vector<nlohmann::json> pages;
+    std::vector<nlohmann::json> batch;
+    std::vector<std::vector<nlohmann::json>> page_batches;
+
+    JsonEntryStream page("changes", [&](nlohmann::json&& change) {
+        batch.push_back(std::move(change));
+        if (batch.size() >= _change_batch_size) {
+            page_batches.push_back(std::exchange(batch, {}));
+        }
+        });
 
-    handle->addHeaders("Authorization: Bearer " + _access_token);
+    handle->addHeaders(authorizationHeader());
     handle->setCommonCURLOpt();
+    handle->setResponseSink([&page](const char* data, std::size_t size) { return page.feed(data, size); });
 
-    nlohmann::json changes;
+    std::size_t pushed = 0;
+    _more_changes = false;
 
     while (!page_token.empty()) {
         std::string url = _api_base_url + "/drive/v3/changes?"
@@ -726,21 +1072,44 @@ void GoogleDrive::getChanges() {
 
         curl_easy_setopt(handle->_curl, CURLOPT_URL, url.c_str());
 
+        handle->_response.clear();
+        page.reset();
+
         HttpClient::get().syncRequest(handle);
 
-        changes = nlohmann::json::parse(handle->_response);
+        page.finish();
 
-        page_token = changes.value("nexPageToken", "");
+        // Entries are handed over only once their page parsed completely, a failed page is fetched again.
+        if (!batch.empty()) {
+            page_batches.push_back(std::exchange(batch, {}));
+        }
+        for (auto& ready : page_batches) {
+            _events_buff.push(std::move(ready));
+            ++pushed;
+        }
+        page_batches.clear();
 
-        pages.push_back(changes);
+        page_token = page.fields().value("nextPageToken", "");
+        if (page_token.empty()) {
+            _page_token = page.fields().value("newStartPageToken", _page_token);
+        }
+        else {
+            _page_token = page_token;
+            if (_events_buff.size() >= static_cast<int>(_max_pending_batches)) {
+                _more_changes = true;
+                break;
+            }
+        }
     }
 
-    _page_token = changes["newStartPageToken"].get<std::string>();
-    LOG_INFO("GoogleDrive", "All changes recieved");
-
-    if (!changes["changes"].empty()) {
-        _events_buff.push(pages);
+    if (_more_changes) {
+        LOG_INFO("GoogleDrive", "Change feed paused with %i batches pending", _events_buff.size());
+    }
+    else {
+        LOG_INFO("GoogleDrive", "All changes recieved");
+    }
 
+    if (pushed > 0) {
         _onChange();
     }
 }
@@ -751,202 +1120,204 @@ void GoogleDrive::setOnChange(std::function<void()> cb) {
 
 std::vector<std::shared_ptr<Change>> GoogleDrive::proccessChanges() {
     std::vector<std::shared_ptr<Change>> changes;
-    std::vector<nlohmann::json> raw_pages;
+    std::vector<nlohmann::json> batch;
 
-    if (!_events_buff.try_pop(raw_pages))
+    if (!_events_buff.try_pop(batch))
         return changes;
 
     PrevEventsRegistry old_expected(_expected_events.copyMap());
 
-    std::unordered_map<std::string, std::filesystem::path> path_map;
     std::unordered_map<std::string, std::unique_ptr<FileRecordDTO>> maybe_new;
 
-    for (const auto& page_json : raw_pages) {
-        for (auto& jchange : page_json["changes"]) {
+    for (const auto& jchange : batch) {
+
+        if (!jchange.contains("file")) {
+            LOG_WARNING("GoogleDrive", "Change without file field: %s", jchange.dump().c_str());
+            continue;
+        }
 
-            if (!jchange.contains("file")) {
-                LOG_WARNING("GoogleDrive", "Change without file field: %s", jchange.dump().c_str());
+        auto const& file = jchange["file"];
+        bool trashed = file.value("trashed", false);
+        bool is_folder = (file["mimeType"] == "application/vnd.google-apps.folder");
+        bool is_doc = file["mimeType"].get<std::string>().rfind("application/vnd.google-apps.", 0) == 0;
+
+        std::string cloud_file_id = file["id"];
+        EntryType   type = is_folder ? EntryType::Directory : (is_doc ? EntryType::Document : EntryType::File);
+        auto        mod_time = convertCloudTime(file["modifiedTime"]);
+        uint64_t    size = file.value("size", 0ULL);
+        auto        name = file.value("name", std::string{});
+        std::string parent_id_str = file.contains("parents")
+            ? file["parents"][0].get<std::string>()
+            : "";
+
+        auto link = _db->getFileByCloudIdAndCloudFileId(_id, cloud_file_id);
+        std::filesystem::path old_path, new_path, rel_path;
+        std::string old_parent, new_parent, hash = file.value("md5Checksum", "");
+        int global_id = link ? link->global_id : 0;
+
+        if (!link) {
+            // NEW only if not trashed and parent known
+            if (trashed || parent_id_str.empty()) {
                 continue;
             }
-
-            auto const& file = jchange["file"];
-            bool trashed = file.value("trashed", false);
-            bool is_folder = (file["mimeType"] == "application/vnd.google-apps.folder");
-            bool is_doc = file["mimeType"].get<std::string>().rfind("application/vnd.google-apps.", 0) == 0;
-
-            std::string cloud_file_id = file["id"];
-            EntryType   type = is_folder ? EntryType::Directory : (is_doc ? EntryType::Document : EntryType::File);
-            auto        mod_time = convertCloudTime(file["modifiedTime"]);
-            uint64_t    size = file.value("size", 0ULL);
-            auto        name = file.value("name", std::string{});
-            std::string parent_id_str = file.contains("parents")
-                ? file["parents"][0].get<std::string>()
-                : "";
-
-            auto link = _db->getFileByCloudIdAndCloudFileId(_id, cloud_file_id);
-            std::filesystem::path old_path, new_path, rel_path;
-            std::string old_parent, new_parent, hash = file.value("md5Checksum", "");
-            int global_id = link ? link->global_id : 0;
-
-            if (!link) {
-                // NEW only if not trashed and parent known
-                if (trashed || parent_id_str.empty()) {
-                    continue;
-                }
-                // compute rel_path from DB or path_map if parent known
-                auto parent_link = _db->getFileByCloudIdAndCloudFileId(_id, parent_id_str);
-                if (parent_link) {
-                    rel_path = _db->getPathByGlobalId(parent_link->global_id) / name;
-                }
-                else if (parent_id_str == _home_dir_id) {
-                    rel_path = name;
-                }
-                else if (path_map.contains(parent_id_str)) {
-                    rel_path = path_map[parent_id_str] / name;
-                }
-                else {
-                    // postpone until folder appears
-                    maybe_new.emplace(
-                        cloud_file_id,
-                        std::make_unique<FileRecordDTO>(
-                            type, parent_id_str, "",
-                            cloud_file_id, size, mod_time, hash, _id
-                        )
-                    );
-                }
-                if (type == EntryType::Directory)
-                    path_map[cloud_file_id] = rel_path;
+            // compute rel_path from DB or _pending_paths if parent known
+            auto parent_link = _db->getFileByCloudIdAndCloudFileId(_id, parent_id_str);
+            if (parent_link) {
+                rel_path = _db->getPathByGlobalId(parent_link->global_id) / name;
             }
-            else {
-                // EXISTING: compute old/new paths for Move/Update/Delete
-                old_parent = link->cloud_parent_id;
-                old_path = _db->getPathByGlobalId(global_id);
-                new_parent = parent_id_str;
-                new_path = old_path;
-                rel_path = old_path; // default for delete
-
-                if (!trashed) {
-                    // Rename?
-                    if (name != old_path.filename()) {
-                        new_path = old_path.parent_path() / name;
-                    }
-                    // Move?
-                    if (old_parent != new_parent) {
-                        auto p_link = _db->getFileByCloudIdAndCloudFileId(_id, new_parent);
-                        if (p_link) {
-                            new_path = _db->getPathByGlobalId(p_link->global_id) / name;
-                        }
-                        else if (new_parent == _home_dir_id) {
-                            new_path = name;
-                        }
-                        else {
-                            // moved out => treat as delete
-                            trashed = true;
-                        }
-                    }
-                    rel_path = new_path;
-                }
+            else if (parent_id_str == _home_dir_id) {
+                rel_path = name;
             }
-
-            if (rel_path.empty() || rel_path == std::filesystem::path(".")) {
-                continue;
+            else if (_pending_paths.contains(parent_id_str)) {
+                rel_path = _pending_paths[parent_id_str] / name;
             }
-
-            bool need_new = !link && !trashed;
-            bool need_del = link && trashed;
-            bool need_move = link && !trashed && (new_path != old_path);
-            bool need_update = link && !trashed
-                && type != EntryType::Directory
-                && mod_time > link->cloud_file_modified_time
-                && hash != get<std::string>(link->cloud_hash_check_sum);
-
-            LOG_DEBUG("GoogleDrive",
-                "Eval change: old_path=\"%s\", new_path=\"%s\", new=%d, del=%d, move=%d, upd=%d",
-                old_path.string().c_str(),
-                new_path.string().c_str(),
-                (int)need_new, (int)need_del, (int)need_move, (int)need_update);
-
-            if (need_new) {
-                if (old_expected.check(rel_path, ChangeType::New)) {
-                    LOG_DEBUG("GoogleDrive", "Expected NEW: %s", jchange.dump().c_str());
-                    continue;
-                }
-            }
-            if (need_del) {
-                if (old_expected.check(cloud_file_id, ChangeType::Delete)) {
-                    LOG_DEBUG("GoogleDrive", "Expected DELETE: %s", jchange.dump().c_str());
-                    continue;
-                }
+            else {
+                // postpone until folder appears
+                maybe_new.emplace(
+                    cloud_file_id,
+                    std::make_unique<FileRecordDTO>(
+                        type, parent_id_str, "",
+                        cloud_file_id, size, mod_time, hash, _id
+                    )
+                );
             }
-            if (need_move) {
-                if (old_expected.check(cloud_file_id, ChangeType::Move)) {
-                    LOG_DEBUG("GoogleDrive", "Expected MOVE: %s", jchange.dump().c_str());
-                    continue;
+            if (type == EntryType::Directory)
+                _pending_paths[cloud_file_id] = rel_path;
+        }
+        else {
+            // EXISTING: compute old/new paths for Move/Update/Delete
+            old_parent = link->cloud_parent_id;
+            old_path = _db->getPathByGlobalId(global_id);
+            new_parent = parent_id_str;
+            new_path = old_path;
+            rel_path = old_path; // default for delete
+
+            if (!trashed) {
+                // Rename?
+                if (name != old_path.filename()) {
+                    new_path = old_path.parent_path() / name;
                 }
-            }
-            if (need_update) {
-                if (old_expected.check(cloud_file_id, ChangeType::Update)) {
-                    LOG_DEBUG("GoogleDrive", "Expected UPDATE: %s", jchange.dump().c_str());
-                    continue;
+                // Move?
+                if (old_parent != new_parent) {
+                    auto p_link = _db->getFileByCloudIdAndCloudFileId(_id, new_parent);
+                    if (p_link) {
+                        new_path = _db->getPathByGlobalId(p_link->global_id) / name;
+                    }
+                    else if (new_parent == _home_dir_id) {
+                        new_path = name;
+                    }
+                    else {
+                        // moved out => treat as delete
+                        trashed = true;
+                    }
                 }
+                rel_path = new_path;
             }
+        }
 
-            if (need_move && need_update) {
-                LOG_DEBUG("GoogleDrive", "  -> emit MOVE+UPDATE for: \"%s\" -> \"%s\"",
-                    old_path.string().c_str(),
-                    new_path.string().c_str());
-
-                auto m_dto = std::make_unique<FileMovedDTO>(
-                    type, global_id, _id, cloud_file_id,
-                    mod_time, old_path, new_path, old_parent, new_parent
-                );
-                auto move_ch = ChangeFactory::makeCloudMove(std::move(m_dto));
-
-                auto u_dto = std::make_unique<FileUpdatedDTO>(
-                    type, global_id, _id, cloud_file_id,
-                    hash, mod_time, new_path,
-                    new_parent, size
-                );
-                auto upd_ch = ChangeFactory::makeCloudUpdate(std::move(u_dto));
-                move_ch->addDependent(std::move(upd_ch));
+        if (rel_path.empty() || rel_path == std::filesystem::path(".")) {
+            continue;
+        }
 
-                changes.push_back(std::move(move_ch));
-            }
-            else if (need_new) {
-                LOG_DEBUG("GoogleDrive", "  -> emit NEW for: \"%s\"", rel_path.string().c_str());
-                auto dto = std::make_unique<FileRecordDTO>(
-                    type, parent_id_str, rel_path, cloud_file_id,
-                    size, mod_time, hash, _id
-                );
-                changes.push_back(ChangeFactory::makeCloudNew(std::move(dto)));
+        bool need_new = !link && !trashed;
+        bool need_del = link && trashed;
+        bool need_move = link && !trashed && (new_path != old_path);
+        bool need_update = link && !trashed
+            && type != EntryType::Directory
+            && mod_time > link->cloud_file_modified_time
+            && hash != get<std::string>(link->cloud_hash_check_sum);
+
+        LOG_DEBUG("GoogleDrive",
+            "Eval change: old_path=\"%s\", new_path=\"%s\", new=%d, del=%d, move=%d, upd=%d",
+            old_path.string().c_str(),
+            new_path.string().c_str(),
+            (int)need_new, (int)need_del, (int)need_move, (int)need_update);
+
+        if (need_new) {
+            if (old_expected.check(rel_path, ChangeType::New)) {
+                LOG_DEBUG("GoogleDrive", "Expected NEW: %s", jchange.dump().c_str());
+                continue;
             }
-            else if (need_del) {
-                LOG_DEBUG("GoogleDrive", "  -> emit DELETE for: \"%s\"", rel_path.string().c_str());
-                auto dto = std::make_unique<FileDeletedDTO>(
-                    rel_path, global_id, _id, cloud_file_id, mod_time
-                );
-                changes.push_back(ChangeFactory::makeDelete(std::move(dto)));
+        }
+        if (need_del) {
+            if (old_expected.check(cloud_file_id, ChangeType::Delete)) {
+                LOG_DEBUG("GoogleDrive", "Expected DELETE: %s", jchange.dump().c_str());
+                continue;
             }
-            else if (need_move) {
-                LOG_DEBUG("GoogleDrive", "  -> emit MOVE for: \"%s\" -> \"%s\"",
-                    old_path.string().c_str(),
-                    new_path.string().c_str());
-                auto dto = std::make_unique<FileMovedDTO>(
-                    type, global_id, _id, cloud_file_id,
-                    mod_time, old_path, new_path, old_parent, new_parent
-                );
-                changes.push_back(ChangeFactory::makeCloudMove(std::move(dto)));
+        }
+        if (need_move) {
+            if (old_expected.check(cloud_file_id, ChangeType::Move)) {
+                LOG_DEBUG("GoogleDrive", "Expected MOVE: %s", jchange.dump().c_str());
+                continue;
             }
-            else if (need_update) {
-                LOG_DEBUG("GoogleDrive", "  -> emit UPDATE for: \"%s\"", rel_path.string().c_str());
-                auto dto = std::make_unique<FileUpdatedDTO>(
-                    type, global_id, _id,
-                    cloud_file_id, hash, mod_time,
-                    new_path, new_parent, size
-                );
-                changes.push_back(ChangeFactory::makeCloudUpdate(std::move(dto)));
+        }
+        if (need_update) {
+            if (old_expected.check(cloud_file_id, ChangeType::Update)) {
+                LOG_DEBUG("GoogleDrive", "Expected UPDATE: %s", jchange.dump().c_str());
+                continue;
             }
         }
+
+        if (need_move && need_update) {
+            LOG_DEBUG("GoogleDrive", "  -> emit MOVE+UPDATE for: \"%s\" -> \"%s\"",
+                old_path.string().c_str(),
+                new_path.string().c_str());
+
+            auto m_dto = std::make_unique<FileMovedDTO>(
+                type, global_id, _id, cloud_file_id,
+                mod_time, old_path, new_path, old_parent, new_parent
+            );
+            auto move_ch = ChangeFactory::makeCloudMove(std::move(m_dto));
+
+            auto u_dto = std::make_unique<FileUpdatedDTO>(
+                type, global_id, _id, cloud_file_id,
+                hash, mod_time, new_path,
+                new_parent, size
+            );
+            auto upd_ch = ChangeFactory::makeCloudUpdate(std::move(u_dto));
+            move_ch->addDependent(std::move(upd_ch));
+
+            changes.push_back(std::move(move_ch));
+        }
+        else if (need_new) {
+            LOG_DEBUG("GoogleDrive", "  -> emit NEW for: \"%s\"", rel_path.string().c_str());
+            auto dto = std::make_unique<FileRecordDTO>(
+                type, parent_id_str, rel_path, cloud_file_id,
+                size, mod_time, hash, _id
+            );
+            changes.push_back(ChangeFactory::makeCloudNew(std::move(dto)));
+        }
+        else if (need_del) {
+            LOG_DEBUG("GoogleDrive", "  -> emit DELETE for: \"%s\"", rel_path.string().c_str());
+            auto dto = std::make_unique<FileDeletedDTO>(
+                rel_path, global_id, _id, cloud_file_id, mod_time
+            );
+            changes.push_back(ChangeFactory::makeDelete(std::move(dto)));
+        }
+        else if (need_move) {
+            LOG_DEBUG("GoogleDrive", "  -> emit MOVE for: \"%s\" -> \"%s\"",
+                old_path.string().c_str(),
+                new_path.string().c_str());
+            auto dto = std::make_unique<FileMovedDTO>(
+                type, global_id, _id, cloud_file_id,
+                mod_time, old_path, new_path, old_parent, new_parent
+            );
+            changes.push_back(ChangeFactory::makeCloudMove(std::move(dto)));
+        }
+        else if (need_update) {
+            LOG_DEBUG("GoogleDrive", "  -> emit UPDATE for: \"%s\"", rel_path.string().c_str());
+            auto dto = std::make_unique<FileUpdatedDTO>(
+                type, global_id, _id,
+                cloud_file_id, hash, mod_time,
+                new_path, new_parent, size
+            );
+            changes.push_back(ChangeFactory::makeCloudUpdate(std::move(dto)));
+        }
+    }
+
+    // Folders seen in earlier batches of the same feed resolve paths of later ones.
+    if (_events_buff.empty() && !_more_changes) {
+        _pending_paths.clear();
     }
 
     // TODO : check maybe_new if there is new folder with that file/folder
@@ -959,6 +1330,10 @@ bool GoogleDrive::hasChanges() const {
     return !_events_buff.empty();
 }
 
+bool GoogleDrive::hasMoreChanges() const {
+    return _more_changes;
+}
+
 void GoogleDrive::proccesUpload(std::unique_ptr<FileRecordDTO>& dto, const std::string& response) const {
     auto json_rsp = nlohmann::json::parse(response);
     dto->cloud_file_modified_time = convertCloudTime(json_rsp["modifiedTime"]);
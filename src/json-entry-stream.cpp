@@ -0,0 +1,254 @@
+#include "json-entry-stream.h"
+#include "logger.h"
+
+#include <stdexcept>
+
+namespace {
+    bool isSpace(char c) {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+    }
+
+    bool endsScalar(char c) {
+        return isSpace(c) || c == ',' || c == '}' || c == ']';
+    }
+}
+
+JsonEntryStream::JsonEntryStream(std::string array_key, std::function<void(nlohmann::json&&)> on_entry)
+    : _array_key(std::move(array_key)),
+    _on_entry(std::move(on_entry)),
+    _state(State::Start),
+    _nesting(0),
+    _in_string(false),
+    _escaped(false),
+    _scalar(false),
+    _entries(0),
+    _fields(nlohmann::json::object())
+{}
+
+bool JsonEntryStream::feed(const char* data, std::size_t size) {
+    std::size_t i = 0;
+    while (i < size) {
+        if (_state == State::Failed) {
+            return false;
+        }
+        // String contents are copied in bulk, only quotes and escapes need a look.
+        if (_in_string && !_escaped && (_state == State::Value || _state == State::Entry)) {
+            std::size_t end = i;
+            while (end < size && data[end] != '"' && data[end] != '\\') {
+                ++end;
+            }
+            _buffer.append(data + i, end - i);
+            i = end;
+            if (i == size) {
+                break;
+            }
+        }
+        if (!consume(data[i])) {
+            _state = State::Failed;
+            return false;
+        }
+        ++i;
+    }
+    return _state != State::Failed;
+}
+
+void JsonEntryStream::reset() {
+    _state = State::Start;
+    _key.clear();
+    _buffer.clear();
+    _nesting = 0;
+    _in_string = false;
+    _escaped = false;
+    _scalar = false;
+    _entries = 0;
+    _fields = nlohmann::json::object();
+    _error = nullptr;
+}
+
+bool JsonEntryStream::complete() const noexcept {
+    return _state == State::Done;
+}
+
+void JsonEntryStream::finish() const {
+    if (_error) {
+        std::rethrow_exception(_error);
+    }
+    if (_state == State::Failed) {
+        throw std::runtime_error("Malformed JSON in listing page near key: " + _key);
+    }
+    if (_state != State::Done) {
+        throw std::runtime_error("Listing page ended before the JSON document was complete");
+    }
+}
+
+std::size_t JsonEntryStream::entries() const noexcept {
+    return _entries;
+}
+
+const nlohmann::json& JsonEntryStream::fields() const noexcept {
+    return _fields;
+}
+
+bool JsonEntryStream::consume(char c) {
+    switch (_state) {
+    case State::Start:
+        if (isSpace(c)) {
+            return true;
+        }
+        if (c != '{') {
+            return false;
+        }
+        _state = State::Key;
+        return true;
+
+    case State::Key:
+        if (_in_string) {
+            if (_escaped) {
+                _escaped = false;
+            }
+            else if (c == '\\') {
+                _escaped = true;
+            }
+            else if (c == '"') {
+                _in_string = false;
+                _state = State::Colon;
+                return true;
+            }
+            _key += c;
+            return true;
+        }
+        if (isSpace(c) || c == ',') {
+            return true;
+        }
+        if (c == '}') {
+            _state = State::Done;
+            return true;
+        }
+        if (c != '"') {
+            return false;
+        }
+        _key.clear();
+        _in_string = true;
+        return true;
+
+    case State::Colon:
+        if (isSpace(c)) {
+            return true;
+        }
+        if (c != ':') {
+            return false;
+        }
+        _buffer.clear();
+        _nesting = 0;
+        _scalar = false;
+        _state = State::Value;
+        return true;
+
+    case State::Value:
+        if (_buffer.empty() && isSpace(c)) {
+            return true;
+        }
+        if (_buffer.empty() && c == '[' && _key == _array_key) {
+            _state = State::Entries;
+            return true;
+        }
+        if (_scalar && endsScalar(c)) {
+            return finishValue() && consume(c);
+        }
+        return capture(c) ? finishValue() : true;
+
+    case State::Entries:
+        if (isSpace(c) || c == ',') {
+            return true;
+        }
+        if (c == ']') {
+            _state = State::Key;
+            return true;
+        }
+        _buffer.clear();
+        _nesting = 0;
+        _scalar = false;
+        _state = State::Entry;
+        return capture(c) ? finishEntry() : true;
+
+    case State::Entry:
+        if (_scalar && endsScalar(c)) {
+            return finishEntry() && consume(c);
+        }
+        return capture(c) ? finishEntry() : true;
+
+    case State::Done:
+        return isSpace(c);
+
+    case State::Failed:
+        return false;
+    }
+    return false;
+}
+
+// Appends one character of a value, returns true once a string or container value is closed.
+bool JsonEntryStream::capture(char c) {
+    _buffer += c;
+    if (_in_string) {
+        if (_escaped) {
+            _escaped = false;
+        }
+        else if (c == '\\') {
+            _escaped = true;
+        }
+        else if (c == '"') {
+            _in_string = false;
+            return _nesting == 0;
+        }
+        return false;
+    }
+    switch (c) {
+    case '"':
+        _in_string = true;
+        return false;
+    case '{':
+    case '[':
+        ++_nesting;
+        return false;
+    case '}':
+    case ']':
+        --_nesting;
+        return _nesting == 0;
+    default:
+        if (_buffer.size() == 1) {
+            _scalar = true;
+        }
+        return false;
+    }
+}
+
+bool JsonEntryStream::finishValue() {
+    auto value = nlohmann::json::parse(_buffer, nullptr, false);
+    if (value.is_discarded()) {
+        LOG_ERROR("JsonEntryStream", "Unparsable value for key %s: %s", _key, _buffer);
+        return false;
+    }
+    _fields[_key] = std::move(value);
+    _buffer.clear();
+    _state = State::Key;
+    return true;
+}
+
+bool JsonEntryStream::finishEntry() {
+    auto entry = nlohmann::json::parse(_buffer, nullptr, false);
+    _buffer.clear();
+    if (entry.is_discarded()) {
+        LOG_ERROR("JsonEntryStream", "Unparsable entry #%zu under key %s", _entries, _array_key);
+        return false;
+    }
+    ++_entries;
+    _state = State::Entries;
+    try {
+        _on_entry(std::move(entry));
+    }
+    catch (...) {
+        _error = std::current_exception();
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,450 @@
+#include "metadata-index.h"
+#include "logger.h"
+
+#include <algorithm>
+#include <climits>
+#include <iterator>
+#include <mutex>
+#include <stdexcept>
+
+namespace {
+    const char* columnText(sqlite3_stmt* stmt, const int col) {
+        const auto* text = reinterpret_cast<const char*>(sqlite3_column_text(stmt, col));
+        return text ? text : "";
+    }
+
+    std::size_t countRows(sqlite3* db, const char* sql) {
+        sqlite3_stmt* stmt = nullptr;
+        if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+            throw std::runtime_error(std::string("Failed to prepare statement (index count): ") + sqlite3_errmsg(db));
+        }
+        std::size_t count = 0;
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            count = static_cast<std::size_t>(sqlite3_column_int64(stmt, 0));
+        }
+        sqlite3_finalize(stmt);
+        return count;
+    }
+}
+
+std::size_t MetadataIndex::CloudFileKeyHash::operator()(const CloudFileKey& key) const noexcept {
+    return std::hash<std::string_view>{}(key.cloud_file_id) ^ (static_cast<std::size_t>(key.cloud_id) * 0x9e3779b97f4a7c15ULL);
+}
+
+void MetadataIndex::Link::assign(std::string_view cloud_file_id, std::string_view cloud_parent_id, std::string_view cloud_hash) {
+    std::string joined;
+    joined.reserve(cloud_file_id.size() + cloud_parent_id.size() + cloud_hash.size());
+    joined.append(cloud_file_id).append(cloud_parent_id).append(cloud_hash);
+    parent_offset = static_cast<uint32_t>(cloud_file_id.size());
+    hash_offset = static_cast<uint32_t>(cloud_file_id.size() + cloud_parent_id.size());
+    text = std::move(joined);
+}
+
+std::string_view MetadataIndex::Link::cloudFileId() const noexcept {
+    return std::string_view(text).substr(0, parent_offset);
+}
+
+std::string_view MetadataIndex::Link::cloudParentId() const noexcept {
+    return std::string_view(text).substr(parent_offset, hash_offset - parent_offset);
+}
+
+std::string_view MetadataIndex::Link::cloudHash() const noexcept {
+    return std::string_view(text).substr(hash_offset);
+}
+
+uint64_t MetadataIndex::linkKey(const int global_id, const int cloud_id) noexcept {
+    return (static_cast<uint64_t>(static_cast<uint32_t>(global_id)) << 32) | static_cast<uint32_t>(cloud_id);
+}
+
+template <typename Map, typename Key>
+std::optional<int> MetadataIndex::lowest(const Map& map, const Key& key) {
+    auto [begin, end] = map.equal_range(key);
+    if (begin == end) {
+        return std::nullopt;
+    }
+    int global_id = begin->second;
+    for (auto it = std::next(begin); it != end; ++it) {
+        global_id = std::min(global_id, it->second);
+    }
+    return global_id;
+}
+
+template <typename Map, typename Key>
+void MetadataIndex::eraseEntry(Map& map, const Key& key, const int global_id) {
+    auto [begin, end] = map.equal_range(key);
+    for (auto it = begin; it != end; ++it) {
+        if (it->second == global_id) {
+            map.erase(it);
+            return;
+        }
+    }
+}
+
+void MetadataIndex::load(sqlite3* db) {
+    std::unique_lock lock(_mtx);
+    clear();
+
+    std::size_t file_rows = countRows(db, "SELECT COUNT(*) FROM files;");
+    std::size_t link_rows = countRows(db, "SELECT COUNT(*) FROM file_links;");
+    _files.reserve(file_rows);
+    _by_file_id.reserve(file_rows);
+    _links.reserve(link_rows);
+    _by_cloud_file_id.reserve(link_rows);
+
+    sqlite3_stmt* stmt = nullptr;
+    const char* files_sql = "SELECT global_id, type, parent_global_id, name, size, local_hash, local_modified_time, file_id FROM files;";
+    if (sqlite3_prepare_v2(db, files_sql, -1, &stmt, nullptr) != SQLITE_OK) {
+        throw std::runtime_error(std::string("Failed to prepare statement (index files): ") + sqlite3_errmsg(db));
+    }
+    int rc = 0;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        int global_id = sqlite3_column_int64(stmt, 0);
+        auto& file = _files[global_id];
+        file.type = entry_type_from_string(columnText(stmt, 1));
+        file.parent_global_id = sqlite3_column_int64(stmt, 2);
+        file.name = columnText(stmt, 3);
+        file.size = static_cast<uint64_t>(sqlite3_column_int64(stmt, 4));
+        file.local_hash = static_cast<uint64_t>(sqlite3_column_int64(stmt, 5));
+        file.local_modified_time = sqlite3_column_int64(stmt, 6);
+        file.file_id = static_cast<uint64_t>(sqlite3_column_int64(stmt, 7));
+        _children.insert(Child{ file.parent_global_id, file.name, global_id });
+        _by_file_id.emplace(file.file_id, global_id);
+    }
+    sqlite3_finalize(stmt);
+    if (rc != SQLITE_DONE) {
+        clear();
+        throw std::runtime_error(std::string("Error loading files into index: ") + sqlite3_errmsg(db));
+    }
+
+    const char* links_sql = "SELECT global_id, cloud_id, cloud_file_id, cloud_parent_id, cloud_file_modified_time, cloud_hash_check_sum, cloud_size FROM file_links;";
+    if (sqlite3_prepare_v2(db, links_sql, -1, &stmt, nullptr) != SQLITE_OK) {
+        clear();
+        throw std::runtime_error(std::string("Failed to prepare statement (index file_links): ") + sqlite3_errmsg(db));
+    }
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        int global_id = sqlite3_column_int64(stmt, 0);
+        int cloud_id = sqlite3_column_int64(stmt, 1);
+        auto& link = _links[linkKey(global_id, cloud_id)];
+        link.cloud_modified_time = sqlite3_column_int64(stmt, 4);
+        link.cloud_size = static_cast<uint64_t>(sqlite3_column_int64(stmt, 6));
+        assignLink(global_id, cloud_id, link, columnText(stmt, 2), columnText(stmt, 3), columnText(stmt, 5));
+        if (std::find(_cloud_ids.begin(), _cloud_ids.end(), cloud_id) == _cloud_ids.end()) {
+            _cloud_ids.push_back(cloud_id);
+        }
+    }
+    sqlite3_finalize(stmt);
+    if (rc != SQLITE_DONE) {
+        clear();
+        throw std::runtime_error(std::string("Error loading file_links into index: ") + sqlite3_errmsg(db));
+    }
+
+    _loaded = true;
+    LOG_INFO("MetadataIndex", "Loaded %zu files and %zu links", _files.size(), _links.size());
+}
+
+bool MetadataIndex::loaded() const noexcept {
+    std::shared_lock lock(_mtx);
+    return _loaded;
+}
+
+std::size_t MetadataIndex::files() const {
+    std::shared_lock lock(_mtx);
+    return _files.size();
+}
+
+std::size_t MetadataIndex::links() const {
+    std::shared_lock lock(_mtx);
+    return _links.size();
+}
+
+std::optional<int> MetadataIndex::childId(const int parent_global_id, const std::string& name) const {
+    std::shared_lock lock(_mtx);
+    auto it = _children.lower_bound(Child{ parent_global_id, name, INT_MIN });
+    if (it == _children.end() || it->parent_global_id != parent_global_id || it->name != name) {
+        return std::nullopt;
+    }
+    return it->global_id;
+}
+
+std::optional<int> MetadataIndex::globalIdByFileId(const uint64_t file_id) const {
+    std::shared_lock lock(_mtx);
+    return lowest(_by_file_id, file_id);
+}
+
+std::optional<std::string> MetadataIndex::pathByGlobalId(const int global_id) const {
+    std::shared_lock lock(_mtx);
+    if (!_files.contains(global_id)) {
+        return std::nullopt;
+    }
+    return pathOf(global_id);
+}
+
+std::optional<std::string> MetadataIndex::cloudFileId(const int cloud_id, const int global_id) const {
+    std::shared_lock lock(_mtx);
+    auto it = _links.find(linkKey(global_id, cloud_id));
+    if (it == _links.end()) {
+        return std::nullopt;
+    }
+    return std::string(it->second.cloudFileId());
+}
+
+std::size_t MetadataIndex::linkCount(const int global_id) const {
+    std::shared_lock lock(_mtx);
+    std::size_t count = 0;
+    for (int cloud_id : _cloud_ids) {
+        count += _links.count(linkKey(global_id, cloud_id));
+    }
+    return count;
+}
+
+std::unique_ptr<FileRecordDTO> MetadataIndex::fileByGlobalId(const int global_id) const {
+    std::shared_lock lock(_mtx);
+    return fileRecord(global_id);
+}
+
+std::unique_ptr<FileRecordDTO> MetadataIndex::fileByFileId(const uint64_t file_id) const {
+    std::shared_lock lock(_mtx);
+    auto global_id = lowest(_by_file_id, file_id);
+    return global_id ? fileRecord(*global_id) : nullptr;
+}
+
+std::unique_ptr<FileRecordDTO> MetadataIndex::linkByGlobalId(const int cloud_id, const int global_id) const {
+    std::shared_lock lock(_mtx);
+    return linkRecord(global_id, cloud_id);
+}
+
+std::unique_ptr<FileRecordDTO> MetadataIndex::linkByCloudFileId(const int cloud_id, const std::string& cloud_file_id) const {
+    std::shared_lock lock(_mtx);
+    auto global_id = lowest(_by_cloud_file_id, CloudFileKey{ cloud_id, cloud_file_id });
+    return global_id ? linkRecord(*global_id, cloud_id) : nullptr;
+}
+
+void MetadataIndex::addFile(const int global_id, const EntryType type, const int parent_global_id, const std::string& name,
+    const uint64_t size, const uint64_t local_hash, const std::time_t local_modified_time, const uint64_t file_id) {
+    std::unique_lock lock(_mtx);
+    if (!_loaded) {
+        return;
+    }
+    auto [it, inserted] = _files.try_emplace(global_id);
+    if (!inserted) {
+        return;
+    }
+    auto& file = it->second;
+    file.type = type;
+    file.size = size;
+    file.local_hash = local_hash;
+    file.local_modified_time = local_modified_time;
+    file.file_id = file_id;
+    file.parent_global_id = parent_global_id;
+    file.name = name;
+    _children.insert(Child{ file.parent_global_id, file.name, global_id });
+    _by_file_id.emplace(file.file_id, global_id);
+}
+
+void MetadataIndex::updateFile(const int global_id, const uint64_t size, const uint64_t local_hash,
+    const std::time_t local_modified_time, const uint64_t file_id) {
+    std::unique_lock lock(_mtx);
+    auto it = _files.find(global_id);
+    if (it == _files.end()) {
+        return;
+    }
+    auto& file = it->second;
+    if (file.file_id != file_id) {
+        eraseEntry(_by_file_id, file.file_id, global_id);
+        _by_file_id.emplace(file_id, global_id);
+        file.file_id = file_id;
+    }
+    file.size = size;
+    file.local_hash = local_hash;
+    file.local_modified_time = local_modified_time;
+}
+
+void MetadataIndex::moveFile(const int global_id, const int parent_global_id, const std::string& name, const std::time_t local_modified_time) {
+    std::unique_lock lock(_mtx);
+    auto it = _files.find(global_id);
+    if (it == _files.end()) {
+        return;
+    }
+    it->second.local_modified_time = local_modified_time;
+    setFileName(global_id, it->second, parent_global_id, name);
+}
+
+void MetadataIndex::adoptChildren(const int global_id) {
+    std::unique_lock lock(_mtx);
+    auto it = _files.find(global_id);
+    if (it == _files.end()) {
+        return;
+    }
+    const int parent_global_id = it->second.parent_global_id;
+    const std::string prefix = it->second.name + '/';
+    const std::string end = it->second.name + static_cast<char>('/' + 1);
+
+    std::vector<int> adopted;
+    auto first = _children.lower_bound(Child{ parent_global_id, prefix, INT_MIN });
+    auto last = _children.lower_bound(Child{ parent_global_id, end, INT_MIN });
+    for (auto child = first; child != last; ++child) {
+        adopted.push_back(child->global_id);
+    }
+    for (int child_id : adopted) {
+        auto& child = _files.at(child_id);
+        setFileName(child_id, child, global_id, child.name.substr(prefix.size()));
+    }
+}
+
+void MetadataIndex::addLink(const int global_id, const int cloud_id, const std::string& cloud_file_id, const std::string& cloud_parent_id,
+    const std::time_t cloud_modified_time, const std::string& cloud_hash, const uint64_t cloud_size) {
+    std::unique_lock lock(_mtx);
+    if (!_loaded || !_files.contains(global_id)) {
+        return;
+    }
+    auto [it, inserted] = _links.try_emplace(linkKey(global_id, cloud_id));
+    if (!inserted) {
+        return;
+    }
+    auto& link = it->second;
+    link.cloud_modified_time = cloud_modified_time;
+    link.cloud_size = cloud_size;
+    assignLink(global_id, cloud_id, link, cloud_file_id, cloud_parent_id, cloud_hash);
+    if (std::find(_cloud_ids.begin(), _cloud_ids.end(), cloud_id) == _cloud_ids.end()) {
+        _cloud_ids.push_back(cloud_id);
+    }
+}
+
+void MetadataIndex::updateLink(const int global_id, const int cloud_id, const std::string& cloud_hash,
+    const std::time_t cloud_modified_time, const uint64_t cloud_size) {
+    std::unique_lock lock(_mtx);
+    auto it = _links.find(linkKey(global_id, cloud_id));
+    if (it == _links.end()) {
+        return;
+    }
+    auto& link = it->second;
+    link.cloud_modified_time = cloud_modified_time;
+    link.cloud_size = cloud_size;
+    assignLink(global_id, cloud_id, link, link.cloudFileId(), link.cloudParentId(), cloud_hash);
+}
+
+void MetadataIndex::moveLink(const int global_id, const int cloud_id, const std::string& cloud_file_id,
+    const std::string& cloud_parent_id, const std::time_t cloud_modified_time) {
+    std::unique_lock lock(_mtx);
+    auto it = _links.find(linkKey(global_id, cloud_id));
+    if (it == _links.end()) {
+        return;
+    }
+    auto& link = it->second;
+    link.cloud_modified_time = cloud_modified_time;
+    assignLink(global_id, cloud_id, link, cloud_file_id, cloud_parent_id, link.cloudHash());
+}
+
+void MetadataIndex::eraseFile(const int global_id) {
+    std::unique_lock lock(_mtx);
+    auto it = _files.find(global_id);
+    if (it == _files.end()) {
+        return;
+    }
+    const int parent_global_id = it->second.parent_global_id;
+    const std::string name = it->second.name;
+    _children.erase(Child{ parent_global_id, it->second.name, global_id });
+    eraseEntry(_by_file_id, it->second.file_id, global_id);
+    _files.erase(it);
+
+    std::vector<int> orphans;
+    auto first = _children.lower_bound(Child{ global_id, std::string_view{}, INT_MIN });
+    for (auto child = first; child != _children.end() && child->parent_global_id == global_id; ++child) {
+        orphans.push_back(child->global_id);
+    }
+    for (int child_id : orphans) {
+        auto& child = _files.at(child_id);
+        setFileName(child_id, child, parent_global_id, name + '/' + child.name);
+    }
+    // file_links rows go with the file through ON DELETE CASCADE.
+    for (int cloud_id : _cloud_ids) {
+        eraseLink(global_id, cloud_id);
+    }
+}
+
+// Joins the names up to the root; a missing parent ends the walk like the root does.
+std::string MetadataIndex::pathOf(const int global_id) const {
+    std::vector<const std::string*> names;
+    auto it = _files.find(global_id);
+    while (it != _files.end() && names.size() <= _files.size()) {
+        names.push_back(&it->second.name);
+        it = _files.find(it->second.parent_global_id);
+    }
+    std::string path;
+    for (auto name = names.rbegin(); name != names.rend(); ++name) {
+        if (!path.empty()) {
+            path += '/';
+        }
+        path += **name;
+    }
+    return path;
+}
+
+// The child key views file.name, so it is dropped before the name changes and added back after.
+void MetadataIndex::setFileName(const int global_id, File& file, const int parent_global_id, std::string name) {
+    _children.erase(Child{ file.parent_global_id, file.name, global_id });
+    file.parent_global_id = parent_global_id;
+    file.name = std::move(name);
+    _children.insert(Child{ file.parent_global_id, file.name, global_id });
+}
+
+std::unique_ptr<FileRecordDTO> MetadataIndex::fileRecord(const int global_id) const {
+    auto it = _files.find(global_id);
+    if (it == _files.end()) {
+        return nullptr;
+    }
+    const auto& file = it->second;
+    return std::make_unique<FileRecordDTO>(
+        global_id,
+        file.type,
+        pathOf(global_id),
+        file.size,
+        file.local_hash,
+        file.local_modified_time,
+        file.file_id
+    );
+}
+
+std::unique_ptr<FileRecordDTO> MetadataIndex::linkRecord(const int global_id, const int cloud_id) const {
+    auto it = _links.find(linkKey(global_id, cloud_id));
+    if (it == _links.end()) {
+        return nullptr;
+    }
+    const auto& link = it->second;
+    return std::make_unique<FileRecordDTO>(
+        global_id,
+        cloud_id,
+        std::string(link.cloudParentId()),
+        std::string(link.cloudFileId()),
+        link.cloud_size,
+        std::string(link.cloudHash()),
+        link.cloud_modified_time
+    );
+}
+
+// The key view points into link.text, so it is dropped before the text is rebuilt and added back after.
+void MetadataIndex::assignLink(const int global_id, const int cloud_id, Link& link, std::string_view cloud_file_id,
+    std::string_view cloud_parent_id, std::string_view cloud_hash) {
+    eraseEntry(_by_cloud_file_id, CloudFileKey{ cloud_id, link.cloudFileId() }, global_id);
+    link.assign(cloud_file_id, cloud_parent_id, cloud_hash);
+    _by_cloud_file_id.emplace(CloudFileKey{ cloud_id, link.cloudFileId() }, global_id);
+}
+
+void MetadataIndex::eraseLink(const int global_id, const int cloud_id) {
+    auto it = _links.find(linkKey(global_id, cloud_id));
+    if (it == _links.end()) {
+        return;
+    }
+    eraseEntry(_by_cloud_file_id, CloudFileKey{ cloud_id, it->second.cloudFileId() }, global_id);
+    _links.erase(it);
+}
+
+void MetadataIndex::clear() {
+    _children.clear();
+    _by_file_id.clear();
+    _by_cloud_file_id.clear();
+    _files.clear();
+    _links.clear();
+    _cloud_ids.clear();
+    _loaded = false;
+}
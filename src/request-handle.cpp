@@ -1,12 +1,33 @@
 #include "request-handle.h"
+#include "Networking.h"
+
+#include <nlohmann/json.hpp>
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <limits>
+#include <cctype>
+#include <string_view>
+#include <thread>
 
 curl_slist* RequestHandle::_global_resolve = nullptr;
 
 RequestHandle::RequestHandle()
-    : _curl(curl_easy_init()),
+    : _curl(HttpClient::get().acquireEasyHandle()),
     _mime(nullptr),
     _headers(nullptr),
-    _retry_count(0)
+    _range_offset(0),
+    _range_length(0),
+    _range_written(0),
+    _resume_offset(0),
+    _retry_count(0),
+    _traffic_class(TrafficClass::Metadata),
+    _in_multi(false),
+    _paused(false),
+    _uploaded(0),
+    _downloaded(0),
+    _auth_generation(0),
+    _auth_retries(0)
 {
 #ifdef TESTING
     curl_easy_setopt(_curl, CURLOPT_SSL_VERIFYPEER, 0L);
@@ -18,6 +39,10 @@ RequestHandle::RequestHandle()
 
 RequestHandle& RequestHandle::operator=(RequestHandle&& other) noexcept {
     if (this != &other) {
+        HttpClient::get().releaseEasyHandle(_curl);
+        curl_mime_free(_mime);
+        curl_slist_free_all(_headers);
+
         _curl = other._curl;
         _mime = other._mime;
         _headers = other._headers;
@@ -29,6 +54,23 @@ RequestHandle& RequestHandle::operator=(RequestHandle&& other) noexcept {
         _timer = other._timer;
         _retry_count = other._retry_count;
         _iofd = std::move(other._iofd);
+        _upload = std::move(other._upload);
+        _download = std::move(other._download);
+        _range_offset = other._range_offset;
+        _range_length = other._range_length;
+        _range_written = other._range_written;
+        _download_path = std::move(other._download_path);
+        _resume_offset = other._resume_offset;
+        _hashers = std::move(other._hashers);
+        _sink = std::move(other._sink);
+        _accepted_codes = std::move(other._accepted_codes);
+        _traffic_class = other._traffic_class;
+        _in_multi = other._in_multi;
+        _paused = other._paused;
+        _uploaded = other._uploaded;
+        _downloaded = other._downloaded;
+        _auth_generation = other._auth_generation;
+        _auth_retries = other._auth_retries;
     }
     return *this;
 }
@@ -39,7 +81,24 @@ RequestHandle::RequestHandle(RequestHandle&& other) noexcept
     _headers(other._headers),
     _timer(other._timer),
     _iofd(std::move(other._iofd)),
-    _retry_count(other._retry_count)
+    _upload(std::move(other._upload)),
+    _download(std::move(other._download)),
+    _range_offset(other._range_offset),
+    _range_length(other._range_length),
+    _range_written(other._range_written),
+    _download_path(std::move(other._download_path)),
+    _resume_offset(other._resume_offset),
+    _hashers(std::move(other._hashers)),
+    _sink(std::move(other._sink)),
+    _accepted_codes(std::move(other._accepted_codes)),
+    _retry_count(other._retry_count),
+    _traffic_class(other._traffic_class),
+    _in_multi(other._in_multi),
+    _paused(other._paused),
+    _uploaded(other._uploaded),
+    _downloaded(other._downloaded),
+    _auth_generation(other._auth_generation),
+    _auth_retries(other._auth_retries)
 {
     other._curl = nullptr;
     other._mime = nullptr;
@@ -47,38 +106,173 @@ RequestHandle::RequestHandle(RequestHandle&& other) noexcept
 }
 
 RequestHandle::~RequestHandle() {
+    HttpClient::get().releaseEasyHandle(_curl);
     curl_mime_free(_mime);
     curl_slist_free_all(_headers);
-    curl_easy_cleanup(_curl);
 }
 
-void RequestHandle::scheduleRetry() {
+bool RequestHandle::scheduleRetry() {
     const int BASE_DELAY = 1000;
 
     _retry_count++;
-    int delay = BASE_DELAY * (1 << (_retry_count + 1));
 
-    if (_iofd.is_open()) {
+    if (_retry_count > MAX_RETRIES) {
+        return false;
+    }
+
+    std::chrono::milliseconds delay;
+    if (auto server_delay = retryAfter()) {
+        delay = *server_delay;
+    }
+    else {
+        int backoff = BASE_DELAY * (1 << (_retry_count + 1));
+        int jitter = _retry_count * BASE_DELAY;
+        thread_local std::random_device rd;
+        thread_local std::mt19937 gen(rd());
+        std::uniform_int_distribution<int> dist(-jitter, jitter);
+        delay = std::chrono::milliseconds(backoff + dist(gen));
+    }
+
+    rewind();
+    _timer = std::chrono::steady_clock::now() + delay;
+    return true;
+}
+
+// Downloads continue after the bytes they already wrote, their hashers have seen exactly those bytes.
+void RequestHandle::rewind() {
+    if (_download) {
+        if (_range_written >= _range_length) {
+            _range_written = 0;
+        }
+        replaceHeader("Range", "Range: bytes=" + std::to_string(_range_offset + _range_written) + "-" + std::to_string(_range_offset + _range_length - 1));
+    }
+    else if (!_download_path.empty()) {
         _iofd.clear();
-        _iofd.seekg(0, std::ios::beg);
+        _iofd.flush();
+        auto written = _iofd.tellp();
+        if (written > 0) {
+            resumeDownloadAt(static_cast<std::uint64_t>(written));
+        }
+    }
+    else {
+        if (_iofd.is_open()) {
+            _iofd.clear();
+            _iofd.seekg(0, std::ios::beg);
+        }
+        if (_upload) {
+            _upload->rewind();
+        }
+        _hashers.reset();
     }
 
     _response.clear();
-    if (_retry_count > 6) {
-        throw std::runtime_error("Too many retry attempts on a request");
+    _response_headers.clear();
+    _uploaded = 0;
+    _downloaded = 0;
+}
+
+void RequestHandle::setDownloadRange(std::shared_ptr<DownloadTarget> target, std::uint64_t offset, std::uint64_t length) {
+    _download = std::move(target);
+    _range_offset = offset;
+    _range_length = length;
+    _range_written = 0;
+    _accepted_codes.push_back(206);
+    addHeaders("Range: bytes=" + std::to_string(offset) + "-" + std::to_string(offset + length - 1));
+}
+
+void RequestHandle::resumeDownloadAt(std::uint64_t offset) {
+    _resume_offset = offset;
+    if (offset == 0) {
+        return;
+    }
+    std::string header = "Range: bytes=" + std::to_string(offset) + "-";
+    if (!replaceHeader("Range", header)) {
+        addHeaders(header);
+        curl_easy_setopt(_curl, CURLOPT_HTTPHEADER, _headers);
+    }
+    if (!accepts(206)) {
+        _accepted_codes.push_back(206);
+    }
+    // Range offsets refer to the stored bytes, not to a compressed representation.
+    curl_easy_setopt(_curl, CURLOPT_ACCEPT_ENCODING, nullptr);
+}
+
+bool RequestHandle::resumable() const noexcept {
+    return _download || !_download_path.empty();
+}
+
+bool RequestHandle::accepts(long http_code) const {
+    return http_code == 200 || std::find(_accepted_codes.begin(), _accepted_codes.end(), http_code) != _accepted_codes.end();
+}
+
+// Server hints are capped at MAX_RETRY_AFTER, a bogus one must not park the request for years or overflow the timer.
+std::optional<std::chrono::milliseconds> RequestHandle::retryAfter() const {
+    constexpr auto max_wait = std::chrono::duration_cast<std::chrono::milliseconds>(MAX_RETRY_AFTER);
+    std::string header = responseHeader("retry-after");
+    if (!header.empty()) {
+        if (std::all_of(header.begin(), header.end(), [](unsigned char c) { return std::isdigit(c); })) {
+            // Too long to parse counts as no hint.
+            std::uint64_t seconds = 0;
+            if (std::from_chars(header.data(), header.data() + header.size(), seconds).ec == std::errc{}) {
+                return std::chrono::seconds(std::min<std::uint64_t>(seconds, MAX_RETRY_AFTER / std::chrono::seconds(1)));
+            }
+        }
+        else {
+            time_t at = curl_getdate(header.c_str(), nullptr);
+            if (at != -1) {
+                // Whole seconds: a far-off date overflows the clock's nanoseconds.
+                auto wait = std::chrono::seconds(at) - std::chrono::seconds(std::time(nullptr));
+                return std::clamp<std::chrono::milliseconds>(wait, std::chrono::milliseconds(0), max_wait);
+            }
+        }
     }
 
-    int jitter = _retry_count * BASE_DELAY;
-    static std::random_device rd;
-    static std::mt19937 gen(rd());
-    std::uniform_int_distribution<int> dist(-jitter, jitter);
-    delay += dist(gen);
+    auto body = nlohmann::json::parse(_response, nullptr, false);
+    if (body.is_object() && body.contains("error") && body["error"].is_object()) {
+        const auto& error = body["error"];
+        if (error.contains("retry_after") && error["retry_after"].is_number()) {
+            double seconds = error["retry_after"].get<double>();
+            if (std::isfinite(seconds)) {
+                seconds = std::clamp(seconds, 0.0, static_cast<double>(MAX_RETRY_AFTER / std::chrono::seconds(1)));
+                return std::chrono::milliseconds(static_cast<long long>(seconds * 1000));
+            }
+        }
+    }
+    return std::nullopt;
+}
 
-    _timer = std::chrono::steady_clock::now() + std::chrono::milliseconds(delay);
+std::string RequestHandle::responseHeader(const std::string& name) const {
+    auto it = _response_headers.find(name);
+    return it != _response_headers.end() ? it->second : std::string{};
 }
 
 void RequestHandle::setFileStream(const std::filesystem::path& file_path, std::ios::openmode mode) {
-    _iofd = std::fstream(file_path, mode | std::ios::binary);
+    if (_download && mode == std::ios::out) {
+        // A ranged request writes its slice of the shared, preallocated file instead of a stream of its own.
+        _download->open(file_path);
+        curl_easy_setopt(_curl, CURLOPT_WRITEDATA, this);
+        curl_easy_setopt(_curl, CURLOPT_WRITEFUNCTION, RequestHandle::writeRangeData);
+        curl_easy_setopt(_curl, CURLOPT_ACCEPT_ENCODING, nullptr);
+        return;
+    }
+    if (mode == std::ios::out) {
+        _download_path = file_path;
+    }
+    if (mode == std::ios::out && _resume_offset > 0) {
+        // Keeps the bytes downloaded by an earlier attempt and appends after them.
+        std::error_code ec;
+        auto existing = std::filesystem::file_size(file_path, ec);
+        if (ec || existing < _resume_offset) {
+            throw std::runtime_error("Partial download is shorter than expected: " + file_path.string());
+        }
+        std::filesystem::resize_file(file_path, _resume_offset);
+        _iofd = std::fstream(file_path, std::ios::in | std::ios::out | std::ios::binary);
+        _iofd.seekp(static_cast<std::streamoff>(_resume_offset));
+        curl_easy_setopt(_curl, CURLOPT_ACCEPT_ENCODING, nullptr);
+    }
+    else {
+        _iofd = std::fstream(file_path, mode | std::ios::binary);
+    }
     if (_iofd && _iofd.is_open()) {
         switch (mode) {
         case std::ios::in:
@@ -86,8 +280,8 @@ void RequestHandle::setFileStream(const std::filesystem::path& file_path, std::i
             curl_easy_setopt(_curl, CURLOPT_READFUNCTION, RequestHandle::readData);
             break;
         case std::ios::out:
-            curl_easy_setopt(_curl, CURLOPT_WRITEDATA, &_iofd);
-            curl_easy_setopt(_curl, CURLOPT_WRITEFUNCTION, RequestHandle::writeData);
+            curl_easy_setopt(_curl, CURLOPT_WRITEDATA, this);
+            curl_easy_setopt(_curl, CURLOPT_WRITEFUNCTION, RequestHandle::writeHashedData);
             break;
         }
     }
@@ -96,6 +290,47 @@ void RequestHandle::setFileStream(const std::filesystem::path& file_path, std::i
     }
 }
 
+void RequestHandle::setResponseSink(std::function<bool(const char*, std::size_t)> sink) {
+    _sink = std::move(sink);
+    curl_easy_setopt(_curl, CURLOPT_WRITEDATA, this);
+    curl_easy_setopt(_curl, CURLOPT_WRITEFUNCTION, RequestHandle::writeSinkData);
+}
+
+void RequestHandle::setUploadSource(const std::filesystem::path& file_path) {
+    setUploadSource(file_path, 0, std::numeric_limits<std::uint64_t>::max());
+}
+
+void RequestHandle::setUploadSource(const std::filesystem::path& file_path, std::uint64_t offset, std::uint64_t length) {
+    _upload = std::make_unique<UploadSource>(file_path);
+    _upload->setWindow(offset, length);
+    curl_off_t size = static_cast<curl_off_t>(_upload->length());
+
+    curl_easy_setopt(_curl, CURLOPT_READDATA, _upload.get());
+    curl_easy_setopt(_curl, CURLOPT_READFUNCTION, UploadSource::readCallback);
+    curl_easy_setopt(_curl, CURLOPT_SEEKDATA, _upload.get());
+    curl_easy_setopt(_curl, CURLOPT_SEEKFUNCTION, UploadSource::seekCallback);
+    curl_easy_setopt(_curl, CURLOPT_INFILESIZE_LARGE, size);
+    curl_easy_setopt(_curl, CURLOPT_POSTFIELDSIZE_LARGE, size);
+    curl_easy_setopt(_curl, CURLOPT_UPLOAD_BUFFERSIZE, UPLOAD_BUFFER_SIZE);
+}
+
+void RequestHandle::addHasher(HashKind kind) {
+    _hashers.add(kind);
+}
+
+void RequestHandle::addMimeUploadPart(curl_mimepart* part, const std::filesystem::path& file_path) {
+    _upload = std::make_unique<UploadSource>(file_path);
+    curl_mime_data_cb(
+        part,
+        static_cast<curl_off_t>(_upload->size()),
+        UploadSource::readCallback,
+        UploadSource::seekCallback,
+        nullptr,
+        _upload.get()
+    );
+    curl_easy_setopt(_curl, CURLOPT_UPLOAD_BUFFERSIZE, UPLOAD_BUFFER_SIZE);
+}
+
 void RequestHandle::addHeaders(const std::string& header) {
     _headers = curl_slist_append(_headers, header.c_str());
 }
@@ -105,6 +340,37 @@ void RequestHandle::clearHeaders() {
     _headers = nullptr;
 }
 
+bool RequestHandle::replaceHeader(const std::string& name, const std::string& header) {
+    auto matches = [&name](std::string_view data) {
+        return data.size() > name.size() && data[name.size()] == ':'
+            && std::equal(name.begin(), name.end(), data.begin(), [](unsigned char a, unsigned char b) {
+                return std::tolower(a) == std::tolower(b);
+            });
+    };
+
+    bool found = false;
+    curl_slist* replaced = nullptr;
+    for (curl_slist* node = _headers; node; node = node->next) {
+        if (matches(node->data)) {
+            found = true;
+            replaced = curl_slist_append(replaced, header.c_str());
+        }
+        else {
+            replaced = curl_slist_append(replaced, node->data);
+        }
+    }
+
+    if (!found) {
+        curl_slist_free_all(replaced);
+        return false;
+    }
+
+    curl_slist_free_all(_headers);
+    _headers = replaced;
+    curl_easy_setopt(_curl, CURLOPT_HTTPHEADER, _headers);
+    return true;
+}
+
 void RequestHandle::setCommonCURLOpt() {
 #ifdef TESTING
     curl_easy_setopt(_curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_1_1);
@@ -117,10 +383,13 @@ void RequestHandle::setCommonCURLOpt() {
     curl_easy_setopt(_curl, CURLOPT_TCP_NODELAY, 1L);
     curl_easy_setopt(_curl, CURLOPT_FOLLOWLOCATION, 1L);
     curl_easy_setopt(_curl, CURLOPT_BUFFERSIZE, 131072L);
-    curl_easy_setopt(_curl, CURLOPT_MAX_SEND_SPEED_LARGE, 0);
-    curl_easy_setopt(_curl, CURLOPT_MAX_RECV_SPEED_LARGE, 0);
+    curl_easy_setopt(_curl, CURLOPT_NOPROGRESS, 0L);
+    curl_easy_setopt(_curl, CURLOPT_XFERINFODATA, this);
+    curl_easy_setopt(_curl, CURLOPT_XFERINFOFUNCTION, RequestHandle::xferInfoCallback);
     curl_easy_setopt(_curl, CURLOPT_WRITEDATA, &_response);
     curl_easy_setopt(_curl, CURLOPT_WRITEFUNCTION, RequestHandle::writeCallback);
+    curl_easy_setopt(_curl, CURLOPT_HEADERDATA, this);
+    curl_easy_setopt(_curl, CURLOPT_HEADERFUNCTION, RequestHandle::headerCallback);
     if (_headers) {
         curl_easy_setopt(_curl, CURLOPT_HTTPHEADER, _headers);
     }
@@ -132,6 +401,75 @@ size_t RequestHandle::writeCallback(void* contents, size_t size, size_t nmemb, s
     return total_size;
 }
 
+size_t RequestHandle::headerCallback(char* buffer, size_t size, size_t nitems, void* userdata) {
+    auto* handle = static_cast<RequestHandle*>(userdata);
+    size_t total_size = size * nitems;
+    std::string line(buffer, total_size);
+
+    if (line.starts_with("HTTP/")) {
+        handle->_response_headers.clear();
+        return total_size;
+    }
+
+    auto colon = line.find(':');
+    if (colon == std::string::npos) {
+        return total_size;
+    }
+
+    std::string name = line.substr(0, colon);
+    std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return std::tolower(c); });
+
+    auto value_begin = line.find_first_not_of(" \t", colon + 1);
+    auto value_end = line.find_last_not_of(" \t\r\n");
+    handle->_response_headers[name] = value_begin == std::string::npos || value_end < value_begin
+        ? std::string{}
+        : line.substr(value_begin, value_end - value_begin + 1);
+    return total_size;
+}
+
+int RequestHandle::xferInfoCallback(
+    void* clientp,
+    curl_off_t,
+    curl_off_t dlnow,
+    curl_off_t,
+    curl_off_t ulnow)
+{
+    constexpr auto PAUSE_THRESHOLD = std::chrono::milliseconds(10);
+
+    auto* handle = static_cast<RequestHandle*>(clientp);
+    if (ulnow < handle->_uploaded) {
+        handle->_uploaded = 0;
+    }
+    if (dlnow < handle->_downloaded) {
+        handle->_downloaded = 0;
+    }
+
+    auto& bandwidth = HttpClient::get().bandwidth();
+    auto now = BandwidthScheduler::Clock::now();
+    auto wait = BandwidthScheduler::Clock::duration::zero();
+    if (ulnow > handle->_uploaded) {
+        wait = std::max(wait, bandwidth.consume(handle->_traffic_class, TrafficDirection::Upload, ulnow - handle->_uploaded, now));
+        handle->_uploaded = ulnow;
+    }
+    if (dlnow > handle->_downloaded) {
+        wait = std::max(wait, bandwidth.consume(handle->_traffic_class, TrafficDirection::Download, dlnow - handle->_downloaded, now));
+        handle->_downloaded = dlnow;
+    }
+
+    if (wait < PAUSE_THRESHOLD) {
+        return 0;
+    }
+
+    if (handle->_in_multi) {
+        handle->_paused = true;
+        curl_easy_pause(handle->_curl, CURLPAUSE_ALL);
+    }
+    else {
+        std::this_thread::sleep_for(wait);
+    }
+    return 0;
+}
+
 size_t RequestHandle::readData(void* ptr, size_t size, size_t nmemb, void* stream) {
     std::ifstream* file = static_cast<std::ifstream*>(stream);
     file->read(static_cast<char*>(ptr), size * nmemb);
@@ -144,6 +482,68 @@ size_t RequestHandle::writeData(void* ptr, size_t size, size_t nmemb, void* stre
     return size * nmemb;
 }
 
+size_t RequestHandle::writeHashedData(void* ptr, size_t size, size_t nmemb, void* userdata) {
+    auto* handle = static_cast<RequestHandle*>(userdata);
+    const char* data = static_cast<const char*>(ptr);
+    std::size_t count = size * nmemb;
+
+    long http_code = 0;
+    curl_easy_getinfo(handle->_curl, CURLINFO_RESPONSE_CODE, &http_code);
+    if (http_code != 0 && (http_code < 200 || http_code >= 300)) {
+        // Error bodies must not end up in the file, a retry resumes after its last byte.
+        return writeCallback(ptr, size, nmemb, &handle->_response);
+    }
+    if (http_code == 200 && handle->_resume_offset > 0) {
+        // The server ignored the Range header and sends the whole file again.
+        handle->_iofd.flush();
+        std::error_code ec;
+        std::filesystem::resize_file(handle->_download_path, 0, ec);
+        handle->_iofd.seekp(0);
+        handle->_hashers.reset();
+        handle->_resume_offset = 0;
+    }
+
+    handle->_iofd.write(data, static_cast<std::streamsize>(count));
+    if (!handle->_iofd) {
+        return 0;
+    }
+    handle->_hashers.update(data, count);
+    return count;
+}
+
+size_t RequestHandle::writeRangeData(void* ptr, size_t size, size_t nmemb, void* userdata) {
+    auto* handle = static_cast<RequestHandle*>(userdata);
+    std::size_t count = size * nmemb;
+
+    long http_code = 0;
+    curl_easy_getinfo(handle->_curl, CURLINFO_RESPONSE_CODE, &http_code);
+    if (http_code != 206) {
+        // Error bodies stay in the response, a full 200 body must not overwrite the other ranges.
+        if (http_code == 200) {
+            return 0;
+        }
+        return writeCallback(ptr, size, nmemb, &handle->_response);
+    }
+    if (handle->_range_written + count > handle->_range_length ||
+        !handle->_download->write(handle->_range_offset + handle->_range_written, static_cast<const char*>(ptr), count)) {
+        return 0;
+    }
+    handle->_range_written += count;
+    return count;
+}
+
+size_t RequestHandle::writeSinkData(void* ptr, size_t size, size_t nmemb, void* userdata) {
+    auto* handle = static_cast<RequestHandle*>(userdata);
+    std::size_t count = size * nmemb;
+
+    long http_code = 0;
+    curl_easy_getinfo(handle->_curl, CURLINFO_RESPONSE_CODE, &http_code);
+    if (http_code != 0 && (http_code < 200 || http_code >= 300)) {
+        return writeCallback(ptr, size, nmemb, &handle->_response);
+    }
+    return handle->_sink(static_cast<const char*>(ptr), count) ? count : 0;
+}
+
 void RequestHandle::addGlobalResolve(
     const std::string& host,
     unsigned short src_port,
@@ -0,0 +1,103 @@
+#include "statement-cache.h"
+
+namespace {
+    // Idle copies kept per SQL text, enough for the threads sharing one connection.
+    constexpr std::size_t MAX_IDLE_PER_SQL = 4;
+}
+
+StatementCache::Statement::Statement(StatementCache* cache, sqlite3_stmt* stmt) noexcept
+    : _cache(cache),
+    _stmt(stmt)
+{}
+
+StatementCache::Statement::~Statement() {
+    reset();
+}
+
+StatementCache::Statement::Statement(Statement&& other) noexcept
+    : _cache(other._cache),
+    _stmt(other._stmt)
+{
+    other._stmt = nullptr;
+}
+
+StatementCache::Statement& StatementCache::Statement::operator=(Statement&& other) noexcept {
+    if (this != &other) {
+        reset();
+        _cache = other._cache;
+        _stmt = other._stmt;
+        other._stmt = nullptr;
+    }
+    return *this;
+}
+
+StatementCache::Statement::operator sqlite3_stmt*() const noexcept {
+    return _stmt;
+}
+
+void StatementCache::Statement::reset() noexcept {
+    if (_stmt) {
+        _cache->giveBack(_stmt);
+        _stmt = nullptr;
+    }
+}
+
+StatementCache::StatementCache(std::shared_ptr<sqlite3> conn)
+    : _conn(std::move(conn))
+{}
+
+StatementCache::~StatementCache() {
+    clear();
+}
+
+int StatementCache::prepare(const std::string& sql, Statement& out) {
+    out.reset();
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        auto it = _idle.find(sql);
+        if (it != _idle.end() && !it->second.empty()) {
+            out = Statement(this, it->second.back());
+            it->second.pop_back();
+            return SQLITE_OK;
+        }
+    }
+    sqlite3_stmt* stmt = nullptr;
+    int rc = sqlite3_prepare_v3(_conn.get(), sql.c_str(), -1, SQLITE_PREPARE_PERSISTENT, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        sqlite3_finalize(stmt);
+        return rc;
+    }
+    out = Statement(this, stmt);
+    return SQLITE_OK;
+}
+
+void StatementCache::clear() {
+    std::lock_guard<std::mutex> lock(_mtx);
+    for (auto& [sql, stmts] : _idle) {
+        for (auto* stmt : stmts) {
+            sqlite3_finalize(stmt);
+        }
+    }
+    _idle.clear();
+}
+
+std::size_t StatementCache::idle() const {
+    std::lock_guard<std::mutex> lock(_mtx);
+    std::size_t count = 0;
+    for (const auto& [sql, stmts] : _idle) {
+        count += stmts.size();
+    }
+    return count;
+}
+
+void StatementCache::giveBack(sqlite3_stmt* stmt) noexcept {
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+    std::lock_guard<std::mutex> lock(_mtx);
+    auto& stmts = _idle[sqlite3_sql(stmt)];
+    if (stmts.size() >= MAX_IDLE_PER_SQL) {
+        sqlite3_finalize(stmt);
+        return;
+    }
+    stmts.push_back(stmt);
+}
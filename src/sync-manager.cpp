@@ -1,5 +1,18 @@
 #include "sync-manager.h"
 
+namespace {
+    constexpr ConnectionLimits CLOUD_CONNECTION_LIMITS{
+        .multiplex = true,
+        // Range downloads and upload appends open a connection each, metadata shares the multiplexed ones.
+        .max_host_connections = 16,
+        .max_total_connections = 32,
+        .max_concurrent_streams = 100
+    };
+
+    constexpr std::size_t GROUP_COMMIT_MAX_CALLBACKS = 128;
+    constexpr std::chrono::milliseconds GROUP_COMMIT_MAX_LATENCY{ 50 };
+}
+
 
 SyncManager::SyncManager(
     const std::string& config_path,
@@ -51,6 +64,7 @@ void SyncManager::shutdown() {
         _changes_worker->join();
     }
 
+    TokenManager::get().stop();
     HttpClient::get().shutdown();
 }
 
@@ -68,11 +82,16 @@ void SyncManager::init() {
 
     ChangeFactory::initClouds(_clouds);
 
-    CallbackDispatcher::get().setDB(_db_file);
+    _db->loadIndex();
+    CallbackDispatcher::get().setDB(_db);
+    CallbackDispatcher::get().setGroupCommit(GROUP_COMMIT_MAX_CALLBACKS, GROUP_COMMIT_MAX_LATENCY);
     CallbackDispatcher::get().setClouds(_clouds);
     CallbackDispatcher::get().start();
     HttpClient::get().setClouds(_clouds);
+    HttpClient::get().setConnectionLimits(CLOUD_CONNECTION_LIMITS);
     HttpClient::get().start();
+
+    refreshAccessTokens();
 }
 
 void SyncManager::loadConfig() {
@@ -252,13 +271,17 @@ void SyncManager::initialSync() {
     auto clouds = _clouds;
     clouds.emplace(0, _local);
 
-    CallbackDispatcher::get().setDB(_db_file);
+    _db->addLocalDir(_local_dir.string());
+
+    CallbackDispatcher::get().setDB(_db);
+    CallbackDispatcher::get().setGroupCommit(GROUP_COMMIT_MAX_CALLBACKS, GROUP_COMMIT_MAX_LATENCY);
     CallbackDispatcher::get().setClouds(clouds);
     CallbackDispatcher::get().start();
     HttpClient::get().setClouds(clouds);
+    HttpClient::get().setConnectionLimits(CLOUD_CONNECTION_LIMITS);
+    HttpClient::get().setInitialSync(true);
     HttpClient::get().start();
-
-    _db->addLocalDir(_local_dir.string());
+    refreshAccessTokens();
 
     _num_clouds = _clouds.size();
 
@@ -268,10 +291,9 @@ void SyncManager::initialSync() {
     std::vector<std::unique_ptr<FileRecordDTO>> tmp_files;
     tmp_files = _local->initialFiles();
     LOG_DEBUG("SyncManager", "LocalStorage returned %i items", tmp_files.size());
+    CallbackDispatcher::get().syncDbWrite(tmp_files, true);
     for (auto& file : tmp_files) {
         LOG_DEBUG("SyncManager", "  LOCAL: %s", file->rel_path.string().c_str());
-        int global_id = _db->add_file(*file);
-        file->global_id = global_id;
         local_files_map.emplace(file->rel_path, std::move(file));
     }
 
@@ -492,7 +514,9 @@ void SyncManager::initialSync() {
                 else {
                     if (cloud_id == local_dto->cloud_id) {
                         LOG_DEBUG("SyncManager", "Cloud: %s has best file: %s, dont upload here", CloudResolver::getName(cloud_id), rel_path.c_str());
-                        _db->add_file_link(*local_dto);
+                        CallbackDispatcher::get().submitDbWrite(ICommand::entryKey(local_dto->global_id, rel_path), [link = *local_dto](const std::unique_ptr<Database>& db) {
+                            db->add_file_link(link);
+                            }).get();
                         continue;
                     }
                     FileRecordDTO* cloud_dto = nullptr;
@@ -517,7 +541,9 @@ void SyncManager::initialSync() {
                     );
 
                     cloud_dto->global_id = local_dto->global_id;
-                    _db->add_file_link(*cloud_dto);
+                    CallbackDispatcher::get().submitDbWrite(ICommand::entryKey(cloud_dto->global_id, rel_path), [link = *cloud_dto](const std::unique_ptr<Database>& db) {
+                        db->add_file_link(link);
+                        }).get();
 
                     auto cmd = std::make_unique<CloudUpdateCommand>(cloud_id);
                     cmd->setDTO(std::move(dto_clone));
@@ -541,14 +567,21 @@ void SyncManager::initialSync() {
     CallbackDispatcher::get().waitUntilIdle();
 
     HttpClient::get().waitUntilIdle();
+    HttpClient::get().setInitialSync(false);
+    TokenManager::get().stop();
 
+    std::unordered_map<int, std::string> delta_tokens;
     for (const auto& [cloud_id, cloud] : _clouds) {
-        nlohmann::json cloud_data = _db->get_cloud_config(cloud_id);
-        cloud_data["start_page_token"] = cloud->getDeltaToken();
-        _db->update_cloud_data(cloud_id, cloud_data);
+        delta_tokens.emplace(cloud_id, cloud->getDeltaToken());
     }
-
-    _db->markInitialSyncDone();
+    CallbackDispatcher::get().submitDbWrite(ICommand::entryKey(0, _local_dir), [&delta_tokens](const std::unique_ptr<Database>& db) {
+        for (const auto& [cloud_id, token] : delta_tokens) {
+            nlohmann::json cloud_data = db->get_cloud_config(cloud_id);
+            cloud_data["start_page_token"] = token;
+            db->update_cloud_data(cloud_id, cloud_data);
+        }
+        db->markInitialSyncDone();
+        }).get();
     LOG_INFO("SyncManager", "=== initialSync() complete ===");
 }
 
@@ -731,7 +764,7 @@ void SyncManager::openUrl(const std::string& url) {
 }
 
 void SyncManager::refreshAccessTokens() {
-
+    TokenManager::get().start(_clouds);
 }
 
 void SyncManager::daemonMode() {
@@ -762,10 +795,25 @@ void SyncManager::proccessLoop() {
     }
 }
 
+// Requests HttpClient gave up on fail their change, a batch fails the change of each request it carried;
+// destroying them also reports a lost range or append to the transfer waiting on it and returns their curl handles.
+void SyncManager::drainDeadLetters() {
+    for (auto& command : HttpClient::get().takeDeadLetters()) {
+        LOG_ERROR(
+            "SyncManager",
+            "Giving up on request for: %s on cloud: %s",
+            command->getTarget(),
+            CloudResolver::getName(command->getId())
+        );
+        command->abandon();
+    }
+}
+
 void SyncManager::pollingLoop() {
     auto now = std::chrono::steady_clock::now();
     auto next_poll = now;
     auto next_flush = now + std::chrono::seconds(8);
+    bool more_changes = false;
 
     while (!_should_exit) {
         now = std::chrono::steady_clock::now();
@@ -773,26 +821,31 @@ void SyncManager::pollingLoop() {
         {
             std::unique_lock lk(_signal_mtx);
             _signal_cv.wait_until(
-                lk, next_poll,
+                lk, more_changes ? now : next_poll,
                 [this] { return _should_exit
                 || _signal_dirty.exchange(false); });
         }
 
         now = std::chrono::steady_clock::now();
+        drainDeadLetters();
 
-        if (now >= next_poll) {
-            for (auto& [id, cloud] : _clouds) {
-                if (id != 0) {
-                    cloud->getChanges();
-                }
+        bool poll_all = now >= next_poll;
+        for (auto& [id, cloud] : _clouds) {
+            if (id != 0 && (poll_all || (cloud->hasMoreChanges() && !cloud->hasChanges()))) {
+                cloud->getChanges();
             }
+        }
+        if (poll_all) {
             next_poll = now + std::chrono::seconds(10);
         }
 
+        // Clouds hand over one bounded batch at a time, a paused change feed resumes once they are drained.
+        more_changes = false;
         for (auto& [id, cloud] : _clouds) {
             if (cloud->hasChanges()) {
                 _changes_buff.push(cloud->proccessChanges());
             }
+            more_changes = more_changes || cloud->hasMoreChanges() || (id != 0 && cloud->hasChanges());
         }
     }
 }
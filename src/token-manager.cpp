@@ -0,0 +1,170 @@
+#include "token-manager.h"
+#include "Networking.h"
+#include "logger.h"
+
+#include <algorithm>
+
+namespace {
+    constexpr auto FAILED_REFRESH_DELAY = std::chrono::seconds(30);
+    constexpr auto MIN_REFRESH_INTERVAL = std::chrono::seconds(60);
+}
+
+TokenManager& TokenManager::get() {
+    static TokenManager instance;
+    return instance;
+}
+
+TokenManager::~TokenManager() {
+    stop();
+}
+
+void TokenManager::start(const std::unordered_map<int, std::shared_ptr<BaseStorage>>& clouds) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_running) {
+        LOG_WARNING("TokenManager", "start() called but worker already running");
+        return;
+    }
+
+    _clouds.clear();
+    for (const auto& [cloud_id, cloud] : clouds) {
+        if (cloud) {
+            _clouds.emplace(cloud_id, cloud);
+        }
+    }
+    _forced.clear();
+    _retry_at.clear();
+    _refreshed_at.clear();
+    _should_stop = false;
+    _running = true;
+
+    LOG_INFO("TokenManager", "Starting token refresh worker for %i clouds", static_cast<int>(_clouds.size()));
+    _worker = std::make_unique<std::thread>(&TokenManager::worker, this);
+}
+
+void TokenManager::stop() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (!_running) {
+            return;
+        }
+        _should_stop = true;
+        _running = false;
+    }
+    _cv.notify_all();
+
+    if (_worker && _worker->joinable()) {
+        _worker->join();
+    }
+    _worker.reset();
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    _clouds.clear();
+    LOG_INFO("TokenManager", "Token refresh worker stopped");
+}
+
+bool TokenManager::requestRefresh(int cloud_id) {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (!_running || !_clouds.contains(cloud_id)) {
+            return false;
+        }
+        _forced.insert(cloud_id);
+    }
+    _cv.notify_one();
+    return true;
+}
+
+bool TokenManager::isRunning() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _running;
+}
+
+void TokenManager::setRefreshMargin(std::chrono::seconds margin) {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _refresh_margin = margin;
+    }
+    _cv.notify_one();
+}
+
+void TokenManager::worker() {
+    ThreadNamer::setThreadName("TokenManager");
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (!_should_stop) {
+        auto now = Clock::now();
+        std::vector<std::pair<int, std::shared_ptr<BaseStorage>>> due;
+        std::optional<Clock::time_point> next;
+
+        for (const auto& [cloud_id, cloud] : _clouds) {
+            auto at = nextRefreshTime(cloud_id, cloud);
+            if (!at) {
+                continue;
+            }
+            if (*at <= now) {
+                due.emplace_back(cloud_id, cloud);
+            }
+            else if (!next || *at < *next) {
+                next = at;
+            }
+        }
+
+        if (due.empty()) {
+            if (next) {
+                _cv.wait_until(lock, *next);
+            }
+            else {
+                _cv.wait(lock);
+            }
+            continue;
+        }
+
+        lock.unlock();
+        for (const auto& [cloud_id, cloud] : due) {
+            refresh(cloud_id, cloud);
+        }
+        lock.lock();
+    }
+}
+
+std::optional<TokenManager::Clock::time_point> TokenManager::nextRefreshTime(int cloud_id, const std::shared_ptr<BaseStorage>& cloud) const {
+    auto retry_it = _retry_at.find(cloud_id);
+    if (retry_it != _retry_at.end()) {
+        return retry_it->second;
+    }
+    if (_forced.contains(cloud_id)) {
+        return Clock::time_point::min();
+    }
+
+    std::time_t expires = cloud->accessTokenExpires();
+    if (expires == 0) {
+        return std::nullopt;
+    }
+    auto at = Clock::from_time_t(expires) - _refresh_margin;
+    auto refreshed_it = _refreshed_at.find(cloud_id);
+    if (refreshed_it != _refreshed_at.end()) {
+        at = std::max(at, refreshed_it->second + MIN_REFRESH_INTERVAL);
+    }
+    return at;
+}
+
+void TokenManager::refresh(int cloud_id, const std::shared_ptr<BaseStorage>& cloud) {
+    LOG_INFO("TokenManager", "Refreshing access token for cloud: %s", CloudResolver::getName(cloud_id));
+    try {
+        cloud->refreshAccessToken();
+    }
+    catch (const std::exception& e) {
+        LOG_ERROR("TokenManager", "Access token refresh failed for cloud: %s: %s", CloudResolver::getName(cloud_id), e.what());
+        std::lock_guard<std::mutex> lock(_mutex);
+        _retry_at[cloud_id] = Clock::now() + FAILED_REFRESH_DELAY;
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _forced.erase(cloud_id);
+        _retry_at.erase(cloud_id);
+        _refreshed_at[cloud_id] = Clock::now();
+    }
+    HttpClient::get().tokensRefreshed(cloud_id);
+}
@@ -0,0 +1,211 @@
+#include "upload-source.h"
+#include "logger.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#include <share.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+    int openForRead(const std::filesystem::path& path) {
+#ifdef _WIN32
+        int fd = -1;
+        return _wsopen_s(&fd, path.c_str(), _O_RDONLY | _O_BINARY | _O_NOINHERIT | _O_SEQUENTIAL, _SH_DENYNO, 0) == 0 ? fd : -1;
+#else
+        return open(path.c_str(), O_RDONLY | O_CLOEXEC);
+#endif
+    }
+
+    void closeFile(int fd) {
+#ifdef _WIN32
+        _close(fd);
+#else
+        close(fd);
+#endif
+    }
+
+    bool fileSize(int fd, std::uint64_t& size) {
+#ifdef _WIN32
+        struct _stat64 st{};
+        if (_fstat64(fd, &st) != 0) {
+            return false;
+        }
+#else
+        struct stat st{};
+        if (fstat(fd, &st) != 0) {
+            return false;
+        }
+#endif
+        size = static_cast<std::uint64_t>(st.st_size);
+        return true;
+    }
+
+    // Asks for aggressive readahead; Windows gets the same hint from _O_SEQUENTIAL at open.
+    void adviseSequential(int fd) {
+#if defined(__linux__)
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#elif defined(__APPLE__)
+        fcntl(fd, F_RDAHEAD, 1);
+#else
+        (void)fd;
+#endif
+    }
+
+    // Reads at an absolute offset without moving a shared file position; the bytes read or -1 with errno set.
+    long long readAt(int fd, char* buffer, std::size_t size, std::uint64_t offset) {
+#ifdef _WIN32
+        HANDLE handle = reinterpret_cast<HANDLE>(_get_osfhandle(fd));
+        OVERLAPPED at{};
+        at.Offset = static_cast<DWORD>(offset & 0xFFFFFFFFull);
+        at.OffsetHigh = static_cast<DWORD>(offset >> 32);
+        DWORD got = 0;
+        DWORD chunk = static_cast<DWORD>(std::min<std::size_t>(size, 0x7FFFFFFF));
+        if (handle == INVALID_HANDLE_VALUE || !ReadFile(handle, buffer, chunk, &got, &at)) {
+            if (GetLastError() == ERROR_HANDLE_EOF) {
+                return 0;
+            }
+            errno = EIO;
+            return -1;
+        }
+        return static_cast<long long>(got);
+#else
+        long long got;
+        do {
+            got = static_cast<long long>(pread(fd, buffer, size, static_cast<off_t>(offset)));
+        } while (got < 0 && errno == EINTR);
+        return got;
+#endif
+    }
+}
+
+UploadSource::UploadSource(const std::filesystem::path& path)
+    : _fd(-1),
+    _size(0),
+    _position(0),
+    _window_begin(0),
+    _window_end(0),
+    _buffer_offset(0),
+    _buffer_length(0)
+{
+    _fd = openForRead(path);
+    if (_fd < 0) {
+        throw std::runtime_error("Error opening file: " + path.string());
+    }
+
+    if (!fileSize(_fd, _size)) {
+        closeFile(_fd);
+        throw std::runtime_error("Error reading file size: " + path.string());
+    }
+    _window_end = _size;
+    adviseSequential(_fd);
+}
+
+UploadSource::~UploadSource() {
+    if (_fd >= 0) {
+        closeFile(_fd);
+    }
+}
+
+std::size_t UploadSource::read(char* buffer, std::size_t size) {
+    if (_position >= _window_end || size == 0) {
+        return 0;
+    }
+    size = static_cast<std::size_t>(std::min<std::uint64_t>(size, _window_end - _position));
+    return readBuffered(buffer, size);
+}
+
+std::size_t UploadSource::readBuffered(char* buffer, std::size_t size) {
+    bool buffered = _position >= _buffer_offset && _position < _buffer_offset + _buffer_length;
+    if (!buffered && size >= DIRECT_READ_SIZE) {
+        // curl pulls a whole upload buffer at a time; copying it through ours first only halves the throughput.
+        long long got = readAt(_fd, buffer, size, _position);
+        if (got <= 0) {
+            LOG_ERROR("UploadSource", "Read failed at offset %llu: %s", static_cast<unsigned long long>(_position), std::strerror(errno));
+            return 0;
+        }
+        _position += static_cast<std::uint64_t>(got);
+        return static_cast<std::size_t>(got);
+    }
+
+    if (!buffered) {
+        if (_buffer.empty()) {
+            _buffer.resize(static_cast<std::size_t>(std::min<std::uint64_t>(_size, PREAD_BUFFER_SIZE)));
+        }
+        long long got = readAt(_fd, _buffer.data(), _buffer.size(), _position);
+        if (got <= 0) {
+            LOG_ERROR("UploadSource", "Read failed at offset %llu: %s", static_cast<unsigned long long>(_position), std::strerror(errno));
+            return 0;
+        }
+        _buffer_offset = _position;
+        _buffer_length = static_cast<std::size_t>(got);
+    }
+
+    std::size_t in_buffer = static_cast<std::size_t>(_position - _buffer_offset);
+    std::size_t count = std::min(size, _buffer_length - in_buffer);
+    std::memcpy(buffer, _buffer.data() + in_buffer, count);
+    _position += count;
+    return count;
+}
+
+bool UploadSource::seek(curl_off_t offset, int origin) {
+    curl_off_t base = 0;
+    switch (origin) {
+    case SEEK_SET: base = static_cast<curl_off_t>(_window_begin); break;
+    case SEEK_CUR: base = static_cast<curl_off_t>(_position); break;
+    case SEEK_END: base = static_cast<curl_off_t>(_window_end); break;
+    default: return false;
+    }
+
+    curl_off_t target = base + offset;
+    if (target < static_cast<curl_off_t>(_window_begin) || static_cast<std::uint64_t>(target) > _window_end) {
+        return false;
+    }
+    _position = static_cast<std::uint64_t>(target);
+    return true;
+}
+
+void UploadSource::rewind() {
+    _position = _window_begin;
+}
+
+// Restricts reads to [offset, offset + length) so a chunk can be sent and retried on its own.
+void UploadSource::setWindow(std::uint64_t offset, std::uint64_t length) {
+    _window_begin = std::min(offset, _size);
+    _window_end = std::min(_size, _window_begin + length);
+    _position = _window_begin;
+}
+
+std::uint64_t UploadSource::size() const noexcept {
+    return _size;
+}
+
+std::uint64_t UploadSource::length() const noexcept {
+    return _window_end - _window_begin;
+}
+
+std::uint64_t UploadSource::position() const noexcept {
+    return _position;
+}
+
+size_t UploadSource::readCallback(char* buffer, size_t size, size_t nitems, void* userdata) {
+    auto* source = static_cast<UploadSource*>(userdata);
+    std::size_t count = source->read(buffer, size * nitems);
+    if (count == 0 && size * nitems > 0 && source->position() < source->_window_end) {
+        return CURL_READFUNC_ABORT;
+    }
+    return count;
+}
+
+int UploadSource::seekCallback(void* userdata, curl_off_t offset, int origin) {
+    auto* source = static_cast<UploadSource*>(userdata);
+    return source->seek(offset, origin) ? CURL_SEEKFUNC_OK : CURL_SEEKFUNC_FAIL;
+}
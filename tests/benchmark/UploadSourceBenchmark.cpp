@@ -0,0 +1,88 @@
+// tests/benchmark/UploadSourceBenchmark.cpp
+//
+// Read throughput of the upload paths as libcurl drives them, from a file already in the page cache: the old
+// std::fstream callback at curl's default 64 KiB upload buffer, and UploadSource at that size and at the
+// buffer RequestHandle configures. Not a test; run it by hand to compare the sources.
+
+#include "upload-source.h"
+#include "request-handle.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace {
+    constexpr std::size_t FILE_SIZE = 64 * 1024 * 1024;
+    constexpr std::size_t CURL_DEFAULT_CHUNK = 64 * 1024;
+    constexpr int RUNS = 5;
+
+    fs::path writeFile(const fs::path& path, std::size_t size) {
+        std::ofstream out(path, std::ios::binary);
+        std::string chunk(CURL_DEFAULT_CHUNK, '\0');
+        std::size_t written = 0;
+        while (written < size) {
+            std::size_t n = std::min(chunk.size(), size - written);
+            for (std::size_t i = 0; i < n; ++i) {
+                chunk[i] = static_cast<char>((written + i) * 31 % 251);
+            }
+            out.write(chunk.data(), static_cast<std::streamsize>(n));
+            written += n;
+        }
+        return path;
+    }
+
+    // Best of RUNS, in MB/s; each run reads the whole file through a fresh source.
+    template<typename MakeReader>
+    double measure(std::size_t chunk, MakeReader&& make_reader) {
+        std::vector<char> buffer(chunk);
+        double best = 0;
+        for (int run = 0; run < RUNS; ++run) {
+            auto read_chunk = make_reader();
+            auto start = std::chrono::steady_clock::now();
+            std::size_t total = 0;
+            std::size_t n;
+            while ((n = read_chunk(buffer.data(), buffer.size())) > 0) {
+                total += n;
+            }
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            if (total != FILE_SIZE) {
+                std::cerr << "short read: " << total << " of " << FILE_SIZE << " bytes" << std::endl;
+                std::exit(EXIT_FAILURE);
+            }
+            best = std::max(best, (static_cast<double>(total) / (1024 * 1024)) / std::max(seconds, 1e-9));
+        }
+        return best;
+    }
+}
+
+int main() {
+    fs::path dir = fs::temp_directory_path() / "-bench-upload_source-";
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+    fs::path path = writeFile(dir / "throughput.bin", FILE_SIZE);
+
+    auto stream = [&] {
+        auto file = std::make_shared<std::fstream>(path, std::ios::in | std::ios::binary);
+        return [file](char* out, std::size_t size) { return RequestHandle::readData(out, 1, size, file.get()); };
+    };
+    auto source = [&] {
+        auto upload = std::make_shared<UploadSource>(path);
+        return [upload](char* out, std::size_t size) { return UploadSource::readCallback(out, 1, size, upload.get()); };
+    };
+    constexpr auto UPLOAD_CHUNK = static_cast<std::size_t>(RequestHandle::UPLOAD_BUFFER_SIZE);
+
+    std::cout << "std::fstream, 64 KiB reads: " << measure(CURL_DEFAULT_CHUNK, stream) << " MB/s" << std::endl;
+    std::cout << "UploadSource, 64 KiB reads: " << measure(CURL_DEFAULT_CHUNK, source) << " MB/s" << std::endl;
+    std::cout << "UploadSource, " << UPLOAD_CHUNK / 1024 << " KiB reads: " << measure(UPLOAD_CHUNK, source) << " MB/s" << std::endl;
+
+    fs::remove_all(dir);
+    return EXIT_SUCCESS;
+}
@@ -1,9 +1,21 @@
 #include <gtest/gtest.h>
 #include <httplib.h>
+#include <fstream>
+#include <future>
+#include <map>
+#define XXH_INLINE_ALL
+#include <xxhash.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <unistd.h>
 
 #include "Networking.h"
 #include "commands.h"
+#include "change.h"
 #include "CallbackDispatcher.h"
+#include "token-manager.h"
+#include "dropbox.h"
+#include "google.h"
 
 struct MockServer {
     httplib::Server srv;
@@ -15,6 +27,41 @@ struct MockServer {
     std::atomic<int> flaky_async{ 0 };
     std::atomic<int> bad_sync{ 0 };
     std::atomic<int> bad_async{ 0 };
+    std::atomic<int> slow{ 0 };
+    std::atomic<int> retry_after{ 0 };
+    std::atomic<int> always_503{ 0 };
+    std::atomic<int> large{ 0 };
+    std::atomic<int> auth_ok{ 0 };
+    std::atomic<int> auth_rejected{ 0 };
+    std::atomic<int> batches{ 0 };
+    std::atomic<int> batch_parts{ 0 };
+    std::atomic<int> single_deletes{ 0 };
+    std::atomic<int> dropbox_batches{ 0 };
+    std::atomic<int> dropbox_checks{ 0 };
+    std::atomic<int> session_starts{ 0 };
+    std::atomic<int> session_queries{ 0 };
+    std::atomic<int> session_chunks{ 0 };
+    std::atomic<int> session_fail_chunk{ 0 };
+    std::atomic<int> dropbox_session_starts{ 0 };
+    std::atomic<int> dropbox_appends{ 0 };
+    std::atomic<int> dropbox_finishes{ 0 };
+    std::atomic<int> appends_in_flight{ 0 };
+    std::atomic<int> max_appends_in_flight{ 0 };
+    std::atomic<int> ranged_requests{ 0 };
+    std::atomic<int> ranged_full{ 0 };
+    std::mutex appends_mtx;
+    std::map<std::uint64_t, std::string> appended;
+    bool append_closed = false;
+    std::string uploaded_body;
+    std::string session_bytes;
+    std::vector<std::string> dropbox_batch_paths;
+    std::string ranged_body;
+    std::mutex downloads_mtx;
+    std::vector<std::string> download_ranges;
+    std::string download_body;
+    std::mutex listing_mtx;
+    std::vector<std::string> listing_cursors;
+    std::map<std::string, std::string> listing_pages;
 
     explicit MockServer(uint16_t port = 8081)
     {
@@ -50,6 +97,275 @@ struct MockServer {
             res.set_content("bad request", "text/plain");
             });
 
+        srv.Get(R"(/slow)", [&](const auto&, auto& res) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1500));
+            ++slow;
+            res.set_content(R"({"status":"slow"})", "application/json");
+            });
+
+        srv.Get(R"(/retry_after)", [&](const auto&, auto& res) {
+            ++retry_after;
+            if (retry_after == 1) {
+                res.status = 429;
+                res.set_header("Retry-After", "1");
+            }
+            else { res.set_content(R"({"status":"done"})", "application/json"); }
+            });
+
+        srv.Get(R"(/always_503)", [&](const auto&, auto& res) {
+            ++always_503;
+            res.status = 503;
+            res.set_header("Retry-After", "0");
+            });
+
+        srv.Get(R"(/large)", [&](const auto&, auto& res) {
+            ++large;
+            res.set_content(std::string(512 * 1024, 'x'), "application/octet-stream");
+            });
+
+        ranged_body.resize(16 * 1024 * 1024);
+        for (std::size_t i = 0; i < ranged_body.size(); ++i) {
+            ranged_body[i] = static_cast<char>(i % 251);
+        }
+        srv.Get(R"(/ranged)", [&](const auto& req, auto& res) {
+            ++(req.has_header("Range") ? ranged_requests : ranged_full);
+            res.set_content(ranged_body, "application/octet-stream");
+            });
+
+        srv.Get(R"(/ranged_head_missing)", [&](const auto& req, auto& res) {
+            if (req.get_header_value("Range").starts_with("bytes=0-")) {
+                res.status = 404;
+                return;
+            }
+            res.set_content(ranged_body, "application/octet-stream");
+            });
+
+        srv.Get(R"(/interrupted)", [&](const auto& req, auto& res) {
+            {
+                std::lock_guard<std::mutex> lock(downloads_mtx);
+                download_ranges.push_back(req.get_header_value("Range"));
+            }
+            std::string body = ranged_body.substr(0, 1024 * 1024);
+            if (req.has_header("Range")) {
+                res.set_content(body, "application/octet-stream");
+                return;
+            }
+            // Cuts the connection halfway through the body.
+            res.set_header("Retry-After", "0");
+            res.set_content_provider(body.size(), "application/octet-stream", [body](std::size_t, std::size_t, httplib::DataSink& sink) {
+                sink.write(body.data(), body.size() / 2);
+                return false;
+                });
+            });
+
+        srv.Get(R"(/2/files/download)", [&](const auto& req, auto& res) {
+            std::lock_guard<std::mutex> lock(downloads_mtx);
+            download_ranges.push_back(req.get_header_value("Range"));
+            res.set_content(download_body, "application/octet-stream");
+            });
+
+        srv.Post(R"(/2/files/list_folder)", [&](const auto& req, auto& res) {
+            std::lock_guard<std::mutex> lock(listing_mtx);
+            listing_cursors.push_back("");
+            res.set_content(listing_pages[""], "application/json");
+            });
+
+        srv.Post(R"(/2/files/list_folder/continue)", [&](const auto& req, auto& res) {
+            std::string cursor = nlohmann::json::parse(req.body)["cursor"];
+            std::lock_guard<std::mutex> lock(listing_mtx);
+            listing_cursors.push_back(cursor);
+            if (!listing_pages.contains(cursor)) {
+                res.status = 409;
+                res.set_content(R"({"error":{".tag":"reset"}})", "application/json");
+                return;
+            }
+            res.set_content(listing_pages[cursor], "application/json");
+            });
+
+        srv.Post(R"(/2/files/list_folder/get_latest_cursor)", [&](const auto&, auto& res) {
+            res.set_content(R"({"cursor":"c0"})", "application/json");
+            });
+
+        srv.Get(R"(/auth)", [&](const auto& req, auto& res) {
+            if (req.get_header_value("Authorization") == "Bearer fresh") {
+                ++auth_ok;
+                res.set_content(R"({"status":"done"})", "application/json");
+            }
+            else {
+                ++auth_rejected;
+                res.status = 401;
+            }
+            });
+
+        srv.Post(R"(/upload)", [&](const auto& req, auto& res) {
+            uploaded_body = req.body;
+            res.set_content(R"({"status":"stored"})", "application/json");
+            });
+
+        srv.Post(R"(/batch)", [&](const auto& req, auto& res) {
+            ++batches;
+            std::string boundary = "resp_boundary";
+            std::string out;
+            std::size_t pos = 0;
+            int index = 0;
+            while ((pos = req.body.find("PATCH /delete/", pos)) != std::string::npos) {
+                pos += 14;
+                std::string id = req.body.substr(pos, req.body.find(' ', pos) - pos);
+                ++batch_parts;
+                bool failed = id.starts_with("flaky");
+                bool missing = id.starts_with("missing");
+                out += "--" + boundary + "\r\nContent-Type: application/http\r\nContent-ID: <response-item" + std::to_string(index++) + ">\r\n\r\n";
+                out += failed ? "HTTP/1.1 503 Service Unavailable\r\n\r\n{}\r\n"
+                    : missing ? "HTTP/1.1 404 Not Found\r\n\r\n{}\r\n"
+                    : "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n\r\n{\"id\":\"" + id + "\"}\r\n";
+            }
+            out += "--" + boundary + "--\r\n";
+            res.set_content(out, "multipart/mixed; boundary=" + boundary);
+            });
+
+        srv.Post(R"(/batch_503)", [&](const auto&, auto& res) {
+            ++batches;
+            res.status = 503;
+            res.set_header("Retry-After", "0");
+            });
+
+        srv.Post(R"(/batch_400)", [&](const auto&, auto& res) {
+            ++batches;
+            res.status = 400;
+            res.set_content("bad request", "text/plain");
+            });
+
+        srv.Patch(R"(/delete/(.*))", [&](const auto& req, auto& res) {
+            ++single_deletes;
+            res.set_content("{\"id\":\"" + std::string(req.matches[1]) + "\"}", "application/json");
+            });
+
+        srv.Post(R"(/2/files/delete_batch)", [&](const auto& req, auto& res) {
+            ++dropbox_batches;
+            auto body = nlohmann::json::parse(req.body);
+            for (const auto& entry : body["entries"]) {
+                dropbox_batch_paths.push_back(entry["path"]);
+            }
+            res.set_content(R"({".tag":"async_job_id","async_job_id":"job-1"})", "application/json");
+            });
+
+        srv.Post(R"(/2/files/delete_batch/check)", [&](const auto& req, auto& res) {
+            if (++dropbox_checks == 1) {
+                res.set_content(R"({".tag":"in_progress"})", "application/json");
+                return;
+            }
+            nlohmann::json entries = nlohmann::json::array();
+            for (const auto& path : dropbox_batch_paths) {
+                if (path.find("busy") != std::string::npos) {
+                    entries.push_back({ {".tag", "failure"}, {"failure", { {".tag", "too_many_write_operations"} } } });
+                }
+                else {
+                    entries.push_back({ {".tag", "success"}, {"metadata", { {".tag", "file"}, {"path_display", path} } } });
+                }
+            }
+            res.set_content(nlohmann::json{ {".tag", "complete"}, {"entries", entries} }.dump(), "application/json");
+            });
+
+        srv.Post(R"(/2/files/delete_v2)", [&](const auto& req, auto& res) {
+            ++single_deletes;
+            auto path = nlohmann::json::parse(req.body)["path"];
+            res.set_content(nlohmann::json{ {"metadata", { {".tag", "file"}, {"path_display", path} } } }.dump(), "application/json");
+            });
+
+        srv.Post(R"(/upload/drive/v3/files)", [&](const auto& req, auto& res) {
+            ++session_starts;
+            session_bytes.clear();
+            res.set_header("Location", "http://127.0.0.1:8081/session/upload-1");
+            res.set_content("", "text/plain");
+            });
+
+        srv.Put(R"(/session/(.*))", [&](const auto& req, auto& res) {
+            std::string range = req.get_header_value("Content-Range");
+            auto stored = [&] {
+                res.status = 308;
+                if (!session_bytes.empty()) {
+                    res.set_header("Range", "bytes=0-" + std::to_string(session_bytes.size() - 1));
+                }
+            };
+            if (range.starts_with("bytes */")) {
+                ++session_queries;
+                stored();
+                return;
+            }
+            if (++session_chunks == session_fail_chunk) {
+                res.status = 503;
+                res.set_header("Retry-After", "0");
+                return;
+            }
+            std::size_t first = std::stoull(range.substr(6, range.find('-') - 6));
+            std::size_t total = std::stoull(range.substr(range.find('/') + 1));
+            if (first != session_bytes.size()) {
+                res.status = 400;
+                return;
+            }
+            session_bytes += req.body;
+            if (session_bytes.size() < total) {
+                stored();
+                return;
+            }
+            res.set_content(R"({"id":"file-1","parents":["root-id"],"modifiedTime":"2024-01-01T00:00:00.000Z","md5Checksum":"x"})", "application/json");
+            });
+
+        srv.Post(R"(/2/files/upload_session/start)", [&](const auto& req, auto& res) {
+            ++dropbox_session_starts;
+            auto arg = nlohmann::json::parse(req.get_header_value("Dropbox-API-Arg"));
+            if (arg.value("session_type", "") != "concurrent") {
+                res.status = 400;
+                return;
+            }
+            res.set_content(R"({"session_id":"dbx-session"})", "application/json");
+            });
+
+        srv.Post(R"(/2/files/upload_session/append_v2)", [&](const auto& req, auto& res) {
+            ++dropbox_appends;
+            int in_flight = ++appends_in_flight;
+            int seen = max_appends_in_flight;
+            while (in_flight > seen && !max_appends_in_flight.compare_exchange_weak(seen, in_flight)) {}
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            --appends_in_flight;
+
+            auto arg = nlohmann::json::parse(req.get_header_value("Dropbox-API-Arg"));
+            std::uint64_t offset = arg["cursor"]["offset"];
+            std::lock_guard<std::mutex> lock(appends_mtx);
+            if (offset % (4 * 1024 * 1024) != 0 || appended.contains(offset)) {
+                res.status = 409;
+                res.set_content(R"({"error":{".tag":"incorrect_offset","correct_offset":0}})", "application/json");
+                return;
+            }
+            appended[offset] = req.body;
+            append_closed = append_closed || arg.value("close", false);
+            res.set_content("null", "application/json");
+            });
+
+        srv.Post(R"(/2/files/upload_session/finish)", [&](const auto& req, auto& res) {
+            ++dropbox_finishes;
+            auto arg = nlohmann::json::parse(req.get_header_value("Dropbox-API-Arg"));
+            std::lock_guard<std::mutex> lock(appends_mtx);
+            std::uint64_t total = arg["cursor"]["offset"];
+            std::string content;
+            for (const auto& [offset, chunk] : appended) {
+                content += chunk;
+            }
+            if (!append_closed || content.size() != total) {
+                res.status = 409;
+                res.set_content(R"({"error":{".tag":"lookup_failed","lookup_failed":{".tag":"not_closed"}}})", "application/json");
+                return;
+            }
+            session_bytes = content;
+            res.set_content(nlohmann::json{
+                { "id", "id:big" },
+                { "path_display", arg["commit"]["path"] },
+                { "server_modified", "2024-01-01T00:00:00Z" },
+                { "content_hash", "abc" },
+                { "size", content.size() }
+            }.dump(), "application/json");
+            });
+
         thr = std::thread([&, port] { srv.listen("127.0.0.1", port); });
     }
     ~MockServer() { srv.stop(); thr.join(); }
@@ -60,9 +376,12 @@ class SimpleCommand : public ICommand {
     std::string _target;
     std::unique_ptr<RequestHandle> _h;
 public:
-    SimpleCommand(int cid, std::string url, std::string tgt) :
+    SimpleCommand(int cid, std::string url, std::string tgt, const std::string& header = "") :
         _cloud_id(cid), _target(std::move(tgt)), _h(std::make_unique<RequestHandle>())
     {
+        if (!header.empty()) {
+            _h->addHeaders(header);
+        }
         curl_easy_setopt(_h->_curl, CURLOPT_HTTPGET, 1L);
         curl_easy_setopt(_h->_curl, CURLOPT_URL, url.c_str());
         _h->setCommonCURLOpt();
@@ -70,6 +389,7 @@ public:
     void execute(const std::shared_ptr<BaseStorage>& cloud) override {}
     RequestHandle& getHandle() override { return *_h; }
     std::string getTarget() const override { return _target; }
+    std::string orderingKey() const override { return _target; }
     int getId() const override { return _cloud_id; }
     void completionCallback(const std::unique_ptr<Database>& db, const std::shared_ptr<BaseStorage>& cloud)  override {}
     void continueChain() override {}
@@ -78,6 +398,162 @@ public:
     bool needRepeat() const override { return false; }
 };
 
+struct FakeAuthStorage : RemoteStorage {
+    void proccesUpload(std::unique_ptr<FileRecordDTO>&, const std::string&) const override {}
+    void proccesUpdate(std::unique_ptr<FileUpdatedDTO>&, const std::string&) const override {}
+    void proccesMove(std::unique_ptr<FileMovedDTO>&, const std::string&) const override {}
+    void proccesDelete(std::unique_ptr<FileDeletedDTO>&, const std::string&) const override {}
+    void proccesDownload(std::unique_ptr<FileUpdatedDTO>&, const std::string&) const override {}
+    std::vector<std::unique_ptr<FileRecordDTO>> initialFiles() override { return {}; }
+    CloudProviderType getType() const override { return CloudProviderType::FakeTest; }
+    void setupUploadHandle(const std::unique_ptr<RequestHandle>&, const std::unique_ptr<FileRecordDTO>&) const override {}
+    void setupUpdateHandle(const std::unique_ptr<RequestHandle>&, const std::unique_ptr<FileUpdatedDTO>&) const override {}
+    void setupDownloadHandle(const std::unique_ptr<RequestHandle>&, const std::unique_ptr<FileRecordDTO>&) const override {}
+    void setupDownloadHandle(const std::unique_ptr<RequestHandle>&, const std::unique_ptr<FileUpdatedDTO>&) const override {}
+    void setupDeleteHandle(const std::unique_ptr<RequestHandle>&, const std::unique_ptr<FileDeletedDTO>&) const override {}
+    void setupMoveHandle(const std::unique_ptr<RequestHandle>&, const std::unique_ptr<FileMovedDTO>&) const override {}
+    std::vector<std::unique_ptr<FileRecordDTO>> createPath(const std::filesystem::path&, const std::filesystem::path&) override { return {}; }
+    std::string buildAuthURL(int) const override { return ""; }
+    std::string getRefreshToken(const std::string&, const int) override { return ""; }
+    void proccessAuth(const std::string&) override {}
+    std::string getDeltaToken() override { return ""; }
+    std::string getHomeDir() const override { return ""; }
+    void getChanges() override {}
+    int id() const override { return 7; }
+    bool hasChanges() const override { return false; }
+    void setOnChange(std::function<void()>) override {}
+    std::vector<std::shared_ptr<Change>> proccessChanges() override { return {}; }
+    void ensureRootExists() override {}
+
+    void refreshAccessToken() override { ++generation; }
+    std::string authorizationHeader() const override {
+        return generation == 0 ? "Authorization: Bearer stale" : "Authorization: Bearer fresh";
+    }
+    std::time_t accessTokenExpires() const override { return std::time(nullptr) + 3600; }
+    std::uint64_t tokenGeneration() const override { return generation; }
+
+    std::atomic<std::uint64_t> generation{ 0 };
+};
+
+struct FakeDownloadStorage : FakeAuthStorage {
+    explicit FakeDownloadStorage(std::filesystem::path target) : _target(std::move(target)) {}
+
+    void setupDownloadHandle(const std::unique_ptr<RequestHandle>& handle, const std::unique_ptr<FileRecordDTO>&) const override {
+        curl_easy_setopt(handle->_curl, CURLOPT_URL, "http://127.0.0.1:8081/large");
+        handle->setCommonCURLOpt();
+        handle->setFileStream(_target, std::ios::out);
+    }
+    std::optional<HashKind> contentHashKind() const override { return HashKind::Md5; }
+
+private:
+    std::filesystem::path _target;
+};
+
+struct FakeUrlDownloadStorage : FakeAuthStorage {
+    FakeUrlDownloadStorage(std::filesystem::path target, std::string url, bool ranges) :
+        _target(std::move(target)), _url(std::move(url)), _ranges(ranges) {}
+
+    void setupDownloadHandle(const std::unique_ptr<RequestHandle>& handle, const std::unique_ptr<FileRecordDTO>&) const override {
+        curl_easy_setopt(handle->_curl, CURLOPT_URL, _url.c_str());
+        handle->setCommonCURLOpt();
+        handle->setFileStream(_target, std::ios::out);
+    }
+    std::optional<HashKind> contentHashKind() const override { return HashKind::Md5; }
+    bool supportsRangeDownloads() const override { return _ranges; }
+
+private:
+    std::filesystem::path _target;
+    std::string _url;
+    bool _ranges;
+};
+
+class ProbeCommand : public SimpleCommand {
+    std::shared_ptr<std::optional<FileRecordDTO>> _received;
+public:
+    ProbeCommand(int cid, std::shared_ptr<std::optional<FileRecordDTO>> received) :
+        SimpleCommand(cid, "http://127.0.0.1:8081/ok", "PROBE"), _received(std::move(received)) {}
+    void setDTO(std::unique_ptr<FileRecordDTO> dto) override { *_received = *dto; }
+};
+
+struct FakeHttp2Storage : FakeAuthStorage {
+    bool supportsMultiplexing() const override { return true; }
+};
+
+class Http2Command : public SimpleCommand {
+public:
+    Http2Command(int cid, std::string url) : SimpleCommand(cid, std::move(url), "H2") {
+        curl_easy_setopt(getHandle()._curl, CURLOPT_SSL_VERIFYPEER, 0L);
+        curl_easy_setopt(getHandle()._curl, CURLOPT_SSL_VERIFYHOST, 0L);
+    }
+};
+
+struct FakeBatchStorage : FakeAuthStorage {
+    std::size_t maxBatchParts() const override { return 100; }
+    std::optional<BatchPart> deleteBatchPart(const std::unique_ptr<FileDeletedDTO>& dto) const override {
+        return BatchPart{ "PATCH", "/delete/" + dto->cloud_file_id, "application/json", R"({"trashed":true})", std::string{} };
+    }
+    void setupDeleteHandle(const std::unique_ptr<RequestHandle>& handle, const std::unique_ptr<FileDeletedDTO>& dto) const override {
+        std::string url = "http://127.0.0.1:8081/delete/" + dto->cloud_file_id;
+        curl_easy_setopt(handle->_curl, CURLOPT_URL, url.c_str());
+        curl_easy_setopt(handle->_curl, CURLOPT_CUSTOMREQUEST, "PATCH");
+        handle->setCommonCURLOpt();
+    }
+    void setupBatchHandle(const std::unique_ptr<RequestHandle>& handle, const std::vector<BatchPart>& parts) const override {
+        MultipartBatch batch;
+        std::string body = batch.encode(parts);
+        curl_easy_setopt(handle->_curl, CURLOPT_URL, "http://127.0.0.1:8081/batch");
+        curl_easy_setopt(handle->_curl, CURLOPT_POSTFIELDSIZE_LARGE, static_cast<curl_off_t>(body.size()));
+        curl_easy_setopt(handle->_curl, CURLOPT_COPYPOSTFIELDS, body.c_str());
+        handle->addHeaders("Content-Type: " + batch.contentType());
+        handle->setCommonCURLOpt();
+    }
+    void proccesDelete(std::unique_ptr<FileDeletedDTO>& dto, const std::string& response) const override {
+        std::lock_guard<std::mutex> lock(mtx);
+        deleted[dto->cloud_file_id] = response;
+    }
+
+    mutable std::mutex mtx;
+    mutable std::map<std::string, std::string> deleted;
+};
+
+struct FailingBatchStorage : FakeBatchStorage {
+    explicit FailingBatchStorage(std::string url) : _url(std::move(url)) {}
+    void setupBatchHandle(const std::unique_ptr<RequestHandle>& handle, const std::vector<BatchPart>& parts) const override {
+        FakeBatchStorage::setupBatchHandle(handle, parts);
+        curl_easy_setopt(handle->_curl, CURLOPT_URL, _url.c_str());
+    }
+
+private:
+    std::string _url;
+};
+
+static std::unique_ptr<ICommand> deleteCommand(const std::string& cloud_file_id) {
+    auto command = std::make_unique<CloudDeleteCommand>(7);
+    command->setDTO(std::make_unique<FileDeletedDTO>(cloud_file_id, 0, 7, cloud_file_id, std::time(nullptr)));
+    return command;
+}
+
+struct RecordingDropbox : Dropbox {
+    RecordingDropbox() : Dropbox("id", "secret", "/SyncHarbor", "/tmp", nullptr, 7) {
+        setTestApiBaseUrl("http://127.0.0.1:8081");
+    }
+    void proccesDelete(std::unique_ptr<FileDeletedDTO>& dto, const std::string& response) const override {
+        std::lock_guard<std::mutex> lock(mtx);
+        deleted[dto->rel_path.string()] = response;
+    }
+
+    mutable std::mutex mtx;
+    mutable std::map<std::string, std::string> deleted;
+};
+
+class SizedCommand : public SimpleCommand {
+    std::uint64_t _size;
+public:
+    SizedCommand(int cid, std::string url, std::string tgt, std::uint64_t size) :
+        SimpleCommand(cid, std::move(url), std::move(tgt)), _size(size) {}
+    std::uint64_t getTransferSize() const override { return _size; }
+};
+
 class HttpClientIntegrationTest : public ::testing::Test {
 protected:
     MockServer mock{ 8081 };
@@ -94,6 +570,23 @@ protected:
     }
 };
 
+class HttpClientShardedIntegrationTest : public ::testing::Test {
+protected:
+    MockServer mock{ 8081 };
+
+    void SetUp() override {
+        HttpClient::get().setShardCount(3);
+        CallbackDispatcher::get().start();
+        HttpClient::get().start();
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    void TearDown() override {
+        HttpClient::get().waitUntilIdle();
+        CallbackDispatcher::get().waitUntilIdle();
+        HttpClient::get().shutdown();
+    }
+};
+
 TEST_F(HttpClientIntegrationTest, SyncSuccess)
 {
     auto h = std::make_unique<RequestHandle>();
@@ -140,6 +633,21 @@ TEST_F(HttpClientIntegrationTest, SyncCurlError)
     SUCCEED();
 }
 
+TEST_F(HttpClientIntegrationTest, SyncReusesPooledConnection)
+{
+    auto before = HttpClient::get().reusedConnectionsCount();
+    for (int i = 0; i < 2; ++i) {
+        auto h = std::make_unique<RequestHandle>();
+        curl_easy_setopt(h->_curl, CURLOPT_HTTPGET, 1L);
+        curl_easy_setopt(h->_curl, CURLOPT_URL, "http://127.0.0.1:8081/ok");
+        h->setCommonCURLOpt();
+
+        HttpClient::get().syncRequest(h);
+    }
+    EXPECT_EQ(mock.ok, 2);
+    EXPECT_GT(HttpClient::get().reusedConnectionsCount(), before);
+}
+
 TEST_F(HttpClientIntegrationTest, AsyncPipelineOk)
 {
     for (int i = 0; i < 3; ++i) {
@@ -150,6 +658,27 @@ TEST_F(HttpClientIntegrationTest, AsyncPipelineOk)
     EXPECT_EQ(mock.async_ok, 3);
 }
 
+TEST_F(HttpClientIntegrationTest, AsyncSubmitWakesBusyWorker)
+{
+    HttpClient::get().submit(std::make_unique<SimpleCommand>(
+        0, "http://127.0.0.1:8081/slow", "SLOW"));
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    auto start = std::chrono::steady_clock::now();
+    HttpClient::get().submit(std::make_unique<SimpleCommand>(
+        0, "http://127.0.0.1:8081/async", "FAST"));
+    while (mock.async_ok == 0 && std::chrono::steady_clock::now() - start < std::chrono::seconds(2)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    EXPECT_EQ(mock.async_ok, 1);
+    EXPECT_EQ(mock.slow, 0);
+    EXPECT_LT(elapsed, std::chrono::milliseconds(500));
+    HttpClient::get().waitUntilIdle();
+    EXPECT_EQ(mock.slow, 1);
+}
+
 TEST_F(HttpClientIntegrationTest, AsyncRetry503)
 {
     HttpClient::get().submit(std::make_unique<SimpleCommand>(
@@ -160,6 +689,57 @@ TEST_F(HttpClientIntegrationTest, AsyncRetry503)
     EXPECT_EQ(mock.flaky_async, 2);
 }
 
+TEST_F(HttpClientIntegrationTest, AsyncRetryHonorsRetryAfter)
+{
+    auto start = std::chrono::steady_clock::now();
+    HttpClient::get().submit(std::make_unique<SimpleCommand>(
+        0, "http://127.0.0.1:8081/retry_after", "RETRY-AFTER"));
+    while (mock.retry_after < 2 && std::chrono::steady_clock::now() - start < std::chrono::seconds(5)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    HttpClient::get().waitUntilIdle();
+
+    EXPECT_EQ(mock.retry_after, 2);
+    EXPECT_GE(elapsed, std::chrono::milliseconds(900));
+    EXPECT_LT(elapsed, std::chrono::milliseconds(2000));
+}
+
+TEST_F(HttpClientIntegrationTest, AsyncExhaustedRetriesGoToDeadLetters)
+{
+    HttpClient::get().takeDeadLetters();
+    HttpClient::get().submit(std::make_unique<SimpleCommand>(
+        0, "http://127.0.0.1:8081/always_503", "DEAD"));
+    HttpClient::get().waitUntilIdle();
+
+    EXPECT_EQ(mock.always_503, RequestHandle::MAX_RETRIES + 1);
+    ASSERT_EQ(HttpClient::get().deadLettersCount(), 1u);
+    auto dead = HttpClient::get().takeDeadLetters();
+    EXPECT_EQ(dead.front()->getTarget(), "DEAD");
+}
+
+TEST_F(HttpClientIntegrationTest, AbandonedDeadLetterFailsItsChange)
+{
+    HttpClient::get().takeDeadLetters();
+    auto change = std::make_shared<Change>(ChangeType::New, "DEAD", 0, 0);
+    bool completed = false;
+    change->setOnComplete([&completed](auto&&) { completed = true; });
+
+    auto command = std::make_unique<SimpleCommand>(0, "http://127.0.0.1:8081/always_503", "DEAD");
+    command->setOwner(change);
+    // A later command of the chain that will never run.
+    change->onCommandCreated();
+    HttpClient::get().submit(std::move(command));
+    HttpClient::get().waitUntilIdle();
+
+    auto dead = HttpClient::get().takeDeadLetters();
+    ASSERT_EQ(dead.size(), 1u);
+    EXPECT_FALSE(completed);
+    dead.front()->abandon();
+    EXPECT_TRUE(completed);
+    change->onCommandFinished();
+}
+
 TEST_F(HttpClientIntegrationTest, AsyncHard4xx)
 {
     HttpClient::get().submit(std::make_unique<SimpleCommand>(
@@ -168,9 +748,925 @@ TEST_F(HttpClientIntegrationTest, AsyncHard4xx)
     EXPECT_EQ(mock.bad_async, 1);
 }
 
+TEST_F(HttpClientIntegrationTest, MetadataUsesReservedSlotBehindBulk)
+{
+    for (int i = 0; i < 40; ++i) {
+        HttpClient::get().submit(std::make_unique<SizedCommand>(
+            0, "http://127.0.0.1:8081/slow", "BULK", 64ull << 20));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    auto start = std::chrono::steady_clock::now();
+    HttpClient::get().submit(std::make_unique<SimpleCommand>(
+        0, "http://127.0.0.1:8081/async", "RENAME"));
+    while (mock.async_ok == 0 && std::chrono::steady_clock::now() - start < std::chrono::seconds(3)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    EXPECT_EQ(mock.async_ok, 1);
+    EXPECT_EQ(mock.slow, 0);
+    EXPECT_LT(elapsed, std::chrono::milliseconds(500));
+    HttpClient::get().waitUntilIdle();
+    EXPECT_EQ(mock.slow, 40);
+}
+
+TEST_F(HttpClientIntegrationTest, SyncDownloadRespectsBandwidthLimit)
+{
+    HttpClient::get().setBandwidthLimit(TrafficDirection::Download, 512 * 1024);
+    auto h = std::make_unique<RequestHandle>();
+    curl_easy_setopt(h->_curl, CURLOPT_URL, "http://127.0.0.1:8081/large");
+    h->setCommonCURLOpt();
+
+    auto start = std::chrono::steady_clock::now();
+    HttpClient::get().syncRequest(h);
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    HttpClient::get().setBandwidthLimit(TrafficDirection::Download, 0);
+
+    EXPECT_EQ(h->_response.size(), 512u * 1024);
+    EXPECT_GE(elapsed, std::chrono::milliseconds(700));
+    EXPECT_LT(elapsed, std::chrono::milliseconds(3000));
+}
+
+TEST_F(HttpClientIntegrationTest, SyncUploadStreamsFileFromUploadSource)
+{
+    auto path = std::filesystem::temp_directory_path() / "-test-upload_source-body.bin";
+    std::string content(300 * 1024, '\0');
+    for (std::size_t i = 0; i < content.size(); ++i) {
+        content[i] = static_cast<char>(i % 253);
+    }
+    {
+        std::ofstream out(path, std::ios::binary);
+        out.write(content.data(), static_cast<std::streamsize>(content.size()));
+    }
+
+    auto h = std::make_unique<RequestHandle>();
+    curl_easy_setopt(h->_curl, CURLOPT_URL, "http://127.0.0.1:8081/upload");
+    curl_easy_setopt(h->_curl, CURLOPT_POST, 1L);
+    h->addHeaders("Content-Type: application/octet-stream");
+    h->setUploadSource(path);
+    h->setCommonCURLOpt();
+
+    HttpClient::get().syncRequest(h);
+    std::filesystem::remove(path);
+
+    EXPECT_EQ(h->_response, R"({"status":"stored"})");
+    EXPECT_EQ(mock.uploaded_body.size(), content.size());
+    EXPECT_TRUE(mock.uploaded_body == content);
+}
+
+TEST_F(HttpClientIntegrationTest, DownloadHashedWhileStreaming)
+{
+    auto path = std::filesystem::temp_directory_path() / "-test-streamed_hash-sync.bin";
+    auto h = std::make_unique<RequestHandle>();
+    curl_easy_setopt(h->_curl, CURLOPT_URL, "http://127.0.0.1:8081/large");
+    h->setCommonCURLOpt();
+    h->setFileStream(path, std::ios::out);
+    h->addHasher(HashKind::Xxh64);
+    h->addHasher(HashKind::Md5);
+    h->addHasher(HashKind::DropboxContentHash);
+
+    HttpClient::get().syncRequest(h);
+    h->_iofd.close();
+
+    std::string expected(512 * 1024, 'x');
+    EXPECT_EQ(h->_hashers.bytesHashed(), expected.size());
+    EXPECT_EQ(h->_hashers.xxh64(), XXH64(expected.data(), expected.size(), 0));
+    EXPECT_EQ(h->_hashers.hexDigest(HashKind::Md5), "9c590b6d329dd99db440640af072b28c");
+    EXPECT_EQ(h->_hashers.hexDigest(HashKind::DropboxContentHash), "9703860a86fada01e3e2befa9585daf01de245e69794586676181e4ffefbd285");
+    EXPECT_EQ(std::filesystem::file_size(path), expected.size());
+    std::filesystem::remove(path);
+}
+
+static void waitForPipeline() {
+    for (int i = 0; i < 5; ++i) {
+        HttpClient::get().waitUntilIdle();
+        CallbackDispatcher::get().waitUntilIdle();
+    }
+}
+
+static std::unique_ptr<FileRecordDTO> downloadDto(const std::string& md5) {
+    return std::make_unique<FileRecordDTO>(
+        EntryType::File, "large.bin", "cloud-large", 512 * 1024, std::time(nullptr), md5, 7);
+}
+
+TEST_F(HttpClientIntegrationTest, DownloadCommandCarriesVerifiedDigests)
+{
+    auto path = std::filesystem::temp_directory_path() / "-test-streamed_hash-verified.bin";
+    auto cloud = std::make_shared<FakeDownloadStorage>(path);
+    HttpClient::get().setClouds({ { 7, cloud } });
+    CallbackDispatcher::get().setClouds({ { 7, cloud } });
+
+    auto received = std::make_shared<std::optional<FileRecordDTO>>();
+    auto command = std::make_unique<CloudDownloadNewCommand>(7);
+    command->setDTO(downloadDto("9c590b6d329dd99db440640af072b28c"));
+    command->addNext(std::make_unique<ProbeCommand>(7, received));
+    HttpClient::get().submit(std::move(command));
+    waitForPipeline();
+    HttpClient::get().setClouds({});
+    CallbackDispatcher::get().setClouds({});
+    std::filesystem::remove(path);
+
+    std::string expected(512 * 1024, 'x');
+    EXPECT_EQ(mock.large, 1);
+    ASSERT_TRUE(received->has_value());
+    EXPECT_EQ((*received)->streamed_hash, XXH64(expected.data(), expected.size(), 0));
+    EXPECT_EQ((*received)->streamed_cloud_hash, "9c590b6d329dd99db440640af072b28c");
+}
+
+TEST_F(HttpClientIntegrationTest, DownloadCommandChecksumMismatchRedownloads)
+{
+    auto path = std::filesystem::temp_directory_path() / "-test-streamed_hash-mismatch.bin";
+    auto cloud = std::make_shared<FakeDownloadStorage>(path);
+    HttpClient::get().setClouds({ { 7, cloud } });
+    CallbackDispatcher::get().setClouds({ { 7, cloud } });
+
+    auto received = std::make_shared<std::optional<FileRecordDTO>>();
+    auto command = std::make_unique<CloudDownloadNewCommand>(7);
+    command->setDTO(downloadDto("00000000000000000000000000000000"));
+    command->addNext(std::make_unique<ProbeCommand>(7, received));
+    HttpClient::get().submit(std::move(command));
+    waitForPipeline();
+    HttpClient::get().setClouds({});
+    CallbackDispatcher::get().setClouds({});
+    std::filesystem::remove(path);
+
+    EXPECT_EQ(mock.large, 3);
+    EXPECT_FALSE(received->has_value());
+}
+
+TEST_F(HttpClientIntegrationTest, LargeDownloadFetchesParallelRanges)
+{
+    HttpClient::get().setRangedDownloads(8 * 1024 * 1024, 4);
+    EXPECT_EQ(HttpClient::get().downloadRanges(7, 1024 * 1024), 1u);
+    EXPECT_EQ(HttpClient::get().downloadRanges(7, mock.ranged_body.size()), 4u);
+
+    auto md5 = IContentHasher::create(HashKind::Md5);
+    md5->update(mock.ranged_body.data(), mock.ranged_body.size());
+    std::string digest = md5->hexDigest();
+
+    auto path = std::filesystem::temp_directory_path() / "-test-ranged-download.bin";
+    auto cloud = std::make_shared<FakeUrlDownloadStorage>(path, "http://127.0.0.1:8081/ranged", true);
+    HttpClient::get().setClouds({ { 7, cloud } });
+    CallbackDispatcher::get().setClouds({ { 7, cloud } });
+
+    auto received = std::make_shared<std::optional<FileRecordDTO>>();
+    auto command = std::make_unique<CloudDownloadNewCommand>(7);
+    command->setDTO(std::make_unique<FileRecordDTO>(
+        EntryType::File, "ranged.bin", "cloud-ranged", mock.ranged_body.size(), std::time(nullptr), digest, 7));
+    command->addNext(std::make_unique<ProbeCommand>(7, received));
+    HttpClient::get().submit(std::move(command));
+    waitForPipeline();
+    HttpClient::get().setClouds({});
+    CallbackDispatcher::get().setClouds({});
+
+    std::ifstream in(path, std::ios::binary);
+    std::string downloaded((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    in.close();
+    std::filesystem::remove(path);
+
+    EXPECT_EQ(mock.ranged_requests, 4);
+    EXPECT_EQ(mock.ranged_full, 0);
+    EXPECT_TRUE(downloaded == mock.ranged_body);
+    ASSERT_TRUE(received->has_value());
+    EXPECT_EQ((*received)->streamed_hash, XXH64(mock.ranged_body.data(), mock.ranged_body.size(), 0));
+    EXPECT_EQ((*received)->streamed_cloud_hash, digest);
+}
+
+TEST_F(HttpClientIntegrationTest, LostFirstRangeFailsTheDownload)
+{
+    HttpClient::get().setRangedDownloads(8 * 1024 * 1024, 4);
+
+    auto path = std::filesystem::temp_directory_path() / "-test-ranged-head-missing.bin";
+    auto cloud = std::make_shared<FakeUrlDownloadStorage>(path, "http://127.0.0.1:8081/ranged_head_missing", true);
+    HttpClient::get().setClouds({ { 7, cloud } });
+    CallbackDispatcher::get().setClouds({ { 7, cloud } });
+
+    auto change = std::make_shared<Change>(ChangeType::New, "ranged.bin", 0, 7);
+    bool completed = false;
+    change->setOnComplete([&completed](auto&&) { completed = true; });
+
+    auto received = std::make_shared<std::optional<FileRecordDTO>>();
+    auto command = std::make_unique<CloudDownloadNewCommand>(7);
+    command->setDTO(std::make_unique<FileRecordDTO>(
+        EntryType::File, "ranged.bin", "cloud-ranged", mock.ranged_body.size(), std::time(nullptr), "", 7));
+    command->addNext(std::make_unique<ProbeCommand>(7, received));
+    command->setOwner(change);
+    HttpClient::get().submit(std::move(command));
+    waitForPipeline();
+    HttpClient::get().setClouds({});
+    CallbackDispatcher::get().setClouds({});
+
+    EXPECT_TRUE(completed);
+    EXPECT_FALSE(received->has_value());
+    EXPECT_FALSE(std::filesystem::exists(path));
+    std::filesystem::remove(path);
+}
+
+TEST_F(HttpClientIntegrationTest, InterruptedDownloadResumesAfterWrittenBytes)
+{
+    std::string expected = mock.ranged_body.substr(0, 1024 * 1024);
+    auto md5 = IContentHasher::create(HashKind::Md5);
+    md5->update(expected.data(), expected.size());
+    std::string digest = md5->hexDigest();
+
+    auto path = std::filesystem::temp_directory_path() / "-test-interrupted-download.bin";
+    auto cloud = std::make_shared<FakeUrlDownloadStorage>(path, "http://127.0.0.1:8081/interrupted", false);
+    HttpClient::get().setClouds({ { 7, cloud } });
+    CallbackDispatcher::get().setClouds({ { 7, cloud } });
+
+    auto received = std::make_shared<std::optional<FileRecordDTO>>();
+    auto command = std::make_unique<CloudDownloadNewCommand>(7);
+    command->setDTO(std::make_unique<FileRecordDTO>(
+        EntryType::File, "interrupted.bin", "cloud-interrupted", expected.size(), std::time(nullptr), digest, 7));
+    command->addNext(std::make_unique<ProbeCommand>(7, received));
+    HttpClient::get().submit(std::move(command));
+    waitForPipeline();
+    HttpClient::get().setClouds({});
+    CallbackDispatcher::get().setClouds({});
+
+    std::ifstream in(path, std::ios::binary);
+    std::string downloaded((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    in.close();
+    std::filesystem::remove(path);
+
+    ASSERT_EQ(mock.download_ranges.size(), 2u);
+    EXPECT_EQ(mock.download_ranges[0], "");
+    EXPECT_EQ(mock.download_ranges[1], "bytes=" + std::to_string(expected.size() / 2) + "-");
+    EXPECT_TRUE(downloaded == expected);
+    ASSERT_TRUE(received->has_value());
+    EXPECT_EQ((*received)->streamed_hash, XXH64(expected.data(), expected.size(), 0));
+    EXPECT_EQ((*received)->streamed_cloud_hash, digest);
+}
+
+TEST_F(HttpClientIntegrationTest, AsyncDownloadRespectsBandwidthLimit)
+{
+    HttpClient::get().setBandwidthLimit(TrafficDirection::Download, 512 * 1024);
+    auto start = std::chrono::steady_clock::now();
+    HttpClient::get().submit(std::make_unique<SimpleCommand>(
+        0, "http://127.0.0.1:8081/large", "LARGE"));
+    HttpClient::get().submit(std::make_unique<SimpleCommand>(
+        0, "http://127.0.0.1:8081/async", "ASYNC"));
+    HttpClient::get().waitUntilIdle();
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    HttpClient::get().setBandwidthLimit(TrafficDirection::Download, 0);
+
+    EXPECT_EQ(mock.large, 1);
+    EXPECT_EQ(mock.async_ok, 1);
+    EXPECT_GE(elapsed, std::chrono::milliseconds(700));
+    EXPECT_LT(elapsed, std::chrono::milliseconds(3000));
+}
+
+TEST_F(HttpClientIntegrationTest, BandwidthLimitLiftedAtRuntime)
+{
+    HttpClient::get().setBandwidthLimit(TrafficDirection::Download, 32 * 1024);
+    auto start = std::chrono::steady_clock::now();
+    HttpClient::get().submit(std::make_unique<SimpleCommand>(
+        0, "http://127.0.0.1:8081/large", "LARGE"));
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+
+    HttpClient::get().setBandwidthLimit(TrafficDirection::Download, 0);
+    HttpClient::get().waitUntilIdle();
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    EXPECT_EQ(mock.large, 1);
+    EXPECT_LT(elapsed, std::chrono::milliseconds(2000));
+}
+
+TEST_F(HttpClientIntegrationTest, AsyncUnauthorizedRequeuedAfterRefresh)
+{
+    auto cloud = std::make_shared<FakeAuthStorage>();
+    HttpClient::get().setClouds({ { 7, cloud } });
+    TokenManager::get().start({ { 7, cloud } });
+
+    HttpClient::get().submit(std::make_unique<SimpleCommand>(
+        7, "http://127.0.0.1:8081/auth", "AUTH", cloud->authorizationHeader()));
+    HttpClient::get().waitUntilIdle();
+    TokenManager::get().stop();
+    HttpClient::get().setClouds({});
+
+    EXPECT_EQ(mock.auth_rejected, 1);
+    EXPECT_EQ(mock.auth_ok, 1);
+    EXPECT_EQ(cloud->generation, 1u);
+}
+
+TEST_F(HttpClientIntegrationTest, AsyncUnauthorizedWithoutTokenManagerIsDropped)
+{
+    HttpClient::get().submit(std::make_unique<SimpleCommand>(
+        0, "http://127.0.0.1:8081/auth", "AUTH", "Authorization: Bearer stale"));
+    HttpClient::get().waitUntilIdle();
+
+    EXPECT_EQ(mock.auth_rejected, 1);
+    EXPECT_EQ(mock.auth_ok, 0);
+}
+
+TEST_F(HttpClientIntegrationTest, MetadataCommandsShareBatchRequests)
+{
+    auto cloud = std::make_shared<FakeBatchStorage>();
+    HttpClient::get().setClouds({ { 7, cloud } });
+    CallbackDispatcher::get().setClouds({ { 7, cloud } });
+    HttpClient::get().setBatchWindow(std::chrono::milliseconds(500));
+
+    for (int i = 0; i < 250; ++i) {
+        HttpClient::get().submit(deleteCommand("file" + std::to_string(i)));
+    }
+    waitForPipeline();
+    HttpClient::get().setBatchWindow(std::chrono::milliseconds(20));
+    HttpClient::get().setClouds({});
+    CallbackDispatcher::get().setClouds({});
+
+    EXPECT_EQ(mock.batches, 3);
+    EXPECT_EQ(mock.batch_parts, 250);
+    EXPECT_EQ(mock.single_deletes, 0);
+    EXPECT_EQ(HttpClient::get().batchedCommandsCount(), 250u);
+    ASSERT_EQ(cloud->deleted.size(), 250u);
+    EXPECT_EQ(cloud->deleted["file42"], R"({"id":"file42"})");
+}
+
+TEST_F(HttpClientIntegrationTest, FailedBatchPartIsSentSeparately)
+{
+    auto cloud = std::make_shared<FakeBatchStorage>();
+    HttpClient::get().setClouds({ { 7, cloud } });
+    CallbackDispatcher::get().setClouds({ { 7, cloud } });
+
+    HttpClient::get().submit(deleteCommand("file0"));
+    HttpClient::get().submit(deleteCommand("flaky1"));
+    HttpClient::get().submit(deleteCommand("file2"));
+    waitForPipeline();
+    HttpClient::get().setClouds({});
+    CallbackDispatcher::get().setClouds({});
+
+    EXPECT_EQ(mock.batches, 1);
+    EXPECT_EQ(mock.single_deletes, 1);
+    ASSERT_EQ(cloud->deleted.size(), 3u);
+    EXPECT_EQ(cloud->deleted["flaky1"], R"({"id":"flaky1"})");
+}
+
+TEST_F(HttpClientIntegrationTest, RejectedBatchPartFailsItsChange)
+{
+    auto cloud = std::make_shared<FakeBatchStorage>();
+    HttpClient::get().setClouds({ { 7, cloud } });
+    CallbackDispatcher::get().setClouds({ { 7, cloud } });
+
+    auto change = std::make_shared<Change>(ChangeType::Delete, "missing1", 0, 7);
+    bool completed = false;
+    change->setOnComplete([&completed](auto&&) { completed = true; });
+    auto rejected = deleteCommand("missing1");
+    rejected->setOwner(change);
+
+    HttpClient::get().submit(deleteCommand("file0"));
+    HttpClient::get().submit(std::move(rejected));
+    waitForPipeline();
+    HttpClient::get().setClouds({});
+    CallbackDispatcher::get().setClouds({});
+
+    EXPECT_EQ(mock.batches, 1);
+    EXPECT_EQ(mock.single_deletes, 0);
+    EXPECT_EQ(cloud->deleted.size(), 1u);
+    EXPECT_TRUE(completed);
+}
+
+TEST_F(HttpClientIntegrationTest, RejectedBatchRequestFailsEveryChange)
+{
+    auto cloud = std::make_shared<FailingBatchStorage>("http://127.0.0.1:8081/batch_400");
+    HttpClient::get().setClouds({ { 7, cloud } });
+    CallbackDispatcher::get().setClouds({ { 7, cloud } });
+
+    std::atomic<int> completed{ 0 };
+    for (const char* id : { "file0", "file1" }) {
+        auto change = std::make_shared<Change>(ChangeType::Delete, id, 0, 7);
+        change->setOnComplete([&completed](auto&&) { ++completed; });
+        auto command = deleteCommand(id);
+        command->setOwner(change);
+        HttpClient::get().submit(std::move(command));
+    }
+    waitForPipeline();
+    HttpClient::get().setClouds({});
+    CallbackDispatcher::get().setClouds({});
+
+    EXPECT_EQ(mock.batches, 1);
+    EXPECT_EQ(mock.single_deletes, 0);
+    EXPECT_EQ(completed, 2);
+}
+
+TEST_F(HttpClientIntegrationTest, DeadLetteredBatchFailsEveryChange)
+{
+    HttpClient::get().takeDeadLetters();
+    auto cloud = std::make_shared<FailingBatchStorage>("http://127.0.0.1:8081/batch_503");
+    HttpClient::get().setClouds({ { 7, cloud } });
+    CallbackDispatcher::get().setClouds({ { 7, cloud } });
+
+    std::atomic<int> completed{ 0 };
+    for (const char* id : { "file0", "file1" }) {
+        auto change = std::make_shared<Change>(ChangeType::Delete, id, 0, 7);
+        change->setOnComplete([&completed](auto&&) { ++completed; });
+        auto command = deleteCommand(id);
+        command->setOwner(change);
+        HttpClient::get().submit(std::move(command));
+    }
+    waitForPipeline();
+    HttpClient::get().setClouds({});
+    CallbackDispatcher::get().setClouds({});
+
+    auto dead = HttpClient::get().takeDeadLetters();
+    ASSERT_EQ(dead.size(), 1u);
+    EXPECT_EQ(completed, 0);
+    dead.front()->abandon();
+    EXPECT_EQ(completed, 2);
+    EXPECT_EQ(mock.single_deletes, 0);
+}
+
+TEST_F(HttpClientIntegrationTest, LoneMetadataCommandIsNotBatched)
+{
+    auto cloud = std::make_shared<FakeBatchStorage>();
+    HttpClient::get().setClouds({ { 7, cloud } });
+    CallbackDispatcher::get().setClouds({ { 7, cloud } });
+
+    HttpClient::get().submit(deleteCommand("file0"));
+    waitForPipeline();
+    HttpClient::get().setClouds({});
+    CallbackDispatcher::get().setClouds({});
+
+    EXPECT_EQ(mock.batches, 0);
+    EXPECT_EQ(mock.single_deletes, 1);
+    EXPECT_EQ(cloud->deleted.size(), 1u);
+}
+
+TEST_F(HttpClientIntegrationTest, DropboxDeletesCompleteFromAsyncBatchJob)
+{
+    auto cloud = std::make_shared<RecordingDropbox>();
+    HttpClient::get().setClouds({ { 7, cloud } });
+    CallbackDispatcher::get().setClouds({ { 7, cloud } });
+    HttpClient::get().setBatchWindow(std::chrono::milliseconds(200));
+
+    HttpClient::get().submit(deleteCommand("file0"));
+    HttpClient::get().submit(deleteCommand("busy1"));
+    HttpClient::get().submit(deleteCommand("file2"));
+    waitForPipeline();
+    HttpClient::get().setBatchWindow(std::chrono::milliseconds(20));
+    HttpClient::get().setClouds({});
+    CallbackDispatcher::get().setClouds({});
+
+    EXPECT_EQ(mock.dropbox_batches, 1);
+    EXPECT_EQ(mock.dropbox_checks, 2);
+    EXPECT_EQ(mock.single_deletes, 1);
+    ASSERT_EQ(cloud->deleted.size(), 3u);
+    EXPECT_EQ(nlohmann::json::parse(cloud->deleted["file2"])["metadata"]["path_display"], "/SyncHarbor/file2");
+    EXPECT_EQ(nlohmann::json::parse(cloud->deleted["busy1"])["metadata"]["path_display"], "/SyncHarbor/busy1");
+}
+
+TEST_F(HttpClientIntegrationTest, DropboxBatchEntriesMapToSingleResponses)
+{
+    RecordingDropbox cloud;
+    RequestHandle handle;
+    handle._response = R"({".tag":"complete","entries":[
+        {".tag":"success","success":{".tag":"file","id":"id:a"}},
+        {".tag":"failure","failure":{".tag":"to","to":{".tag":"conflict"}}},
+        {".tag":"failure","failure":{".tag":"too_many_write_operations"}},
+        {".tag":"success","id":"id:d","content_hash":"abc"}
+    ]})";
+
+    auto result = cloud.proccesBatch(handle, 5);
+
+    EXPECT_FALSE(result.in_progress);
+    ASSERT_EQ(result.responses.size(), 5u);
+    EXPECT_EQ(result.responses[0]->status, 200);
+    EXPECT_EQ(nlohmann::json::parse(result.responses[0]->body)["metadata"]["id"], "id:a");
+    EXPECT_EQ(result.responses[1]->status, 409);
+    EXPECT_EQ(result.responses[2]->status, 429);
+    EXPECT_EQ(nlohmann::json::parse(result.responses[3]->body), nlohmann::json::parse(R"({"id":"id:d","content_hash":"abc"})"));
+    EXPECT_FALSE(result.responses[4].has_value());
+
+    handle._response = R"({".tag":"async_job_id","async_job_id":"job-9"})";
+    result = cloud.proccesBatch(handle, 1);
+    EXPECT_TRUE(result.in_progress);
+    EXPECT_EQ(result.async_job_id, "job-9");
+}
+
+struct ResumableTransferFixture {
+    std::filesystem::path dir = std::filesystem::temp_directory_path() / "-test-resumable_transfer-";
+    std::filesystem::path db_path = dir / "sync.db";
+    std::filesystem::path home = dir / "home";
+    std::string content;
+    std::shared_ptr<Database> db;
+    int cloud_id = 0;
+    int global_id = 0;
+
+    ResumableTransferFixture(CloudProviderType type, std::size_t size) {
+        std::filesystem::remove_all(dir);
+        std::filesystem::create_directories(home);
+        for (std::size_t i = 0; i < size; ++i) {
+            content += static_cast<char>(i * 31 % 251);
+        }
+        std::ofstream(home / "big.bin", std::ios::binary) << content;
+
+        db = std::make_shared<Database>(db_path.string());
+        cloud_id = db->add_cloud("cloud", type, nlohmann::json::object());
+        global_id = db->add_file(FileRecordDTO{ EntryType::File, "big.bin", content.size(), 0, 0, 1 });
+        CallbackDispatcher::get().setDB(db_path.string());
+    }
+
+    ~ResumableTransferFixture() {
+        HttpClient::get().setClouds({});
+        CallbackDispatcher::get().setClouds({});
+        std::filesystem::remove_all(dir);
+    }
+
+    void attach(const std::shared_ptr<BaseStorage>& cloud) {
+        HttpClient::get().setClouds({ { cloud_id, cloud } });
+        CallbackDispatcher::get().setClouds({ { cloud_id, cloud } });
+    }
+
+    void saveSession(const std::string& session_id, std::uint64_t offset) {
+        db->saveUploadSession(UploadSessionDTO{
+            cloud_id, "big.bin", session_id, offset, content.size(), convertSystemTime(home / "big.bin") });
+    }
+
+    std::shared_ptr<std::optional<FileRecordDTO>> upload() {
+        auto dto = std::make_unique<FileRecordDTO>(EntryType::File, "big.bin", content.size(), 0, 0, 1);
+        dto->global_id = global_id;
+        dto->cloud_parent_id = "root-id";
+
+        auto received = std::make_shared<std::optional<FileRecordDTO>>();
+        auto command = std::make_unique<CloudUploadCommand>(cloud_id);
+        command->setDTO(std::move(dto));
+        command->addNext(std::make_unique<ProbeCommand>(cloud_id, received));
+        HttpClient::get().submit(std::move(command));
+        for (int i = 0; i < 20 && !received->has_value(); ++i) {
+            waitForPipeline();
+        }
+        return received;
+    }
+
+    std::shared_ptr<std::optional<FileRecordDTO>> download(const std::string& revision) {
+        auto received = std::make_shared<std::optional<FileRecordDTO>>();
+        auto command = std::make_unique<CloudDownloadNewCommand>(cloud_id);
+        command->setDTO(std::make_unique<FileRecordDTO>(
+            EntryType::File, "remote.bin", "id:remote", content.size(), std::time(nullptr), revision, cloud_id));
+        command->addNext(std::make_unique<ProbeCommand>(cloud_id, received));
+        HttpClient::get().submit(std::move(command));
+        waitForPipeline();
+        return received;
+    }
+
+    std::string downloaded() const {
+        std::ifstream in(home / ".-tmp-SyncHarbor-remote.bin", std::ios::binary);
+        return std::string((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    }
+};
+
+static std::shared_ptr<GoogleDrive> resumableDrive(const ResumableTransferFixture& fixture) {
+    auto cloud = std::make_shared<GoogleDrive>("id", "secret", "", "/SyncHarbor", fixture.home, fixture.db, fixture.cloud_id, "", true);
+    cloud->setTestApiBaseUrl("http://127.0.0.1:8081");
+    cloud->setUploadChunking(256 * 1024, 256 * 1024);
+    return cloud;
+}
+
+static std::shared_ptr<Dropbox> sessionDropbox(const ResumableTransferFixture& fixture) {
+    auto cloud = std::make_shared<Dropbox>("id", "secret", "/SyncHarbor", fixture.home, fixture.db, fixture.cloud_id);
+    cloud->setTestApiBaseUrl("http://127.0.0.1:8081");
+    cloud->setUploadChunking(1024 * 1024, 4 * 1024 * 1024, 3);
+    return cloud;
+}
+
+TEST_F(HttpClientIntegrationTest, GoogleResumableUploadSendsChunksAndRetriesOnlyFailedOne)
+{
+    ResumableTransferFixture fixture(CloudProviderType::GoogleDrive, 1024 * 1024 + 100);
+    fixture.attach(resumableDrive(fixture));
+    mock.session_fail_chunk = 2;
+
+    auto received = fixture.upload();
+
+    EXPECT_EQ(mock.session_starts, 1);
+    EXPECT_EQ(mock.session_queries, 0);
+    EXPECT_EQ(mock.session_chunks, 6);
+    EXPECT_EQ(mock.session_bytes, fixture.content);
+    ASSERT_TRUE(received->has_value());
+    EXPECT_EQ((*received)->cloud_file_id, "file-1");
+    EXPECT_EQ(fixture.db->getUploadSession(fixture.cloud_id, "big.bin"), nullptr);
+}
+
+TEST_F(HttpClientIntegrationTest, GoogleResumableUploadContinuesPersistedSession)
+{
+    ResumableTransferFixture fixture(CloudProviderType::GoogleDrive, 1024 * 1024 + 100);
+    fixture.attach(resumableDrive(fixture));
+    mock.session_bytes = fixture.content.substr(0, 512 * 1024);
+    fixture.saveSession("http://127.0.0.1:8081/session/upload-1", 0);
+
+    auto received = fixture.upload();
+
+    EXPECT_EQ(mock.session_starts, 0);
+    EXPECT_EQ(mock.session_queries, 1);
+    EXPECT_EQ(mock.session_chunks, 3);
+    EXPECT_EQ(mock.session_bytes, fixture.content);
+    ASSERT_TRUE(received->has_value());
+    EXPECT_EQ(fixture.db->getUploadSession(fixture.cloud_id, "big.bin"), nullptr);
+}
+
+TEST_F(HttpClientIntegrationTest, DropboxSessionAppendsChunksConcurrently)
+{
+    ResumableTransferFixture fixture(CloudProviderType::Dropbox, 4 * 4 * 1024 * 1024 + 100);
+    fixture.attach(sessionDropbox(fixture));
+
+    auto received = fixture.upload();
+
+    EXPECT_EQ(mock.dropbox_session_starts, 1);
+    EXPECT_EQ(mock.dropbox_appends, 5);
+    EXPECT_EQ(mock.dropbox_finishes, 1);
+    EXPECT_GT(mock.max_appends_in_flight, 1);
+    EXPECT_LE(mock.max_appends_in_flight, 3);
+    EXPECT_EQ(mock.session_bytes, fixture.content);
+    ASSERT_TRUE(received->has_value());
+    EXPECT_EQ((*received)->cloud_file_id, "id:big");
+    EXPECT_EQ(fixture.db->getUploadSession(fixture.cloud_id, "big.bin"), nullptr);
+}
+
+TEST_F(HttpClientIntegrationTest, DropboxSessionResumesFromPersistedOffset)
+{
+    ResumableTransferFixture fixture(CloudProviderType::Dropbox, 3 * 4 * 1024 * 1024 + 100);
+    fixture.attach(sessionDropbox(fixture));
+    mock.appended[0] = fixture.content.substr(0, 4 * 1024 * 1024);
+    mock.appended[4 * 1024 * 1024] = fixture.content.substr(4 * 1024 * 1024, 4 * 1024 * 1024);
+    fixture.saveSession("dbx-session", 4 * 1024 * 1024);
+
+    auto received = fixture.upload();
+
+    EXPECT_EQ(mock.dropbox_session_starts, 0);
+    EXPECT_EQ(mock.dropbox_appends, 3);
+    EXPECT_EQ(mock.dropbox_finishes, 1);
+    EXPECT_EQ(mock.session_bytes, fixture.content);
+    ASSERT_TRUE(received->has_value());
+    EXPECT_EQ(fixture.db->getUploadSession(fixture.cloud_id, "big.bin"), nullptr);
+}
+
+static std::string dropboxContentHash(const std::string& content) {
+    auto hasher = IContentHasher::create(HashKind::DropboxContentHash);
+    hasher->update(content.data(), content.size());
+    return hasher->hexDigest();
+}
+
+TEST_F(HttpClientIntegrationTest, DropboxDownloadResumesPersistedPartialFile)
+{
+    ResumableTransferFixture fixture(CloudProviderType::Dropbox, 9 * 1024 * 1024);
+    fixture.attach(sessionDropbox(fixture));
+    mock.download_body = fixture.content;
+    std::string revision = dropboxContentHash(fixture.content);
+    std::uint64_t partial = 5 * 1024 * 1024;
+
+    auto tmp_path = fixture.home / ".-tmp-SyncHarbor-remote.bin";
+    std::ofstream(tmp_path, std::ios::binary) << fixture.content.substr(0, partial);
+    fixture.db->saveDownloadProgress(DownloadProgressDTO{ fixture.cloud_id, "remote.bin", tmp_path, revision, 0, fixture.content.size() });
+
+    auto received = fixture.download(revision);
+
+    ASSERT_EQ(mock.download_ranges.size(), 1u);
+    EXPECT_EQ(mock.download_ranges[0], "bytes=" + std::to_string(partial) + "-");
+    EXPECT_TRUE(fixture.downloaded() == fixture.content);
+    ASSERT_TRUE(received->has_value());
+    EXPECT_EQ((*received)->streamed_hash, XXH64(fixture.content.data(), fixture.content.size(), 0));
+    EXPECT_EQ((*received)->streamed_cloud_hash, revision);
+    EXPECT_EQ(fixture.db->getDownloadProgress(fixture.cloud_id, "remote.bin"), nullptr);
+}
+
+TEST_F(HttpClientIntegrationTest, DropboxDownloadStartsOverWhenRemoteChanged)
+{
+    ResumableTransferFixture fixture(CloudProviderType::Dropbox, 9 * 1024 * 1024);
+    fixture.attach(sessionDropbox(fixture));
+    mock.download_body = fixture.content;
+    std::string revision = dropboxContentHash(fixture.content);
+
+    auto tmp_path = fixture.home / ".-tmp-SyncHarbor-remote.bin";
+    std::ofstream(tmp_path, std::ios::binary) << std::string(5 * 1024 * 1024, 'o');
+    fixture.db->saveDownloadProgress(DownloadProgressDTO{ fixture.cloud_id, "remote.bin", tmp_path, "old-revision", 0, fixture.content.size() });
+
+    auto received = fixture.download(revision);
+
+    ASSERT_EQ(mock.download_ranges.size(), 1u);
+    EXPECT_EQ(mock.download_ranges[0], "");
+    EXPECT_TRUE(fixture.downloaded() == fixture.content);
+    ASSERT_TRUE(received->has_value());
+    EXPECT_EQ((*received)->streamed_cloud_hash, revision);
+    EXPECT_EQ(fixture.db->getDownloadProgress(fixture.cloud_id, "remote.bin"), nullptr);
+}
+
+TEST_F(HttpClientIntegrationTest, OpenDownloadDoesNotWaitForQueuedCallbacks)
+{
+    ResumableTransferFixture fixture(CloudProviderType::Dropbox, 9 * 1024 * 1024);
+    auto cloud = sessionDropbox(fixture);
+    fixture.attach(cloud);
+    auto dto = std::make_unique<FileRecordDTO>(
+        EntryType::File, "remote.bin", "id:remote", fixture.content.size(), std::time(nullptr), dropboxContentHash(fixture.content), fixture.cloud_id);
+
+    std::promise<void> release;
+    auto released = release.get_future().share();
+    auto blocker = CallbackDispatcher::get().submitDbWrite(ICommand::entryKey(dto->global_id, dto->rel_path), [released](const std::unique_ptr<Database>&) {
+        released.wait();
+        });
+
+    auto opened = std::async(std::launch::async, [&cloud, &dto] { return cloud->openDownload(dto); });
+    bool returned = opened.wait_for(std::chrono::seconds(2)) == std::future_status::ready;
+    release.set_value();
+    EXPECT_TRUE(returned);
+    EXPECT_NE(opened.get(), nullptr);
+    blocker.get();
+    CallbackDispatcher::get().waitUntilIdle();
+
+    EXPECT_NE(fixture.db->getDownloadProgress(fixture.cloud_id, "remote.bin"), nullptr);
+}
+
+static std::string dropboxListingPage(int first, int count, const std::string& cursor, bool has_more) {
+    nlohmann::json entries = nlohmann::json::array();
+    for (int i = first; i < first + count; ++i) {
+        entries.push_back({
+            { ".tag", "file" },
+            { "id", "id:" + std::to_string(i) },
+            { "path_display", "/SyncHarbor/f" + std::to_string(i) },
+            { "server_modified", "2024-01-01T00:00:00Z" },
+            { "size", 1 },
+            { "content_hash", "h" + std::to_string(i) }
+        });
+    }
+    return nlohmann::json{ { "entries", entries }, { "cursor", cursor }, { "has_more", has_more } }.dump();
+}
+
+TEST_F(HttpClientIntegrationTest, DropboxInitialFilesStreamsEveryPage)
+{
+    ResumableTransferFixture fixture(CloudProviderType::Dropbox, 0);
+    mock.listing_pages[""] = dropboxListingPage(0, 2, "l1", true);
+    mock.listing_pages["l1"] = dropboxListingPage(2, 1, "l2", false);
+
+    auto files = sessionDropbox(fixture)->initialFiles();
+
+    EXPECT_EQ(mock.listing_cursors, (std::vector<std::string>{ "", "l1" }));
+    ASSERT_EQ(files.size(), 3u);
+    EXPECT_EQ(files[0]->rel_path, "f0");
+    EXPECT_EQ(files[2]->rel_path, "f2");
+    EXPECT_EQ(files[2]->cloud_file_id, "id:2");
+    EXPECT_EQ(std::get<std::string>(files[2]->cloud_hash_check_sum), "h2");
+}
+
+TEST_F(HttpClientIntegrationTest, DropboxChangeFeedPausesAtPendingBatchLimit)
+{
+    ResumableTransferFixture fixture(CloudProviderType::Dropbox, 0);
+    mock.listing_pages["c0"] = dropboxListingPage(0, 3, "c1", true);
+    mock.listing_pages["c1"] = dropboxListingPage(3, 3, "c2", true);
+    mock.listing_pages["c2"] = dropboxListingPage(6, 1, "c3", false);
+
+    auto cloud = sessionDropbox(fixture);
+    cloud->setChangeBatching(2, 2);
+    int notified = 0;
+    cloud->setOnChange([&notified] { ++notified; });
+
+    std::vector<std::size_t> batch_sizes;
+    std::vector<std::string> paths;
+    for (int poll = 0; poll < 5 && (poll == 0 || cloud->hasMoreChanges()); ++poll) {
+        cloud->getChanges();
+        while (cloud->hasChanges()) {
+            auto changes = cloud->proccessChanges();
+            batch_sizes.push_back(changes.size());
+            for (const auto& change : changes) {
+                paths.push_back(change->getTargetPath().string());
+            }
+        }
+    }
+
+    EXPECT_EQ(mock.listing_cursors, (std::vector<std::string>{ "c0", "c1", "c2" }));
+    EXPECT_EQ(batch_sizes, (std::vector<std::size_t>{ 2, 1, 2, 1, 1 }));
+    EXPECT_EQ(paths, (std::vector<std::string>{ "f0", "f1", "f2", "f3", "f4", "f5", "f6" }));
+    EXPECT_EQ(notified, 3);
+    EXPECT_FALSE(cloud->hasMoreChanges());
+}
+
+TEST_F(HttpClientShardedIntegrationTest, ShardCountApplied)
+{
+    EXPECT_EQ(HttpClient::get().shardCount(), 3);
+    HttpClient::get().setShardCount(5);
+    EXPECT_EQ(HttpClient::get().shardCount(), 3);
+}
+
+TEST_F(HttpClientShardedIntegrationTest, AsyncPipelineAcrossShards)
+{
+    HttpClient::get().setShardAssignment(ShardAssignment::ByLoad);
+    for (int i = 0; i < 30; ++i) {
+        HttpClient::get().submit(std::make_unique<SimpleCommand>(
+            i % 2, "http://127.0.0.1:8081/async", "ASYNC"));
+    }
+    HttpClient::get().waitUntilIdle();
+    EXPECT_TRUE(HttpClient::get().isIdle());
+    EXPECT_EQ(mock.async_ok, 30);
+}
+
+TEST_F(HttpClientShardedIntegrationTest, AsyncRetryByCloudAssignment)
+{
+    HttpClient::get().setShardAssignment(ShardAssignment::ByCloud);
+    HttpClient::get().submit(std::make_unique<SimpleCommand>(
+        1, "http://127.0.0.1:8081/retry_after", "RETRY-AFTER"));
+    HttpClient::get().submit(std::make_unique<SimpleCommand>(
+        2, "http://127.0.0.1:8081/async", "ASYNC"));
+    HttpClient::get().waitUntilIdle();
+
+    EXPECT_EQ(mock.retry_after, 2);
+    EXPECT_EQ(mock.async_ok, 1);
+}
+
 TEST_F(HttpClientIntegrationTest, CleanShutdown)
 {
     HttpClient::get().shutdown();
     HttpClient::get().shutdown();
     SUCCEED();
 }
+
+class HttpClientMultiplexBenchmark : public ::testing::Test {
+protected:
+    static constexpr int PORT = 18443;
+    static constexpr int REQUESTS = 300;
+
+    pid_t _server = -1;
+    std::filesystem::path _root = std::filesystem::temp_directory_path() / "-test-h2-root-";
+
+    void SetUp() override {
+        std::filesystem::create_directories(_root);
+        std::ofstream(_root / "small.json") << R"({"status":"ok"})";
+
+        std::string make_cert = "openssl req -x509 -newkey rsa:2048 -nodes -days 1 -subj /CN=localhost"
+            " -keyout " + (_root / "key.pem").string() + " -out " + (_root / "cert.pem").string() + " >/dev/null 2>&1";
+        if (std::system(make_cert.c_str()) != 0) {
+            GTEST_SKIP() << "openssl is not available, skipping HTTP/2 benchmark";
+        }
+
+        _server = fork();
+        if (_server == 0) {
+            execlp("nghttpd", "nghttpd", "-d", _root.c_str(), std::to_string(PORT).c_str(),
+                (_root / "key.pem").c_str(), (_root / "cert.pem").c_str(), nullptr);
+            _exit(127);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(300));
+        int status = 0;
+        if (_server < 0 || waitpid(_server, &status, WNOHANG) != 0) {
+            _server = -1;
+            GTEST_SKIP() << "nghttpd is not available, skipping HTTP/2 benchmark";
+        }
+
+        CallbackDispatcher::get().start();
+        HttpClient::get().start();
+        HttpClient::get().setClouds({ { 7, std::make_shared<FakeHttp2Storage>() } });
+    }
+
+    void TearDown() override {
+        if (_server > 0) {
+            HttpClient::get().waitUntilIdle();
+            CallbackDispatcher::get().waitUntilIdle();
+            HttpClient::get().setClouds({});
+            HttpClient::get().setConnectionLimits(ConnectionLimits{});
+            HttpClient::get().shutdown();
+            kill(_server, SIGTERM);
+            waitpid(_server, nullptr, 0);
+        }
+        std::filesystem::remove_all(_root);
+    }
+
+    struct Result {
+        double requests_per_second;
+        std::uint64_t connections;
+        std::uint64_t transfers;
+    };
+
+    Result run(const ConnectionLimits& limits) {
+        HttpClient::get().setConnectionLimits(limits);
+
+        auto opened = HttpClient::get().openedConnectionsCount();
+        auto transfers = HttpClient::get().transfersCount();
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < REQUESTS; ++i) {
+            HttpClient::get().submit(std::make_unique<Http2Command>(
+                7, "https://127.0.0.1:" + std::to_string(PORT) + "/small.json"));
+        }
+        HttpClient::get().waitUntilIdle();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        return Result{
+            REQUESTS / std::max(seconds, 1e-9),
+            HttpClient::get().openedConnectionsCount() - opened,
+            HttpClient::get().transfersCount() - transfers
+        };
+    }
+};
+
+TEST_F(HttpClientMultiplexBenchmark, MultiplexedStreamsShareFewConnections)
+{
+    ConnectionLimits multiplexed{ .multiplex = true, .max_host_connections = 4, .max_total_connections = 16, .max_concurrent_streams = 100 };
+    ConnectionLimits separate{ .multiplex = false, .max_host_connections = 0, .max_total_connections = 0, .max_concurrent_streams = 100 };
+
+    auto with_streams = run(multiplexed);
+    auto without_streams = run(separate);
+
+    std::cout << "[ BENCHMARK ] multiplexed: " << with_streams.requests_per_second << " req/s over "
+        << with_streams.connections << " connections" << std::endl;
+    std::cout << "[ BENCHMARK ] one stream per connection: " << without_streams.requests_per_second << " req/s over "
+        << without_streams.connections << " connections" << std::endl;
+
+    EXPECT_EQ(with_streams.transfers, static_cast<std::uint64_t>(REQUESTS));
+    EXPECT_EQ(without_streams.transfers, static_cast<std::uint64_t>(REQUESTS));
+    EXPECT_LE(with_streams.connections, static_cast<std::uint64_t>(std::max(4, HttpClient::get().shardCount())));
+    EXPECT_LT(with_streams.connections, without_streams.connections);
+}
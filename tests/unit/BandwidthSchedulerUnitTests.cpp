@@ -0,0 +1,84 @@
+#include <gtest/gtest.h>
+#include "bandwidth-scheduler.h"
+
+using namespace std::chrono_literals;
+
+class BandwidthSchedulerUnitTest : public ::testing::Test {
+protected:
+    BandwidthScheduler scheduler;
+    BandwidthScheduler::Clock::time_point t0;
+
+    void SetUp() override {
+        scheduler.setLimit(TrafficDirection::Download, 1000000);
+        t0 = BandwidthScheduler::Clock::now();
+    }
+};
+
+TEST_F(BandwidthSchedulerUnitTest, UnlimitedDirectionNeverWaits) {
+    EXPECT_TRUE(scheduler.isLimited());
+    EXPECT_EQ(scheduler.getLimit(TrafficDirection::Upload), 0u);
+    EXPECT_EQ(scheduler.consume(TrafficClass::Bulk, TrafficDirection::Upload, 1ull << 30, t0), 0ns);
+    EXPECT_EQ(scheduler.waitTime(TrafficClass::Bulk, TrafficDirection::Upload, t0), 0ns);
+}
+
+TEST_F(BandwidthSchedulerUnitTest, ConsumeBeyondTokensReturnsWait) {
+    auto wait = scheduler.consume(TrafficClass::Metadata, TrafficDirection::Download, 100000, t0);
+    EXPECT_GE(wait, 90ms);
+    EXPECT_LE(wait, 100ms);
+
+    EXPECT_GT(scheduler.waitTime(TrafficClass::Metadata, TrafficDirection::Download, t0), 0ns);
+    EXPECT_EQ(scheduler.waitTime(TrafficClass::Metadata, TrafficDirection::Download, t0 + wait + 1ms), 0ns);
+}
+
+TEST_F(BandwidthSchedulerUnitTest, ActiveClassesShareByWeight) {
+    scheduler.transferStarted(TrafficClass::Metadata);
+    scheduler.transferStarted(TrafficClass::Bulk);
+
+    EXPECT_DOUBLE_EQ(scheduler.classRate(TrafficClass::Metadata, TrafficDirection::Download), 800000.0);
+    EXPECT_DOUBLE_EQ(scheduler.classRate(TrafficClass::Bulk, TrafficDirection::Download), 200000.0);
+
+    scheduler.transferFinished(TrafficClass::Metadata);
+    EXPECT_DOUBLE_EQ(scheduler.classRate(TrafficClass::Bulk, TrafficDirection::Download), 1000000.0);
+}
+
+TEST_F(BandwidthSchedulerUnitTest, IdleClassesDoNotReserveBandwidth) {
+    scheduler.transferStarted(TrafficClass::InitialSync);
+    EXPECT_DOUBLE_EQ(scheduler.classRate(TrafficClass::InitialSync, TrafficDirection::Download), 1000000.0);
+
+    auto wait = scheduler.consume(TrafficClass::InitialSync, TrafficDirection::Download, 100000, t0);
+    EXPECT_LE(wait, 100ms);
+}
+
+TEST_F(BandwidthSchedulerUnitTest, CustomWeightChangesShare) {
+    scheduler.setWeight(TrafficClass::Bulk, 8);
+    scheduler.transferStarted(TrafficClass::Metadata);
+    scheduler.transferStarted(TrafficClass::Bulk);
+
+    EXPECT_EQ(scheduler.getWeight(TrafficClass::Bulk), 8u);
+    EXPECT_DOUBLE_EQ(scheduler.classRate(TrafficClass::Bulk, TrafficDirection::Download), 500000.0);
+}
+
+TEST_F(BandwidthSchedulerUnitTest, IdleBurstIsCapped) {
+    EXPECT_EQ(scheduler.consume(TrafficClass::Metadata, TrafficDirection::Download, 100000, t0 + 10s), 0ns);
+
+    auto wait = scheduler.consume(TrafficClass::Metadata, TrafficDirection::Download, 100000, t0 + 10s);
+    EXPECT_GE(wait, 99ms);
+    EXPECT_LE(wait, 101ms);
+}
+
+TEST_F(BandwidthSchedulerUnitTest, LimitChangeAppliesToWaitingTransfers) {
+    auto wait = scheduler.consume(TrafficClass::Bulk, TrafficDirection::Download, 500000, t0);
+    ASSERT_GT(wait, 400ms);
+
+    scheduler.setLimit(TrafficDirection::Download, 0);
+    EXPECT_FALSE(scheduler.isLimited());
+    EXPECT_EQ(scheduler.waitTime(TrafficClass::Bulk, TrafficDirection::Download, t0), 0ns);
+}
+
+TEST_F(BandwidthSchedulerUnitTest, DirectionsAreIndependent) {
+    scheduler.setLimit(TrafficDirection::Upload, 1000);
+    scheduler.consume(TrafficClass::Bulk, TrafficDirection::Upload, 1000000, t0);
+
+    EXPECT_GT(scheduler.waitTime(TrafficClass::Bulk, TrafficDirection::Upload, t0), 100s);
+    EXPECT_LE(scheduler.consume(TrafficClass::Bulk, TrafficDirection::Download, 10000, t0), 10ms);
+}
@@ -0,0 +1,107 @@
+// tests/unit/BatchRequestUnitTests.cpp
+
+#include <gtest/gtest.h>
+#include "batch-request.h"
+
+#include <string>
+#include <vector>
+
+namespace {
+    std::string responsePart(const std::string& boundary, const std::string& content_id, const std::string& status, const std::string& body, const std::string& eol = "\r\n") {
+        return "--" + boundary + eol +
+            "Content-Type: application/http" + eol +
+            "Content-ID: <" + content_id + ">" + eol + eol +
+            "HTTP/1.1 " + status + eol +
+            "Content-Type: application/json; charset=UTF-8" + eol + eol +
+            body + eol;
+    }
+}
+
+TEST(BatchRequestUnitTest, EncodesEveryPartAsHttpRequest) {
+    MultipartBatch batch("batch_test");
+    std::vector<BatchPart> parts{
+        { "PATCH", "/drive/v3/files/a", "application/json", R"({"trashed":true})", std::string{} },
+        { "GET", "/drive/v3/files/b?fields=id", "", "", std::string{} }
+    };
+
+    std::string body = batch.encode(parts);
+
+    EXPECT_EQ(batch.contentType(), "multipart/mixed; boundary=batch_test");
+    EXPECT_NE(body.find("--batch_test\r\nContent-Type: application/http\r\nContent-ID: <item0>\r\n\r\n"
+        "PATCH /drive/v3/files/a HTTP/1.1\r\nContent-Type: application/json\r\nContent-Length: 16\r\n\r\n"
+        "{\"trashed\":true}\r\n"), std::string::npos);
+    EXPECT_NE(body.find("Content-ID: <item1>\r\n\r\nGET /drive/v3/files/b?fields=id HTTP/1.1\r\n\r\n\r\n"), std::string::npos);
+    EXPECT_TRUE(body.ends_with("--batch_test--\r\n"));
+}
+
+TEST(BatchRequestUnitTest, GeneratedBoundariesDiffer) {
+    MultipartBatch first;
+    MultipartBatch second;
+
+    EXPECT_TRUE(first.boundary().starts_with("batch_"));
+    EXPECT_NE(first.boundary(), second.boundary());
+}
+
+TEST(BatchRequestUnitTest, DecodesResponsesByContentId) {
+    std::string body =
+        responsePart("resp", "response-item1", "404 Not Found", R"({"error":"missing"})") +
+        responsePart("resp", "response-item0", "200 OK", R"({"id":"a"})") +
+        "--resp--\r\n";
+
+    auto responses = MultipartBatch::decode("multipart/mixed; boundary=resp", body, 2);
+
+    ASSERT_EQ(responses.size(), 2u);
+    ASSERT_TRUE(responses[0].has_value());
+    EXPECT_EQ(responses[0]->status, 200);
+    EXPECT_EQ(responses[0]->body, R"({"id":"a"})");
+    ASSERT_TRUE(responses[1].has_value());
+    EXPECT_EQ(responses[1]->status, 404);
+    EXPECT_EQ(responses[1]->body, R"({"error":"missing"})");
+}
+
+TEST(BatchRequestUnitTest, DecodesBareLineFeedsAndQuotedBoundary) {
+    std::string body =
+        responsePart("resp", "response-item0", "200 OK", R"({"id":"a"})", "\n") +
+        "--resp--\n";
+
+    auto responses = MultipartBatch::decode(R"(multipart/mixed; boundary="resp")", body, 1);
+
+    ASSERT_TRUE(responses[0].has_value());
+    EXPECT_EQ(responses[0]->status, 200);
+    EXPECT_EQ(responses[0]->body, R"({"id":"a"})");
+}
+
+TEST(BatchRequestUnitTest, MissingPartsStayEmpty) {
+    std::string body =
+        responsePart("resp", "response-item2", "200 OK", "{}") +
+        responsePart("resp", "response-item7", "200 OK", "{}") +
+        "--resp--\r\n";
+
+    auto responses = MultipartBatch::decode("multipart/mixed; boundary=resp", body, 3);
+
+    EXPECT_FALSE(responses[0].has_value());
+    EXPECT_FALSE(responses[1].has_value());
+    EXPECT_TRUE(responses[2].has_value());
+}
+
+TEST(BatchRequestUnitTest, ResponseWithoutBoundaryDecodesNothing) {
+    auto responses = MultipartBatch::decode("application/json", R"({"error":"bad"})", 2);
+
+    ASSERT_EQ(responses.size(), 2u);
+    EXPECT_FALSE(responses[0].has_value());
+    EXPECT_FALSE(responses[1].has_value());
+}
+
+TEST(BatchRequestUnitTest, OverflowingContentIdFallsBackToPartOrder) {
+    std::string body =
+        responsePart("resp", "response-item99999999999999999999999", "200 OK", R"({"id":"a"})") +
+        responsePart("resp", "response-item1", "200 OK", R"({"id":"b"})") +
+        "--resp--\r\n";
+
+    auto responses = MultipartBatch::decode("multipart/mixed; boundary=resp", body, 2);
+
+    ASSERT_TRUE(responses[0].has_value());
+    EXPECT_EQ(responses[0]->body, R"({"id":"a"})");
+    ASSERT_TRUE(responses[1].has_value());
+    EXPECT_EQ(responses[1]->body, R"({"id":"b"})");
+}
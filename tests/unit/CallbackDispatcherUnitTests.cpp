@@ -3,6 +3,19 @@
 #include "DatabaseTestFixture.h"
 #include "BaseStorage.h"
 #include "commands.h"
+#include "change.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
 
 struct FakeStorage : BaseStorage {
     void proccesUpload(std::unique_ptr<FileRecordDTO>&, const std::string&) const override {}
@@ -43,6 +56,7 @@ public:
 
     int getId() const override { return _id; }
     std::string getTarget() const override { return "T"; }
+    std::string orderingKey() const override { return "T"; }
 
     void execute(const std::shared_ptr<BaseStorage>&) override {
         _executed = true;
@@ -81,15 +95,86 @@ private:
     std::atomic<bool> _called{ false };
 };
 
+class HookCommand : public ICommand {
+public:
+    HookCommand(std::string target, std::function<void()> prepare, std::function<void()> complete)
+        : _target(std::move(target)), _prepare(std::move(prepare)), _complete(std::move(complete)) {}
+
+    int getId() const override { return 42; }
+    std::string getTarget() const override { return _target; }
+    std::string orderingKey() const override { return _target; }
+    void execute(const std::shared_ptr<BaseStorage>&) override {}
+    void prepareCallback(const std::shared_ptr<BaseStorage>&) override { if (_prepare) _prepare(); }
+    void completionCallback(const std::unique_ptr<Database>&, const std::shared_ptr<BaseStorage>&) override { if (_complete) _complete(); }
+    void continueChain() override {}
+    void addNext(std::unique_ptr<ICommand>) override {}
+
+private:
+    std::string _target;
+    std::function<void()> _prepare;
+    std::function<void()> _complete;
+};
+
+// Asks to be parked and hands itself to the slot it was given.
+class ParkingCommand : public HookCommand {
+public:
+    explicit ParkingCommand(std::unique_ptr<ICommand>& slot) : HookCommand("P", nullptr, nullptr), _slot(slot) {}
+
+    bool needPark() const override { return true; }
+    bool needRepeat() const override { return true; }
+    void park(std::unique_ptr<ICommand> self) override { _slot = std::move(self); }
+
+private:
+    std::unique_ptr<ICommand>& _slot;
+};
+
+// Runs the hooks under the ordering key and log label of a real command.
+class MirrorCommand : public HookCommand {
+public:
+    MirrorCommand(const ICommand& real, std::function<void()> prepare, std::function<void()> complete)
+        : HookCommand(real.orderingKey(), std::move(prepare), std::move(complete)), _label(real.getTarget()) {}
+
+    std::string getTarget() const override { return _label; }
+
+private:
+    std::string _label;
+};
+
+// Two targets that land on different callback workers.
+static std::pair<std::string, std::string> targetsOnDifferentWorkers(std::size_t workers) {
+    std::string first = "first";
+    std::size_t shard = std::hash<std::string>{}(first) % workers;
+    for (int i = 0;; ++i) {
+        std::string second = "second" + std::to_string(i);
+        if (std::hash<std::string>{}(second) % workers != shard) {
+            return { first, second };
+        }
+    }
+}
+
+// A path whose file name, full path and id key land on three different callback workers.
+static std::filesystem::path pathOnDifferentWorkers(std::size_t workers, int global_id) {
+    auto shard = [workers](const std::string& key) { return std::hash<std::string>{}(key) % workers; };
+    for (int i = 0;; ++i) {
+        std::filesystem::path path = "dir/file" + std::to_string(i) + ".txt";
+        std::set<std::size_t> shards{ shard(path.filename().string()), shard(path.string()), shard(ICommand::entryKey(global_id, path)) };
+        if (shards.size() == 3) {
+            return path;
+        }
+    }
+}
+
 struct CallbackDispatcherUnitTest : public ::testing::Test {
     void TearDown() override {
         auto& disp = CallbackDispatcher::get();
         disp.finish();
+        disp.setGroupCommit(1, std::chrono::milliseconds(0));
         disp.setDB(std::make_shared<Database>(std::string{":memory:"}));
         disp.setClouds({});
     }
 
     void SetUp() override {
+        CallbackDispatcher::get().setWorkerCount(4);
     }
 };
 
@@ -126,6 +211,20 @@ TEST_F(CallbackDispatcherUnitTest, RepeatRequeues) {
     EXPECT_TRUE(raw->called());
 }
 
+TEST_F(CallbackDispatcherUnitTest, ParkedCommandIsHandedItsOwnership) {
+    auto& disp = CallbackDispatcher::get();
+    disp.setDB(std::make_shared<Database>(std::string{":memory:"}));
+    disp.start();
+
+    std::unique_ptr<ICommand> parked;
+    auto cmd = std::make_unique<ParkingCommand>(parked);
+    ICommand* raw = cmd.get();
+    disp.submit(std::move(cmd));
+
+    disp.waitUntilIdle();
+    EXPECT_EQ(parked.get(), raw);
+}
+
 TEST_F(CallbackDispatcherUnitTest, SyncDbWrite_RecordAndLink) {
     auto& disp = CallbackDispatcher::get();
     auto db_ptr = std::make_shared<Database>(std::string{":memory:"});
@@ -286,4 +385,382 @@ TEST_F(CallbackDispatcherUnitTest, SetDB_StringOverload) {
 
     disp.syncDbWrite(dto);
     ASSERT_GT(dto->global_id, 0);
-}
\ No newline at end of file
+}
+TEST_F(CallbackDispatcherUnitTest, CallbacksForSameTargetStayOrdered) {
+    auto& disp = CallbackDispatcher::get();
+    disp.setDB(std::make_shared<Database>(std::string{ ":memory:" }));
+    disp.setClouds({ {42, std::make_shared<FakeStorage>()} });
+    disp.start();
+
+    std::mutex mtx;
+    std::map<std::string, std::vector<int>> seen;
+    for (int i = 0; i < 200; ++i) {
+        std::string target = "file" + std::to_string(i % 5);
+        disp.submit(std::make_unique<HookCommand>(target, nullptr, [&mtx, &seen, target, i] {
+            std::lock_guard<std::mutex> lock(mtx);
+            seen[target].push_back(i);
+            }));
+    }
+    disp.waitUntilIdle();
+
+    ASSERT_EQ(seen.size(), 5u);
+    for (const auto& [target, order] : seen) {
+        ASSERT_EQ(order.size(), 40u);
+        EXPECT_TRUE(std::is_sorted(order.begin(), order.end())) << target;
+    }
+}
+
+TEST_F(CallbackDispatcherUnitTest, MixedCommandsForOneEntryStayOrdered) {
+    auto path = pathOnDifferentWorkers(CallbackDispatcher::get().workerCount(), 5);
+    auto updated = std::make_unique<CloudDownloadUpdateCommand>(42);
+    updated->setDTO(std::make_unique<FileUpdatedDTO>(EntryType::File, 5, 42, "cf", "hash", 0, path, "parent", 10));
+    auto deleted = std::make_unique<CloudDeleteCommand>(42);
+    deleted->setDTO(std::make_unique<FileDeletedDTO>(path, 5, 42, "cf", 0));
+    auto local = std::make_unique<LocalUpdateCommand>(0);
+    local->setDTO(std::make_unique<FileUpdatedDTO>(EntryType::File, 5, 1, 0, path, 10, 1));
+    auto moved = std::make_unique<CloudMoveCommand>(42);
+    moved->setDTO(std::make_unique<FileMovedDTO>(EntryType::File, 5, 42, "cf", 0, path, "c/b.txt", "parent", "other"));
+
+    EXPECT_EQ(updated->orderingKey(), deleted->orderingKey());
+    EXPECT_EQ(updated->orderingKey(), local->orderingKey());
+    EXPECT_EQ(updated->orderingKey(), moved->orderingKey());
+
+    // Untracked entries fall back to the normalized full path.
+    auto downloaded = std::make_unique<CloudDownloadNewCommand>(42);
+    downloaded->setDTO(std::make_unique<FileRecordDTO>(EntryType::File, "a/./b.txt", "cf", 10, 0, "hash", 42));
+    auto uploaded = std::make_unique<CloudUploadCommand>(42);
+    uploaded->setDTO(std::make_unique<FileRecordDTO>(EntryType::File, "a/b.txt", "cf", 10, 0, "hash", 42));
+    EXPECT_EQ(downloaded->orderingKey(), uploaded->orderingKey());
+    EXPECT_NE(downloaded->orderingKey(), ICommand::entryKey(0, "c/b.txt"));
+
+    auto& disp = CallbackDispatcher::get();
+    disp.setDB(std::make_shared<Database>(std::string{ ":memory:" }));
+    disp.setClouds({ {42, std::make_shared<FakeStorage>()} });
+    disp.start();
+
+    std::promise<void> release;
+    auto released = release.get_future().share();
+    std::mutex mtx;
+    std::vector<std::string> order;
+    auto record = [&mtx, &order](std::string name) {
+        return [&mtx, &order, name] {
+            std::lock_guard<std::mutex> lock(mtx);
+            order.push_back(name);
+        };
+    };
+    disp.submit(std::make_unique<MirrorCommand>(*updated, [released] { released.wait(); }, record("download-update")));
+    disp.submit(std::make_unique<MirrorCommand>(*local, nullptr, record("local-update")));
+    auto written = disp.submitDbWrite(ICommand::entryKey(5, path), [record](const std::unique_ptr<Database>&) { record("db-write")(); });
+    disp.submit(std::make_unique<MirrorCommand>(*moved, nullptr, record("move")));
+    disp.submit(std::make_unique<MirrorCommand>(*deleted, nullptr, record("delete")));
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    release.set_value();
+    written.get();
+    disp.waitUntilIdle();
+
+    EXPECT_EQ(order, (std::vector<std::string>{ "download-update", "local-update", "db-write", "move", "delete" }));
+}
+
+TEST_F(CallbackDispatcherUnitTest, PrepareRunsWhileAnotherCallbackHoldsDbLock) {
+    auto& disp = CallbackDispatcher::get();
+    disp.setDB(std::make_shared<Database>(std::string{ ":memory:" }));
+    disp.setClouds({ {42, std::make_shared<FakeStorage>()} });
+    disp.start();
+
+    auto [first, second] = targetsOnDifferentWorkers(disp.workerCount());
+    std::mutex mtx;
+    std::condition_variable cv;
+    bool completing = false;
+    bool prepared = false;
+    bool overlapped = false;
+
+    disp.submit(std::make_unique<HookCommand>(first, nullptr, [&] {
+        std::unique_lock<std::mutex> lock(mtx);
+        completing = true;
+        cv.notify_all();
+        overlapped = cv.wait_for(lock, std::chrono::seconds(5), [&] { return prepared; });
+        }));
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        ASSERT_TRUE(cv.wait_for(lock, std::chrono::seconds(5), [&] { return completing; }));
+    }
+    disp.submit(std::make_unique<HookCommand>(second, [&] {
+        std::lock_guard<std::mutex> lock(mtx);
+        prepared = true;
+        cv.notify_all();
+        }, nullptr));
+    disp.waitUntilIdle();
+
+    EXPECT_TRUE(overlapped);
+}
+
+TEST_F(CallbackDispatcherUnitTest, RestartedDispatcherRunsQueuedCallbacks) {
+    auto& disp = CallbackDispatcher::get();
+    disp.setDB(std::make_shared<Database>(std::string{ ":memory:" }));
+    disp.setClouds({ {42, std::make_shared<FakeStorage>()} });
+    disp.start();
+    disp.finish();
+
+    std::atomic<int> called{ 0 };
+    disp.submit(std::make_unique<HookCommand>("late", nullptr, [&called] { ++called; }));
+    EXPECT_FALSE(disp.isIdle());
+
+    disp.start();
+    disp.waitUntilIdle();
+
+    EXPECT_EQ(called, 1);
+}
+
+TEST_F(CallbackDispatcherUnitTest, GroupCommitClosesBatchAtSizeLimit) {
+    auto path = std::filesystem::temp_directory_path() / "-test-group_commit-.sqlite3";
+    for (const char* suffix : { "", "-wal", "-shm" }) {
+        std::filesystem::remove(path.string() + suffix);
+    }
+    auto db = std::make_shared<Database>(path);
+    Database observer(path);
+
+    auto& disp = CallbackDispatcher::get();
+    disp.setDB(db);
+    disp.setClouds({ {42, std::make_shared<FakeStorage>()} });
+    disp.setGroupCommit(2, std::chrono::seconds(5));
+    disp.start();
+
+    std::vector<std::string> targets;
+    std::set<std::size_t> shards;
+    for (int i = 0; targets.size() < disp.workerCount(); ++i) {
+        std::string target = "entry" + std::to_string(i);
+        if (shards.insert(std::hash<std::string>{}(target) % disp.workerCount()).second) {
+            targets.push_back(target);
+        }
+    }
+
+    std::mutex mtx;
+    std::condition_variable cv;
+    bool completing = false;
+    std::size_t prepared = 0;
+    std::vector<std::size_t> committed_before;
+
+    auto complete = [&](std::size_t idx) {
+        return [&, idx] {
+            if (idx == 0) {
+                std::unique_lock<std::mutex> lock(mtx);
+                completing = true;
+                cv.notify_all();
+                cv.wait_for(lock, std::chrono::seconds(5), [&] { return prepared == targets.size() - 1; });
+                lock.unlock();
+                // Let the prepared callbacks line up on the database lock.
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            }
+            std::size_t committed = 0;
+            for (const auto& target : targets) {
+                committed += observer.getFileByPath(target) != nullptr;
+            }
+            committed_before.push_back(committed);
+            FileRecordDTO dto{ EntryType::File, targets[idx], 1, 2, 3, idx + 1 };
+            db->add_file(dto);
+            };
+        };
+
+    disp.submit(std::make_unique<HookCommand>(targets[0], nullptr, complete(0)));
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        ASSERT_TRUE(cv.wait_for(lock, std::chrono::seconds(5), [&] { return completing; }));
+    }
+    for (std::size_t i = 1; i < targets.size(); ++i) {
+        disp.submit(std::make_unique<HookCommand>(targets[i], [&] {
+            std::lock_guard<std::mutex> lock(mtx);
+            ++prepared;
+            cv.notify_all();
+            }, complete(i)));
+    }
+    disp.waitUntilIdle();
+
+    EXPECT_EQ(committed_before, (std::vector<std::size_t>{ 0, 0, 2, 2 }));
+    EXPECT_FALSE(db->inBatch());
+    for (const auto& target : targets) {
+        EXPECT_NE(observer.getFileByPath(target), nullptr) << target;
+    }
+}
+
+TEST_F(CallbackDispatcherUnitTest, FailedCallbackAndCommitKeepWorkersRunning) {
+    auto db = std::make_shared<Database>(std::string{ ":memory:" });
+    auto& disp = CallbackDispatcher::get();
+    disp.setDB(db);
+    disp.setGroupCommit(4, std::chrono::seconds(5));
+    disp.start();
+
+    std::atomic<bool> ran{ false };
+    disp.submit(std::make_unique<HookCommand>("T", nullptr, [] { throw std::runtime_error("callback failed"); }));
+    // Ends the batch behind the dispatcher's back, so its own COMMIT fails.
+    disp.submit(std::make_unique<HookCommand>("T", nullptr, [&] { db->commitBatch(); }));
+    disp.submit(std::make_unique<HookCommand>("T", nullptr, [&] { ran = true; }));
+    disp.waitUntilIdle();
+
+    EXPECT_TRUE(ran);
+    EXPECT_FALSE(db->inBatch());
+}
+
+TEST_F(CallbackDispatcherUnitTest, ThrowingCallbackIsRolledBackAndReleasesItsChange) {
+    auto db = std::make_shared<Database>(std::string{ ":memory:" });
+    auto& disp = CallbackDispatcher::get();
+    disp.setDB(db);
+    disp.setGroupCommit(4, std::chrono::seconds(5));
+    disp.start();
+
+    auto change = std::make_shared<Change>(ChangeType::New, "failed.txt", 0, 0);
+    std::atomic<bool> released{ false };
+    change->setOnComplete([&](std::vector<std::shared_ptr<Change>>&&) { released = true; });
+
+    disp.submit(std::make_unique<HookCommand>("T", nullptr, [&] {
+        db->add_file(localFile("kept.txt", 1));
+        }));
+    auto failing = std::make_unique<HookCommand>("T", nullptr, [&] {
+        db->add_file(localFile("failed.txt", 2));
+        throw std::runtime_error("callback failed");
+        });
+    failing->setOwner(change);
+    disp.submit(std::move(failing));
+    disp.waitUntilIdle();
+
+    EXPECT_TRUE(released);
+    EXPECT_FALSE(db->inBatch());
+    EXPECT_NE(db->getFileByPath("kept.txt"), nullptr);
+    EXPECT_EQ(db->getFileByPath("failed.txt"), nullptr);
+}
+
+TEST_F(CallbackDispatcherUnitTest, SubmitDbWriteResolvesOnceItsBatchCommits) {
+    auto db = std::make_shared<Database>(std::string{ ":memory:" });
+    auto& disp = CallbackDispatcher::get();
+    disp.setDB(db);
+    disp.setGroupCommit(4, std::chrono::seconds(5));
+    disp.start();
+
+    auto [first, second] = targetsOnDifferentWorkers(disp.workerCount());
+    std::mutex mtx;
+    std::condition_variable cv;
+    bool completing = false;
+    bool prepared = false;
+    std::shared_future<void> written;
+    bool ready_in_batch = true;
+
+    disp.submit(std::make_unique<HookCommand>(first, nullptr, [&] {
+        std::unique_lock<std::mutex> lock(mtx);
+        completing = true;
+        cv.notify_all();
+        cv.wait_for(lock, std::chrono::seconds(5), [&] { return prepared; });
+        lock.unlock();
+        // Let the second callback line up on the database lock, keeping the batch open.
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }));
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        ASSERT_TRUE(cv.wait_for(lock, std::chrono::seconds(5), [&] { return completing; }));
+    }
+    written = disp.submitDbWrite(first, [&first](const std::unique_ptr<Database>& db) {
+        FileRecordDTO dto{ EntryType::File, first, 1, 2, 3, 4 };
+        db->add_file(dto);
+        }).share();
+    disp.submit(std::make_unique<HookCommand>(second, [&] {
+        std::lock_guard<std::mutex> lock(mtx);
+        prepared = true;
+        cv.notify_all();
+        }, [&] { ready_in_batch = written.wait_for(std::chrono::seconds(0)) == std::future_status::ready; }));
+    disp.waitUntilIdle();
+
+    EXPECT_FALSE(ready_in_batch);
+    EXPECT_EQ(written.wait_for(std::chrono::seconds(0)), std::future_status::ready);
+    EXPECT_FALSE(db->inBatch());
+}
+
+TEST_F(CallbackDispatcherUnitTest, SubmitDbWriteFailsWithItsRolledBackBatch) {
+    auto db = std::make_shared<Database>(std::string{ ":memory:" });
+    auto& disp = CallbackDispatcher::get();
+    disp.setDB(db);
+    disp.setGroupCommit(4, std::chrono::seconds(5));
+    disp.start();
+
+    // Ends the batch behind the dispatcher's back right after the write, so the dispatcher's COMMIT fails.
+    auto written = disp.submitDbWrite("T", [](const std::unique_ptr<Database>& db) {
+        FileRecordDTO dto{ EntryType::File, "T", 1, 2, 3, 4 };
+        db->add_file(dto);
+        db->commitBatch();
+        });
+    disp.waitUntilIdle();
+
+    EXPECT_THROW(written.get(), std::runtime_error);
+}
+
+TEST_F(CallbackDispatcherUnitTest, SubmitDbWriteDoesNotWaitForOtherTargets) {
+    auto& disp = CallbackDispatcher::get();
+    auto db_ptr = std::make_shared<Database>(std::string{ ":memory:" });
+    disp.setDB(db_ptr);
+    disp.setClouds({ {42, std::make_shared<FakeStorage>()} });
+    disp.start();
+
+    auto [busy, other] = targetsOnDifferentWorkers(disp.workerCount());
+    std::promise<void> release;
+    auto released = release.get_future().share();
+    disp.submit(std::make_unique<HookCommand>(busy, [released] { released.wait(); }, nullptr));
+
+    auto written = disp.submitDbWrite(other, [&other](const std::unique_ptr<Database>& db) {
+        FileRecordDTO dto{ EntryType::File, other, 1, 2, 3, 4 };
+        db->add_file(dto);
+        });
+
+    EXPECT_EQ(written.wait_for(std::chrono::seconds(5)), std::future_status::ready);
+    EXPECT_FALSE(disp.isIdle());
+    EXPECT_TRUE(db_ptr->quickPathCheck(other));
+
+    release.set_value();
+    disp.waitUntilIdle();
+}
+
+TEST_F(CallbackDispatcherUnitTest, SubmitDbWriteRunsAfterQueuedCallbacksForTarget) {
+    auto& disp = CallbackDispatcher::get();
+    disp.setDB(std::make_shared<Database>(std::string{ ":memory:" }));
+    disp.setClouds({ {42, std::make_shared<FakeStorage>()} });
+    disp.start();
+
+    std::promise<void> release;
+    auto released = release.get_future().share();
+    std::vector<std::string> order;
+    disp.submit(std::make_unique<HookCommand>("same", [released] { released.wait(); }, [&order] { order.push_back("callback"); }));
+    auto written = disp.submitDbWrite("same", [&order](const std::unique_ptr<Database>&) { order.push_back("write"); });
+
+    EXPECT_EQ(written.wait_for(std::chrono::milliseconds(100)), std::future_status::timeout);
+    release.set_value();
+    written.get();
+
+    EXPECT_EQ(order, (std::vector<std::string>{ "callback", "write" }));
+}
+
+TEST_F(CallbackDispatcherUnitTest, SyncDbWriteFromCallbackRunsInPlace) {
+    auto& disp = CallbackDispatcher::get();
+    auto db_ptr = std::make_shared<Database>(std::string{ ":memory:" });
+    disp.setDB(db_ptr);
+    disp.setClouds({ {42, std::make_shared<FakeStorage>()} });
+    disp.start();
+
+    int global_id = 0;
+    disp.submit(std::make_unique<HookCommand>("parent", nullptr, [&] {
+        auto dto = std::make_unique<FileRecordDTO>(EntryType::Directory, std::filesystem::path("parent/child"), 0, 0, 0, 9);
+        CallbackDispatcher::get().syncDbWrite(dto);
+        global_id = dto->global_id;
+        }));
+    disp.waitUntilIdle();
+
+    EXPECT_GT(global_id, 0);
+    EXPECT_TRUE(db_ptr->quickPathCheck("parent/child"));
+}
+
+TEST_F(CallbackDispatcherUnitTest, SubmitDbWriteReportsFailure) {
+    auto& disp = CallbackDispatcher::get();
+    disp.setDB(std::make_shared<Database>(std::string{ ":memory:" }));
+
+    auto written = disp.submitDbWrite("missing", [](const std::unique_ptr<Database>& db) {
+        db->getGlobalIdByPath("missing");
+        });
+
+    EXPECT_THROW(written.get(), std::runtime_error);
+}
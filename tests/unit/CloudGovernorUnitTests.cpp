@@ -0,0 +1,126 @@
+#include <gtest/gtest.h>
+#include "cloud-governor.h"
+#include "utils.h"
+
+using namespace std::chrono_literals;
+
+class CloudGovernorUnitTest : public ::testing::Test {
+protected:
+    CloudGovernor governor;
+    CloudGovernor::Clock::time_point t0 = CloudGovernor::Clock::now();
+
+    void SetUp() override {
+        governor.setQuota(CloudProviderType::GoogleDrive, { 60, 8, 1 });
+        governor.registerCloud(1, CloudProviderType::GoogleDrive);
+        governor.registerCloud(2, CloudProviderType::Dropbox);
+    }
+};
+
+TEST_F(CloudGovernorUnitTest, StartsAtQuarterOfMaxConcurrent) {
+    auto st = governor.stats(1, t0);
+    EXPECT_DOUBLE_EQ(st.concurrency_limit, 2.0);
+    EXPECT_EQ(st.in_flight, 0);
+    EXPECT_EQ(st.requests_per_minute_quota, 60);
+}
+
+TEST_F(CloudGovernorUnitTest, RespectsInFlightLimit) {
+    governor.setQuota(CloudProviderType::GoogleDrive, { 0, 8, 1 });
+    EXPECT_TRUE(governor.tryAcquire(1, t0));
+    EXPECT_TRUE(governor.tryAcquire(1, t0));
+    EXPECT_FALSE(governor.tryAcquire(1, t0));
+
+    governor.release(1, 200, 0us, t0);
+    EXPECT_TRUE(governor.tryAcquire(1, t0));
+}
+
+TEST_F(CloudGovernorUnitTest, ReservesSlotsForHighPriority) {
+    governor.setQuota(CloudProviderType::GoogleDrive, { 0, 64, 1 });
+    for (int i = 0; i < 14; ++i) {
+        ASSERT_TRUE(governor.tryAcquire(1, t0, false));
+    }
+    EXPECT_FALSE(governor.tryAcquire(1, t0, false));
+    EXPECT_TRUE(governor.tryAcquire(1, t0, true));
+    EXPECT_TRUE(governor.tryAcquire(1, t0, true));
+    EXPECT_FALSE(governor.tryAcquire(1, t0, true));
+}
+
+TEST_F(CloudGovernorUnitTest, LowPriorityHasNoTokenTimeWhenOnlyReservedSlotsRemain) {
+    governor.setQuota(CloudProviderType::GoogleDrive, { 6000, 64, 1 });
+    for (int i = 0; i < 14; ++i) {
+        ASSERT_TRUE(governor.tryAcquire(1, t0, false));
+    }
+    EXPECT_FALSE(governor.nextTokenTime(1, t0, false).has_value());
+    EXPECT_TRUE(governor.nextTokenTime(1, t0, true).has_value());
+}
+
+TEST_F(CloudGovernorUnitTest, PacesAgainstRequestsPerMinute) {
+    EXPECT_TRUE(governor.tryAcquire(1, t0));
+    governor.release(1, 200, 0us, t0);
+    EXPECT_FALSE(governor.tryAcquire(1, t0));
+
+    auto next = governor.nextTokenTime(1, t0);
+    ASSERT_TRUE(next.has_value());
+    EXPECT_GE(*next - t0, 900ms);
+    EXPECT_LE(*next - t0, 1000ms);
+
+    EXPECT_TRUE(governor.tryAcquire(1, t0 + 1s));
+}
+
+TEST_F(CloudGovernorUnitTest, AdditiveIncreaseOnSuccess) {
+    governor.setQuota(CloudProviderType::GoogleDrive, { 0, 8, 1 });
+    for (int i = 0; i < 20; ++i) {
+        ASSERT_TRUE(governor.tryAcquire(1, t0));
+        governor.release(1, 200, 0us, t0);
+    }
+    auto st = governor.stats(1, t0);
+    EXPECT_GT(st.concurrency_limit, 2.0);
+    EXPECT_LE(st.concurrency_limit, 8.0);
+}
+
+TEST_F(CloudGovernorUnitTest, MultiplicativeDecreaseOnRateLimit) {
+    governor.setQuota(CloudProviderType::GoogleDrive, { 0, 64, 1 });
+    ASSERT_DOUBLE_EQ(governor.stats(1, t0).concurrency_limit, 16.0);
+
+    ASSERT_TRUE(governor.tryAcquire(1, t0));
+    governor.release(1, 429, 0us, t0 + 2s);
+    EXPECT_DOUBLE_EQ(governor.stats(1, t0).concurrency_limit, 8.0);
+
+    ASSERT_TRUE(governor.tryAcquire(1, t0));
+    governor.release(1, 503, 0us, t0 + 2s + 100ms);
+    EXPECT_DOUBLE_EQ(governor.stats(1, t0).concurrency_limit, 8.0);
+
+    ASSERT_TRUE(governor.tryAcquire(1, t0));
+    governor.release(1, 503, 0us, t0 + 4s);
+    EXPECT_DOUBLE_EQ(governor.stats(1, t0).concurrency_limit, 4.0);
+}
+
+TEST_F(CloudGovernorUnitTest, DecreasesOnLatencyInflation) {
+    governor.setQuota(CloudProviderType::GoogleDrive, { 0, 64, 1 });
+    ASSERT_TRUE(governor.tryAcquire(1, t0));
+    governor.release(1, 200, 50ms, t0);
+    double limit = governor.stats(1, t0).concurrency_limit;
+
+    ASSERT_TRUE(governor.tryAcquire(1, t0));
+    governor.release(1, 200, 900ms, t0 + 2s);
+    EXPECT_LT(governor.stats(1, t0).concurrency_limit, limit);
+}
+
+TEST_F(CloudGovernorUnitTest, CloudsAreIndependent) {
+    governor.setQuota(CloudProviderType::GoogleDrive, { 0, 8, 1 });
+    ASSERT_TRUE(governor.tryAcquire(1, t0));
+    governor.release(1, 429, 0us, t0 + 2s);
+
+    auto dropbox = governor.stats(2, t0);
+    EXPECT_DOUBLE_EQ(dropbox.concurrency_limit, 8.0);
+    EXPECT_EQ(dropbox.requests_per_minute_quota, 6000);
+}
+
+TEST_F(CloudGovernorUnitTest, CountsRequestsInLastMinute) {
+    governor.setQuota(CloudProviderType::GoogleDrive, { 0, 8, 1 });
+    for (int i = 0; i < 3; ++i) {
+        ASSERT_TRUE(governor.tryAcquire(1, t0 + std::chrono::seconds(i * 20)));
+        governor.release(1, 200, 0us, t0 + std::chrono::seconds(i * 20));
+    }
+    EXPECT_EQ(governor.stats(1, t0 + 50s).requests_last_minute, 3);
+    EXPECT_EQ(governor.stats(1, t0 + 70s).requests_last_minute, 2);
+}
@@ -0,0 +1,102 @@
+// tests/unit/ContentHasherUnitTests.cpp
+
+#include <gtest/gtest.h>
+#include "content-hasher.h"
+#include "request-handle.h"
+
+#define XXH_INLINE_ALL
+#include <xxhash.h>
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+namespace {
+    std::string patternData(std::size_t size) {
+        std::string data(size, '\0');
+        for (std::size_t i = 0; i < size; ++i) {
+            data[i] = static_cast<char>((i * 31) % 251);
+        }
+        return data;
+    }
+
+    std::string digestOf(HashKind kind, const std::string& data, std::size_t chunk) {
+        HasherChain chain;
+        chain.add(kind);
+        for (std::size_t offset = 0; offset < data.size(); offset += chunk) {
+            chain.update(data.data() + offset, std::min(chunk, data.size() - offset));
+        }
+        return chain.hexDigest(kind).value_or("");
+    }
+}
+
+TEST(ContentHasherUnitTest, Md5KnownVectors) {
+    EXPECT_EQ(digestOf(HashKind::Md5, "", 1), "d41d8cd98f00b204e9800998ecf8427e");
+    EXPECT_EQ(digestOf(HashKind::Md5, "abc", 1), "900150983cd24fb0d6963f7d28e17f72");
+}
+
+TEST(ContentHasherUnitTest, DropboxContentHashKnownVectors) {
+    EXPECT_EQ(digestOf(HashKind::DropboxContentHash, "", 1),
+        "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+    EXPECT_EQ(digestOf(HashKind::DropboxContentHash, "abc", 1),
+        "4f8b42c22dd3729b519ba6f68d2da7cc5b2d606d05daed5ad5128cc03e6c6358");
+}
+
+TEST(ContentHasherUnitTest, ChunkingDoesNotChangeDigests) {
+    std::string data = patternData(4 * 1024 * 1024 + 1000);
+
+    for (std::size_t chunk : { std::size_t{ 777 }, std::size_t{ 16384 }, std::size_t{ 4 * 1024 * 1024 }, data.size() }) {
+        EXPECT_EQ(digestOf(HashKind::Md5, data, chunk), "480afd909bdde1e352c1de61efe47086");
+        EXPECT_EQ(digestOf(HashKind::DropboxContentHash, data, chunk),
+            "57ea1ff40c9321fb280d0e66ceed2ec0c4d0f406d1c4cfd29b8f4b178db89ad1");
+    }
+}
+
+TEST(ContentHasherUnitTest, Xxh64MatchesOneShotHash) {
+    std::string data = patternData(100000);
+    HasherChain chain;
+    chain.add(HashKind::Xxh64);
+    chain.update(data.data(), 1234);
+    chain.update(data.data() + 1234, data.size() - 1234);
+
+    EXPECT_EQ(chain.xxh64(), XXH64(data.data(), data.size(), 0));
+    EXPECT_EQ(chain.bytesHashed(), data.size());
+}
+
+TEST(ContentHasherUnitTest, ChainFeedsEveryHasherAndResets) {
+    HasherChain chain;
+    EXPECT_TRUE(chain.empty());
+    chain.add(HashKind::Xxh64);
+    chain.add(HashKind::Md5);
+    chain.add(HashKind::Md5);
+
+    EXPECT_TRUE(chain.contains(HashKind::Md5));
+    EXPECT_FALSE(chain.contains(HashKind::DropboxContentHash));
+    EXPECT_FALSE(chain.hexDigest(HashKind::DropboxContentHash).has_value());
+
+    chain.update("garbage", 7);
+    chain.reset();
+    chain.update("abc", 3);
+
+    EXPECT_EQ(chain.hexDigest(HashKind::Md5), "900150983cd24fb0d6963f7d28e17f72");
+    EXPECT_EQ(chain.hexDigest(HashKind::Md5), "900150983cd24fb0d6963f7d28e17f72");
+    EXPECT_EQ(chain.xxh64(), XXH64("abc", 3, 0));
+}
+
+TEST(ContentHasherUnitTest, RequestHandleHashesWrittenBytes) {
+    auto path = std::filesystem::temp_directory_path() / "-test-content_hasher-.bin";
+    {
+        RequestHandle handle;
+        handle.setFileStream(path, std::ios::out);
+        handle.addHasher(HashKind::Md5);
+
+        std::string head = "a";
+        ASSERT_EQ(RequestHandle::writeHashedData(head.data(), 1, head.size(), &handle), head.size());
+        handle.rewind();
+
+        std::string tail = "bc";
+        ASSERT_EQ(RequestHandle::writeHashedData(tail.data(), 1, tail.size(), &handle), tail.size());
+        EXPECT_EQ(handle._hashers.hexDigest(HashKind::Md5), "900150983cd24fb0d6963f7d28e17f72");
+        EXPECT_EQ(handle._hashers.bytesHashed(), 3u);
+    }
+    std::filesystem::remove(path);
+}
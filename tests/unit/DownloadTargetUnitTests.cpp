@@ -0,0 +1,94 @@
+// tests/unit/DownloadTargetUnitTests.cpp
+
+#include <gtest/gtest.h>
+#include "download-target.h"
+
+#include <fstream>
+#include <filesystem>
+#include <string>
+
+namespace fs = std::filesystem;
+
+class DownloadTargetUnitTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        _dir = fs::temp_directory_path() / "-test-download_target-";
+        fs::remove_all(_dir);
+        fs::create_directories(_dir);
+    }
+
+    void TearDown() override {
+        fs::remove_all(_dir);
+    }
+
+    static std::string readFile(const fs::path& path) {
+        std::ifstream in(path, std::ios::binary);
+        return std::string((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    }
+
+    fs::path _dir;
+};
+
+TEST_F(DownloadTargetUnitTest, OpenPreallocatesFullSize) {
+    DownloadTarget target(1024 * 1024);
+    target.open(_dir / "file.bin");
+
+    EXPECT_EQ(fs::file_size(_dir / "file.bin"), 1024u * 1024);
+    EXPECT_EQ(target.path(), _dir / "file.bin");
+}
+
+TEST_F(DownloadTargetUnitTest, OpenTruncatesExistingFile) {
+    {
+        std::ofstream out(_dir / "file.bin", std::ios::binary);
+        out << std::string(4096, 'z');
+    }
+    DownloadTarget target(16);
+    target.open(_dir / "file.bin");
+
+    EXPECT_EQ(readFile(_dir / "file.bin"), std::string(16, '\0'));
+}
+
+TEST_F(DownloadTargetUnitTest, OpenKeepsExistingDataWhenResuming) {
+    {
+        std::ofstream out(_dir / "file.bin", std::ios::binary);
+        out << "abcd";
+    }
+    DownloadTarget target(8, true);
+    target.open(_dir / "file.bin");
+
+    EXPECT_TRUE(target.write(4, "efgh", 4));
+    EXPECT_EQ(readFile(_dir / "file.bin"), "abcdefgh");
+}
+
+TEST_F(DownloadTargetUnitTest, RangesWrittenOutOfOrderAssemble) {
+    DownloadTarget target(12);
+    target.open(_dir / "file.bin");
+    target.open(_dir / "file.bin");
+
+    EXPECT_TRUE(target.write(8, "ijkl", 4));
+    EXPECT_TRUE(target.write(0, "abcd", 4));
+    EXPECT_TRUE(target.write(4, "efgh", 4));
+
+    EXPECT_EQ(readFile(_dir / "file.bin"), "abcdefghijkl");
+}
+
+TEST_F(DownloadTargetUnitTest, WritePastSizeIsRejected) {
+    DownloadTarget target(8);
+    target.open(_dir / "file.bin");
+
+    EXPECT_FALSE(target.write(6, "xyz", 3));
+    EXPECT_EQ(fs::file_size(_dir / "file.bin"), 8u);
+}
+
+TEST_F(DownloadTargetUnitTest, WriteBeforeOpenIsRejected) {
+    DownloadTarget target(8);
+
+    EXPECT_FALSE(target.write(0, "abc", 3));
+}
+
+TEST_F(DownloadTargetUnitTest, OpeningAnotherPathThrows) {
+    DownloadTarget target(8);
+    target.open(_dir / "first.bin");
+
+    EXPECT_THROW(target.open(_dir / "second.bin"), std::runtime_error);
+}
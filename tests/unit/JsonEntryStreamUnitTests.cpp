@@ -0,0 +1,100 @@
+// tests/unit/JsonEntryStreamUnitTests.cpp
+
+#include <gtest/gtest.h>
+#include "json-entry-stream.h"
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+    const std::string PAGE = R"({
+        "cursor": "c-1",
+        "entries": [
+            {".tag": "file", "name": "a \"quoted\" ]}[{ name", "tags": [1, [2, 3]]},
+            {".tag": "folder", "name": "dir\\"},
+            "plain",
+            42
+        ],
+        "has_more": true,
+        "meta": {"nested": [1, 2]}
+    })";
+}
+
+TEST(JsonEntryStreamUnitTest, EntriesArriveOneByOneAcrossChunkBoundaries) {
+    std::vector<nlohmann::json> entries;
+    JsonEntryStream stream("entries", [&](nlohmann::json&& entry) { entries.push_back(std::move(entry)); });
+
+    for (char c : PAGE) {
+        ASSERT_TRUE(stream.feed(&c, 1));
+    }
+
+    ASSERT_TRUE(stream.complete());
+    EXPECT_NO_THROW(stream.finish());
+    ASSERT_EQ(entries.size(), 4u);
+    EXPECT_EQ(stream.entries(), 4u);
+    EXPECT_EQ(entries[0]["name"], "a \"quoted\" ]}[{ name");
+    EXPECT_EQ(entries[0]["tags"][1][1], 3);
+    EXPECT_EQ(entries[1]["name"], "dir\\");
+    EXPECT_EQ(entries[2], "plain");
+    EXPECT_EQ(entries[3], 42);
+}
+
+TEST(JsonEntryStreamUnitTest, OtherMembersAreKeptAsFields) {
+    JsonEntryStream stream("entries", [](nlohmann::json&&) {});
+
+    ASSERT_TRUE(stream.feed(PAGE.data(), PAGE.size()));
+
+    EXPECT_EQ(stream.fields()["cursor"], "c-1");
+    EXPECT_EQ(stream.fields()["has_more"], true);
+    EXPECT_EQ(stream.fields()["meta"]["nested"][1], 2);
+    EXPECT_FALSE(stream.fields().contains("entries"));
+}
+
+TEST(JsonEntryStreamUnitTest, EntryIsHandedOutBeforePageEnds) {
+    std::size_t seen = 0;
+    JsonEntryStream stream("files", [&](nlohmann::json&&) { ++seen; });
+
+    std::string head = R"({"files":[{"id":"1"},{"id":"2"},{"id")";
+    ASSERT_TRUE(stream.feed(head.data(), head.size()));
+
+    EXPECT_EQ(seen, 2u);
+    EXPECT_FALSE(stream.complete());
+    EXPECT_THROW(stream.finish(), std::runtime_error);
+}
+
+TEST(JsonEntryStreamUnitTest, MalformedDocumentStopsFeeding) {
+    JsonEntryStream stream("files", [](nlohmann::json&&) {});
+
+    std::string body = R"({"files":[{"id":}]})";
+
+    EXPECT_FALSE(stream.feed(body.data(), body.size()));
+    EXPECT_THROW(stream.finish(), std::runtime_error);
+}
+
+TEST(JsonEntryStreamUnitTest, HandlerExceptionIsRethrownByFinish) {
+    JsonEntryStream stream("files", [](nlohmann::json&& entry) { entry.at("missing"); });
+
+    std::string body = R"({"files":[{"id":"1"}]})";
+
+    EXPECT_FALSE(stream.feed(body.data(), body.size()));
+    EXPECT_THROW(stream.finish(), nlohmann::json::out_of_range);
+}
+
+TEST(JsonEntryStreamUnitTest, ResetStartsNextPage) {
+    std::vector<std::string> ids;
+    JsonEntryStream stream("files", [&](nlohmann::json&& entry) { ids.push_back(entry["id"]); });
+
+    std::string first = R"({"nextPageToken":"p2","files":[{"id":"1"}]})";
+    std::string second = R"({"files":[{"id":"2"}]})";
+    ASSERT_TRUE(stream.feed(first.data(), first.size()));
+    EXPECT_EQ(stream.fields().value("nextPageToken", ""), "p2");
+
+    stream.reset();
+    ASSERT_TRUE(stream.feed(second.data(), second.size()));
+
+    EXPECT_TRUE(stream.complete());
+    EXPECT_EQ(stream.fields().value("nextPageToken", ""), "");
+    EXPECT_EQ(stream.entries(), 1u);
+    EXPECT_EQ(ids, (std::vector<std::string>{ "1", "2" }));
+}
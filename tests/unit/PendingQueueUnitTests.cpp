@@ -0,0 +1,65 @@
+#include <gtest/gtest.h>
+#include "pending-queue.h"
+
+using namespace std::chrono_literals;
+
+class PendingQueueUnitTest : public ::testing::Test {
+protected:
+    PendingQueue<int> queue;
+    PendingQueue<int>::Clock::time_point t0 = PendingQueue<int>::Clock::now();
+};
+
+TEST_F(PendingQueueUnitTest, EmptyByDefault) {
+    EXPECT_TRUE(queue.empty());
+    EXPECT_EQ(queue.size(), 0u);
+}
+
+TEST_F(PendingQueueUnitTest, MetadataBeforeTransfers) {
+    queue.push(1, TrafficClass::Bulk, 1ull << 30, t0);
+    queue.push(2, TrafficClass::SmallFile, 2048, t0);
+    queue.push(3, TrafficClass::Metadata, 0, t0 + 100ms);
+
+    EXPECT_EQ(queue.topClass(), TrafficClass::Metadata);
+    EXPECT_EQ(queue.pop(), 3);
+    EXPECT_EQ(queue.pop(), 2);
+    EXPECT_EQ(queue.pop(), 1);
+    EXPECT_TRUE(queue.empty());
+}
+
+TEST_F(PendingQueueUnitTest, ShortestJobFirstInsideClass) {
+    queue.push(1, TrafficClass::Bulk, 512ull << 20, t0);
+    queue.push(2, TrafficClass::Bulk, 16ull << 20, t0);
+    queue.push(3, TrafficClass::Bulk, 64ull << 20, t0);
+
+    EXPECT_EQ(queue.pop(), 2);
+    EXPECT_EQ(queue.pop(), 3);
+    EXPECT_EQ(queue.pop(), 1);
+}
+
+TEST_F(PendingQueueUnitTest, FifoForEqualJobs) {
+    for (int i = 0; i < 5; ++i) {
+        queue.push(i, TrafficClass::Metadata, 0, t0);
+    }
+    for (int i = 0; i < 5; ++i) {
+        EXPECT_EQ(queue.pop(), i);
+    }
+}
+
+TEST_F(PendingQueueUnitTest, AgingBoundsWaitBehindNewerWork) {
+    queue.push(1, TrafficClass::InitialSync, 8ull << 30, t0);
+    queue.push(2, TrafficClass::Metadata, 0, t0 + PendingQueue<int>::MAX_AGING - 1s);
+    queue.push(3, TrafficClass::Metadata, 0, t0 + PendingQueue<int>::MAX_AGING + 1s);
+
+    EXPECT_EQ(queue.pop(), 2);
+    EXPECT_EQ(queue.pop(), 1);
+    EXPECT_EQ(queue.pop(), 3);
+}
+
+TEST_F(PendingQueueUnitTest, MovesOnlyItems) {
+    PendingQueue<std::unique_ptr<int>> owning;
+    owning.push(std::make_unique<int>(7), TrafficClass::SmallFile, 10, t0);
+    ASSERT_EQ(*owning.top(), 7);
+    auto item = owning.pop();
+    EXPECT_EQ(*item, 7);
+    EXPECT_TRUE(owning.empty());
+}
@@ -14,6 +14,16 @@ TEST(RequestHandleUnitTest, DefaultConstructorInitializesCurl) {
     EXPECT_EQ(rh._retry_count, 0);
 }
 
+TEST(RequestHandleUnitTest, DestroyedHandleReturnsCurlToPool) {
+    CURL* released = nullptr;
+    {
+        RequestHandle rh;
+        released = rh._curl;
+    }
+    RequestHandle next;
+    EXPECT_EQ(next._curl, released);
+}
+
 TEST(RequestHandleUnitTest, MoveAssignmentTransfersResourcesAndNullsSource) {
     RequestHandle a;
     a.addHeaders("X-Test: 1");
@@ -116,12 +126,68 @@ TEST(RequestHandleUnitTest, WriteDataWritesToFile) {
     std::filesystem::remove(path);
 }
 
-TEST(RequestHandleUnitTest, ScheduleRetryThrowsAfterMaxRetries) {
+TEST(RequestHandleUnitTest, ScheduleRetryFailsAfterMaxRetries) {
     RequestHandle rh;
-    for (int i = 0; i < 6; ++i) {
-        EXPECT_NO_THROW(rh.scheduleRetry());
+    for (int i = 0; i < RequestHandle::MAX_RETRIES; ++i) {
+        EXPECT_TRUE(rh.scheduleRetry());
     }
-    EXPECT_THROW(rh.scheduleRetry(), std::runtime_error);
+    EXPECT_NO_THROW(EXPECT_FALSE(rh.scheduleRetry()));
+}
+
+TEST(RequestHandleUnitTest, ScheduleRetryHonorsRetryAfterHeader) {
+    RequestHandle rh;
+    std::string status = "HTTP/1.1 429 Too Many Requests\r\n";
+    std::string header = "Retry-After: 3\r\n";
+    RequestHandle::headerCallback(status.data(), 1, status.size(), &rh);
+    RequestHandle::headerCallback(header.data(), 1, header.size(), &rh);
+
+    auto before = std::chrono::steady_clock::now();
+    ASSERT_TRUE(rh.scheduleRetry());
+    EXPECT_GE(rh._timer - before, std::chrono::seconds(3));
+    EXPECT_LT(rh._timer - before, std::chrono::milliseconds(3100));
+    EXPECT_TRUE(rh._response_headers.empty());
+}
+
+TEST(RequestHandleUnitTest, ScheduleRetryHonorsDropboxRetryAfter) {
+    RequestHandle rh;
+    rh._response = R"({"error_summary": "too_many_requests/..", "error": {"reason": {".tag": "too_many_requests"}, "retry_after": 1}})";
+
+    auto before = std::chrono::steady_clock::now();
+    ASSERT_TRUE(rh.scheduleRetry());
+    EXPECT_GE(rh._timer - before, std::chrono::seconds(1));
+    EXPECT_LT(rh._timer - before, std::chrono::milliseconds(1100));
+    EXPECT_TRUE(rh._response.empty());
+}
+
+TEST(RequestHandleUnitTest, RetryAfterIsCappedAndIgnoredWhenUnparsable) {
+    auto retryAfter = [](const std::string& value) {
+        RequestHandle rh;
+        std::string status = "HTTP/1.1 503 Service Unavailable\r\n";
+        std::string header = "Retry-After: " + value + "\r\n";
+        RequestHandle::headerCallback(status.data(), 1, status.size(), &rh);
+        RequestHandle::headerCallback(header.data(), 1, header.size(), &rh);
+        return rh.retryAfter();
+    };
+    EXPECT_EQ(retryAfter("9999999999"), std::chrono::milliseconds(RequestHandle::MAX_RETRY_AFTER));
+    EXPECT_EQ(retryAfter("99999999999999999999999999"), std::nullopt);
+    EXPECT_EQ(retryAfter("Fri, 31 Dec 9999 23:59:59 GMT"), std::chrono::milliseconds(RequestHandle::MAX_RETRY_AFTER));
+
+    RequestHandle rh;
+    rh._response = R"({"error": {"retry_after": 1e300}})";
+    EXPECT_EQ(rh.retryAfter(), std::chrono::milliseconds(RequestHandle::MAX_RETRY_AFTER));
+}
+
+TEST(RequestHandleUnitTest, HeaderCallbackResetsOnNewStatusLine) {
+    RequestHandle rh;
+    std::string redirect = "HTTP/1.1 302 Found\r\n";
+    std::string location = "Location: /next\r\n";
+    std::string ok = "HTTP/1.1 200 OK\r\n";
+    std::string type = "Content-Type:  application/json \r\n";
+    for (auto* line : { &redirect, &location, &ok, &type }) {
+        RequestHandle::headerCallback(line->data(), 1, line->size(), &rh);
+    }
+    EXPECT_EQ(rh.responseHeader("location"), "");
+    EXPECT_EQ(rh.responseHeader("content-type"), "application/json");
 }
 
 TEST(RequestHandleUnitTest, SetFileStreamThrowsOnMissingFile) {
@@ -149,6 +215,41 @@ TEST(RequestHandleUnitTest, AddAndClearHeadersNoCrash) {
     EXPECT_EQ(rh._headers, nullptr);
 }
 
+TEST(RequestHandleUnitTest, ReplaceHeaderSwapsMatchingHeaderOnly) {
+    RequestHandle rh;
+    rh.addHeaders("Authorization: Bearer stale");
+    rh.addHeaders("Content-Type: application/json");
+    rh.setCommonCURLOpt();
+
+    EXPECT_TRUE(rh.replaceHeader("Authorization", "Authorization: Bearer fresh"));
+    ASSERT_NE(rh._headers, nullptr);
+    EXPECT_STREQ(rh._headers->data, "Authorization: Bearer fresh");
+    ASSERT_NE(rh._headers->next, nullptr);
+    EXPECT_STREQ(rh._headers->next->data, "Content-Type: application/json");
+    EXPECT_EQ(rh._headers->next->next, nullptr);
+}
+
+TEST(RequestHandleUnitTest, ReplaceHeaderMissingLeavesHeaders) {
+    RequestHandle rh;
+    rh.addHeaders("Authorization-Extra: 1");
+    curl_slist* before = rh._headers;
+
+    EXPECT_FALSE(rh.replaceHeader("Authorization", "Authorization: Bearer fresh"));
+    EXPECT_EQ(rh._headers, before);
+}
+
+TEST(RequestHandleUnitTest, ReplaceHeaderIgnoresNameCase) {
+    RequestHandle rh;
+    rh.addHeaders("Auth: short");
+    rh.addHeaders("authorization: Bearer stale");
+
+    EXPECT_TRUE(rh.replaceHeader("Authorization", "Authorization: Bearer fresh"));
+    ASSERT_NE(rh._headers, nullptr);
+    EXPECT_STREQ(rh._headers->data, "Auth: short");
+    ASSERT_NE(rh._headers->next, nullptr);
+    EXPECT_STREQ(rh._headers->next->data, "Authorization: Bearer fresh");
+}
+
 TEST(RequestHandleUnitTest, SetCommonCURLOptDoesNotCrash) {
     RequestHandle rh;
     EXPECT_NO_THROW(rh.setCommonCURLOpt());
@@ -0,0 +1,132 @@
+#include <gtest/gtest.h>
+#include "token-manager.h"
+#include "Networking.h"
+
+using namespace std::chrono_literals;
+
+struct FakeTokenStorage : BaseStorage {
+    explicit FakeTokenStorage(std::time_t expires_in, bool failing = false)
+        : _expires(std::time(nullptr) + expires_in), _failing(failing) {}
+
+    void proccesUpload(std::unique_ptr<FileRecordDTO>&, const std::string&) const override {}
+    void proccesUpdate(std::unique_ptr<FileUpdatedDTO>&, const std::string&) const override {}
+    void proccesMove(std::unique_ptr<FileMovedDTO>&, const std::string&) const override {}
+    void proccesDelete(std::unique_ptr<FileDeletedDTO>&, const std::string&) const override {}
+    void proccesDownload(std::unique_ptr<FileUpdatedDTO>&, const std::string&) const override {}
+    std::vector<std::unique_ptr<FileRecordDTO>> initialFiles() override { return {}; }
+    CloudProviderType getType() const override { return CloudProviderType::FakeTest; }
+    void setupUploadHandle(const std::unique_ptr<RequestHandle>&, const std::unique_ptr<FileRecordDTO>&) const override {}
+    void setupUpdateHandle(const std::unique_ptr<RequestHandle>&, const std::unique_ptr<FileUpdatedDTO>&) const override {}
+    void setupDownloadHandle(const std::unique_ptr<RequestHandle>&, const std::unique_ptr<FileRecordDTO>&) const override {}
+    void setupDownloadHandle(const std::unique_ptr<RequestHandle>&, const std::unique_ptr<FileUpdatedDTO>&) const override {}
+    void setupDeleteHandle(const std::unique_ptr<RequestHandle>&, const std::unique_ptr<FileDeletedDTO>&) const override {}
+    void setupMoveHandle(const std::unique_ptr<RequestHandle>&, const std::unique_ptr<FileMovedDTO>&) const override {}
+    std::vector<std::unique_ptr<FileRecordDTO>> createPath(const std::filesystem::path&, const std::filesystem::path&) override { return {}; }
+    std::string buildAuthURL(int) const override { return ""; }
+    std::string getRefreshToken(const std::string&, const int) override { return ""; }
+    void proccessAuth(const std::string&) override {}
+    std::string getDeltaToken() override { return ""; }
+    std::string getHomeDir() const override { return ""; }
+    void getChanges() override {}
+    int id() const override { return 5; }
+    bool hasChanges() const override { return false; }
+    void setOnChange(std::function<void()>) override {}
+    std::vector<std::shared_ptr<Change>> proccessChanges() override { return {}; }
+    void ensureRootExists() override {}
+
+    void refreshAccessToken() override {
+        ++attempts;
+        if (_failing) {
+            throw std::runtime_error("refresh rejected");
+        }
+        _expires = std::time(nullptr) + 3600;
+        ++generation;
+    }
+    std::string authorizationHeader() const override { return "Authorization: Bearer token-" + std::to_string(generation.load()); }
+    std::time_t accessTokenExpires() const override { return _expires; }
+    std::uint64_t tokenGeneration() const override { return generation; }
+
+    std::atomic<int> attempts{ 0 };
+    std::atomic<std::uint64_t> generation{ 0 };
+
+private:
+    std::atomic<std::time_t> _expires;
+    bool _failing;
+};
+
+class TokenManagerUnitTest : public ::testing::Test {
+protected:
+    void TearDown() override {
+        TokenManager::get().stop();
+        TokenManager::get().setRefreshMargin(std::chrono::seconds(300));
+    }
+
+    static bool waitFor(const std::function<bool()>& pred, std::chrono::milliseconds timeout = 2000ms) {
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        while (!pred()) {
+            if (std::chrono::steady_clock::now() > deadline) {
+                return false;
+            }
+            std::this_thread::sleep_for(5ms);
+        }
+        return true;
+    }
+};
+
+TEST_F(TokenManagerUnitTest, RefreshesTokenCloseToExpiry) {
+    auto cloud = std::make_shared<FakeTokenStorage>(60);
+    TokenManager::get().start({ { 5, cloud } });
+
+    EXPECT_TRUE(waitFor([&] { return cloud->generation == 1; }));
+    std::this_thread::sleep_for(200ms);
+    EXPECT_EQ(cloud->attempts, 1);
+}
+
+TEST_F(TokenManagerUnitTest, KeepsFreshToken) {
+    auto cloud = std::make_shared<FakeTokenStorage>(3600);
+    TokenManager::get().start({ { 5, cloud } });
+
+    std::this_thread::sleep_for(200ms);
+    EXPECT_EQ(cloud->attempts, 0);
+}
+
+TEST_F(TokenManagerUnitTest, RequestRefreshForcesRefresh) {
+    auto cloud = std::make_shared<FakeTokenStorage>(3600);
+    EXPECT_FALSE(TokenManager::get().requestRefresh(5));
+
+    TokenManager::get().start({ { 5, cloud } });
+    EXPECT_TRUE(TokenManager::get().isRunning());
+    EXPECT_FALSE(TokenManager::get().requestRefresh(6));
+    EXPECT_TRUE(TokenManager::get().requestRefresh(5));
+
+    EXPECT_TRUE(waitFor([&] { return cloud->generation == 1; }));
+}
+
+TEST_F(TokenManagerUnitTest, MarginControlsRefreshTime) {
+    auto cloud = std::make_shared<FakeTokenStorage>(600);
+    TokenManager::get().setRefreshMargin(std::chrono::seconds(60));
+    TokenManager::get().start({ { 5, cloud } });
+
+    std::this_thread::sleep_for(200ms);
+    EXPECT_EQ(cloud->attempts, 0);
+
+    TokenManager::get().setRefreshMargin(std::chrono::seconds(900));
+    EXPECT_TRUE(waitFor([&] { return cloud->generation == 1; }));
+}
+
+TEST_F(TokenManagerUnitTest, FailedRefreshBacksOff) {
+    auto cloud = std::make_shared<FakeTokenStorage>(10, true);
+    TokenManager::get().start({ { 5, cloud } });
+
+    EXPECT_TRUE(waitFor([&] { return cloud->attempts == 1; }));
+    std::this_thread::sleep_for(300ms);
+    EXPECT_EQ(cloud->attempts, 1);
+    EXPECT_EQ(cloud->generation, 0u);
+}
+
+TEST_F(TokenManagerUnitTest, StopIsIdempotent) {
+    TokenManager::get().start({});
+    TokenManager::get().stop();
+    TokenManager::get().stop();
+    EXPECT_FALSE(TokenManager::get().isRunning());
+}
@@ -0,0 +1,168 @@
+// tests/unit/UploadSourceUnitTests.cpp
+
+#include <gtest/gtest.h>
+#include "upload-source.h"
+#include "request-handle.h"
+
+#include <fstream>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+class UploadSourceUnitTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        _dir = fs::temp_directory_path() / "-test-upload_source-";
+        fs::remove_all(_dir);
+        fs::create_directories(_dir);
+    }
+
+    void TearDown() override {
+        fs::remove_all(_dir);
+    }
+
+    fs::path writeFile(const std::string& name, std::size_t size) {
+        fs::path path = _dir / name;
+        std::ofstream out(path, std::ios::binary);
+        std::string chunk(64 * 1024, '\0');
+        std::size_t written = 0;
+        while (written < size) {
+            std::size_t n = std::min(chunk.size(), size - written);
+            for (std::size_t i = 0; i < n; ++i) {
+                chunk[i] = static_cast<char>((written + i) * 31 % 251);
+            }
+            out.write(chunk.data(), static_cast<std::streamsize>(n));
+            written += n;
+        }
+        return path;
+    }
+
+    static std::string readAll(const fs::path& path) {
+        std::ifstream in(path, std::ios::binary);
+        return std::string(std::istreambuf_iterator<char>(in), {});
+    }
+
+    static std::string drain(UploadSource& source, std::size_t chunk) {
+        std::string result;
+        std::vector<char> buffer(chunk);
+        std::size_t n;
+        while ((n = UploadSource::readCallback(buffer.data(), 1, buffer.size(), &source)) > 0) {
+            result.append(buffer.data(), n);
+        }
+        return result;
+    }
+
+    fs::path _dir;
+};
+
+TEST_F(UploadSourceUnitTest, ReadMatchesFileContent) {
+    auto path = writeFile("pread.bin", UploadSource::PREAD_BUFFER_SIZE + 12345);
+    UploadSource source(path);
+
+    EXPECT_EQ(source.size(), fs::file_size(path));
+    EXPECT_EQ(drain(source, 1000), readAll(path));
+    EXPECT_EQ(source.position(), source.size());
+}
+
+TEST_F(UploadSourceUnitTest, LargeAndSmallReadsMatchFileContent) {
+    auto path = writeFile("direct.bin", 3 * UploadSource::DIRECT_READ_SIZE + 777);
+    std::string content = readAll(path);
+    UploadSource source(path);
+
+    EXPECT_EQ(drain(source, UploadSource::DIRECT_READ_SIZE + 1), content);
+
+    source.rewind();
+    char small[100];
+    ASSERT_EQ(source.read(small, sizeof(small)), sizeof(small));
+    EXPECT_EQ(std::string(small, sizeof(small)) + drain(source, UploadSource::DIRECT_READ_SIZE), content);
+}
+
+TEST_F(UploadSourceUnitTest, TruncatedFileAbortsByDefault) {
+    auto path = writeFile("truncated.bin", 3 * UploadSource::PREAD_BUFFER_SIZE);
+    UploadSource source(path);
+
+    fs::resize_file(path, 1000);
+    std::vector<char> out(UploadSource::PREAD_BUFFER_SIZE);
+    EXPECT_EQ(UploadSource::readCallback(out.data(), 1, out.size(), &source), 1000u);
+    EXPECT_EQ(UploadSource::readCallback(out.data(), 1, out.size(), &source), static_cast<size_t>(CURL_READFUNC_ABORT));
+}
+
+TEST_F(UploadSourceUnitTest, SeekAndRewind) {
+    auto path = writeFile("seek.bin", 4096);
+    std::string content = readAll(path);
+
+    UploadSource source(path);
+    char buffer[16];
+
+    EXPECT_EQ(UploadSource::seekCallback(&source, 1000, SEEK_SET), CURL_SEEKFUNC_OK);
+    ASSERT_EQ(source.read(buffer, sizeof(buffer)), sizeof(buffer));
+    EXPECT_EQ(std::string(buffer, sizeof(buffer)), content.substr(1000, sizeof(buffer)));
+
+    EXPECT_EQ(UploadSource::seekCallback(&source, -16, SEEK_END), CURL_SEEKFUNC_OK);
+    ASSERT_EQ(source.read(buffer, sizeof(buffer)), sizeof(buffer));
+    EXPECT_EQ(std::string(buffer, sizeof(buffer)), content.substr(4080, sizeof(buffer)));
+
+    EXPECT_EQ(UploadSource::seekCallback(&source, 1, SEEK_CUR), CURL_SEEKFUNC_FAIL);
+    EXPECT_EQ(UploadSource::seekCallback(&source, -1, SEEK_SET), CURL_SEEKFUNC_FAIL);
+
+    source.rewind();
+    EXPECT_EQ(source.position(), 0u);
+    EXPECT_EQ(drain(source, 1000), content);
+}
+
+TEST_F(UploadSourceUnitTest, WindowLimitsReadsAndSeeks) {
+    auto path = writeFile("window.bin", 10000);
+    std::string content = readAll(path);
+
+    UploadSource source(path);
+    source.setWindow(3000, 2500);
+
+    EXPECT_EQ(source.length(), 2500u);
+    EXPECT_EQ(source.position(), 3000u);
+    EXPECT_EQ(drain(source, 700), content.substr(3000, 2500));
+
+    char buffer[16];
+    EXPECT_EQ(UploadSource::seekCallback(&source, 0, SEEK_SET), CURL_SEEKFUNC_OK);
+    ASSERT_EQ(source.read(buffer, sizeof(buffer)), sizeof(buffer));
+    EXPECT_EQ(std::string(buffer, sizeof(buffer)), content.substr(3000, sizeof(buffer)));
+
+    EXPECT_EQ(UploadSource::seekCallback(&source, -16, SEEK_END), CURL_SEEKFUNC_OK);
+    ASSERT_EQ(source.read(buffer, sizeof(buffer)), sizeof(buffer));
+    EXPECT_EQ(std::string(buffer, sizeof(buffer)), content.substr(5484, sizeof(buffer)));
+    EXPECT_EQ(source.read(buffer, sizeof(buffer)), 0u);
+
+    source.rewind();
+    EXPECT_EQ(source.position(), 3000u);
+
+    source.setWindow(9000, 5000);
+    EXPECT_EQ(source.length(), 1000u);
+    EXPECT_EQ(drain(source, 4096), content.substr(9000));
+}
+
+TEST_F(UploadSourceUnitTest, EmptyFileReadsNothing) {
+    auto path = writeFile("empty.bin", 0);
+    UploadSource source(path);
+    char buffer[8];
+
+    EXPECT_EQ(source.size(), 0u);
+    EXPECT_EQ(UploadSource::readCallback(buffer, 1, sizeof(buffer), &source), 0u);
+}
+
+TEST_F(UploadSourceUnitTest, MissingFileThrows) {
+    EXPECT_THROW(UploadSource(_dir / "missing.bin"), std::runtime_error);
+}
+
+TEST_F(UploadSourceUnitTest, RequestHandleRewindsUploadSource) {
+    auto path = writeFile("handle.bin", 2048);
+    RequestHandle handle;
+    handle.setUploadSource(path);
+
+    char buffer[512];
+    ASSERT_EQ(UploadSource::readCallback(buffer, 1, sizeof(buffer), handle._upload.get()), sizeof(buffer));
+    EXPECT_EQ(handle._upload->position(), sizeof(buffer));
+
+    handle.rewind();
+    EXPECT_EQ(handle._upload->position(), 0u);
+}
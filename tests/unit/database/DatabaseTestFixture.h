@@ -5,8 +5,18 @@
 #include <nlohmann/json.hpp>
 #include "logger.h"
 
+#include <filesystem>
+
 using json = nlohmann::json;
 
+inline FileRecordDTO localFile(const std::filesystem::path& path, const uint64_t file_id, const EntryType type = EntryType::File) {
+    return FileRecordDTO{ type, path, 123, 2000, 0x42, file_id };
+}
+
+inline FileRecordDTO cloudLink(const int global_id, const int cloud_id, const std::string& cloud_file_id) {
+    return FileRecordDTO{ global_id, cloud_id, "root", cloud_file_id, 123, std::string("ffee"), 2000 };
+}
+
 class DatabaseUnitTest : public ::testing::Test {
 protected:
     void SetUp() override {
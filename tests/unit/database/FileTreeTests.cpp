@@ -0,0 +1,115 @@
+#include "DatabaseTestFixture.h"
+
+#include <filesystem>
+
+namespace {
+    // Each scenario runs against SQLite and against the loaded in-memory tree.
+    template <typename Scenario>
+    void withAndWithoutIndex(Scenario scenario) {
+        for (bool indexed : { false, true }) {
+            SCOPED_TRACE(indexed ? "indexed" : "sqlite");
+            Database db(std::string{ ":memory:" });
+            if (indexed) {
+                db.loadIndex();
+            }
+            scenario(db);
+        }
+    }
+}
+
+TEST(FileTreeUnitTest, DirectoryMoveCarriesDescendants) {
+    withAndWithoutIndex([](Database& db) {
+        auto dir = db.add_file(localFile("a", 1, EntryType::Directory));
+        auto sub = db.add_file(localFile("a/b", 2, EntryType::Directory));
+        auto file = db.add_file(localFile("a/b/c.txt", 3));
+
+        db.update_file(FileMovedDTO{ EntryType::Directory, dir, 3000, "a", "x/y" });
+
+        EXPECT_EQ(db.getGlobalIdByPath("x/y/b/c.txt"), file);
+        EXPECT_EQ(db.getGlobalIdByPath("x/y/b"), sub);
+        EXPECT_FALSE(db.quickPathCheck("a/b/c.txt"));
+        EXPECT_EQ(db.getPathByGlobalId(file), "x/y/b/c.txt");
+        EXPECT_EQ(db.getFileByFileId(3)->rel_path, "x/y/b/c.txt");
+        EXPECT_EQ(db.getFileByGlobalId(dir)->cloud_file_modified_time, 3000);
+    });
+}
+
+TEST(FileTreeUnitTest, UnrecordedParentsResolveAndAreAdopted) {
+    withAndWithoutIndex([](Database& db) {
+        auto file = db.add_file(localFile("d/e/f.txt", 1));
+        EXPECT_EQ(db.getGlobalIdByPath("d/e/f.txt"), file);
+        EXPECT_FALSE(db.quickPathCheck("d"));
+
+        auto dir = db.add_file(localFile("d", 2, EntryType::Directory));
+        db.update_file(FileMovedDTO{ EntryType::Directory, dir, 2000, "d", "g" });
+
+        EXPECT_EQ(db.getGlobalIdByPath("g/e/f.txt"), file);
+        EXPECT_FALSE(db.quickPathCheck("d/e/f.txt"));
+    });
+}
+
+TEST(FileTreeUnitTest, DeletedDirectoryLeavesChildrenInPlace) {
+    withAndWithoutIndex([](Database& db) {
+        auto dir = db.add_file(localFile("a", 1, EntryType::Directory));
+        auto file = db.add_file(localFile("a/b.txt", 2));
+
+        db.delete_file_and_links(dir);
+
+        EXPECT_FALSE(db.quickPathCheck("a"));
+        EXPECT_EQ(db.getGlobalIdByPath("a/b.txt"), file);
+        EXPECT_EQ(db.getPathByGlobalId(file), "a/b.txt");
+    });
+}
+
+TEST(FileTreeMigrationTest, FullPathRowsAreRehungUnderParents) {
+    auto path = std::filesystem::temp_directory_path() / "-test-file_tree_migration-.db";
+    std::filesystem::remove(path);
+
+    sqlite3* raw = nullptr;
+    ASSERT_EQ(sqlite3_open(path.string().c_str(), &raw), SQLITE_OK);
+    const char* legacy = R"(
+        CREATE TABLE files (
+            global_id           INTEGER PRIMARY KEY AUTOINCREMENT,
+            type                TEXT NOT NULL,
+            path                TEXT NOT NULL,
+            size                INTEGER,
+            local_hash          INTEGER,
+            local_modified_time INTEGER,
+            file_id             INTEGER NOT NULL
+        );
+        CREATE INDEX idx_files_path ON files(path);
+        INSERT INTO files (type, path, size, local_hash, local_modified_time, file_id) VALUES
+            ('directory', 'a', 0, 0, 10, 1),
+            ('file', 'a/b/c.txt', 5, 7, 11, 2),
+            ('directory', 'a/b', 0, 0, 12, 3),
+            ('file', 'top.txt', 6, 8, 13, 4);
+    )";
+    ASSERT_EQ(sqlite3_exec(raw, legacy, nullptr, nullptr, nullptr), SQLITE_OK);
+    sqlite3_close(raw);
+
+    {
+        Database db(path);
+        EXPECT_EQ(db.getGlobalIdByPath("a/b/c.txt"), 2);
+        EXPECT_EQ(db.getPathByGlobalId(2), "a/b/c.txt");
+        EXPECT_EQ(db.getGlobalIdByPath("top.txt"), 4);
+
+        auto file = db.getFileByFileId(2);
+        ASSERT_TRUE(file);
+        EXPECT_EQ(file->size, 5u);
+        EXPECT_EQ(file->cloud_file_modified_time, 11);
+
+        db.update_file(FileMovedDTO{ EntryType::Directory, 1, 20, "a", "z" });
+        EXPECT_EQ(db.getGlobalIdByPath("z/b/c.txt"), 2);
+    }
+
+    ASSERT_EQ(sqlite3_open(path.string().c_str(), &raw), SQLITE_OK);
+    EXPECT_NE(sqlite3_exec(raw, "SELECT path FROM files;", nullptr, nullptr, nullptr), SQLITE_OK);
+    sqlite3_close(raw);
+
+    Database reopened(path);
+    EXPECT_EQ(reopened.getGlobalIdByPath("z/b/c.txt"), 2);
+
+    std::filesystem::remove(path);
+    std::filesystem::remove(path.string() + "-wal");
+    std::filesystem::remove(path.string() + "-shm");
+}
@@ -0,0 +1,81 @@
+#include "DatabaseTestFixture.h"
+
+#include <filesystem>
+
+namespace {
+    int indexCount(sqlite3* raw) {
+        sqlite3_stmt* stmt = nullptr;
+        sqlite3_prepare_v2(raw, "SELECT COUNT(*) FROM sqlite_master WHERE type = 'index' AND name LIKE 'idx_%';", -1, &stmt, nullptr);
+        sqlite3_step(stmt);
+        int count = sqlite3_column_int(stmt, 0);
+        sqlite3_finalize(stmt);
+        return count;
+    }
+}
+
+TEST_F(DatabaseUnitTest, IngestReturnsGlobalIdsInInputOrder) {
+    auto existing = db->add_file(localFile("top", 1, EntryType::Directory));
+
+    std::vector<std::unique_ptr<FileRecordDTO>> records;
+    records.push_back(std::make_unique<FileRecordDTO>(localFile("top/a", 2, EntryType::Directory)));
+    records.push_back(std::make_unique<FileRecordDTO>(localFile("top/a/x.bin", 3)));
+    records.push_back(std::make_unique<FileRecordDTO>(localFile("loose/y.bin", 4)));
+    records.push_back(std::make_unique<FileRecordDTO>(localFile("loose", 5, EntryType::Directory)));
+
+    auto ids = db->ingest(records, true);
+    ASSERT_EQ(ids.size(), records.size());
+    EXPECT_EQ(db->getGlobalIdByPath("top/a"), ids[0]);
+    EXPECT_EQ(db->getGlobalIdByPath("top/a/x.bin"), ids[1]);
+    EXPECT_EQ(db->getGlobalIdByPath("loose/y.bin"), ids[2]);
+    EXPECT_EQ(db->getPathByGlobalId(ids[1]), "top/a/x.bin");
+    EXPECT_EQ(db->getGlobalIdByFileId(4), ids[2]);
+    EXPECT_NE(ids[0], existing);
+
+    db->update_file(FileMovedDTO{ EntryType::Directory, ids[3], 2000, "loose", "tight" });
+    EXPECT_EQ(db->getGlobalIdByPath("tight/y.bin"), ids[2]);
+
+    auto cid = db->add_cloud("cloud", CloudProviderType::Dropbox, json{ {"foo", 1} });
+    std::vector<std::unique_ptr<FileRecordDTO>> links;
+    links.push_back(std::make_unique<FileRecordDTO>(cloudLink(ids[1], cid, "cf-x")));
+    links.push_back(std::make_unique<FileRecordDTO>(cloudLink(existing, cid, "cf-top")));
+    EXPECT_EQ(db->ingest(links), (std::vector<int>{ ids[1], existing }));
+    EXPECT_EQ(db->getCloudFileIdByPath("top/a/x.bin", cid), "cf-x");
+    EXPECT_EQ(db->getFileByCloudIdAndCloudFileId(cid, "cf-top")->global_id, existing);
+}
+
+TEST_F(DatabaseUnitTest, IngestWritesThroughLoadedIndex) {
+    db->loadIndex();
+
+    std::vector<std::unique_ptr<FileRecordDTO>> records;
+    for (uint64_t i = 0; i < 12000; ++i) {
+        records.push_back(std::make_unique<FileRecordDTO>(localFile("bulk/f" + std::to_string(i), 100 + i)));
+    }
+    records.insert(records.begin(), std::make_unique<FileRecordDTO>(localFile("bulk", 99, EntryType::Directory)));
+
+    auto ids = db->ingest(records);
+    ASSERT_EQ(ids.size(), records.size());
+    EXPECT_EQ(db->getGlobalIdByPath("bulk/f11999"), ids.back());
+    EXPECT_EQ(db->getFileByFileId(100)->rel_path, "bulk/f0");
+    EXPECT_EQ(db->getFileByGlobalId(ids.front())->type, EntryType::Directory);
+}
+
+TEST(IngestUnitTest, DeferredIndexesAreRebuilt) {
+    auto path = std::filesystem::temp_directory_path() / "-test-ingest-.db";
+    std::filesystem::remove(path);
+    {
+        Database db(path);
+        std::vector<std::unique_ptr<FileRecordDTO>> records;
+        records.push_back(std::make_unique<FileRecordDTO>(localFile("a.bin", 1)));
+        db.ingest(records, true);
+        EXPECT_EQ(db.getGlobalIdByFileId(1), 1);
+    }
+
+    sqlite3* raw = nullptr;
+    ASSERT_EQ(sqlite3_open(path.string().c_str(), &raw), SQLITE_OK);
+    EXPECT_EQ(indexCount(raw), 4);
+    sqlite3_close(raw);
+
+    std::filesystem::remove(path);
+    std::filesystem::remove(path.string() + "-wal");
+    std::filesystem::remove(path.string() + "-shm");
+}
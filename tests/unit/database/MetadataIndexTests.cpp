@@ -0,0 +1,111 @@
+#include "DatabaseTestFixture.h"
+
+#include <filesystem>
+
+TEST_F(DatabaseUnitTest, IndexLoadsExistingRows) {
+    auto cid = db->add_cloud("cloud", CloudProviderType::Dropbox, json{ {"foo", 1} });
+    auto gid = db->add_file(localFile("dir/a.bin", 7));
+    db->add_file_link(cloudLink(gid, cid, "cf-a"));
+
+    Database copy = *db;
+    EXPECT_FALSE(db->indexLoaded());
+    copy.loadIndex();
+    EXPECT_TRUE(db->indexLoaded());
+
+    auto by_path = db->getFileByPath("dir/a.bin");
+    ASSERT_TRUE(by_path);
+    EXPECT_EQ(by_path->global_id, gid);
+    EXPECT_EQ(by_path->file_id, 7u);
+    EXPECT_EQ(by_path->size, 123u);
+    EXPECT_EQ(std::get<uint64_t>(by_path->cloud_hash_check_sum), 0x42u);
+    EXPECT_EQ(by_path->type, EntryType::File);
+
+    EXPECT_EQ(db->getFileByFileId(7)->rel_path, "dir/a.bin");
+    EXPECT_EQ(db->getFileByGlobalId(gid)->file_id, 7u);
+    EXPECT_EQ(db->getGlobalIdByFileId(7), gid);
+    EXPECT_EQ(db->getGlobalIdByPath("dir/a.bin"), gid);
+    EXPECT_EQ(db->getPathByGlobalId(gid), "dir/a.bin");
+    EXPECT_TRUE(db->quickPathCheck("dir/a.bin"));
+    EXPECT_FALSE(db->quickPathCheck("dir"));
+
+    auto link = db->getFileByCloudIdAndCloudFileId(cid, "cf-a");
+    ASSERT_TRUE(link);
+    EXPECT_EQ(link->global_id, gid);
+    EXPECT_EQ(link->cloud_parent_id, "root");
+    EXPECT_EQ(std::get<std::string>(link->cloud_hash_check_sum), "ffee");
+    EXPECT_EQ(db->getFileByCloudIdAndGlobalId(cid, gid)->cloud_file_id, "cf-a");
+    EXPECT_EQ(db->getCloudFileIdByPath("dir/a.bin", cid), "cf-a");
+    EXPECT_EQ(db->get_cloud_file_id_by_cloud_id(cid, gid), "cf-a");
+    EXPECT_EQ(db->getFileByCloudIdAndCloudFileId(cid + 1, "cf-a"), nullptr);
+}
+
+TEST_F(DatabaseUnitTest, MutatorsWriteThroughIndex) {
+    auto cid = db->add_cloud("cloud", CloudProviderType::Dropbox, json{ {"foo", 1} });
+    db->loadIndex();
+
+    auto dir = db->add_file(FileRecordDTO{ EntryType::Directory, "dir", 0, 1000, 0, 5 });
+    db->add_file_link(cloudLink(dir, cid, "cf-dir"));
+    auto gid = db->add_file(localFile("dir/a.bin", 7));
+    db->add_file_link(cloudLink(gid, cid, "cf-a"));
+    db->add_file_link(cloudLink(gid, cid, "cf-ignored"));
+    EXPECT_EQ(db->getCloudFileIdByPath("dir/a.bin", cid), "cf-a");
+    EXPECT_EQ(db->getMissingPathPart("dir/b/c.bin", 1), "b/c.bin");
+
+    db->update_file(FileUpdatedDTO{ EntryType::File, gid, 0x99, 3000, "dir/a.bin", 456, 8 });
+    auto updated = db->getFileByFileId(8);
+    ASSERT_TRUE(updated);
+    EXPECT_EQ(updated->size, 456u);
+    EXPECT_EQ(std::get<uint64_t>(updated->cloud_hash_check_sum), 0x99u);
+    EXPECT_EQ(db->getFileByFileId(7), nullptr);
+
+    db->update_file_link(FileUpdatedDTO{ EntryType::File, gid, cid, "cf-a", "beef", 3000, "dir/a.bin", "root", 456 });
+    EXPECT_EQ(std::get<std::string>(db->getFileByCloudIdAndGlobalId(cid, gid)->cloud_hash_check_sum), "beef");
+
+    db->update_file(FileMovedDTO{ EntryType::File, gid, 4000, "dir/a.bin", "b.bin" });
+    db->update_file_link(FileMovedDTO{ EntryType::File, gid, cid, "cf-b", 4000, "dir/a.bin", "b.bin", "cf-dir", "root" });
+    EXPECT_FALSE(db->quickPathCheck("dir/a.bin"));
+    EXPECT_EQ(db->getGlobalIdByPath("b.bin"), gid);
+    EXPECT_EQ(db->getFileByCloudIdAndCloudFileId(cid, "cf-a"), nullptr);
+    EXPECT_EQ(db->getFileByCloudIdAndCloudFileId(cid, "cf-b")->global_id, gid);
+
+    db->delete_file_and_links(gid);
+    EXPECT_EQ(db->getFileByGlobalId(gid), nullptr);
+    EXPECT_EQ(db->getFileByCloudIdAndCloudFileId(cid, "cf-b"), nullptr);
+    EXPECT_THROW(db->getGlobalIdByPath("b.bin"), std::runtime_error);
+    EXPECT_THROW(db->get_cloud_file_id_by_cloud_id(cid, gid), std::runtime_error);
+}
+
+TEST_F(DatabaseUnitTest, RolledBackBatchIsDroppedFromIndex) {
+    db->add_file(localFile("kept.bin", 1));
+    db->loadIndex();
+
+    db->beginBatch();
+    db->add_file(localFile("dropped.bin", 2));
+    EXPECT_TRUE(db->quickPathCheck("dropped.bin"));
+    db->rollbackBatch();
+
+    EXPECT_TRUE(db->indexLoaded());
+    EXPECT_FALSE(db->quickPathCheck("dropped.bin"));
+    EXPECT_TRUE(db->quickPathCheck("kept.bin"));
+}
+
+TEST(MetadataIndexUnitTest, LoadedIndexAnswersWithoutSqlite) {
+    auto path = std::filesystem::temp_directory_path() / "-test-metadata_index-.db";
+    std::filesystem::remove(path);
+    {
+        Database db(path);
+        auto gid = db.add_file(localFile("a.bin", 7));
+        db.loadIndex();
+
+        sqlite3* raw = nullptr;
+        ASSERT_EQ(sqlite3_open(path.string().c_str(), &raw), SQLITE_OK);
+        ASSERT_EQ(sqlite3_exec(raw, "DELETE FROM files;", nullptr, nullptr, nullptr), SQLITE_OK);
+        sqlite3_close(raw);
+
+        EXPECT_EQ(db.getGlobalIdByPath("a.bin"), gid);
+        ASSERT_TRUE(db.getFileByFileId(7));
+    }
+    std::filesystem::remove(path);
+    std::filesystem::remove(path.string() + "-wal");
+    std::filesystem::remove(path.string() + "-shm");
+}
@@ -105,3 +105,78 @@ TEST_F(DatabaseUnitTest, UpdateFileMovedDTOPrepareError) {
     db->execute("DROP TABLE files;");
     EXPECT_THROW(db->update_file(md), std::runtime_error);
 }
+
+TEST_F(DatabaseUnitTest, UploadSessionRoundTrip) {
+    json cfg = { {"foo",1} };
+    int cid = db->add_cloud("c", CloudProviderType::GoogleDrive, cfg);
+
+    EXPECT_EQ(db->getUploadSession(cid, "big.bin"), nullptr);
+
+    UploadSessionDTO session{ cid, "big.bin", "https://upload/session/1", 0, 4096, 77 };
+    db->saveUploadSession(session);
+    session.offset = 2048;
+    db->saveUploadSession(session);
+
+    auto loaded = db->getUploadSession(cid, "big.bin");
+    ASSERT_NE(loaded, nullptr);
+    EXPECT_EQ(loaded->session_id, "https://upload/session/1");
+    EXPECT_EQ(loaded->offset, 2048u);
+    EXPECT_EQ(loaded->size, 4096u);
+    EXPECT_EQ(loaded->local_modified_time, 77);
+    EXPECT_FALSE(loaded->confirmed);
+
+    db->deleteUploadSession(cid, "big.bin");
+    EXPECT_EQ(db->getUploadSession(cid, "big.bin"), nullptr);
+}
+
+TEST_F(DatabaseUnitTest, DownloadProgressRoundTrip) {
+    json cfg = { {"foo",1} };
+    int cid = db->add_cloud("c", CloudProviderType::Dropbox, cfg);
+
+    EXPECT_EQ(db->getDownloadProgress(cid, "big.bin"), nullptr);
+
+    DownloadProgressDTO progress{ cid, "big.bin", "/home/.-tmp-SyncHarbor-big.bin", "abc123", 0, 8192 };
+    db->saveDownloadProgress(progress);
+    progress.offset = 4096;
+    db->saveDownloadProgress(progress);
+
+    auto loaded = db->getDownloadProgress(cid, "big.bin");
+    ASSERT_NE(loaded, nullptr);
+    EXPECT_EQ(loaded->tmp_path, "/home/.-tmp-SyncHarbor-big.bin");
+    EXPECT_EQ(loaded->revision, "abc123");
+    EXPECT_EQ(loaded->offset, 4096u);
+    EXPECT_EQ(loaded->size, 8192u);
+
+    db->deleteDownloadProgress(cid, "big.bin");
+    EXPECT_EQ(db->getDownloadProgress(cid, "big.bin"), nullptr);
+}
+
+TEST_F(DatabaseUnitTest, MutatorsNestInsideBatch) {
+    db->beginBatch();
+    EXPECT_TRUE(db->inBatch());
+
+    FileRecordDTO dto{ EntryType::File, std::filesystem::path("batched.txt"), 1, 2, 3, 4 };
+    EXPECT_GT(db->add_file(dto), 0);
+    db->markInitialSyncDone();
+    EXPECT_TRUE(db->inBatch());
+
+    db->rollbackBatch();
+    EXPECT_FALSE(db->inBatch());
+    EXPECT_EQ(db->getFileByPath("batched.txt"), nullptr);
+    EXPECT_FALSE(db->isInitialSyncDone());
+}
+
+TEST_F(DatabaseUnitTest, CopiesShareConnectionAndBatch) {
+    auto copy = std::make_unique<Database>(*db);
+    copy->beginBatch();
+
+    FileRecordDTO dto{ EntryType::File, std::filesystem::path("shared.txt"), 1, 2, 3, 4 };
+    db->add_file(dto);
+    EXPECT_TRUE(db->inBatch());
+
+    copy->commitBatch();
+    copy.reset();
+
+    EXPECT_FALSE(db->inBatch());
+    EXPECT_NE(db->getFileByPath("shared.txt"), nullptr);
+}
@@ -0,0 +1,73 @@
+#include "DatabaseTestFixture.h"
+#include "statement-cache.h"
+
+class StatementCacheUnitTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        sqlite3* raw = nullptr;
+        ASSERT_EQ(sqlite3_open(":memory:", &raw), SQLITE_OK);
+        cache = std::make_unique<StatementCache>(std::shared_ptr<sqlite3>(raw, sqlite3_close));
+    }
+
+    std::unique_ptr<StatementCache> cache;
+};
+
+TEST_F(StatementCacheUnitTest, ReleasedStatementIsReused) {
+    StatementCache::Statement stmt;
+    ASSERT_EQ(cache->prepare("SELECT 1;", stmt), SQLITE_OK);
+    sqlite3_stmt* first = stmt;
+    stmt.reset();
+    EXPECT_EQ(cache->idle(), 1u);
+
+    ASSERT_EQ(cache->prepare("SELECT 1;", stmt), SQLITE_OK);
+    EXPECT_EQ(static_cast<sqlite3_stmt*>(stmt), first);
+    EXPECT_EQ(cache->idle(), 0u);
+}
+
+TEST_F(StatementCacheUnitTest, ReleaseResetsAndClearsBindings) {
+    {
+        StatementCache::Statement stmt;
+        ASSERT_EQ(cache->prepare("SELECT ?;", stmt), SQLITE_OK);
+        sqlite3_bind_int(stmt, 1, 42);
+        ASSERT_EQ(sqlite3_step(stmt), SQLITE_ROW);
+        EXPECT_EQ(sqlite3_column_int(stmt, 0), 42);
+    }
+
+    StatementCache::Statement stmt;
+    ASSERT_EQ(cache->prepare("SELECT ?;", stmt), SQLITE_OK);
+    ASSERT_EQ(sqlite3_step(stmt), SQLITE_ROW);
+    EXPECT_EQ(sqlite3_column_type(stmt, 0), SQLITE_NULL);
+}
+
+TEST_F(StatementCacheUnitTest, ConcurrentLeasesGetDistinctStatements) {
+    StatementCache::Statement a;
+    StatementCache::Statement b;
+    ASSERT_EQ(cache->prepare("SELECT 1;", a), SQLITE_OK);
+    ASSERT_EQ(cache->prepare("SELECT 1;", b), SQLITE_OK);
+    EXPECT_NE(static_cast<sqlite3_stmt*>(a), static_cast<sqlite3_stmt*>(b));
+
+    a.reset();
+    b.reset();
+    EXPECT_EQ(cache->idle(), 2u);
+
+    cache->clear();
+    EXPECT_EQ(cache->idle(), 0u);
+}
+
+TEST_F(StatementCacheUnitTest, PrepareErrorLeavesLeaseEmpty) {
+    StatementCache::Statement stmt;
+    ASSERT_EQ(cache->prepare("SELECT 1;", stmt), SQLITE_OK);
+
+    EXPECT_NE(cache->prepare("SELECT FROM nowhere;", stmt), SQLITE_OK);
+    EXPECT_EQ(static_cast<sqlite3_stmt*>(stmt), nullptr);
+    EXPECT_EQ(cache->idle(), 1u);
+}
+
+TEST_F(DatabaseUnitTest, CachedLookupFailsAfterDropTable) {
+    FileRecordDTO dto{ EntryType::File, std::filesystem::path("cached.txt"), 1, 2, 3, 4 };
+    db->add_file(dto);
+    ASSERT_NE(db->getFileByPath("cached.txt"), nullptr);
+
+    db->execute("DROP TABLE files;");
+    EXPECT_THROW(db->getFileByPath("cached.txt"), std::runtime_error);
+}
@@ -31,6 +31,27 @@ TEST_F(LocalStorageUnitTest, ProccesUploadCloud) {
     EXPECT_FALSE(links.empty());
 }
 
+TEST_F(LocalStorageUnitTest, ProccesUploadCloudUsesStreamedHash) {
+    auto dto = std::make_unique<FileRecordDTO>(
+        EntryType::File,
+        std::filesystem::path("s.txt"),
+        "cfs",
+        0,
+        0,
+        "hash",
+        cid
+    );
+    dto->streamed_hash = 0x1234ULL;
+
+    auto tmpf = tmp / (std::string(".-tmp-SyncHarbor-") + dto->rel_path.filename().string());
+    std::ofstream(tmpf) << "S";
+
+    ls->proccesUpload(dto, "");
+
+    ASSERT_TRUE(std::holds_alternative<uint64_t>(dto->cloud_hash_check_sum));
+    EXPECT_EQ(std::get<uint64_t>(dto->cloud_hash_check_sum), 0x1234ULL);
+}
+
 TEST_F(LocalStorageUnitTest, ProccesDeleteLocalNoop) {
     auto dto = std::make_unique<FileDeletedDTO>("d.txt", 1, 0);
     EXPECT_NO_THROW(ls->proccesDelete(dto, ""));
@@ -253,4 +253,40 @@ TEST_F(LocalStorageUnitTest, HandleCreatedExpectedNew) {
     std::this_thread::sleep_for(std::chrono::milliseconds(200));
     auto changes = ls->proccessChanges();
     EXPECT_TRUE(changes.empty());
-}
\ No newline at end of file
+}
+TEST_F(LocalStorageUnitTest, HandleMovedWaitsForPendingUpdate) {
+    auto f = tmp / "doc.txt"; std::ofstream(f) << "X";
+    FileRecordDTO rec{ EntryType::File, "doc.txt", std::filesystem::file_size(f), convertSystemTime(f), ls->computeFileHash(f), ls->getFileId(f) };
+    int gid = db->add_file(rec);
+    ASSERT_GT(gid, 0);
+
+    // Holds the entry's writes so the update below is still queued when the move is handled.
+    auto& disp = CallbackDispatcher::get();
+    disp.start();
+    std::promise<void> gate;
+    auto held = disp.submitDbWrite(ICommand::entryKey(gid, "doc.txt"), [opened = gate.get_future().share()](const std::unique_ptr<Database>&) {
+        opened.wait();
+        });
+
+    // An editor's atomic save leaves the same path on a new inode.
+    auto staged = tmp / "doc.txt.new";
+    std::ofstream(staged) << "XY";
+    std::filesystem::rename(staged, f);
+    ls->_events_buff.push(FileEvent{ f, std::time(nullptr) + 1, ChangeType::Update });
+    auto updated = ls->proccessChanges();
+    EXPECT_EQ(updated.size(), 1u);
+
+    auto moved = tmp / "renamed.txt";
+    std::filesystem::rename(f, moved);
+    ls->_events_buff.push(FileEvent{ f, std::time(nullptr), ChangeType::Rename, std::make_shared<FileEvent>(moved, std::time(nullptr), ChangeType::Rename) });
+    auto release = std::async(std::launch::async, [&gate] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        gate.set_value();
+        });
+    auto changes = ls->proccessChanges();
+    release.get();
+    disp.finish();
+
+    ASSERT_EQ(changes.size(), 1u);
+    EXPECT_EQ(changes[0]->getType(), ChangeType::Move);
+}